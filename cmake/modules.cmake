@@ -13,6 +13,7 @@ find_package(GST)
 find_package(GTK3)
 find_package(GZRTP)
 find_package(JACK)
+find_package(JPEG)
 find_package(MOSQUITTO)
 find_package(MPA)
 find_package(OPENSLES)
@@ -61,6 +62,7 @@ set(MODULES
   netroam
   pcp
   presence
+  prometheus
   rtcpsummary
   selfview
   serreg
@@ -70,6 +72,7 @@ set(MODULES
   uuid
   vidbridge
   vidinfo
+  vidmcu
   vumeter
 )
 
@@ -75,6 +75,7 @@ enum sipansbeep {
 struct account;
 
 int account_alloc(struct account **accp, const char *sipaddr);
+int account_aor_decode(char **aorp, const struct pl *sipaddr);
 int account_debug(struct re_printf *pf, const struct account *acc);
 int account_json_api(struct odict *odacc, struct odict *odcfg,
 		 const struct account *acc);
@@ -281,6 +282,7 @@ int  conf_modules(void);
 void conf_path_set(const char *path);
 int  conf_path_get(char *path, size_t sz);
 int  conf_parse(const char *filename, confline_h *ch, void *arg);
+int  conf_parse_buf(const struct mbuf *mb, confline_h *ch, void *arg);
 int  conf_get_range(const struct conf *conf, const char *name,
 		    struct range *rng);
 int  conf_get_vidsz(const struct conf *conf, const char *name,
@@ -309,6 +311,13 @@ enum audio_mode {
 	AUDIO_MODE_THREAD,           /**< Use dedicated thread          */
 };
 
+/** Audio resampler quality */
+enum aupoly_quality {
+	AUPOLY_LOW = 0,              /**< Short filters, lowest CPU     */
+	AUPOLY_MEDIUM,               /**< Default                       */
+	AUPOLY_HIGH,                 /**< Long filters, best quality    */
+};
+
 
 /** SIP User-Agent */
 struct config_sip {
@@ -321,6 +330,7 @@ struct config_sip {
 	enum sip_transp transp; /**< Default outgoing SIP transport protocol */
 	bool verify_server;     /**< Enable SIP TLS verify server   */
 	uint8_t tos;            /**< Type-of-Service for SIP        */
+	uint32_t shards;        /**< Number of UA worker threads    */
 };
 
 /** Call config */
@@ -351,8 +361,12 @@ struct config_audio {
 	int dec_fmt;            /**< Audio decoder sample format    */
 	struct range buffer;    /**< Audio receive buffer in [ms]   */
 	bool adaptive;          /**< Enable adaptive audio buffer   */
+	bool stretch;           /**< Time-stretch to the jitter     */
 	double silence;         /**< Silence volume in [dB]         */
 	uint32_t telev_pt;      /**< Payload type for tel.-event    */
+	bool ring;              /**< Lock-free ring instead of aubuf*/
+	enum aupoly_quality resamp; /**< Audio resampler quality    */
+	bool dtx;               /**< VAD and comfort noise          */
 };
 
 /** Video */
@@ -366,6 +380,7 @@ struct config_video {
 	double fps;             /**< Video framerate                */
 	bool fullscreen;        /**< Enable fullscreen display      */
 	int enc_fmt;            /**< Encoder pixelfmt (enum vidfmt) */
+	bool rtx;               /**< RTP retransmission (RFC 4588)  */
 };
 
 /** Audio/Video Transport */
@@ -380,6 +395,7 @@ struct config_avt {
 	bool rtp_stats;         /**< Enable RTP statistics          */
 	uint32_t rtp_timeout;   /**< RTP Timeout in seconds (0=off) */
 	bool bundle;            /**< Media Multiplexing (BUNDLE)    */
+	uint32_t stream_pool;   /**< Pre-allocated streams per AF   */
 };
 
 /** Network Configuration */
@@ -412,6 +428,7 @@ struct config {
 };
 
 int config_parse_conf(struct config *cfg, const struct conf *conf);
+int config_parse_core(const struct conf *conf);
 int config_print(struct re_printf *pf, const struct config *cfg);
 int config_write_template(const char *file, const struct config *cfg);
 struct config *conf_config(void);
@@ -583,6 +600,30 @@ int auplay_alloc(struct auplay_st **stp, struct list *auplayl,
 		 auplay_write_h *wh, void *arg);
 
 
+/*
+ * Audio Resampler
+ */
+
+struct aupoly;
+
+int    aupoly_alloc(struct aupoly **rsp, uint32_t irate, uint8_t ich,
+		    uint32_t orate, uint8_t och, enum aupoly_quality quality);
+int    aupoly_process(struct aupoly *rs, int16_t *outv, size_t *outc,
+		      const int16_t *inv, size_t inc);
+size_t aupoly_maxout(const struct aupoly *rs, size_t inc);
+const char *aupoly_quality_name(enum aupoly_quality quality);
+
+
+/*
+ * G.711 batch encode and decode
+ */
+
+void aug711_pcm2ulaw(uint8_t *dst, const int16_t *src, size_t n);
+void aug711_pcm2alaw(uint8_t *dst, const int16_t *src, size_t n);
+void aug711_ulaw2pcm(int16_t *dst, const uint8_t *src, size_t n);
+void aug711_alaw2pcm(int16_t *dst, const uint8_t *src, size_t n);
+
+
 /*
  * Audio Filter
  */
@@ -660,6 +701,10 @@ void log_enable_info(bool enable);
 void log_enable_stdout(bool enable);
 void log_enable_timestamps(bool enable);
 void log_enable_color(bool enable);
+int log_enable_async(bool enable);
+void log_set_ratelimit(uint32_t limit);
+uint64_t log_dropped(void);
+uint64_t log_suppressed(void);
 void vlog(enum log_level level, const char *fmt, va_list ap);
 void loglv(enum log_level level, const char *fmt, ...);
 void debug(const char *fmt, ...);
@@ -667,6 +712,33 @@ void info(const char *fmt, ...);
 void warning(const char *fmt, ...);
 
 
+/*
+ * Stats - Global media and signalling counters
+ */
+
+int stats_prometheus(struct re_printf *pf, void *unused);
+
+
+/*
+ * Prof - Main loop profiler
+ */
+
+struct prof_ctx {
+	uint64_t t0;
+	uint32_t late;
+	bool tmr;
+};
+
+int  prof_enable(bool enable);
+bool prof_enabled(void);
+void prof_set_budget(uint32_t usec);
+void prof_reset(void);
+void prof_begin(struct prof_ctx *ctx, const struct tmr *tmr);
+void prof_end(const struct prof_ctx *ctx, const char *mod, const char *func);
+int  prof_debug(struct re_printf *pf, void *unused);
+int  prof_json_api(struct odict *od);
+
+
 /*
  * Menc - Media encryption (for RTP)
  */
@@ -746,6 +818,25 @@ const struct sa *net_laddr_for(const struct network *net,
 bool net_is_laddr(const struct network *net, struct sa *sa);
 int net_set_dst_scopeid(const struct network *net, struct sa *dst);
 struct dnsc     *net_dnsc(const struct network *net);
+int net_dnsc_alloc(struct dnsc **dnscp, const struct network *net);
+
+
+/*
+ * RTP port allocator
+ */
+
+struct rtpport;
+
+int  rtpport_debug(struct re_printf *pf, const struct rtpport *rp);
+
+
+/*
+ * Stream pool
+ */
+
+struct strmpool;
+
+int  strmpool_debug(struct re_printf *pf, const struct strmpool *sp);
 
 
 /*
@@ -852,6 +943,7 @@ int  ua_print_calls(struct re_printf *pf, const struct ua *ua);
 int  ua_print_status(struct re_printf *pf, const struct ua *ua);
 int  ua_print_supported(struct re_printf *pf, const struct ua *ua);
 int  ua_update_account(struct ua *ua);
+int  ua_reload_account(struct ua *ua, const char *aor, bool *regp);
 int  ua_register(struct ua *ua);
 int  ua_fallback(struct ua *ua);
 void ua_unregister(struct ua *ua);
@@ -863,6 +955,7 @@ void ua_pub_gruu_set(struct ua *ua, const struct pl *pval);
 const char     *ua_cuser(const struct ua *ua);
 const char     *ua_local_cuser(const struct ua *ua);
 struct account *ua_account(const struct ua *ua);
+struct shard   *ua_shard(const struct ua *ua);
 const char     *ua_outbound(const struct ua *ua);
 struct call    *ua_call(const struct ua *ua);
 struct list    *ua_calls(const struct ua *ua);
@@ -918,6 +1011,22 @@ struct call *uag_call_find(const char *id);
 void uag_filter_calls(call_list_h *listh, call_match_h *matchh, void *arg);
 
 
+/*
+ * Shard - User-Agents in worker threads
+ */
+
+struct shard;
+
+typedef void (shard_h)(void *arg);
+
+unsigned      shard_count(void);
+struct shard *shard_get(unsigned idx);
+struct shard *shard_current(void);
+unsigned      shard_index(const struct shard *sh);
+int shard_exec(struct shard *sh, shard_h *h, void *arg, bool wait);
+int shard_exec_all(shard_h *h, void *arg);
+
+
 /*
  * User Interface
  */
@@ -1314,6 +1423,7 @@ int  audio_set_player(struct audio *au, const char *mod, const char *device);
 void audio_level_put(const struct audio *au, bool tx, double lvl);
 int  audio_level_get(const struct audio *au, double *level);
 int  audio_debug(struct re_printf *pf, const struct audio *a);
+int  audio_latency_json_api(struct odict *od, const struct audio *a);
 struct stream *audio_strm(const struct audio *au);
 uint64_t audio_jb_current_value(const struct audio *au);
 int  audio_set_bitrate(struct audio *au, uint32_t bitrate);
@@ -1326,6 +1436,7 @@ bool audio_started(const struct audio *a);
 void audio_set_hold(struct audio *au, bool hold);
 int  audio_set_conference(struct audio *au, bool conference);
 bool audio_is_conference(const struct audio *au);
+int  audio_set_relay(struct audio *a, struct audio *peer);
 int  audio_encoder_set(struct audio *a, const struct aucodec *ac,
 		       int pt_tx, const char *params);
 int  audio_decoder_set(struct audio *a, const struct aucodec *ac,
@@ -1372,6 +1483,9 @@ double video_calc_seconds(uint64_t rtp_ts);
 double video_timestamp_to_seconds(uint64_t timestamp);
 uint64_t video_calc_rtp_timestamp_fix(uint64_t timestamp);
 uint64_t video_calc_timebase_timestamp(uint64_t rtp_ts);
+unsigned video_enc_threads(const struct vidsz *size);
+void vidscale(struct vidframe *dst, const struct vidframe *src,
+	      struct vidrect *r);
 
 
 /*
@@ -1561,6 +1675,8 @@ const char  *uag_event_str(enum ua_event ev);
 int  baresip_init(struct config *cfg);
 void baresip_close(void);
 struct network *baresip_network(void);
+struct rtpport *baresip_rtpport(void);
+struct strmpool *baresip_strmpool(void);
 struct contacts *baresip_contacts(void);
 struct commands *baresip_commands(void);
 struct player *baresip_player(void);
@@ -27,6 +27,7 @@
 #   USE_GTK           GTK+ user interface
 #   USE_HTTPREQ       HTTP request module
 #   USE_JACK          JACK Audio Connection Kit audio driver
+#   USE_JPEG          JPEG output for the snapshot module
 #   USE_L16           L16 audio codec
 #   USE_MPA           MPA audio codec
 #   USE_MPG123        Use mpg123
@@ -87,6 +88,7 @@ USE_GST       := $(shell pkg-config --exists gstreamer-1.0 && echo "yes")
 USE_GTK       := $(shell pkg-config 'gtk+-3.0 >= 3.0' && \
 		   pkg-config 'glib-2.0 >= 2.32' && echo "yes")
 USE_JACK      := $(shell $(call CC_TEST,jack/jack.h))
+USE_JPEG      := $(shell $(call CC_TEST,jpeglib.h))
 USE_MPG123    := $(shell $(call CC_TEST,mpg123.h))
 USE_OPUS      := $(shell $(call CC_TEST,opus/opus.h))
 USE_OPUS_MS   := $(shell $(call CC_TEST,opus/opus_multistream.h))
@@ -180,6 +182,7 @@ MODULES   += menu
 MODULES   += mwi
 MODULES   += natpmp
 MODULES   += presence
+MODULES   += prometheus
 MODULES   += rtcpsummary
 MODULES   += selfview
 MODULES   += serreg
@@ -189,6 +192,7 @@ MODULES   += turn
 MODULES   += uuid
 MODULES   += vidbridge
 MODULES   += vidinfo
+MODULES   += vidmcu
 MODULES   += vumeter
 MODULES   += mixausrc
 MODULES   += mixminus
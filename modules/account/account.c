@@ -3,6 +3,7 @@
  *
  * Copyright (C) 2010 - 2015 Alfred E. Heggestad
  */
+#include <string.h>
 #include <re.h>
 #include <baresip.h>
 
@@ -17,6 +18,10 @@
  * from this file. If the file does not exist, a template file will be
  * created.
  *
+ * The accounts file can be reloaded with the command "uareload". Only the
+ * changed lines are parsed, User-Agents of removed or changed lines are
+ * destroyed and User-Agents of new or changed lines are created.
+ *
  * Examples:
  \verbatim
   "User 1 with password prompt" <sip:user@example.com>
@@ -27,6 +32,336 @@
  */
 
 
+enum {
+	LINE_HASH_SIZE =  256,
+	RELOAD_BUDGET  = 2000,  /* Time budget per reload step in [us] */
+	REG_INTERVAL   =   20,  /* Registration pacing interval in [ms]  */
+	REG_RATE       =   50,  /* Default registrations per second      */
+};
+
+
+/** An account line which was loaded from the accounts file */
+struct acc_line {
+	struct le he;           /**< Element in the digest hash table */
+	struct le he_aor;       /**< Element in the AOR hash table    */
+	uint8_t md[MD5_SIZE];   /**< Digest of the account line       */
+	char *aor;              /**< AOR of the User-Agent            */
+	bool seen;              /**< Found in the reloaded file       */
+};
+
+enum op_type {
+	OP_ADD,
+	OP_UPDATE,
+	OP_REMOVE,
+};
+
+/** A pending reload operation */
+struct acc_op {
+	struct le le;
+	enum op_type type;
+	struct pl pl;           /**< Account line, not for OP_REMOVE  */
+	uint8_t md[MD5_SIZE];
+	char *aor;
+	struct acc_line *line;  /**< Loaded line, not for OP_ADD      */
+};
+
+/** A User-Agent which existed when the reload was started */
+struct acc_ua {
+	struct le he;
+	char *aor;
+};
+
+/** A paced registration */
+struct acc_reg {
+	struct le le;
+	char *aor;
+};
+
+struct reload {
+	struct mbuf *mb;        /**< Accounts file, ops point into it   */
+	struct hash *uas;       /**< User-Agents by AOR (acc_ua)        */
+	struct pl rest;         /**< Lines of the file not yet parsed   */
+	bool parsed;            /**< All lines are parsed               */
+	struct list opl;        /**< Pending operations (struct acc_op) */
+	struct list regl;       /**< Pending registrations (acc_reg)    */
+	struct tmr tmr;
+	struct tmr tmr_reg;
+	uint32_t rate;          /**< Registrations per second           */
+	unsigned added;
+	unsigned updated;
+	unsigned removed;
+	unsigned unchanged;
+	unsigned failed;
+};
+
+
+static struct hash *lines;    /**< Loaded account lines (struct acc_line) */
+static struct hash *aors;     /**< Loaded account lines by AOR            */
+static struct reload *reload; /**< Reload in progress                     */
+
+
+static void line_destructor(void *arg)
+{
+	struct acc_line *line = arg;
+
+	hash_unlink(&line->he);
+	hash_unlink(&line->he_aor);
+	mem_deref(line->aor);
+}
+
+
+static uint32_t line_key(const uint8_t *md)
+{
+	return (uint32_t)md[0] << 24 | (uint32_t)md[1] << 16 |
+		(uint32_t)md[2] << 8 | md[3];
+}
+
+
+static bool line_cmp_handler(struct le *le, void *arg)
+{
+	const struct acc_line *line = le->data;
+
+	return 0 == memcmp(line->md, arg, MD5_SIZE);
+}
+
+
+static bool aor_cmp_handler(struct le *le, void *arg)
+{
+	const struct acc_line *line = le->data;
+
+	return 0 == str_casecmp(line->aor, arg);
+}
+
+
+static struct acc_line *line_find(const uint8_t *md)
+{
+	return list_ledata(hash_lookup(lines, line_key(md),
+				       line_cmp_handler, (void *)md));
+}
+
+
+static struct acc_line *aor_find(const char *aor)
+{
+	return list_ledata(hash_lookup(aors, hash_joaat_str_ci(aor),
+				       aor_cmp_handler, (void *)aor));
+}
+
+
+static void acc_ua_destructor(void *arg)
+{
+	struct acc_ua *au = arg;
+
+	hash_unlink(&au->he);
+	mem_deref(au->aor);
+}
+
+
+static bool ua_cmp_handler(struct le *le, void *arg)
+{
+	const struct acc_ua *au = le->data;
+
+	return 0 == str_casecmp(au->aor, arg);
+}
+
+
+static bool ua_exists(const struct reload *rl, const char *aor)
+{
+	return NULL != hash_lookup(rl->uas, hash_joaat_str_ci(aor),
+				   ua_cmp_handler, (void *)aor);
+}
+
+
+static void line_digest(const struct pl *addr, uint8_t *md)
+{
+	md5((const uint8_t *)addr->p, addr->l, md);
+}
+
+
+static void line_set_digest(struct acc_line *line, const uint8_t *md)
+{
+	hash_unlink(&line->he);
+	memcpy(line->md, md, sizeof(line->md));
+	hash_append(lines, line_key(md), &line->he, line);
+}
+
+
+static int line_record(const uint8_t *md, const char *aor)
+{
+	struct acc_line *line;
+	int err;
+
+	if (line_find(md))
+		return 0;
+
+	line = mem_zalloc(sizeof(*line), line_destructor);
+	if (!line)
+		return ENOMEM;
+
+	line->seen = true;
+
+	err = str_dup(&line->aor, aor);
+	if (err) {
+		mem_deref(line);
+		return err;
+	}
+
+	line_set_digest(line, md);
+	hash_append(aors, hash_joaat_str_ci(aor), &line->he_aor, line);
+
+	return 0;
+}
+
+
+static void register_handler(void *arg)
+{
+	struct ua *ua = arg;
+	struct account *acc = ua_account(ua);
+	int err;
+
+	if (!account_regint(acc))
+		return;
+
+	if (!account_prio(acc))
+		err = ua_register(ua);
+	else
+		err = ua_fallback(ua);
+
+	if (err) {
+		warning("account: failed to register ua"
+			" '%s' (%m)\n", account_aor(acc), err);
+	}
+}
+
+
+/* a User-Agent of a shard is used in the thread of the shard */
+static void register_ua(struct ua *ua)
+{
+	(void)shard_exec(ua_shard(ua), register_handler, ua, true);
+}
+
+
+struct ua_reload {
+	struct ua *ua;
+	const char *addr;
+	bool reg;
+	int err;
+};
+
+
+static void ua_reload_handler(void *arg)
+{
+	struct ua_reload *ur = arg;
+
+	ur->err = ua_reload_account(ur->ua, ur->addr, &ur->reg);
+	if (ur->err == ENOTSUP)
+		(void)ua_destroy(ur->ua);
+	else if (!ur->err && ur->reg)
+		ur->reg = account_regint(ua_account(ur->ua)) != 0;
+}
+
+
+static void ua_destroy_handler(void *arg)
+{
+	(void)ua_destroy(arg);
+}
+
+
+static void ua_count_handler(void *arg)
+{
+	uint32_t *n = arg;
+
+	*n += list_count(uag_list());
+}
+
+
+/* runs in the main thread and in each shard, see ua_index() */
+static void ua_index_handler(void *arg)
+{
+	struct reload *rl = arg;
+	struct le *le;
+
+	for (le = list_head(uag_list()); le; le = le->next) {
+		const char *aor = account_aor(ua_account(le->data));
+		struct acc_ua *au;
+
+		au = mem_zalloc(sizeof(*au), acc_ua_destructor);
+		if (!au)
+			continue;
+
+		if (str_dup(&au->aor, aor)) {
+			mem_deref(au);
+			continue;
+		}
+
+		hash_append(rl->uas, hash_joaat_str_ci(aor), &au->he, au);
+	}
+}
+
+
+/*
+ * The AORs of all User-Agents are collected once per reload, instead of
+ * a lookup in all shards for each line of the accounts file
+ */
+static int ua_index(struct reload *rl)
+{
+	uint32_t n = 0;
+	int err;
+
+	if (shard_current())
+		ua_count_handler(&n);
+	else
+		(void)shard_exec_all(ua_count_handler, &n);
+
+	err = hash_alloc(&rl->uas, hash_valid_size(max(n, 16u)));
+	if (err)
+		return err;
+
+	if (shard_current())
+		ua_index_handler(rl);
+	else
+		err = shard_exec_all(ua_index_handler, rl);
+
+	return err;
+}
+
+
+static void reg_tmr_handler(void *arg);
+
+
+static void reg_destructor(void *arg)
+{
+	struct acc_reg *reg = arg;
+
+	list_unlink(&reg->le);
+	mem_deref(reg->aor);
+}
+
+
+/* registrations after a reload are paced, see reg_tmr_handler() */
+static int reg_queue(struct reload *rl, const char *aor)
+{
+	struct acc_reg *reg;
+	int err;
+
+	reg = mem_zalloc(sizeof(*reg), reg_destructor);
+	if (!reg)
+		return ENOMEM;
+
+	err = str_dup(&reg->aor, aor);
+	if (err) {
+		mem_deref(reg);
+		return err;
+	}
+
+	list_append(&rl->regl, &reg->le, reg);
+
+	if (!tmr_isrunning(&rl->tmr_reg))
+		tmr_start(&rl->tmr_reg, 0, reg_tmr_handler, rl);
+
+	return 0;
+}
+
+
 static int account_write_template(const char *file)
 {
 	FILE *f = NULL;
@@ -116,19 +451,21 @@ static int account_write_template(const char *file)
  * Add a User-Agent (UA)
  *
  * @param addr SIP Address string
- * @param arg  Handler argument (unused)
+ * @param arg  Reload in progress, or NULL at startup
  *
  * @return 0 if success, otherwise errorcode
  */
 static int line_handler(const struct pl *addr, void *arg)
 {
+	struct reload *rl = arg;
+	uint8_t md[MD5_SIZE];
 	char buf[512];
 	struct ua *ua;
 	struct account *acc;
 	int err;
-	(void)arg;
 
 	(void)pl_strcpy(addr, buf, sizeof(buf));
+	line_digest(addr, md);
 
 	err = ua_alloc(&ua, buf);
 	if (err)
@@ -140,19 +477,14 @@ static int line_handler(const struct pl *addr, void *arg)
 		return ENOENT;
 	}
 
-	if (account_regint(acc)) {
-		int e;
-
-		if (!account_prio(acc))
-			e = ua_register(ua);
-		else
-			e = ua_fallback(ua);
+	err = line_record(md, account_aor(acc));
+	if (err)
+		return err;
 
-		if (e) {
-			warning("account: failed to register ua"
-				" '%s' (%m)\n", account_aor(acc), e);
-		}
-	}
+	if (!rl)
+		register_ua(ua);
+	else if (account_regint(acc))
+		(void)reg_queue(rl, account_aor(acc));
 
 	/* prompt password if auth_user is set, but auth_pass is not  */
 	if (str_isset(account_auth_user(acc)) &&
@@ -176,6 +508,23 @@ static int line_handler(const struct pl *addr, void *arg)
 }
 
 
+static int account_file(char *file, size_t sz, char *path, size_t psz)
+{
+	int err;
+
+	err = conf_path_get(path, psz);
+	if (err) {
+		warning("account: conf_path_get (%m)\n", err);
+		return err;
+	}
+
+	if (re_snprintf(file, sz, "%s/accounts", path) < 0)
+		return ENOMEM;
+
+	return 0;
+}
+
+
 /**
  * Read the SIP accounts from the ~/.baresip/accounts file
  *
@@ -187,14 +536,9 @@ static int account_read_file(void)
 	uint32_t n;
 	int err;
 
-	err = conf_path_get(path, sizeof(path));
-	if (err) {
-		warning("account: conf_path_get (%m)\n", err);
+	err = account_file(file, sizeof(file), path, sizeof(path));
+	if (err)
 		return err;
-	}
-
-	if (re_snprintf(file, sizeof(file), "%s/accounts", path) < 0)
-		return ENOMEM;
 
 	if (!fs_isfile(file)) {
 
@@ -209,10 +553,11 @@ static int account_read_file(void)
 	if (err)
 		return err;
 
-	n = list_count(uag_list());
+	n = 0;
+	(void)shard_exec_all(ua_count_handler, &n);
 	info("Populated %u account%s\n", n, 1==n ? "" : "s");
 
-	if (list_isempty(uag_list())) {
+	if (!n) {
 		info("account: No SIP accounts found\n"
 			" -- check your config "
 			"or add an account using 'uanew' command\n");
@@ -222,14 +567,453 @@ static int account_read_file(void)
 }
 
 
+static void reload_destructor(void *arg)
+{
+	struct reload *rl = arg;
+
+	tmr_cancel(&rl->tmr);
+	tmr_cancel(&rl->tmr_reg);
+	list_flush(&rl->opl);
+	list_flush(&rl->regl);
+	hash_flush(rl->uas);
+	mem_deref(rl->uas);
+	mem_deref(rl->mb);
+}
+
+
+static void op_destructor(void *arg)
+{
+	struct acc_op *op = arg;
+
+	list_unlink(&op->le);
+	mem_deref(op->aor);
+}
+
+
+static struct acc_op *op_alloc(struct list *opl, enum op_type type,
+			       char *aor, struct acc_line *line)
+{
+	struct acc_op *op;
+
+	op = mem_zalloc(sizeof(*op), op_destructor);
+	if (!op) {
+		mem_deref(aor);
+		return NULL;
+	}
+
+	op->type = type;
+	op->aor  = aor;
+	op->line = line;
+
+	list_append(opl, &op->le, op);
+
+	return op;
+}
+
+
+static void reload_done(struct reload *rl)
+{
+	if (!rl->parsed ||
+	    !list_isempty(&rl->opl) || !list_isempty(&rl->regl))
+		return;
+
+	info("account: reload done: %u added, %u updated, %u removed,"
+	     " %u unchanged, %u failed\n",
+	     rl->added, rl->updated, rl->removed, rl->unchanged, rl->failed);
+
+	reload = mem_deref(reload);
+}
+
+
+static void reg_tmr_handler(void *arg)
+{
+	struct reload *rl = arg;
+	uint32_t n = max(rl->rate * REG_INTERVAL / 1000, 1u);
+	struct le *le;
+
+	while (n-- && (le = list_head(&rl->regl))) {
+		struct acc_reg *reg = le->data;
+		struct ua *ua = uag_find_aor(reg->aor);
+
+		if (ua)
+			register_ua(ua);
+
+		mem_deref(reg);
+	}
+
+	if (list_isempty(&rl->regl))
+		reload_done(rl);
+	else
+		tmr_start(&rl->tmr_reg, REG_INTERVAL, reg_tmr_handler, rl);
+}
+
+
+static int op_add(struct reload *rl, struct acc_op *op)
+{
+	int err;
+
+	err = line_handler(&op->pl, rl);
+	if (err)
+		return err;
+
+	++rl->added;
+
+	return 0;
+}
+
+
+static int op_update(struct reload *rl, struct acc_op *op)
+{
+	struct ua *ua = uag_find_aor(op->aor);
+	struct ua_reload ur;
+	char buf[512];
+	int err;
+
+	if (!ua) {
+		op->line = mem_deref(op->line);
+		return op_add(rl, op);
+	}
+
+	(void)pl_strcpy(&op->pl, buf, sizeof(buf));
+
+	memset(&ur, 0, sizeof(ur));
+	ur.ua   = ua;
+	ur.addr = buf;
+
+	err = shard_exec(ua_shard(ua), ua_reload_handler, &ur, true);
+	if (!err)
+		err = ur.err;
+
+	if (err == ENOTSUP) {
+		op->line = mem_deref(op->line);
+		return op_add(rl, op);
+	}
+	else if (err) {
+		return err;
+	}
+
+	line_set_digest(op->line, op->md);
+
+	if (ur.reg)
+		err = reg_queue(rl, op->aor);
+
+	++rl->updated;
+
+	return err;
+}
+
+
+static void op_remove(struct reload *rl, struct acc_op *op)
+{
+	struct ua *ua = uag_find_aor(op->aor);
+
+	if (ua) {
+		(void)shard_exec(ua_shard(ua), ua_destroy_handler, ua, true);
+		++rl->removed;
+	}
+
+	mem_deref(op->line);
+}
+
+
+static int reload_parse(struct reload *rl, uint64_t t0);
+
+
+/*
+ * The accounts file is parsed and the operations are executed in steps,
+ * to keep the main loop running
+ */
+static void reload_tmr_handler(void *arg)
+{
+	struct reload *rl = arg;
+	uint64_t t0 = tmr_jiffies_usec();
+	struct le *le;
+
+	if (!rl->parsed) {
+		int err = reload_parse(rl, t0);
+
+		if (err) {
+			warning("account: reload failed (%m)\n", err);
+			reload = mem_deref(reload);
+			return;
+		}
+
+		if (!rl->parsed) {
+			tmr_start(&rl->tmr, 1, reload_tmr_handler, rl);
+			return;
+		}
+	}
+
+	while ((le = list_head(&rl->opl))) {
+		struct acc_op *op = le->data;
+		int err = 0;
+
+		switch (op->type) {
+
+		case OP_ADD:
+			err = op_add(rl, op);
+			break;
+
+		case OP_UPDATE:
+			err = op_update(rl, op);
+			break;
+
+		case OP_REMOVE:
+			op_remove(rl, op);
+			break;
+		}
+
+		if (err) {
+			warning("account: reload of '%s' failed (%m)\n",
+				op->aor, err);
+			++rl->failed;
+		}
+
+		mem_deref(op);
+
+		if (tmr_jiffies_usec() - t0 > RELOAD_BUDGET) {
+			tmr_start(&rl->tmr, 1, reload_tmr_handler, rl);
+			return;
+		}
+	}
+
+	reload_done(rl);
+}
+
+
+static bool reset_handler(struct le *le, void *arg)
+{
+	struct acc_line *line = le->data;
+	(void)arg;
+
+	line->seen = false;
+
+	return false;
+}
+
+
+static int reload_handler(const struct pl *addr, void *arg)
+{
+	struct reload *rl = arg;
+	struct acc_line *line;
+	struct acc_op *op;
+	uint8_t md[MD5_SIZE];
+	char *aor = NULL;
+
+	line_digest(addr, md);
+
+	line = line_find(md);
+	if (line && !line->seen && !ua_exists(rl, line->aor))
+		line = mem_deref(line);   /* the UA was deleted */
+
+	if (line) {
+		if (!line->seen) {
+			line->seen = true;
+			++rl->unchanged;
+		}
+		return 0;
+	}
+
+	if (account_aor_decode(&aor, addr)) {
+		warning("account: invalid account '%r'\n", addr);
+		++rl->failed;
+		return 0;
+	}
+
+	/* a changed line of a loaded account is updated in place */
+	line = aor_find(aor);
+	if (line && !line->seen && ua_exists(rl, aor)) {
+		line->seen = true;
+		op = op_alloc(&rl->opl, OP_UPDATE, aor, line);
+	}
+	else {
+		op = op_alloc(&rl->opl, OP_ADD, aor, NULL);
+	}
+
+	if (!op)
+		return ENOMEM;
+
+	op->pl = *addr;
+	memcpy(op->md, md, sizeof(op->md));
+
+	return 0;
+}
+
+
+static bool remove_handler(struct le *le, void *arg)
+{
+	struct acc_line *line = le->data;
+	struct reload *rl = arg;
+	struct acc_op *op;
+	char *aor = NULL;
+
+	if (line->seen)
+		return false;
+
+	line->seen = true;
+
+	if (str_dup(&aor, line->aor))
+		return true;
+
+	op = op_alloc(&rl->opl, OP_REMOVE, aor, line);
+	if (!op)
+		return true;
+
+	/* the UAs of removed lines are destroyed first */
+	list_unlink(&op->le);
+	list_prepend(&rl->opl, &op->le, op);
+
+	return false;
+}
+
+
+static unsigned op_count(const struct reload *rl, enum op_type type)
+{
+	struct le *le;
+	unsigned n = 0;
+
+	for (le = rl->opl.head; le; le = le->next) {
+		const struct acc_op *op = le->data;
+
+		if (op->type == type)
+			++n;
+	}
+
+	return n;
+}
+
+
+/* parses the lines of the accounts file within the time budget */
+static int reload_parse(struct reload *rl, uint64_t t0)
+{
+	struct pl *pl = &rl->rest;
+
+	while (pl->l) {
+		const char *lb = pl_strchr(pl, '\n');
+		struct pl val;
+		int err;
+
+		val.p = pl->p;
+		val.l = lb ? (size_t)(lb - pl->p) : pl->l;
+		pl_advance(pl, lb ? val.l + 1 : val.l);
+
+		if (!val.l || val.p[0] == '#')
+			continue;
+
+		err = reload_handler(&val, rl);
+		if (err)
+			return err;
+
+		if (tmr_jiffies_usec() - t0 > RELOAD_BUDGET)
+			return 0;
+	}
+
+	if (hash_apply(lines, remove_handler, rl))
+		return ENOMEM;
+
+	rl->parsed = true;
+
+	info("account: reloading: %u to add, %u to update, %u to remove,"
+	     " %u unchanged\n",
+	     op_count(rl, OP_ADD), op_count(rl, OP_UPDATE),
+	     op_count(rl, OP_REMOVE), rl->unchanged);
+
+	return 0;
+}
+
+
+/*
+ * Reload the accounts file. The digests of the account lines are compared
+ * with the loaded lines, so unchanged accounts are neither parsed nor
+ * re-registered. Changed lines are matched by AOR and the account of the
+ * UA is updated in place. The comparison, the operations and the resulting
+ * registrations are executed in the background.
+ */
+static int cmd_reload(struct re_printf *pf, void *arg)
+{
+	char path[256] = "", file[256] = "";
+	struct reload *rl;
+	int err;
+	(void)arg;
+
+	if (reload)
+		return re_hprintf(pf, "account: reload in progress\n");
+
+	rl = mem_zalloc(sizeof(*rl), reload_destructor);
+	if (!rl)
+		return ENOMEM;
+
+	tmr_init(&rl->tmr);
+	tmr_init(&rl->tmr_reg);
+	rl->rate = REG_RATE;
+	(void)conf_get_u32(conf_cur(), "account_reg_rate", &rl->rate);
+
+	err = account_file(file, sizeof(file), path, sizeof(path));
+	if (err)
+		goto out;
+
+	/* the operations point into the loaded file */
+	err = conf_loadfile(&rl->mb, file);
+	if (err) {
+		(void)re_hprintf(pf, "account: could not load %s (%m)\n",
+				 file, err);
+		goto out;
+	}
+
+	err = ua_index(rl);
+	if (err)
+		goto out;
+
+	hash_apply(lines, reset_handler, NULL);
+
+	rl->rest.p = (const char *)rl->mb->buf;
+	rl->rest.l = rl->mb->end;
+
+	err = re_hprintf(pf, "reloading accounts from %s\n", file);
+
+	reload = rl;
+	tmr_start(&rl->tmr, 0, reload_tmr_handler, rl);
+
+ out:
+	if (err)
+		mem_deref(rl);
+
+	return err;
+}
+
+
+static const struct cmd cmdv[] = {
+{"uareload", 0, 0, "Reload accounts file", cmd_reload },
+};
+
+
 static int module_init(void)
 {
-	return account_read_file();
+	int err;
+
+	err  = hash_alloc(&lines, LINE_HASH_SIZE);
+	err |= hash_alloc(&aors, LINE_HASH_SIZE);
+	if (err)
+		return err;
+
+	err = account_read_file();
+	if (err)
+		return err;
+
+	return cmd_register(baresip_commands(), cmdv, ARRAY_SIZE(cmdv));
 }
 
 
 static int module_close(void)
 {
+	cmd_unregister(baresip_commands(), cmdv);
+
+	reload = mem_deref(reload);
+
+	hash_flush(lines);
+	lines = mem_deref(lines);
+	aors = mem_deref(aors);
+
 	return 0;
 }
 
@@ -23,6 +23,10 @@
   audio_player            aubridge,pseudo0
   audio_source            aubridge,pseudo0
  \endverbatim
+ *
+ * Two calls are bridged with crossed devices, i.e. the player of one
+ * call is the source of the other call. The received RTP payload is then
+ * relayed between the calls without decoding, if the codecs allow it.
  */
 
 
@@ -36,7 +36,9 @@ struct auresamp_st {
 	int16_t *sampv;          /* s16le audio data buffer                  */
 	int16_t *rsampv;         /* resampled data                           */
 	size_t rsampsz;          /* size of rsampv buffer                    */
-	struct auresamp resamp;  /* resampler                                */
+	struct aupoly *resamp;   /* resampler                                */
+	uint32_t irate;          /* resampler input sample rate              */
+	uint8_t ich;             /* resampler input channels                 */
 	struct aufilt_prm oprm;  /* filter output parameters                 */
 	const char *dbg;         /* debugging "encoder"/"decoder"            */
 };
@@ -46,6 +48,7 @@ static void common_destructor(void *arg)
 {
 	struct auresamp_st *st = arg;
 
+	mem_deref(st->resamp);
 	mem_deref(st->rsampv);
 	mem_deref(st->sampv);
 }
@@ -73,7 +76,8 @@ static int sampv_alloc(struct auresamp_st *st, struct auframe *af)
 {
 	size_t psize;
 
-	psize = af->sampc * af->ch * 2;
+	/* used for the input and for the output conversion */
+	psize = max(af->sampc, st->rsampsz / 2) * sizeof(float);
 	st->sampv = mem_zalloc(psize, NULL);
 
 	if (!st->sampv)
@@ -85,19 +89,15 @@ static int sampv_alloc(struct auresamp_st *st, struct auframe *af)
 
 static int rsampv_check_size(struct auresamp_st *st, struct auframe *af)
 {
-	uint64_t ptime;
 	size_t psize;
 
-	ptime = af->sampc * 1000 / af->srate;
-	psize = ptime * st->oprm.srate * st->oprm.ch *
-		aufmt_sample_size(af->fmt) / 1000;
+	psize = aupoly_maxout(st->resamp, af->sampc) * 2;
 
-	/* auresamp minimum output size is the input size */
-	psize = max(psize, auframe_size(af));
 	if (st->rsampsz < psize) {
 		st->rsampsz = 0;
 		st->rsampv = mem_deref(st->rsampv);
 		st->rsampv = mem_zalloc(psize, NULL);
+		st->sampv  = mem_deref(st->sampv);
 	}
 
 	if (!st->rsampv)
@@ -110,15 +110,22 @@ static int rsampv_check_size(struct auresamp_st *st, struct auframe *af)
 
 static int resamp_setup(struct auresamp_st *st, struct auframe *af)
 {
+	const struct config *cfg = conf_config();
 	int err = 0;
 
-	err = auresamp_setup(&st->resamp, af->srate, af->ch,
-			     st->oprm.srate, st->oprm.ch);
+	st->resamp = mem_deref(st->resamp);
+
+	err = aupoly_alloc(&st->resamp, af->srate, af->ch,
+			   st->oprm.srate, st->oprm.ch,
+			   cfg ? cfg->audio.resamp : AUPOLY_MEDIUM);
 	if (err) {
-		warning("resample: auresamp_setup error (%m)\n", err);
+		warning("resample: aupoly_alloc error (%m)\n", err);
 		return err;
 	}
 
+	st->irate = af->srate;
+	st->ich   = af->ch;
+
 	return rsampv_check_size(st, af);
 }
 
@@ -141,7 +148,6 @@ static int common_update(struct auresamp_st **stp, struct aufilt_prm *oprm,
 		return ENOMEM;
 
 	st->oprm = *oprm;
-	auresamp_init(&st->resamp);
 
 	*stp = st;
 	return 0;
@@ -165,35 +171,40 @@ static int common_resample(struct auresamp_st *st, struct auframe *af)
 
 	if (st->oprm.srate == af->srate && st->oprm.ch == af->ch) {
 		st->rsampsz = 0;
+		st->resamp = mem_deref(st->resamp);
 		st->rsampv = mem_deref(st->rsampv);
 		st->sampv  = mem_deref(st->sampv);
+		st->irate  = 0;
 		return 0;
 	}
 
+	if (st->irate != af->srate || st->ich != af->ch)
+		err = resamp_setup(st, af);
+	else
+		err = rsampv_check_size(st, af);
+
+	if (err)
+		return err;
+
 	sampv  = af->sampv;
-	if (af->fmt != AUFMT_S16LE) {
+	if (af->fmt != AUFMT_S16LE || st->oprm.fmt != AUFMT_S16LE) {
 		if (!st->sampv)
 			err = sampv_alloc(st, af);
 
 		if (err)
 			return err;
+	}
 
+	if (af->fmt != AUFMT_S16LE) {
 		auconv_to_s16(st->sampv, af->fmt, af->sampv, af->sampc);
 		sampv = st->sampv;
 	}
 
-	if (st->resamp.irate != af->srate || st->resamp.ich != af->ch)
-		err = resamp_setup(st, af);
-	else
-		err = rsampv_check_size(st, af);
-
-	if (err)
-		return err;
-
 	rsampc = st->rsampsz / 2;
-	err = auresamp(&st->resamp, st->rsampv, &rsampc, sampv, af->sampc);
+	err = aupoly_process(st->resamp, st->rsampv, &rsampc,
+			     sampv, af->sampc);
 	if (err) {
-		warning("resample: auresamp error (%m)\n", err);
+		warning("resample: aupoly_process error (%m)\n", err);
 		return err;
 	}
 
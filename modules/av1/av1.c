@@ -17,22 +17,43 @@
  * Reference: http://aomedia.org/
  *
  * https://aomediacodec.github.io/av1-rtp-spec/
+ *
+ * The following options can be configured:
+ *
+ \verbatim
+  av1_threads      0    # Encoder threads, 0 for auto from size and cores
+  av1_cpuused      8    # Encoder speed preset, 0 to 10
+  av1_tile_columns 1    # Tile columns in log2, 0 to 6 (default auto)
+  av1_row_mt       yes  # Row based multi-threading
+ \endverbatim
  */
 
 
-static struct vidcodec av1 = {
-	.name      = "AV1",
-	.encupdh   = av1_encode_update,
-	.ench      = av1_encode_packet,
-	.decupdh   = av1_decode_update,
-	.dech      = av1_decode,
-	.packetizeh = av1_encode_packetize,
+static struct av1_vidcodec av1 = {
+	.vc = {
+		.name      = "AV1",
+		.encupdh   = av1_encode_update,
+		.ench      = av1_encode_packet,
+		.decupdh   = av1_decode_update,
+		.dech      = av1_decode,
+		.packetizeh = av1_encode_packetize,
+	},
+	.cpuused   = 8,
+	.tile_cols = -1,
+	.row_mt    = true,
 };
 
 
 static int module_init(void)
 {
-	vidcodec_register(baresip_vidcodecl(), &av1);
+	struct conf *conf = conf_cur();
+
+	(void)conf_get_u32(conf, "av1_threads", &av1.threads);
+	(void)conf_get_i32(conf, "av1_cpuused", &av1.cpuused);
+	(void)conf_get_i32(conf, "av1_tile_columns", &av1.tile_cols);
+	(void)conf_get_bool(conf, "av1_row_mt", &av1.row_mt);
+
+	vidcodec_register(baresip_vidcodecl(), (struct vidcodec *)&av1);
 
 	return 0;
 }
@@ -40,7 +61,7 @@ static int module_init(void)
 
 static int module_close(void)
 {
-	vidcodec_unregister(&av1);
+	vidcodec_unregister((struct vidcodec *)&av1);
 
 	return 0;
 }
@@ -5,6 +5,15 @@
  */
 
 
+struct av1_vidcodec {
+	struct vidcodec vc;
+	uint32_t threads;     /**< Encoder threads, 0 for auto            */
+	int32_t cpuused;      /**< Encoder speed preset, 0 to 10          */
+	int32_t tile_cols;    /**< Tile columns in log2, -1 for auto      */
+	bool row_mt;          /**< Row based multi-threading              */
+};
+
+
 /* Encode */
 int av1_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 		      struct videnc_param *prm, const char *fmtp,
@@ -20,7 +20,13 @@
 #endif
 
 
+enum {
+	MIN_TILE_WIDTH = 256,
+};
+
+
 struct videnc_state {
+	const struct av1_vidcodec *av1;
 	aom_codec_ctx_t ctx;
 	struct vidsz size;
 	double fps;
@@ -30,6 +36,10 @@ struct videnc_state {
 	bool new;
 	videnc_packet_h *pkth;
 	void *arg;
+
+	unsigned n_frames;
+	uint64_t enc_usec;    /**< Total encode time in [us]   */
+	uint32_t enc_max;     /**< Longest encode time in [us] */
 };
 
 
@@ -37,8 +47,29 @@ static void destructor(void *arg)
 {
 	struct videnc_state *ves = arg;
 
-	if (ves->ctxup)
+	if (ves->ctxup) {
+
+		if (ves->n_frames)
+			debug("av1: encoder stats: frames=%u,"
+			      " encode time avg=%llu us max=%u us\n",
+			      ves->n_frames, ves->enc_usec / ves->n_frames,
+			      ves->enc_max);
+
 		aom_codec_destroy(&ves->ctx);
+	}
+}
+
+
+/* log2 of the tile columns, each tile is at least MIN_TILE_WIDTH wide */
+static int tile_columns(unsigned threads, unsigned width)
+{
+	int n = 0;
+
+	while ((2u << n) <= threads &&
+	       (unsigned)MIN_TILE_WIDTH << (n+1) <= width)
+		++n;
+
+	return n;
 }
 
 
@@ -61,6 +92,7 @@ int av1_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 			return ENOMEM;
 
 		ves->new = true;
+		ves->av1 = (const struct av1_vidcodec *)vc;
 
 		*vesp = ves;
 	}
@@ -85,8 +117,13 @@ int av1_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 
 static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 {
+	const struct av1_vidcodec *av1 = ves->av1;
 	aom_codec_enc_cfg_t cfg;
 	aom_codec_err_t res;
+	unsigned threads;
+	int tiles;
+
+	threads = av1->threads ? av1->threads : video_enc_threads(size);
 
 	res = aom_codec_enc_config_default(&aom_codec_av1_cx_algo, &cfg,
 					   AOM_USAGE_REALTIME);
@@ -97,7 +134,7 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 	cfg.g_h               = size->h;
 	cfg.g_timebase.num    = 1;
 	cfg.g_timebase.den    = VIDEO_TIMEBASE;
-	cfg.g_threads         = 8;
+	cfg.g_threads         = threads;
 	cfg.g_error_resilient = AOM_ERROR_RESILIENT_DEFAULT;
 	cfg.g_pass            = AOM_RC_ONE_PASS;
 	cfg.g_lag_in_frames   = 0;
@@ -124,12 +161,33 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 
 	ves->ctxup = true;
 
-	res = aom_codec_control(&ves->ctx, AOME_SET_CPUUSED, 8);
+	res = aom_codec_control(&ves->ctx, AOME_SET_CPUUSED, av1->cpuused);
 	if (res) {
 		warning("av1: codec ctrl C: %s\n",
 			aom_codec_err_to_string(res));
 	}
 
+	/* the threads encode the tile columns in parallel */
+	tiles = av1->tile_cols >= 0 ? av1->tile_cols :
+		tile_columns(threads, size->w);
+
+	res = aom_codec_control(&ves->ctx, AV1E_SET_TILE_COLUMNS, tiles);
+	if (res) {
+		warning("av1: codec ctrl: %s\n",
+			aom_codec_err_to_string(res));
+	}
+
+	res = aom_codec_control(&ves->ctx, AV1E_SET_ROW_MT, av1->row_mt);
+	if (res) {
+		warning("av1: codec ctrl: %s\n",
+			aom_codec_err_to_string(res));
+	}
+
+	debug("av1: encoder opened, picture size %u x %u,"
+	      " threads=%u, cpuused=%d, tile_columns=%d, row_mt=%d\n",
+	      size->w, size->h, threads, av1->cpuused, 1 << tiles,
+	      av1->row_mt);
+
 	return 0;
 }
 
@@ -150,6 +208,8 @@ int av1_encode_packet(struct videnc_state *ves, bool update,
 	aom_codec_err_t res;
 	aom_image_t *img;
 	aom_img_fmt_t img_fmt;
+	uint64_t t0;
+	uint32_t usec;
 	int err = 0;
 
 	if (!ves || !frame || frame->fmt != VID_FMT_YUV420P)
@@ -184,6 +244,8 @@ int av1_encode_packet(struct videnc_state *ves, bool update,
 		img->planes[i] = frame->data[i];
 	}
 
+	t0 = tmr_jiffies_usec();
+
 	res = aom_codec_encode(&ves->ctx, img, timestamp, 1, flags);
 	if (res) {
 		warning("av1: enc error: %s\n", aom_codec_err_to_string(res));
@@ -191,6 +253,12 @@ int av1_encode_packet(struct videnc_state *ves, bool update,
 		goto out;
 	}
 
+	usec = (uint32_t)(tmr_jiffies_usec() - t0);
+
+	++ves->n_frames;
+	ves->enc_usec += usec;
+	ves->enc_max   = max(ves->enc_max, usec);
+
 	for (;;) {
 		const aom_codec_cx_pkt_t *pkt;
 		uint64_t rtp_ts;
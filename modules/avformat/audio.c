@@ -5,6 +5,7 @@
  */
 
 #include <re.h>
+#include <re_atomic.h>
 #include <rem.h>
 #include <baresip.h>
 #include <libavutil/opt.h>
@@ -137,6 +138,11 @@ void avformat_audio_decode(struct shared *st, AVPacket *pkt)
 	if (ret < 0)
 		return;
 
+	if (!avformat_shared_wait(st, &st->au, frame.pts)) {
+		av_frame_unref(&frame);
+		return;
+	}
+
 	/* NOTE: pass timestamp to application */
 
 	mtx_lock(&st->lock);
@@ -11,6 +11,7 @@
 #include <unistd.h>
 #include <string.h>
 #include <re.h>
+#include <re_atomic.h>
 #include <rem.h>
 #include <baresip.h>
 #include <libavformat/avformat.h>
@@ -25,6 +26,11 @@
  *
  * Audio/video source using FFmpeg libavformat
  *
+ * One thread demuxes the input into a bounded packet queue per stream.
+ * The audio and the video stream have their own decode thread, which
+ * releases the frames at their timestamps. Media files are looped
+ * without a gap, the timestamps continue after each rewind.
+ *
  *
  * Example config:
  \verbatim
@@ -50,15 +56,41 @@ static char rtsp_transport[256] = "";
 static struct list sharedl;
 
 
+enum {
+	QUEUE_AUDIO = 128,   /* Audio packets, a few seconds */
+	QUEUE_VIDEO = 64,    /* Video packets, a few seconds */
+};
+
+
+static void stream_join(struct stream *s)
+{
+	if (s->thread_started) {
+		s->thread_started = false;
+		thrd_join(s->thread, NULL);
+	}
+}
+
+
 static void shared_destructor(void *arg)
 {
 	struct shared *st = arg;
 
-	if (st->run) {
-		st->run = false;
+	re_atomic_rlx_set(&st->run, false);
+
+	avformat_pktq_abort(st->au.q);
+	avformat_pktq_abort(st->vid.q);
+
+	if (st->thread_started) {
+		st->thread_started = false;
 		thrd_join(st->thread, NULL);
 	}
 
+	stream_join(&st->au);
+	stream_join(&st->vid);
+
+	mem_deref(st->au.q);
+	mem_deref(st->vid.q);
+
 	if (st->au.ctx) {
 		avcodec_close(st->au.ctx);
 		avcodec_free_context(&st->au.ctx);
@@ -78,102 +110,201 @@ static void shared_destructor(void *arg)
 }
 
 
+/* Aborts blocking network reads when the source is closed */
+static int interrupt_handler(void *arg)
+{
+	struct shared *st = arg;
+
+	return !re_atomic_rlx(&st->run);
+}
+
+
+static struct stream *stream_find(struct shared *st, int idx)
+{
+	if (idx < 0)
+		return NULL;
+
+	if (idx == st->au.idx)
+		return &st->au;
+	if (idx == st->vid.idx)
+		return &st->vid;
+
+	return NULL;
+}
+
+
+/**
+ * Wait until a frame is due, relative to the start of playback
+ *
+ * @param sh  Shared state
+ * @param s   Stream of the frame
+ * @param pts Presentation timestamp in the time base of the stream
+ *
+ * @return True if the frame should be delivered, false if stopped
+ */
+bool avformat_shared_wait(const struct shared *sh, const struct stream *s,
+			  int64_t pts)
+{
+	int64_t t;
+
+	if (sh->is_realtime || pts == AV_NOPTS_VALUE)
+		return re_atomic_rlx(&sh->run);
+
+	t = av_rescale_q(pts, s->time_base, AV_TIME_BASE_Q) - sh->start_time;
+
+	return avformat_pktq_sleep(s->q, sh->t0 + (uint64_t)max(t, 0));
+}
+
+
+/*
+ * Demux the input into the packet queues. A full queue blocks the
+ * demuxer, so it runs only as far ahead as the queues allow.
+ */
 static int read_thread(void *data)
 {
 	struct shared *st = data;
-	uint64_t now, offset = tmr_jiffies();
-	double auts = 0, vidts = 0;
+	int64_t offset = 0;     /* Timestamp offset of this loop [us] */
+	int64_t end = 0;        /* End of the media [us]              */
+	unsigned npkt = 0;      /* Packets since the last rewind      */
 	AVPacket *pkt;
 
 	pkt = av_packet_alloc();
 	if (!pkt)
 		return ENOMEM;
 
-	while (st->run) {
+	while (re_atomic_rlx(&st->run)) {
 
+		struct stream *s;
 		int ret;
 
-		sys_msleep(4);
+		ret = av_read_frame(st->ic, pkt);
+		if (ret == (int)AVERROR_EOF) {
 
-		now = tmr_jiffies();
+			if (!npkt) {
+				info("avformat: no packets, stop reading\n");
+				break;
+			}
 
-		for (;;) {
-			double xts;
+			debug("avformat: rewind stream\n");
 
-			if (!st->run)
+			ret = av_seek_frame(st->ic, -1, 0,
+					    AVSEEK_FLAG_BACKWARD);
+			if (ret < 0) {
+				info("avformat: seek error (%d)\n", ret);
 				break;
+			}
 
-			if (st->au.idx >=0 && st->vid.idx >=0)
-				xts = min(auts, vidts);
-			else if (st->au.idx >=0)
-				xts = auts;
-			else if (st->vid.idx >=0)
-				xts = vidts;
-			else
-				break;
+			/* continue the timestamps seamlessly */
+			offset += max(end - st->start_time, (int64_t)0);
+			npkt = 0;
+			continue;
+		}
+		else if (ret < 0) {
+			debug("avformat: read error (%d)\n", ret);
+			break;
+		}
 
-			if (!(st->is_realtime))
-				if (now < (offset + xts))
-					break;
+		s = stream_find(st, pkt->stream_index);
+		if (!s) {
+			av_packet_unref(pkt);
+			continue;
+		}
 
-			ret = av_read_frame(st->ic, pkt);
-			if (ret == (int)AVERROR_EOF) {
+		++npkt;
 
-				debug("avformat: rewind stream\n");
+		if (pkt->pts == AV_NOPTS_VALUE) {
+			warning("avformat: no %s pts\n",
+				s == &st->au ? "audio" : "video");
+		}
+		else {
+			int64_t t = av_rescale_q(pkt->pts + pkt->duration,
+						 s->time_base,
+						 AV_TIME_BASE_Q);
 
-				sys_msleep(1000);
+			end = max(end, t);
+		}
 
-				ret = av_seek_frame(st->ic, -1, 0,
-						    AVSEEK_FLAG_BACKWARD);
-				if (ret < 0) {
-					info("avformat: seek error (%d)\n",
-					     ret);
-					goto out;
-				}
+		if (offset) {
+			int64_t o = av_rescale_q(offset, AV_TIME_BASE_Q,
+						 s->time_base);
 
-				offset = tmr_jiffies();
-				auts = vidts = 0;
-				break;
-			}
-			else if (ret < 0) {
-				debug("avformat: read error (%d)\n", ret);
-				goto out;
-			}
+			if (pkt->pts != AV_NOPTS_VALUE)
+				pkt->pts += o;
+			if (pkt->dts != AV_NOPTS_VALUE)
+				pkt->dts += o;
+		}
 
-			if (pkt->stream_index == st->au.idx) {
+		if (avformat_pktq_put(s->q, pkt)) {
+			av_packet_unref(pkt);
+			break;
+		}
+	}
 
-				if (pkt->pts == AV_NOPTS_VALUE) {
-					warning("no audio pts\n");
-				}
+	av_packet_free(&pkt);
 
-				auts = 1000 * pkt->pts *
-					av_q2d(st->au.time_base);
+	return 0;
+}
 
-				avformat_audio_decode(st, pkt);
-			}
-			else if (pkt->stream_index == st->vid.idx) {
 
-				if (pkt->pts == AV_NOPTS_VALUE) {
-					warning("no video pts\n");
-				}
+static bool has_consumer(struct shared *st, const struct stream *s)
+{
+	bool ok;
 
-				vidts = 1000 * pkt->pts *
-					av_q2d(st->vid.time_base);
+	mtx_lock(&st->lock);
+	ok = s == &st->au ? st->ausrc_st != NULL : st->vidsrc_st != NULL;
+	mtx_unlock(&st->lock);
 
-				if (st->is_pass_through) {
-					avformat_video_copy(st, pkt);
-				}
-				else {
-					avformat_video_decode(st, pkt);
-				}
-			}
+	return ok;
+}
 
-			av_packet_unref(pkt);
+
+/* Decode the packets of one stream, independent of the other stream */
+static int decode_thread(void *data)
+{
+	struct stream *s = data;
+	struct shared *st = s->shared;
+	AVPacket *pkt;
+
+	while ((pkt = avformat_pktq_get(s->q))) {
+
+		/* nobody is listening, skip decoding but keep the pace */
+		if (!has_consumer(st, s)) {
+			(void)avformat_shared_wait(st, s, pkt->dts);
+		}
+		else if (s == &st->au) {
+			avformat_audio_decode(st, pkt);
 		}
+		else if (st->is_pass_through) {
+			if (avformat_shared_wait(st, s, pkt->pts))
+				avformat_video_copy(st, pkt);
+		}
+		else {
+			avformat_video_decode(st, pkt);
+		}
+
+		av_packet_free(&pkt);
 	}
 
- out:
-	av_packet_free(&pkt);
+	return 0;
+}
+
+
+static int stream_start(struct stream *s, size_t qsz, const char *name)
+{
+	int err;
+
+	if (s->idx < 0)
+		return 0;
+
+	err = avformat_pktq_alloc(&s->q, qsz);
+	if (err)
+		return err;
+
+	err = thread_create_name(&s->thread, name, decode_thread, s);
+	if (err)
+		return err;
+
+	s->thread_started = true;
 
 	return 0;
 }
@@ -268,6 +399,9 @@ int avformat_shared_alloc(struct shared **shp, const char *dev,
 
 	st->au.idx  = -1;
 	st->vid.idx = -1;
+	st->au.shared  = st;
+	st->vid.shared = st;
+	re_atomic_rlx_set(&st->run, true);
 
 	err = str_dup(&st->dev, dev);
 	if (err)
@@ -375,6 +509,15 @@ int avformat_shared_alloc(struct shared **shp, const char *dev,
 		}
 	}
 
+	st->ic = avformat_alloc_context();
+	if (!st->ic) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	st->ic->interrupt_callback.callback = interrupt_handler;
+	st->ic->interrupt_callback.opaque   = st;
+
 	ret = avformat_open_input(&st->ic, dev, input_format, &format_opts);
 	if (ret < 0) {
 		warning("avformat: avformat_open_input(%s) failed (ret=%s)\n",
@@ -421,12 +564,20 @@ int avformat_shared_alloc(struct shared **shp, const char *dev,
 		}
 	}
 
-	st->run = true;
+	st->start_time = st->ic->start_time != AV_NOPTS_VALUE ?
+		st->ic->start_time : 0;
+	st->t0 = tmr_jiffies_usec();
+
+	err  = stream_start(&st->au, QUEUE_AUDIO, "avformat_audio");
+	err |= stream_start(&st->vid, QUEUE_VIDEO, "avformat_video");
+	if (err)
+		goto out;
+
 	err = thread_create_name(&st->thread, "avformat", read_thread, st);
-	if (err) {
-		st->run = false;
+	if (err)
 		goto out;
-	}
+
+	st->thread_started = true;
 
 	list_append(&sharedl, &st->le, st);
 
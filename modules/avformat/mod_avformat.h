@@ -14,13 +14,20 @@ struct shared {
 	thrd_t thread;
 	char *dev;
 	bool is_realtime;
-	bool run;
+	RE_ATOMIC bool run;
 	bool is_pass_through;
+	bool thread_started;
+	uint64_t t0;                  /* Start of playback [us] */
+	int64_t start_time;           /* Start of the media [us] */
 
 	struct stream {
+		struct shared *shared;    /* pointer */
 		AVRational time_base;
 		AVCodecContext *ctx;
 		int idx;
+		struct pktq *q;
+		thrd_t thread;
+		bool thread_started;
 	} au, vid;
 };
 
@@ -29,6 +36,8 @@ int avformat_shared_alloc(struct shared **shp, const char *dev,
 			  double fps, const struct vidsz *size,
 			  bool video);
 struct shared *avformat_shared_lookup(const char *dev);
+bool avformat_shared_wait(const struct shared *sh, const struct stream *s,
+			  int64_t pts);
 void avformat_shared_set_audio(struct shared *sh, struct ausrc_st *st);
 void avformat_shared_set_video(struct shared *sh, struct vidsrc_st *st);
 
@@ -49,3 +58,16 @@ void avformat_video_decode(struct shared *st, AVPacket *pkt);
 
 /*add avformat_video_copy function which passes packets to packet handler*/
 void avformat_video_copy(struct shared *st, AVPacket *pkt);
+
+
+/*
+ * Packet queue
+ */
+
+struct pktq;
+
+int  avformat_pktq_alloc(struct pktq **qp, size_t sz);
+int  avformat_pktq_put(struct pktq *q, AVPacket *pkt);
+AVPacket *avformat_pktq_get(struct pktq *q);
+bool avformat_pktq_sleep(struct pktq *q, uint64_t until);
+void avformat_pktq_abort(struct pktq *q);
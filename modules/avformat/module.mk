@@ -7,6 +7,7 @@
 MOD		:= avformat
 $(MOD)_SRCS	+= avformat.c
 $(MOD)_SRCS	+= audio.c
+$(MOD)_SRCS	+= pktq.c
 $(MOD)_SRCS	+= video.c
 $(MOD)_LFLAGS	+= \
 	`pkg-config --libs libavformat libavcodec libswresample \
@@ -0,0 +1,226 @@
+/**
+ * @file avformat/pktq.c  libavformat media-source -- packet queue
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+
+#include <time.h>
+#include <re.h>
+#include <re_atomic.h>
+#include <rem.h>
+#include <baresip.h>
+#include <libavformat/avformat.h>
+#include <libavcodec/avcodec.h>
+#include "mod_avformat.h"
+
+
+/*
+ * Bounded queue of packets from the demuxer to the decoder of one
+ * stream. The demuxer blocks when the queue is full, the decoder blocks
+ * when it is empty. After an abort all calls return immediately.
+ */
+struct pktq {
+	AVPacket **pktv;
+	size_t sz;
+	size_t rd;
+	size_t n;
+	mtx_t *mtx;
+	cnd_t cnd;
+	bool cnd_ok;
+	bool abort;
+};
+
+
+static void pktq_destructor(void *arg)
+{
+	struct pktq *q = arg;
+
+	while (q->n) {
+		av_packet_free(&q->pktv[q->rd]);
+		q->rd = (q->rd + 1) % q->sz;
+		--q->n;
+	}
+
+	mem_deref(q->pktv);
+	if (q->cnd_ok)
+		cnd_destroy(&q->cnd);
+	mem_deref(q->mtx);
+}
+
+
+int avformat_pktq_alloc(struct pktq **qp, size_t sz)
+{
+	struct pktq *q;
+	int err = 0;
+
+	if (!qp || !sz)
+		return EINVAL;
+
+	q = mem_zalloc(sizeof(*q), pktq_destructor);
+	if (!q)
+		return ENOMEM;
+
+	q->sz = sz;
+
+	q->pktv = mem_zalloc(sz * sizeof(*q->pktv), NULL);
+	if (!q->pktv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = mutex_alloc(&q->mtx);
+	if (err)
+		goto out;
+
+	if (cnd_init(&q->cnd) != thrd_success) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	q->cnd_ok = true;
+
+ out:
+	if (err)
+		mem_deref(q);
+	else
+		*qp = q;
+
+	return err;
+}
+
+
+/**
+ * Put a packet into the queue, blocks while the queue is full
+ *
+ * @param q   Packet queue
+ * @param pkt Packet, the reference is moved into the queue
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int avformat_pktq_put(struct pktq *q, AVPacket *pkt)
+{
+	AVPacket *p;
+
+	if (!q || !pkt)
+		return EINVAL;
+
+	p = av_packet_alloc();
+	if (!p)
+		return ENOMEM;
+
+	av_packet_move_ref(p, pkt);
+
+	mtx_lock(q->mtx);
+
+	while (q->n == q->sz && !q->abort)
+		cnd_wait(&q->cnd, q->mtx);
+
+	if (q->abort) {
+		mtx_unlock(q->mtx);
+		av_packet_free(&p);
+		return ECANCELED;
+	}
+
+	q->pktv[(q->rd + q->n) % q->sz] = p;
+	++q->n;
+
+	cnd_broadcast(&q->cnd);
+	mtx_unlock(q->mtx);
+
+	return 0;
+}
+
+
+/**
+ * Get the next packet from the queue, blocks while the queue is empty
+ *
+ * @param q Packet queue
+ *
+ * @return Packet, to be freed with av_packet_free(), or NULL if aborted
+ */
+AVPacket *avformat_pktq_get(struct pktq *q)
+{
+	AVPacket *p = NULL;
+
+	if (!q)
+		return NULL;
+
+	mtx_lock(q->mtx);
+
+	while (!q->n && !q->abort)
+		cnd_wait(&q->cnd, q->mtx);
+
+	if (!q->abort) {
+		p = q->pktv[q->rd];
+		q->pktv[q->rd] = NULL;
+		q->rd = (q->rd + 1) % q->sz;
+		--q->n;
+
+		cnd_broadcast(&q->cnd);
+	}
+
+	mtx_unlock(q->mtx);
+
+	return p;
+}
+
+
+/**
+ * Wait until a point in time, or until the queue is aborted
+ *
+ * @param q     Packet queue
+ * @param until Time to wait for, in tmr_jiffies_usec() units
+ *
+ * @return True if the time was reached, false if aborted
+ */
+bool avformat_pktq_sleep(struct pktq *q, uint64_t until)
+{
+	bool ok;
+
+	if (!q)
+		return false;
+
+	mtx_lock(q->mtx);
+
+	while (!q->abort) {
+
+		uint64_t now = tmr_jiffies_usec();
+		struct timespec ts;
+		uint64_t nsec;
+
+		if (now >= until)
+			break;
+
+		(void)timespec_get(&ts, TIME_UTC);
+
+		nsec = ts.tv_nsec + (until - now) * 1000;
+
+		ts.tv_sec  += (time_t)(nsec / 1000000000);
+		ts.tv_nsec  = (long)(nsec % 1000000000);
+
+		(void)cnd_timedwait(&q->cnd, q->mtx, &ts);
+	}
+
+	ok = !q->abort;
+
+	mtx_unlock(q->mtx);
+
+	return ok;
+}
+
+
+/**
+ * Abort the queue and wake up all waiting threads
+ *
+ * @param q Packet queue
+ */
+void avformat_pktq_abort(struct pktq *q)
+{
+	if (!q)
+		return;
+
+	mtx_lock(q->mtx);
+	q->abort = true;
+	cnd_broadcast(&q->cnd);
+	mtx_unlock(q->mtx);
+}
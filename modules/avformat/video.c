@@ -8,6 +8,7 @@
  */
 
 #include <re.h>
+#include <re_atomic.h>
 #include <rem.h>
 #include <baresip.h>
 #include <libavformat/avformat.h>
@@ -202,6 +203,9 @@ void avformat_video_decode(struct shared *st, AVPacket *pkt)
 	/* convert timestamp */
 	timestamp = frame->pts * VIDEO_TIMEBASE * tb.num / tb.den;
 
+	if (!avformat_shared_wait(st, &st->vid, frame->pts))
+		goto out;
+
 	mtx_lock(&st->lock);
 
 	if (st->vidsrc_st && st->vidsrc_st->frameh)
@@ -33,6 +33,20 @@ static int cmd_net_debug(struct re_printf *pf, void *unused)
 }
 
 
+static int cmd_rtpport_debug(struct re_printf *pf, void *unused)
+{
+	(void)unused;
+	return rtpport_debug(pf, baresip_rtpport());
+}
+
+
+static int cmd_strmpool_debug(struct re_printf *pf, void *unused)
+{
+	(void)unused;
+	return strmpool_debug(pf, baresip_strmpool());
+}
+
+
 static int print_system_info(struct re_printf *pf, void *arg)
 {
 	uint32_t uptime;
@@ -139,6 +153,63 @@ static int cmd_api_uastate(struct re_printf *pf, void *unused)
 }
 
 
+/**
+ * Print the main loop profiler, or control it with the parameter
+ * "on", "off" or "reset"
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+static int cmd_prof(struct re_printf *pf, void *arg)
+{
+	const struct cmd_arg *carg = arg;
+	const char *prm = carg->prm;
+
+	if (!str_isset(prm))
+		return prof_debug(pf, NULL);
+
+	if (0 == str_casecmp(prm, "on"))
+		return prof_enable(true);
+
+	if (0 == str_casecmp(prm, "off"))
+		return prof_enable(false);
+
+	if (0 == str_casecmp(prm, "reset")) {
+		prof_reset();
+		return 0;
+	}
+
+	return re_hprintf(pf, "usage: prof [on|off|reset]\n");
+}
+
+
+/**
+ * Print the main loop profiler
+ *
+ * Formatted as JSON, for use with TCP / MQTT API interface.
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+static int cmd_api_prof(struct re_printf *pf, void *unused)
+{
+	struct odict *od = NULL;
+	int err;
+	(void)unused;
+
+	err = odict_alloc(&od, 8);
+	if (err)
+		return err;
+
+	err  = prof_json_api(od);
+	err |= json_encode_odict(pf, od);
+	if (err)
+		warning("debug: failed to encode json (%m)\n", err);
+
+	mem_deref(od);
+
+	return re_hprintf(pf, "\n");
+}
+
+
 static int cmd_play_file(struct re_printf *pf, void *arg)
 {
 	struct cmd_arg *carg = arg;
@@ -375,6 +446,7 @@ static int print_uuid(struct re_printf *pf, void *arg)
 
 
 static const struct cmd debugcmdv[] = {
+{"apiprof",     0,       0, "Main loop profiler",     cmd_api_prof        },
 {"apistate",    0,       0, "User Agent state",       cmd_api_uastate     },
 {"aufileinfo",  0, CMD_PRM, "Audio file info",        cmd_aufileinfo      },
 {"conf_reload", 0,       0, "Reload config file",     reload_config       },
@@ -385,7 +457,10 @@ static const struct cmd debugcmdv[] = {
 {"modules",     0,       0, "Module debug",           mod_debug           },
 {"netstat",    'n',      0, "Network debug",          cmd_net_debug       },
 {"play",        0, CMD_PRM, "Play audio file",        cmd_play_file       },
+{"prof",        0, CMD_PRM, "Main loop profiler",     cmd_prof            },
+{"rtpports",    0,       0, "RTP port allocator",     cmd_rtpport_debug   },
 {"sipstat",    'i',      0, "SIP debug",              cmd_sip_debug       },
+{"streampool",  0,       0, "Stream pool",            cmd_strmpool_debug  },
 {"sysinfo",    's',      0, "System info",            print_system_info   },
 {"timers",      0,       0, "Timer debug",            tmr_status          },
 {"uastat",     'u',      0, "UA debug",               cmd_ua_debug        },
@@ -11,6 +11,9 @@
  * REQUIRES: aubridge
  * NOTE: This module is experimental.
  *
+ * The audio payload is sent back without decoding when the codec allows
+ * it, otherwise the audio is looped through aubridge.
+ *
  */
 
 struct session {
@@ -79,12 +82,18 @@ static int new_session(struct ua *ua, struct call *call)
 	audio_set_devicename(call_audio(sess->call_in), a, a);
 	video_set_devicename(call_video(sess->call_in), a, a);
 
+	err = audio_set_relay(call_audio(sess->call_in),
+			      call_audio(sess->call_in));
+	if (err)
+		goto out;
+
 	call_set_handlers(sess->call_in, call_event_handler,
 			call_dtmf_handler, sess);
 
 	list_append(&sessionl, &sess->le, sess);
 	err = ua_answer(ua, call, VIDMODE_ON);
 
+ out:
 	if (err)
 		mem_deref(sess);
 
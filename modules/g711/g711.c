@@ -19,8 +19,6 @@
 static int pcmu_encode(struct auenc_state *aes, bool *marker, uint8_t *buf,
 		       size_t *len, int fmt, const void *sampv, size_t sampc)
 {
-	const int16_t *p = sampv;
-
 	(void)aes;
 	(void)marker;
 
@@ -35,8 +33,7 @@ static int pcmu_encode(struct auenc_state *aes, bool *marker, uint8_t *buf,
 
 	*len = sampc;
 
-	while (sampc--)
-		*buf++ = g711_pcm2ulaw(*p++);
+	aug711_pcm2ulaw(buf, sampv, sampc);
 
 	return 0;
 }
@@ -46,8 +43,6 @@ static int pcmu_decode(struct audec_state *ads, int fmt, void *sampv,
 		       size_t *sampc, bool marker,
 		       const uint8_t *buf, size_t len)
 {
-	int16_t *p = sampv;
-
 	(void)ads;
 	(void)marker;
 
@@ -62,8 +57,7 @@ static int pcmu_decode(struct audec_state *ads, int fmt, void *sampv,
 
 	*sampc = len;
 
-	while (len--)
-		*p++ = g711_ulaw2pcm(*buf++);
+	aug711_ulaw2pcm(sampv, buf, len);
 
 	return 0;
 }
@@ -72,8 +66,6 @@ static int pcmu_decode(struct audec_state *ads, int fmt, void *sampv,
 static int pcma_encode(struct auenc_state *aes, bool *marker, uint8_t *buf,
 		       size_t *len, int fmt, const void *sampv, size_t sampc)
 {
-	const int16_t *p = sampv;
-
 	(void)aes;
 	(void)marker;
 
@@ -88,8 +80,7 @@ static int pcma_encode(struct auenc_state *aes, bool *marker, uint8_t *buf,
 
 	*len = sampc;
 
-	while (sampc--)
-		*buf++ = g711_pcm2alaw(*p++);
+	aug711_pcm2alaw(buf, sampv, sampc);
 
 	return 0;
 }
@@ -99,8 +90,6 @@ static int pcma_decode(struct audec_state *ads, int fmt, void *sampv,
 		       size_t *sampc, bool marker,
 		       const uint8_t *buf, size_t len)
 {
-	int16_t *p = sampv;
-
 	(void)ads;
 	(void)marker;
 
@@ -115,8 +104,7 @@ static int pcma_decode(struct audec_state *ads, int fmt, void *sampv,
 
 	*sampc = len;
 
-	while (len--)
-		*p++ = g711_alaw2pcm(*buf++);
+	aug711_alaw2pcm(sampv, buf, len);
 
 	return 0;
 }
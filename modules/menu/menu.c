@@ -353,8 +353,56 @@ static void check_registrations(void)
 }
 
 
+static void connect_handler(void *arg)
+{
+	struct menu_dial *d = arg;
+	struct call *call;
+
+	if (d->autoans) {
+		ua_set_autoanswer_value(d->ua, menu.ansval);
+		(void)ua_enable_autoanswer(d->ua, menu.adelay, d->met);
+	}
+
+	d->err = ua_connect_dir(d->ua, &call, NULL, d->uri, VIDMODE_ON,
+				d->adir, d->vdir);
+
+	if (d->autoans)
+		(void)ua_disable_autoanswer(d->ua, d->met);
+
+	if (d->err)
+		return;
+
+	if (d->user_data)
+		(void)call_set_user_data(call, d->user_data);
+
+	d->err = str_dup(&d->id, call_id(call));
+}
+
+
+/**
+ * Make a call in the thread of the User-Agent
+ *
+ * In sharded mode a User-Agent belongs to a shard, see ua_shard().
+ *
+ * @param d Dial parameters, on success d->id is the new Call-ID
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int menu_dial(struct menu_dial *d)
+{
+	int err;
+
+	if (!d || !d->ua)
+		return EINVAL;
+
+	err = shard_exec(ua_shard(d->ua), connect_handler, d, true);
+
+	return err ? err : d->err;
+}
+
 static void redial_handler(void *arg)
 {
+	struct menu_dial d;
 	char *uri = NULL;
 	int err;
 	(void)arg;
@@ -379,12 +427,18 @@ static void redial_handler(void *arg)
 	if (err)
 		return;
 
-	err = ua_connect(uag_find_aor(menu.redial_aor), NULL, NULL,
-			 uri, VIDMODE_ON);
+	memset(&d, 0, sizeof(d));
+	d.ua   = uag_find_aor(menu.redial_aor);
+	d.uri  = uri;
+	d.adir = SDP_SENDRECV;
+	d.vdir = SDP_SENDRECV;
+
+	err = menu_dial(&d);
 	if (err) {
 		warning("menu: redial: ua_connect failed (%m)\n", err);
 	}
 
+	mem_deref(d.id);
 	mem_deref(uri);
 }
 
@@ -64,3 +64,18 @@ int  menu_param_decode(const char *prm, const char *name, struct pl *val);
 struct call *menu_find_call(call_match_h *matchh, const struct call *exclude);
 struct call *menu_find_call_state(enum call_state st);
 enum sdp_dir decode_sdp_enum(const struct pl *pl);
+
+/** Outgoing call, made in the thread of the User-Agent */
+struct menu_dial {
+	struct ua *ua;                /**< User-Agent                     */
+	const char *uri;              /**< Request URI                    */
+	enum sdp_dir adir;            /**< Audio direction                */
+	enum sdp_dir vdir;            /**< Video direction                */
+	bool autoans;                 /**< Request auto answer            */
+	enum answer_method met;       /**< Auto answer method             */
+	const char *user_data;       /**< Optional call user data        */
+	char *id;                     /**< Call-ID of the new call        */
+	int err;                      /**< Result of ua_connect_dir()     */
+};
+
+int menu_dial(struct menu_dial *d);
@@ -167,12 +167,64 @@ static int cmd_answerdir(struct re_printf *pf, void *arg)
 }
 
 
+struct acc_mode {
+	struct ua *ua;                /**< User-Agent, NULL for all       */
+	bool rel100;                  /**< 100rel mode, else answer mode  */
+	int mode;                     /**< New mode                       */
+	int err;
+};
+
+
+static int acc_mode_set(struct account *acc, const struct acc_mode *am)
+{
+	if (am->rel100)
+		return account_set_rel100_mode(acc,
+					       (enum rel100_mode)am->mode);
+
+	return account_set_answermode(acc, (enum answermode)am->mode);
+}
+
+
+static void acc_mode_handler(void *arg)
+{
+	struct acc_mode *am = arg;
+	struct le *le;
+
+	if (am->ua) {
+		am->err = acc_mode_set(ua_account(am->ua), am);
+		return;
+	}
+
+	for (le = list_head(uag_list()); le && !am->err; le = le->next) {
+		struct ua *ua = le->data;
+
+		am->err = acc_mode_set(ua_account(ua), am);
+	}
+}
+
+
+/* The accounts are changed in the thread of their User-Agent */
+static int acc_mode_apply(struct acc_mode *am)
+{
+	int err = 0;
+
+	if (am->ua)
+		err = shard_exec(ua_shard(am->ua), acc_mode_handler, am, true);
+	else if (shard_current())
+		acc_mode_handler(am);
+	else
+		err = shard_exec_all(acc_mode_handler, am);
+
+	return err ? err : am->err;
+}
+
+
 static int cmd_set_answermode(struct re_printf *pf, void *arg)
 {
 	enum answermode mode;
 	const struct cmd_arg *carg = arg;
 	struct ua *ua = carg->data;
-	struct le *le;
+	struct acc_mode am = {NULL, false, 0, 0};
 	int err;
 
 	if (0 == str_cmp(carg->prm, "manual")) {
@@ -189,19 +241,12 @@ static int cmd_set_answermode(struct re_printf *pf, void *arg)
 		return EINVAL;
 	}
 
-	if (ua) {
-		err = account_set_answermode(ua_account(ua), mode);
-		if (err)
-			return err;
-	}
-	else {
-		for (le = list_head(uag_list()); le; le = le->next) {
-			ua = le->data;
-			err = account_set_answermode(ua_account(ua), mode);
-			if (err)
-				return err;
-		}
-	}
+	am.ua   = ua;
+	am.mode = mode;
+
+	err = acc_mode_apply(&am);
+	if (err)
+		return err;
 
 	(void)re_hprintf(pf, "Answer mode changed to: %s\n", carg->prm);
 
@@ -215,9 +260,9 @@ static int cmd_set_100rel_mode(struct re_printf *pf, void *arg)
 	struct pl w1 = PL_INIT;
 	struct pl w2 = PL_INIT;
 	struct ua *ua = menu_ua_carg(pf, carg, &w1, &w2);
+	struct acc_mode am = {NULL, true, 0, 0};
 	char *mode_str = NULL;
 	enum rel100_mode mode;
-	struct le *le;
 	int err;
 
 	err = pl_strdup(&mode_str, &w1);
@@ -246,21 +291,19 @@ static int cmd_set_100rel_mode(struct re_printf *pf, void *arg)
 	if (!ua)
 		ua = uag_find_requri_pl(&w2);
 
+	am.ua   = ua;
+	am.mode = mode;
+
+	err = acc_mode_apply(&am);
+	if (err)
+		goto out;
+
 	if (ua) {
-		err = account_set_rel100_mode(ua_account(ua), mode);
-		if (err)
-			goto out;
 		(void)re_hprintf(pf, "100rel mode of account %s changed to: "
 				 "%s\n", account_aor(ua_account(ua)),
 				 mode_str);
 	}
 	else {
-		for (le = list_head(uag_list()); le; le = le->next) {
-			ua = le->data;
-			err = account_set_rel100_mode(ua_account(ua), mode);
-			if (err)
-				goto out;
-		}
 		(void)re_hprintf(pf, "100rel mode of all accounts changed to: "
 				 "%s\n", mode_str);
 	}
@@ -483,14 +526,16 @@ static int dial_handler(struct re_printf *pf, void *arg)
 	struct menu *menu = menu_get();
 	struct pl word[2] = {PL_INIT, PL_INIT};
 	struct ua *ua = menu_ua_carg(pf, carg, &word[0], &word[1]);
+	struct menu_dial d;
 	char *uri = NULL;
 	char *uric = NULL;
 	struct pl pluri;
-	struct call *call;
 	int err = 0;
 
 	(void)pf;
 
+	memset(&d, 0, sizeof(d));
+
 	if (pl_isset(&word[0])) {
 		err = pl_strdup(&uri, &word[0]);
 		if (err)
@@ -531,39 +576,35 @@ static int dial_handler(struct re_printf *pf, void *arg)
 		goto out;
 	}
 
-	if (menu->adelay >= 0) {
-		ua_set_autoanswer_value(ua, menu->ansval);
-		(void)ua_enable_autoanswer(ua, menu->adelay,
-				auto_answer_method(pf));
-	}
-
 	re_hprintf(pf, "call uri: %s\n", uri);
 	err = account_uri_complete_strdup(ua_account(ua), &uric, &pluri);
 	if (err)
 		goto out;
 
-	err = ua_connect(ua, &call, NULL, uric, VIDMODE_ON);
-
-	if (menu->adelay >= 0)
-		(void)ua_disable_autoanswer(ua, auto_answer_method(pf));
-	if (err) {
-		(void)re_hprintf(pf, "ua_connect failed: %m\n", err);
-		goto out;
-	}
+	d.ua      = ua;
+	d.uri     = uric;
+	d.adir    = SDP_SENDRECV;
+	d.vdir    = SDP_SENDRECV;
+	d.autoans = menu->adelay >= 0;
+	d.met     = d.autoans ? auto_answer_method(pf) : ANSM_NONE;
 
 	const char ud_sentinel[] = "userdata=";
 	char *ud_pos = NULL;
 	if (carg->prm != NULL)
 		ud_pos = strstr(carg->prm, ud_sentinel);
-	char *user_data = NULL;
-	if (ud_pos != NULL) {
-		user_data = ud_pos + strlen(ud_sentinel);
-		call_set_user_data(call, user_data);
+	if (ud_pos != NULL)
+		d.user_data = ud_pos + strlen(ud_sentinel);
+
+	err = menu_dial(&d);
+	if (err) {
+		(void)re_hprintf(pf, "ua_connect failed: %m\n", err);
+		goto out;
 	}
 
-	re_hprintf(pf, "call id: %s\n", call_id(call));
+	re_hprintf(pf, "call id: %s\n", d.id);
 
 out:
+	mem_deref(d.id);
 	mem_deref(uri);
 	mem_deref(uric);
 	return err;
@@ -578,7 +619,7 @@ static int cmd_dialdir(struct re_printf *pf, void *arg)
 	struct pl argdir[2] = {PL_INIT, PL_INIT};
 	struct pl dname = PL_INIT;
 	struct pl pluri;
-	struct call *call;
+	struct menu_dial d;
 	char *uri = NULL;
 	struct ua *ua = carg->data;
 	int err = 0;
@@ -655,30 +696,27 @@ static int cmd_dialdir(struct re_printf *pf, void *arg)
 		goto out;
 	}
 
-	if (menu->adelay >= 0) {
-		ua_set_autoanswer_value(ua, menu->ansval);
-		(void)ua_enable_autoanswer(ua, menu->adelay,
-				auto_answer_method(pf));
-	}
-
 	re_hprintf(pf, "call uri: %s\n", uri);
 
-	err = ua_connect_dir(ua, &call, NULL, uri, VIDMODE_ON, adir, vdir);
-
-	if (menu->adelay >= 0)
-		(void)ua_disable_autoanswer(ua, auto_answer_method(pf));
-	if (err)
-		goto out;
+	memset(&d, 0, sizeof(d));
+	d.ua      = ua;
+	d.uri     = uri;
+	d.adir    = adir;
+	d.vdir    = vdir;
+	d.autoans = menu->adelay >= 0;
+	d.met     = d.autoans ? auto_answer_method(pf) : ANSM_NONE;
 
 	const char ud_sentinel[] = "userdata=";
 	char *ud_pos = strstr(carg->prm, ud_sentinel);
-	char *user_data = NULL;
-	if (ud_pos != NULL) {
-		user_data = ud_pos + strlen(ud_sentinel);
-		call_set_user_data(call, user_data);
-	}
+	if (ud_pos != NULL)
+		d.user_data = ud_pos + strlen(ud_sentinel);
+
+	err = menu_dial(&d);
+	if (err)
+		goto out;
 
-	re_hprintf(pf, "call id: %s\n", call_id(call));
+	re_hprintf(pf, "call id: %s\n", d.id);
+	mem_deref(d.id);
 
  out:
 	mem_deref(uri);
@@ -1108,6 +1146,21 @@ static int cmd_set_ansval(struct re_printf *pf, void *arg)
 }
 
 
+static void ua_delete_handler(void *arg)
+{
+	struct ua *ua = arg;
+	struct le *le;
+
+	if (ua) {
+		mem_deref(ua);
+		return;
+	}
+
+	while ((le = list_head(uag_list())))
+		mem_deref(le->data);
+}
+
+
 static int cmd_ua_delete(struct re_printf *pf, void *arg)
 {
 	const struct cmd_arg *carg = arg;
@@ -1122,7 +1175,7 @@ static int cmd_ua_delete(struct re_printf *pf, void *arg)
 	}
 
 	(void)re_hprintf(pf, "deleting ua: %s\n", carg->prm);
-	mem_deref(ua);
+	(void)shard_exec(ua_shard(ua), ua_delete_handler, ua, true);
 	(void)ua_print_reg_status(pf, NULL);
 
 	return 0;
@@ -1131,14 +1184,12 @@ static int cmd_ua_delete(struct re_printf *pf, void *arg)
 
 static int cmd_ua_delete_all(struct re_printf *pf, void *unused)
 {
-	struct ua *ua = NULL;
-
 	(void)unused;
 
-	while (list_head(uag_list())) {
-		ua = list_head(uag_list())->data;
-		mem_deref(ua);
-	}
+	if (shard_current())
+		ua_delete_handler(NULL);
+	else
+		(void)shard_exec_all(ua_delete_handler, NULL);
 
 	(void)ua_print_reg_status(pf, NULL);
 
@@ -1146,29 +1197,43 @@ static int cmd_ua_delete_all(struct re_printf *pf, void *unused)
 }
 
 
+struct ua_find {
+	struct ua *ua;
+	struct call *call;
+};
+
+
+static void ua_find_handler(void *arg)
+{
+	struct ua_find *uf = arg;
+
+	ua_raise(uf->ua);
+	uf->call = list_ledata(list_tail(ua_calls(uf->ua)));
+}
+
+
 static int cmd_ua_find(struct re_printf *pf, void *arg)
 {
 	const struct cmd_arg *carg = arg;
-	struct le *le;
-	struct ua *ua = NULL;
+	struct ua_find uf = {NULL, NULL};
 
 	if (str_isset(carg->prm)) {
-		ua = uag_find_aor(carg->prm);
+		uf.ua = uag_find_aor(carg->prm);
 	}
 
-	if (!ua) {
+	if (!uf.ua) {
 		(void)re_hprintf(pf, "could not find User-Agent: %s\n",
 				 carg->prm);
 		return ENOENT;
 	}
 
-	(void)re_hprintf(pf, "ua: %s\n", account_aor(ua_account(ua)));
+	(void)re_hprintf(pf, "ua: %s\n", account_aor(ua_account(uf.ua)));
 
-	ua_raise(ua);
+	/* the User-Agent list of its shard is changed in that thread */
+	(void)shard_exec(ua_shard(uf.ua), ua_find_handler, &uf, true);
 
-	le = list_tail(ua_calls(ua));
-	if (le)
-		menu_selcall(le->data);
+	if (uf.call)
+		menu_selcall(uf.call);
 
 	menu_update_callstatus(uag_call_count());
 
@@ -22,6 +22,9 @@ struct mix {
 	struct aubuf *ab;
 	const struct audio *au;
 	struct aufilt_prm prm;
+	struct aupoly *resamp;    /* from this mix to the encoder */
+	uint32_t rs_srate;
+	uint8_t rs_ch;
 	bool ready;
 	struct le le_priv;
 };
@@ -34,7 +37,6 @@ struct mixminus_enc {
 	int16_t *sampv;
 	int16_t *rsampv;
 	int16_t *fsampv;
-	struct auresamp resamp;
 	struct aufilt_prm prm;
 	struct le le_priv;
 };
@@ -93,6 +95,7 @@ static void dec_destructor(void *arg)
 static void mix_destructor(void *arg)
 {
 	struct mix *mix = arg;
+	mem_deref(mix->resamp);
 	mem_deref(mix->ab);
 }
 
@@ -134,7 +137,6 @@ static int encode_update(struct aufilt_enc_st **stp, void **ctx,
 
 	st->prm = *prm;
 	st->au = au;
-	auresamp_init(&st->resamp);
 
 	list_append(&encs, &st->le_priv, st);
 
@@ -223,6 +225,24 @@ static int decode_update(struct aufilt_dec_st **stp, void **ctx,
 }
 
 
+static int resamp_setup(struct mix *mix, const struct aufilt_prm *prm)
+{
+	const struct config *cfg = conf_config();
+
+	if (mix->resamp && mix->rs_srate == mix->prm.srate &&
+	    mix->rs_ch == mix->prm.ch)
+		return 0;
+
+	mix->resamp = mem_deref(mix->resamp);
+	mix->rs_srate = mix->prm.srate;
+	mix->rs_ch    = mix->prm.ch;
+
+	return aupoly_alloc(&mix->resamp, mix->prm.srate, mix->prm.ch,
+			    prm->srate, prm->ch,
+			    cfg ? cfg->audio.resamp : AUPOLY_MEDIUM);
+}
+
+
 static void read_samp(struct aubuf *ab, int16_t *sampv, size_t sampc,
 		      size_t stime)
 {
@@ -276,44 +296,37 @@ static int encode(struct aufilt_enc_st *aufilt_enc_st, struct auframe *af)
 		if (!mix->prm.srate || !mix->prm.ch)
 			continue;
 
-		err = auresamp_setup(&enc->resamp, mix->prm.srate, mix->prm.ch,
-				     enc->prm.srate, enc->prm.ch);
-		if (err) {
-			warning("mixminus/auresamp_setup error (%m)\n", err);
-			return err;
-		}
+		if (mix->prm.srate != enc->prm.srate ||
+		    mix->prm.ch != enc->prm.ch) {
 
-		if (enc->resamp.resample) {
-			outc = AUDIO_SAMPSZ;
-			sampv_mix = enc->rsampv;
-
-			if (enc->prm.srate > mix->prm.srate) {
-				inc = af->sampc / enc->resamp.ratio;
-			}
-			else {
-				inc = af->sampc * enc->resamp.ratio;
+			err = resamp_setup(mix, &enc->prm);
+			if (err) {
+				warning("mixminus/aupoly_alloc error (%m)\n",
+					err);
+				return err;
 			}
 
-			if (enc->prm.ch == 2 && mix->prm.ch == 1) {
-				inc = inc / 2;
-			}
+			sampv_mix = enc->rsampv;
 
-			if (enc->prm.ch == 1 && mix->prm.ch == 2) {
-				inc = inc * 2;
-			}
+			/* input for one frame of the encoder */
+			inc = (uint64_t)af->sampc * mix->prm.srate *
+				mix->prm.ch / (enc->prm.srate * enc->prm.ch);
+			inc = min(inc, (size_t)AUDIO_SAMPSZ);
 
 			read_samp(mix->ab, enc->sampv, inc, stime);
 
-			err = auresamp(&enc->resamp, sampv_mix, &outc,
-				       enc->sampv, inc);
+			outc = AUDIO_SAMPSZ;
+			err = aupoly_process(mix->resamp, sampv_mix, &outc,
+					     enc->sampv, inc);
 			if (err) {
-				warning("mixminus/auresamp error (%m)\n", err);
+				warning("mixminus/aupoly error (%m)\n", err);
 				return err;
 			}
-			if (outc != af->sampc) {
-				warning("mixminus/auresamp sample count "
-					"error\n");
-				return EINVAL;
+
+			/* odd block sizes may give one frame less or more */
+			if (outc < af->sampc) {
+				memset(&sampv_mix[outc], 0,
+				       (af->sampc - outc) * sizeof(int16_t));
 			}
 		}
 		else {
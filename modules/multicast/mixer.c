@@ -0,0 +1,444 @@
+/**
+ * @file multicast/mixer.c  Mix of all running multicast receivers
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+
+#include "multicast.h"
+
+
+#define DEBUG_MODULE "mcmixer"
+#define DEBUG_LEVEL 6
+#include <re_dbg.h>
+
+
+/*
+ * In mix mode every running receiver decodes into its own mixer source,
+ * which is resampled to the mixer sample rate and buffered in an aubuf.
+ * A single audio player reads one frame of every source and mixes them.
+ *
+ * The sources with the highest priority (lowest number) which have audio
+ * are played with full gain, all other sources are ducked. Gain changes
+ * are ramped over one frame to avoid clicks.
+ */
+
+
+enum {
+	MIX_SRATE = 16000,
+	MIX_CH    = 1,
+};
+
+
+/**
+ * Multicast mixer struct
+ *
+ * Contains the audio player and the list of mixer sources
+ */
+struct mcmixer {
+	struct auplay_st *auplay;
+	mtx_t *lock;
+	struct list srcl;
+	int16_t *sampv;
+	int32_t *mixv;
+};
+
+
+/**
+ * Multicast mixer source struct
+ *
+ * Contains the decoder and audio buffer of one receiver
+ */
+struct mcmix_src {
+	struct le le;
+	struct mcmixer *mix;
+
+	const struct aucodec *ac;
+	struct audec_state *dec;
+	struct auresamp resamp;
+	struct aubuf *aubuf;
+	int16_t *sampv;
+	int16_t *sampv_rs;
+	uint32_t ssrc;
+
+	uint8_t prio;
+	bool muted;
+	float gain;
+};
+
+
+static struct mcmixer *mixer;
+
+
+static void mcmixer_destructor(void *arg)
+{
+	struct mcmixer *mix = arg;
+
+	mem_deref(mix->auplay);
+	mem_deref(mix->lock);
+	mem_deref(mix->sampv);
+	mem_deref(mix->mixv);
+
+	if (mixer == mix)
+		mixer = NULL;
+}
+
+
+static void mcmix_src_destructor(void *arg)
+{
+	struct mcmix_src *src = arg;
+
+	mtx_lock(src->mix->lock);
+	list_unlink(&src->le);
+	mtx_unlock(src->mix->lock);
+
+	mem_deref(src->aubuf);
+	mem_deref(src->dec);
+	mem_deref(src->sampv);
+	mem_deref(src->sampv_rs);
+	mem_deref(src->mix);
+}
+
+
+static inline int16_t saturate(int32_t v)
+{
+	if (v > 32767)
+		return 32767;
+	else if (v < -32768)
+		return -32768;
+
+	return (int16_t)v;
+}
+
+
+/**
+ * Audio player write handler, mixes one frame of all sources
+ *
+ * @note This function has REAL-TIME properties
+ *
+ * @param af   Audio frame
+ * @param arg  Multicast mixer
+ */
+static void auplay_write_handler(struct auframe *af, void *arg)
+{
+	struct mcmixer *mix = arg;
+	int16_t *outv = af->sampv;
+	size_t i, sampc = min(af->sampc, (size_t)AUDIO_SAMPSZ);
+	float duck = multicast_duck() / 100.0f;
+	uint8_t top = 255;
+	struct le *le;
+
+	memset(mix->mixv, 0, sampc * sizeof(*mix->mixv));
+
+	mtx_lock(mix->lock);
+
+	LIST_FOREACH(&mix->srcl, le) {
+		struct mcmix_src *src = le->data;
+
+		if (!src->muted && aubuf_cur_size(src->aubuf) &&
+		    src->prio < top)
+			top = src->prio;
+	}
+
+	LIST_FOREACH(&mix->srcl, le) {
+		struct mcmix_src *src = le->data;
+		struct auframe saf;
+		float target, step, g;
+
+		memset(mix->sampv, 0, sampc * sizeof(*mix->sampv));
+
+		auframe_init(&saf, AUFMT_S16LE, mix->sampv, sampc,
+			     MIX_SRATE, MIX_CH);
+		aubuf_read_auframe(src->aubuf, &saf);
+
+		if (src->muted)
+			target = 0.0f;
+		else
+			target = src->prio == top ? 1.0f : duck;
+
+		g    = src->gain;
+		step = (target - g) / (float)sampc;
+
+		for (i = 0; i < sampc; i++) {
+			g += step;
+			mix->mixv[i] += (int32_t)(mix->sampv[i] * g);
+		}
+
+		src->gain = target;
+	}
+
+	mtx_unlock(mix->lock);
+
+	for (i = 0; i < sampc; i++)
+		outv[i] = saturate(mix->mixv[i]);
+
+	for (; i < af->sampc; i++)
+		outv[i] = 0;
+}
+
+
+static int mcmixer_alloc(struct mcmixer **mixp)
+{
+	struct config_audio *cfg = &conf_config()->audio;
+	struct mcmixer *mix;
+	struct auplay_prm prm;
+	int err;
+
+	mix = mem_zalloc(sizeof(*mix), mcmixer_destructor);
+	if (!mix)
+		return ENOMEM;
+
+	mix->sampv = mem_zalloc(AUDIO_SAMPSZ * sizeof(*mix->sampv), NULL);
+	mix->mixv  = mem_zalloc(AUDIO_SAMPSZ * sizeof(*mix->mixv), NULL);
+	if (!mix->sampv || !mix->mixv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = mutex_alloc(&mix->lock);
+	if (err)
+		goto out;
+
+	prm.srate = MIX_SRATE;
+	prm.ch    = MIX_CH;
+	prm.ptime = PTIME;
+	prm.fmt   = AUFMT_S16LE;
+
+	err = auplay_alloc(&mix->auplay, baresip_auplayl(), cfg->play_mod,
+		&prm, cfg->play_dev, auplay_write_handler, mix);
+	if (err) {
+		warning("multicast mixer: start of %s.%s failed (%m)\n",
+			cfg->play_mod, cfg->play_dev, err);
+		goto out;
+	}
+
+  out:
+	if (err)
+		mem_deref(mix);
+	else
+		*mixp = mix;
+
+	return err;
+}
+
+
+/**
+ * Allocate a mixer source, starts the mixer player if needed
+ *
+ * @param srcp Pointer to allocated mixer source
+ * @param prio Priority of the source
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mcmixer_src_alloc(struct mcmix_src **srcp, uint8_t prio)
+{
+	struct config_audio *cfg = &conf_config()->audio;
+	struct mcmix_src *src;
+	size_t min_sz, max_sz;
+	int err = 0;
+
+	if (!srcp)
+		return EINVAL;
+
+	if (!cfg->buffer.min || !cfg->buffer.max)
+		return EINVAL;
+
+	src = mem_zalloc(sizeof(*src), mcmix_src_destructor);
+	if (!src)
+		return ENOMEM;
+
+	if (mixer) {
+		src->mix = mem_ref(mixer);
+	}
+	else {
+		err = mcmixer_alloc(&src->mix);
+		if (err) {
+			mem_deref(src);
+			return err;
+		}
+
+		mixer = src->mix;
+	}
+
+	src->prio = prio;
+	auresamp_init(&src->resamp);
+
+	src->sampv    = mem_zalloc(AUDIO_SAMPSZ * sizeof(int16_t), NULL);
+	src->sampv_rs = mem_zalloc(AUDIO_SAMPSZ * sizeof(int16_t), NULL);
+	if (!src->sampv || !src->sampv_rs) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	min_sz = sizeof(int16_t) * calc_nsamp(MIX_SRATE, MIX_CH,
+					      cfg->buffer.min);
+	max_sz = sizeof(int16_t) * calc_nsamp(MIX_SRATE, MIX_CH,
+					      cfg->buffer.max);
+
+	err = aubuf_alloc(&src->aubuf, min_sz, max_sz);
+	if (err)
+		goto out;
+
+	aubuf_set_mode(src->aubuf, cfg->adaptive ?
+		       AUBUF_ADAPTIVE : AUBUF_FIXED);
+
+	mtx_lock(src->mix->lock);
+	list_append(&src->mix->srcl, &src->le, src);
+	mtx_unlock(src->mix->lock);
+
+  out:
+	if (err)
+		mem_deref(src);
+	else
+		*srcp = src;
+
+	return err;
+}
+
+
+static int src_set_codec(struct mcmix_src *src, const struct aucodec *ac)
+{
+	int err = 0;
+
+	src->dec = mem_deref(src->dec);
+	src->ac  = NULL;
+
+	if (ac->decupdh) {
+		err = ac->decupdh(&src->dec, ac, NULL);
+		if (err) {
+			warning("multicast mixer: alloc decoder (%m)\n", err);
+			return err;
+		}
+	}
+
+	auresamp_init(&src->resamp);
+
+	if (ac->srate != MIX_SRATE || ac->ch != MIX_CH) {
+		err = auresamp_setup(&src->resamp, ac->srate, ac->ch,
+				     MIX_SRATE, MIX_CH);
+		if (err) {
+			warning("multicast mixer: could not setup resampler"
+				" %u/%u -> %u/%u (%m)\n", ac->srate, ac->ch,
+				MIX_SRATE, MIX_CH, err);
+			return err;
+		}
+	}
+
+	src->ac = ac;
+
+	return 0;
+}
+
+
+/**
+ * Decode the payload of the RTP packet into the mixer source
+ *
+ * @param src   Mixer source
+ * @param ac    Audio codec of the packet
+ * @param hdr   RTP header
+ * @param mb    RTP payload
+ * @param drop  True if the jbuf returned EAGAIN
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mcmixer_decode(struct mcmix_src *src, const struct aucodec *ac,
+		   const struct rtp_header *hdr, struct mbuf *mb, bool drop)
+{
+	struct auframe af;
+	size_t sampc = AUDIO_SAMPSZ;
+	int16_t *sampv;
+	int err;
+
+	if (!src || !ac || !hdr)
+		return EINVAL;
+
+	if (hdr->ext && hdr->x.len && mb)
+		return ENOTSUP;
+
+	if (src->ac != ac) {
+		err = src_set_codec(src, ac);
+		if (err)
+			return err;
+	}
+
+	if (src->ssrc != hdr->ssrc)
+		aubuf_flush(src->aubuf);
+
+	src->ssrc = hdr->ssrc;
+
+	if (mbuf_get_left(mb)) {
+		err = ac->dech(src->dec, AUFMT_S16LE, src->sampv, &sampc,
+			       hdr->m, mbuf_buf(mb), mbuf_get_left(mb));
+	}
+	else if (ac->plch) {
+		err = ac->plch(src->dec, AUFMT_S16LE, src->sampv, &sampc,
+			       mbuf_buf(mb), mbuf_get_left(mb));
+	}
+	else {
+		return 0;
+	}
+
+	if (err)
+		return err;
+
+	sampv = src->sampv;
+
+	if (src->resamp.resample) {
+		size_t sampc_rs = AUDIO_SAMPSZ;
+
+		err = auresamp(&src->resamp, src->sampv_rs, &sampc_rs,
+			       src->sampv, sampc);
+		if (err)
+			return err;
+
+		sampv = src->sampv_rs;
+		sampc = sampc_rs;
+	}
+
+	auframe_init(&af, AUFMT_S16LE, sampv, sampc, MIX_SRATE, MIX_CH);
+
+	if (drop) {
+		aubuf_drop_auframe(src->aubuf, &af);
+		return 0;
+	}
+
+	return aubuf_write_auframe(src->aubuf, &af);
+}
+
+
+/**
+ * Mute / unmute a mixer source
+ *
+ * @param src  Mixer source
+ * @param mute True to mute
+ */
+void mcmixer_src_mute(struct mcmix_src *src, bool mute)
+{
+	if (!src)
+		return;
+
+	mtx_lock(src->mix->lock);
+	src->muted = mute;
+	mtx_unlock(src->mix->lock);
+}
+
+
+/**
+ * Set the priority of a mixer source
+ *
+ * @param src  Mixer source
+ * @param prio Priority
+ */
+void mcmixer_src_set_prio(struct mcmix_src *src, uint8_t prio)
+{
+	if (!src)
+		return;
+
+	mtx_lock(src->mix->lock);
+	src->prio = prio;
+	mtx_unlock(src->mix->lock);
+}
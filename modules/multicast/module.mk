@@ -7,6 +7,6 @@
 MOD		:= multicast
 
 $(MOD)_SRCS	+= multicast.c sender.c receiver.c
-$(MOD)_SRCS	+= player.c source.c
+$(MOD)_SRCS	+= mixer.c player.c source.c
 
 include mk/mod.mk
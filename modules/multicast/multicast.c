@@ -20,12 +20,16 @@ struct mccfg {
 	uint32_t callprio;
 	uint32_t ttl;
 	uint32_t tfade;
+	bool mix;
+	uint32_t duck;
 };
 
 static struct mccfg mccfg = {
 	0,
 	1,
 	125,
+	false,
+	20,
 };
 
 
@@ -136,6 +140,28 @@ uint32_t multicast_fade_time(void)
 }
 
 
+/**
+ * Getter for configurable multicast mix mode
+ *
+ * @return true if all running receivers are mixed
+ */
+bool multicast_mix(void)
+{
+	return mccfg.mix;
+}
+
+
+/**
+ * Getter for configurable gain of ducked streams in mix mode
+ *
+ * @return uint32_t gain in [%]
+ */
+uint32_t multicast_duck(void)
+{
+	return mccfg.duck;
+}
+
+
 /**
  * Create a new multicast sender
  *
@@ -178,7 +204,8 @@ static int cmd_mcsend(struct re_printf *pf, void *arg)
 
 
 /**
- * Enable / Disable all multicast sender without removing it
+ * Enable / Disable all multicast sender, or the sender with the given
+ * address, without removing it
  *
  * @param pf  Printer
  * @param arg Command arguments
@@ -189,7 +216,8 @@ static int cmd_mcsenden(struct re_printf *pf, void *arg)
 {
 	int err = 0;
 	const struct cmd_arg *carg = arg;
-	struct pl plenable;
+	struct pl plenable, pladdr;
+	struct sa addr;
 	bool enable;
 
 	err = re_regex(carg->prm, str_len(carg->prm),
@@ -198,11 +226,24 @@ static int cmd_mcsenden(struct re_printf *pf, void *arg)
 		goto out;
 
 	enable = pl_u32(&plenable);
-	mcsender_enable(enable);
+
+	if (!re_regex(carg->prm, str_len(carg->prm),
+		"addr=[^ ]*", &pladdr)) {
+
+		err = decode_addr(&pladdr, &addr);
+		if (err)
+			goto out;
+
+		err = mcsender_enable_addr(&addr, enable);
+	}
+	else {
+		mcsender_enable(enable);
+	}
 
   out:
 	if (err)
-		re_hprintf(pf, "usage: /mcsenden enable=<0,1>\n");
+		re_hprintf(pf, "usage: /mcsenden enable=<0,1>"
+			" [addr=<IP>:<PORT>]\n");
 
 	return err;
 }
@@ -645,6 +686,11 @@ static int module_read_config(void)
 	if (mccfg.tfade > 2000)
 		mccfg.tfade = 2000;
 
+	(void)conf_get_bool(conf_cur(), "multicast_mix", &mccfg.mix);
+	(void)conf_get_u32(conf_cur(), "multicast_duck", &mccfg.duck);
+	if (mccfg.duck > 100)
+		mccfg.duck = 100;
+
 	sa_init(&laddr, AF_INET);
 	err = conf_apply(conf_cur(), "multicast_listener",
 		module_read_config_handler, &prio);
@@ -661,7 +707,7 @@ static const struct cmd cmdv[] = {
 	{"mcsend",    0, CMD_PRM, "Send multicast"            , cmd_mcsend   },
 	{"mcstop",    0, CMD_PRM, "Stop multicast"            , cmd_mcstop   },
 	{"mcstopall", 0, CMD_PRM, "Stop all multicast"        , cmd_mcstopall},
-	{"mcsenden",  0, CMD_PRM, "Enable/Disable all sender" , cmd_mcsenden },
+	{"mcsenden",  0, CMD_PRM, "Enable/Disable sender"     , cmd_mcsenden },
 
 	{"mcreg",     0, CMD_PRM, "Reg. multicast listener"   , cmd_mcreg    },
 	{"mcunreg",   0, CMD_PRM, "Unreg. multicast listener" , cmd_mcunreg  },
@@ -21,6 +21,8 @@ enum {
 uint8_t multicast_callprio(void);
 uint8_t multicast_ttl(void);
 uint32_t multicast_fade_time(void);
+bool multicast_mix(void);
+uint32_t multicast_duck(void);
 
 
 /* Sender */
@@ -31,6 +33,7 @@ int  mcsender_alloc(struct sa *addr, const struct aucodec *codec);
 void mcsender_stopall(void);
 void mcsender_stop(struct sa *addr);
 void mcsender_enable(bool enable);
+int  mcsender_enable_addr(struct sa *addr, bool enable);
 
 void mcsender_print(struct re_printf *pf);
 
@@ -58,6 +61,14 @@ int mcplayer_decode(const struct rtp_header *hdr, struct mbuf *mb, bool drop);
 int  mcplayer_init(void);
 void mcplayer_terminate(void);
 
+/* Mixer <multi-stream player> */
+struct mcmix_src;
+int  mcmixer_src_alloc(struct mcmix_src **srcp, uint8_t prio);
+int  mcmixer_decode(struct mcmix_src *src, const struct aucodec *ac,
+	const struct rtp_header *hdr, struct mbuf *mb, bool drop);
+void mcmixer_src_mute(struct mcmix_src *src, bool mute);
+void mcmixer_src_set_prio(struct mcmix_src *src, uint8_t prio);
+
 /* Source <exchangable source> */
 struct mcsource;
 int mcsource_start(struct mcsource **srcp, const struct aucodec *ac,
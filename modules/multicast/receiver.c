@@ -17,10 +17,12 @@
 
 struct list mcreceivl = LIST_INIT;
 static mtx_t mcreceivl_lock;
+static struct tmr sweep_tmr;
 
 
 enum {
 	TIMEOUT = 1000,
+	SWEEP_INTERVAL = 100,
 };
 
 enum state {
@@ -45,8 +47,9 @@ struct mcreceiver {
 	struct jbuf *jbuf;
 
 	const struct aucodec *ac;
+	struct mcmix_src *mix;
 
-	struct tmr timeout;
+	uint64_t last_seen;
 
 	enum state state;
 	bool muted;
@@ -77,11 +80,11 @@ static void mcreceiver_destructor(void *arg)
 {
 	struct mcreceiver *mcreceiver = arg;
 
-	tmr_cancel(&mcreceiver->timeout);
-
-	if (mcreceiver->state == RUNNING)
+	if (mcreceiver->state == RUNNING && !mcreceiver->mix)
 		mcplayer_stop();
 
+	mcreceiver->mix = mem_deref(mcreceiver->mix);
+
 	mcreceiver->ssrc = 0;
 
 	mcreceiver->rtp  = mem_deref(mcreceiver->rtp);
@@ -202,6 +205,54 @@ static void resume_uag_state(void)
 }
 
 
+/**
+ * Stop playing the stream of a multicast receiver and flush its jbuf
+ *
+ * @param mcreceiver Multicast receiver object
+ */
+static void play_stop(struct mcreceiver *mcreceiver)
+{
+	if (mcreceiver->mix)
+		mcreceiver->mix = mem_deref(mcreceiver->mix);
+	else
+		mcplayer_stop();
+
+	jbuf_flush(mcreceiver->jbuf);
+}
+
+
+/**
+ * Hold all calls and block new calls for a multicast with a higher
+ * priority than calls
+ */
+static void uag_prio_hold(void)
+{
+	struct le *leua;
+	struct ua *ua;
+
+	uag_set_dnd(true);
+	uag_set_nodial(true);
+
+	for (leua = list_head(uag_list()); leua; leua = leua->next) {
+		struct le *lecall;
+		ua = leua->data;
+		lecall = list_head(ua_calls(ua));
+		while (lecall) {
+			struct call *call = lecall->data;
+			lecall = lecall->next;
+
+			if (call_state(call) != CALL_STATE_ESTABLISHED) {
+				ua_hangup(ua, call, 0, NULL);
+				continue;
+			}
+
+			if (!call_is_onhold(call))
+				call_hold(call, true);
+		}
+	}
+}
+
+
 /**
  * Stops, flush, start player
  *
@@ -269,30 +320,7 @@ static int prio_handling(struct mcreceiver *mcreceiver, uint32_t ssrc)
 		goto out;
 	}
 	else if (mcreceiver->prio < multicast_callprio()) {
-		struct le *leua;
-		struct ua *ua;
-
-		uag_set_dnd(true);
-		uag_set_nodial(true);
-
-		for (leua = list_head(uag_list()); leua; leua = leua->next) {
-			struct le *lecall;
-			ua = leua->data;
-			lecall = list_head(ua_calls(ua));
-			while (lecall) {
-				struct call *call = lecall->data;
-				lecall = lecall->next;
-
-				if (call_state(call) !=
-					CALL_STATE_ESTABLISHED) {
-					ua_hangup(ua, call, 0, NULL);
-					continue;
-				}
-
-				if (!call_is_onhold(call))
-					call_hold(call, true);
-			}
-		}
+		uag_prio_hold();
 	}
 
 	le = list_apply(&mcreceivl, true, mcreceiver_running, NULL);
@@ -368,14 +396,73 @@ static int prio_handling(struct mcreceiver *mcreceiver, uint32_t ssrc)
 }
 
 
+/**
+ * Multicast mix handling, all enabled receivers are played at once
+ *
+ * @param mcreceiver Multicast receiver object
+ *
+ * @return int 0 if success, errorcode otherwise
+ */
+static int mix_handling(struct mcreceiver *mcreceiver)
+{
+	int err = 0;
+
+	err = mtx_trylock(&mcreceivl_lock) != thrd_success;
+	if (err)
+		return ENOMEM;
+
+	if (mcreceiver->state == LISTENING)
+		mcreceiver->state = RECEIVING;
+
+	if (!mcreceiver->enable || mcreceiver->state == IGNORED) {
+		err = ECANCELED;
+		goto out;
+	}
+
+	if (mcreceiver->prio >= multicast_callprio() && uag_call_count()) {
+		if (mcreceiver->state == RUNNING) {
+			mcreceiver->state = RECEIVING;
+			play_stop(mcreceiver);
+		}
+
+		goto out;
+	}
+	else if (mcreceiver->prio < multicast_callprio()) {
+		uag_prio_hold();
+	}
+
+	if (mcreceiver->state == RUNNING)
+		goto out;
+
+	err = mcmixer_src_alloc(&mcreceiver->mix, mcreceiver->prio);
+	if (err)
+		goto out;
+
+	mcmixer_src_mute(mcreceiver->mix, mcreceiver->muted);
+	mcreceiver->state = RUNNING;
+
+	info ("multicast receiver: start addr=%J prio=%d enabled=%d "
+		"state=%s (mix)\n", &mcreceiver->addr, mcreceiver->prio,
+		mcreceiver->enable, state_str(mcreceiver->state));
+
+	module_event("multicast", "receiver start", NULL, NULL,
+		"addr=%J prio=%d enabled=%d state=%s",
+		&mcreceiver->addr, mcreceiver->prio, mcreceiver->enable,
+		state_str(mcreceiver->state));
+
+  out:
+	mtx_unlock(&mcreceivl_lock);
+	return err;
+}
+
+
 /**
  * RTP timeout handler
  *
- * @param arg Multicast receiver object
+ * @param mcreceiver Multicast receiver object
  */
-static void timeout_handler(void *arg)
+static void timeout_handler(struct mcreceiver *mcreceiver)
 {
-	struct mcreceiver *mcreceiver = arg;
 	info ("multicast receiver: EOS addr=%J prio=%d enabled=%d state=%s\n",
 		&mcreceiver->addr, mcreceiver->prio, mcreceiver->enable,
 		state_str(mcreceiver->state));
@@ -386,10 +473,8 @@ static void timeout_handler(void *arg)
 		state_str(mcreceiver->state));
 
 	mtx_lock(&mcreceivl_lock);
-	if (mcreceiver->state == RUNNING) {
-		mcplayer_stop();
-		jbuf_flush(mcreceiver->jbuf);
-	}
+	if (mcreceiver->state == RUNNING)
+		play_stop(mcreceiver);
 
 	mcreceiver->state = LISTENING;
 	mcreceiver->muted = false;
@@ -402,6 +487,32 @@ static void timeout_handler(void *arg)
 }
 
 
+/**
+ * Sweep timer handler, checks all receivers for an RTP timeout
+ *
+ * @param arg Unused
+ */
+static void sweep_handler(void *arg)
+{
+	uint64_t now = tmr_jiffies();
+	struct le *le;
+	(void) arg;
+
+	tmr_start(&sweep_tmr, SWEEP_INTERVAL, sweep_handler, NULL);
+
+	LIST_FOREACH(&mcreceivl, le) {
+		struct mcreceiver *mcreceiver = le->data;
+
+		if (!mcreceiver->last_seen ||
+		    now - mcreceiver->last_seen < TIMEOUT)
+			continue;
+
+		mcreceiver->last_seen = 0;
+		timeout_handler(mcreceiver);
+	}
+}
+
+
 /**
  * Decode RTP packet
  *
@@ -418,7 +529,11 @@ static int player_decode(struct mcreceiver *mcreceiver)
 	if (jerr && jerr != EAGAIN)
 		return jerr;
 
-	err = mcplayer_decode(&hdr, mb, jerr == EAGAIN);
+	if (mcreceiver->mix)
+		err = mcmixer_decode(mcreceiver->mix, mcreceiver->ac, &hdr,
+			mb, jerr == EAGAIN);
+	else
+		err = mcplayer_decode(&hdr, mb, jerr == EAGAIN);
 	mb = mem_deref(mb);
 	if (err)
 		return err;
@@ -451,12 +566,16 @@ static void rtp_handler(const struct sa *src, const struct rtp_header *hdr,
 	if (!mbuf_get_left(mb))
 		goto out;
 
-	err = prio_handling(mcreceiver, hdr->ssrc);
+	if (multicast_mix())
+		err = mix_handling(mcreceiver);
+	else
+		err = prio_handling(mcreceiver, hdr->ssrc);
 	if (err)
 		goto out;
 
 	if (mcreceiver->state == RUNNING) {
-		if (mcreceiver->muted && mcplayer_fadeout_done()) {
+		if (!mcreceiver->mix && mcreceiver->muted &&
+		    mcplayer_fadeout_done()) {
 			mcplayer_stop();
 			jbuf_flush(mcreceiver->jbuf);
 			goto out;
@@ -472,7 +591,7 @@ static void rtp_handler(const struct sa *src, const struct rtp_header *hdr,
 	}
 
   out:
-	tmr_start(&mcreceiver->timeout, TIMEOUT, timeout_handler, mcreceiver);
+	mcreceiver->last_seen = tmr_jiffies();
 
 	return;
 }
@@ -531,8 +650,7 @@ void mcreceiver_enprio(uint32_t prio)
 
 			if (mcreceiver->state == RUNNING) {
 				mcreceiver->state = RECEIVING;
-				mcplayer_stop();
-				jbuf_flush(mcreceiver->jbuf);
+				play_stop(mcreceiver);
 			}
 		}
 	}
@@ -574,8 +692,7 @@ void mcreceiver_enrangeprio(uint32_t priol, uint32_t prioh, bool en)
 					mcreceiver->enable,
 					state_str(mcreceiver->state));
 
-				mcplayer_stop();
-				jbuf_flush(mcreceiver->jbuf);
+				play_stop(mcreceiver);
 			}
 		}
 	}
@@ -609,6 +726,7 @@ void mcreceiver_enable(bool enable)
 				mcreceiver->enable,
 				state_str(mcreceiver->state));
 		}
+		mcreceiver->mix = mem_deref(mcreceiver->mix);
 		jbuf_flush(mcreceiver->jbuf);
 	}
 
@@ -649,6 +767,7 @@ int mcreceiver_chprio(struct sa *addr, uint32_t prio)
 	mcreceiver = le->data;
 	mtx_lock(&mcreceivl_lock);
 	mcreceiver->prio = prio;
+	mcmixer_src_set_prio(mcreceiver->mix, prio);
 	mtx_unlock(&mcreceivl_lock);
 	resume_uag_state();
 	return 0;
@@ -685,8 +804,7 @@ int mcreceiver_prioignore(uint32_t prio)
 	switch (mcreceiver->state) {
 		case RUNNING:
 			mcreceiver->state = IGNORED;
-			mcplayer_stop();
-			jbuf_flush(mcreceiver->jbuf);
+			play_stop(mcreceiver);
 			break;
 		case RECEIVING:
 			mcreceiver->state = IGNORED;
@@ -729,7 +847,10 @@ int mcreceiver_mute(uint32_t prio)
 	mcreceiver = le->data;
 	mtx_lock(&mcreceivl_lock);
 	mcreceiver->muted = !mcreceiver->muted;
-	if (mcreceiver->state == RUNNING) {
+	if (mcreceiver->mix) {
+		mcmixer_src_mute(mcreceiver->mix, mcreceiver->muted);
+	}
+	else if (mcreceiver->state == RUNNING) {
 		if (mcreceiver->muted) {
 			mcplayer_fadeout();
 		}
@@ -750,6 +871,8 @@ int mcreceiver_mute(uint32_t prio)
  */
 void mcreceiver_unregall(void)
 {
+	tmr_cancel(&sweep_tmr);
+
 	mtx_lock(&mcreceivl_lock);
 	list_flush(&mcreceivl);
 	mtx_unlock(&mcreceivl_lock);
@@ -780,8 +903,10 @@ void mcreceiver_unreg(struct sa *addr){
 	mem_deref(mcreceiver);
 	resume_uag_state();
 
-	if (list_isempty(&mcreceivl))
+	if (list_isempty(&mcreceivl)) {
+		tmr_cancel(&sweep_tmr);
 		mtx_destroy(&mcreceivl_lock);
+	}
 }
 
 
@@ -872,6 +997,9 @@ int mcreceiver_alloc(struct sa *addr, uint8_t prio)
 	list_append(&mcreceivl, &mcreceiver->le, mcreceiver);
 	mtx_unlock(&mcreceivl_lock);
 
+	if (!tmr_isrunning(&sweep_tmr))
+		tmr_start(&sweep_tmr, SWEEP_INTERVAL, sweep_handler, NULL);
+
   out:
 	if (err)
 		mem_deref(mcreceiver);
@@ -894,8 +1022,9 @@ void mcreceiver_print(struct re_printf *pf)
 	LIST_FOREACH(&mcreceivl, le) {
 		mcreceiver = le->data;
 		re_hprintf(pf, "   addr=%J prio=%d enabled=%d muted=%d "
-			"state=%s\n", &mcreceiver->addr, mcreceiver->prio,
+			"state=%s%s\n", &mcreceiver->addr, mcreceiver->prio,
 			mcreceiver->enable, mcreceiver->muted,
-			state_str(mcreceiver->state));
+			state_str(mcreceiver->state),
+			mcreceiver->mix ? " (mix)" : "");
 	}
 }
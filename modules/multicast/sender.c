@@ -21,6 +21,24 @@
 
 
 static struct list mcsenderl = LIST_INIT;
+static struct list mcsharedl = LIST_INIT;
+
+
+/**
+ * Shared multicast source
+ *
+ * All senders with the same codec share one audio source and encoder.
+ * The encoded packets are sent to the RTP socket of every sender.
+ */
+struct mcshared {
+	struct le le;
+
+	const struct aucodec *ac;
+	struct mcsource *src;
+
+	mtx_t *lock;
+	struct list senderl;
+};
 
 
 /**
@@ -30,24 +48,43 @@ static struct list mcsenderl = LIST_INIT;
  */
 struct mcsender {
 	struct le le;
+	struct le sle;
 
 	struct sa addr;
 	struct rtp_sock *rtp;
+	uint8_t pt;
 
 	struct config_audio *cfg;
 	const struct aucodec *ac;
 
-	struct mcsource *src;
+	struct mcshared *shared;
 	bool enable;
 };
 
 
+static void mcshared_destructor(void *arg)
+{
+	struct mcshared *shared = arg;
+
+	list_unlink(&shared->le);
+
+	mcsource_stop(shared->src);
+	shared->src = mem_deref(shared->src);
+	shared->lock = mem_deref(shared->lock);
+}
+
+
 static void mcsender_destructor(void *arg)
 {
 	struct mcsender *mcsender = arg;
 
-	mcsource_stop(mcsender->src);
-	mcsender->src = mem_deref(mcsender->src);
+	if (mcsender->shared) {
+		mtx_lock(mcsender->shared->lock);
+		list_unlink(&mcsender->sle);
+		mtx_unlock(mcsender->shared->lock);
+	}
+
+	mcsender->shared = mem_deref(mcsender->shared);
 	mcsender->rtp = mem_deref(mcsender->rtp);
 }
 
@@ -71,7 +108,26 @@ static bool mcsender_addr_cmp(struct le *le, void *arg)
 
 
 /**
- * Multicast send handler
+ * Shared source codec comparison
+ *
+ * @param le  List element (mcshared)
+ * @param arg Argument     (audio codec)
+ *
+ * @return true if the shared source uses the codec
+ */
+static bool mcshared_codec_cmp(struct le *le, void *arg)
+{
+	struct mcshared *shared = le->data;
+
+	return shared->ac == arg;
+}
+
+
+/**
+ * Multicast send handler, sends the encoded packet to all enabled senders
+ * of the shared source
+ *
+ * @note This function has REAL-TIME properties
  *
  * @param ext_len RTP extension header Length
  * @param marker  RTP marker
@@ -82,27 +138,96 @@ static bool mcsender_addr_cmp(struct le *le, void *arg)
 static int mcsender_send_handler(size_t ext_len, bool marker,
 	uint32_t rtp_ts, struct mbuf *mb, void *arg)
 {
-	struct mcsender *mcsender = arg;
-	struct pl placpt = PL_INIT;
+	struct mcshared *shared = arg;
+	size_t pos;
+	uint64_t jfs;
+	struct le *le;
 	int err = 0;
 
 	if (!mb)
 		return EINVAL;
 
-	if (!mcsender->enable)
+	if (uag_call_count())
 		return 0;
 
-	if (uag_call_count())
+	pos = mb->pos;
+	jfs = tmr_jiffies_rt_usec();
+
+	mtx_lock(shared->lock);
+
+	LIST_FOREACH(&shared->senderl, le) {
+		struct mcsender *mcsender = le->data;
+
+		if (!mcsender->enable)
+			continue;
+
+		/* each sender writes its own RTP header */
+		mb->pos = pos;
+		err |= rtp_send(mcsender->rtp, &mcsender->addr, ext_len != 0,
+			marker, mcsender->pt, rtp_ts, jfs, mb);
+	}
+
+	mtx_unlock(shared->lock);
+
+	return err;
+}
+
+
+/**
+ * Get the shared source for a codec, start it if needed
+ *
+ * @param sharedp Pointer to shared source, referenced
+ * @param codec   Audio codec
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+static int mcshared_get(struct mcshared **sharedp, const struct aucodec *codec)
+{
+	struct mcshared *shared;
+	struct le *le;
+	int err;
+
+	le = list_apply(&mcsharedl, true, mcshared_codec_cmp, (void *)codec);
+	if (le) {
+		*sharedp = mem_ref(le->data);
 		return 0;
+	}
 
-	pl_set_str(&placpt, mcsender->ac->pt);
-	err = rtp_send(mcsender->rtp, &mcsender->addr, ext_len != 0, marker,
-		pl_u32(&placpt), rtp_ts, tmr_jiffies_rt_usec(), mb);
+	shared = mem_zalloc(sizeof(*shared), mcshared_destructor);
+	if (!shared)
+		return ENOMEM;
+
+	shared->ac = codec;
+
+	err = mutex_alloc(&shared->lock);
+	if (err)
+		goto out;
+
+	err = mcsource_start(&shared->src, codec,
+		mcsender_send_handler, shared);
+	if (err)
+		goto out;
+
+	list_append(&mcsharedl, &shared->le, shared);
+
+  out:
+	if (err)
+		mem_deref(shared);
+	else
+		*sharedp = shared;
 
 	return err;
 }
 
 
+static void mcsender_set_enable(struct mcsender *mcsender, bool enable)
+{
+	mtx_lock(mcsender->shared->lock);
+	mcsender->enable = enable;
+	mtx_unlock(mcsender->shared->lock);
+}
+
+
 /**
  * Enable / Disable all existing sender
  *
@@ -111,12 +236,34 @@ static int mcsender_send_handler(size_t ext_len, bool marker,
 void mcsender_enable(bool enable)
 {
 	struct le *le;
-	struct mcsender *mcsender;
 
-	LIST_FOREACH(&mcsenderl, le) {
-		mcsender = le->data;
-		mcsender->enable = enable;
+	LIST_FOREACH(&mcsenderl, le)
+		mcsender_set_enable(le->data, enable);
+}
+
+
+/**
+ * Enable / Disable the multicast sender with addr. The shared source
+ * keeps running for the other senders.
+ *
+ * @param addr   Address
+ * @param enable True to enable, false to mute
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int mcsender_enable_addr(struct sa *addr, bool enable)
+{
+	struct le *le;
+
+	le = list_apply(&mcsenderl, true, mcsender_addr_cmp, addr);
+	if (!le) {
+		warning ("multicast: multicast sender %J not found\n", addr);
+		return ENOENT;
 	}
+
+	mcsender_set_enable(le->data, enable);
+
+	return 0;
 }
 
 
@@ -179,6 +326,7 @@ int mcsender_alloc(struct sa *addr, const struct aucodec *codec)
 	sa_cpy(&mcsender->addr, addr);
 	mcsender->ac = codec;
 	mcsender->enable = true;
+	mcsender->pt = atoi(codec->pt);
 
 	err = rtp_open(&mcsender->rtp, sa_af(&mcsender->addr));
 	if (err)
@@ -192,8 +340,13 @@ int mcsender_alloc(struct sa *addr, const struct aucodec *codec)
 			IP_MULTICAST_TTL, &ttl, sizeof(ttl));
 	}
 
-	err = mcsource_start(&mcsender->src, mcsender->ac,
-		mcsender_send_handler, mcsender);
+	err = mcshared_get(&mcsender->shared, mcsender->ac);
+	if (err)
+		goto out;
+
+	mtx_lock(mcsender->shared->lock);
+	list_append(&mcsender->shared->senderl, &mcsender->sle, mcsender);
+	mtx_unlock(mcsender->shared->lock);
 
 	list_append(&mcsenderl, &mcsender->le, mcsender);
 
@@ -218,8 +371,9 @@ void mcsender_print(struct re_printf *pf)
 	re_hprintf(pf, "Multicast Sender List:\n");
 	LIST_FOREACH(&mcsenderl, le) {
 		mcsender = le->data;
-		re_hprintf(pf, "   %J - %s%s\n", &mcsender->addr,
-			mcsender->ac->name,
-			mcsender->enable ? " (enabled)" : " (disabled)");
+		re_hprintf(pf, "   %J - %s%s (shared by %u)\n",
+			&mcsender->addr, mcsender->ac->name,
+			mcsender->enable ? " (enabled)" : " (disabled)",
+			list_count(&mcsender->shared->senderl));
 	}
 }
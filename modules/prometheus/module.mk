@@ -0,0 +1,10 @@
+#
+# module.mk
+#
+# Copyright (C) 2023 Alfred E. Heggestad
+#
+
+MOD		:= prometheus
+$(MOD)_SRCS	+= prometheus.c
+
+include mk/mod.mk
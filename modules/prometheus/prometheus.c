@@ -0,0 +1,108 @@
+/**
+ * @file prometheus.c Prometheus metrics exporter
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <re.h>
+#include <baresip.h>
+
+
+/**
+ * @defgroup prometheus prometheus
+ *
+ * Prometheus metrics exporter
+ *
+ * Serves the global call, registration and RTP counters in the
+ * Prometheus text exposition format (version 0.0.4), to be scraped by
+ * a Prometheus server:
+ *
+ \verbatim
+  http://127.0.0.1:9091/metrics
+ \endverbatim
+ *
+ * The counters are kept by the core, so a scrape only formats them and
+ * does not walk the calls or streams.
+ *
+ * The following options can be configured:
+ *
+ \verbatim
+  prometheus_listen   0.0.0.0:9091      # IP-address and port to listen on
+ \endverbatim
+ */
+
+enum {PROMETHEUS_PORT = 9091};
+
+static struct http_sock *httpsock;
+
+
+static void http_req_handler(struct http_conn *conn,
+			     const struct http_msg *msg, void *arg)
+{
+	struct mbuf *mb;
+	int err;
+	(void)arg;
+
+	if (0 != pl_strcasecmp(&msg->path, "/metrics")) {
+		http_ereply(conn, 404, "Not Found");
+		return;
+	}
+
+	mb = mbuf_alloc(8192);
+	if (!mb) {
+		http_ereply(conn, 500, "Internal Server Error");
+		return;
+	}
+
+	err = mbuf_printf(mb, "%H", stats_prometheus, NULL);
+	if (err) {
+		http_ereply(conn, 500, "Internal Server Error");
+		goto out;
+	}
+
+	http_reply(conn, 200, "OK",
+		   "Content-Type: text/plain; version=0.0.4;"
+		   " charset=utf-8\r\n"
+		   "Content-Length: %zu\r\n"
+		   "\r\n"
+		   "%b",
+		   mb->end,
+		   mb->buf, mb->end);
+
+ out:
+	mem_deref(mb);
+}
+
+
+static int module_init(void)
+{
+	struct sa laddr;
+	int err;
+
+	if (conf_get_sa(conf_cur(), "prometheus_listen", &laddr)) {
+		sa_set_str(&laddr, "0.0.0.0", PROMETHEUS_PORT);
+	}
+
+	err = http_listen(&httpsock, &laddr, http_req_handler, NULL);
+	if (err)
+		return err;
+
+	info("prometheus: listening on %J\n", &laddr);
+
+	return 0;
+}
+
+
+static int module_close(void)
+{
+	httpsock = mem_deref(httpsock);
+
+	return 0;
+}
+
+
+EXPORT_SYM const struct mod_export DECL_EXPORTS(prometheus) = {
+	"prometheus",
+	"application",
+	module_init,
+	module_close,
+};
@@ -224,7 +224,7 @@ static int encode_pip(struct vidfilt_enc_st *st, struct vidframe *frame,
 		err = vidframe_alloc(&selfview->frame, VID_FMT_YUV420P, &sz);
 	}
 	if (!err)
-		vidconv(selfview->frame, frame, NULL);
+		vidscale(selfview->frame, frame, NULL);
 	mtx_unlock(&selfview->lock);
 
 	return err;
@@ -256,7 +256,7 @@ static int decode_pip(struct vidfilt_dec_st *st, struct vidframe *frame,
 		else
 			rect.y = frame->size.h/2;
 
-		vidconv(frame, sv->frame, &rect);
+		vidscale(frame, sv->frame, &rect);
 
 		vidframe_draw_rect(frame, rect.x, rect.y, rect.w, rect.h,
 				   127, 127, 127);
@@ -0,0 +1,115 @@
+/**
+ * @file jpg_vf.c  Write vidframe to a JPEG-file
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <stdio.h>
+#include <string.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "jpg_vf.h"
+
+
+struct jpg_error {
+	struct jpeg_error_mgr mgr;
+	jmp_buf jmp;
+};
+
+
+/* The default handler calls exit() */
+static void error_exit(j_common_ptr cinfo)
+{
+	struct jpg_error *jerr = (struct jpg_error *)cinfo->err;
+
+	longjmp(jerr->jmp, 1);
+}
+
+
+int jpg_save_vidframe(const struct vidframe *vf, const char *path,
+		      int quality)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpg_error jerr;
+	struct vidframe *f2 = NULL;
+	JSAMPROW row = NULL;
+	FILE *fp = NULL;
+	unsigned width  = vf->size.w & ~1;
+	unsigned height = vf->size.h & ~1;
+	unsigned x;
+	int err = 0;
+
+	memset(&cinfo, 0, sizeof(cinfo));
+
+	if (vf->fmt != VID_FMT_RGB32) {
+
+		err = vidframe_alloc(&f2, VID_FMT_RGB32, &vf->size);
+		if (err)
+			goto out;
+
+		vidconv(f2, vf, NULL);
+		vf = f2;
+	}
+
+	row = mem_alloc(width * 3, NULL);
+	if (!row) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	fp = fopen(path, "wb");
+	if (fp == NULL) {
+		err = errno;
+		goto out;
+	}
+
+	cinfo.err = jpeg_std_error(&jerr.mgr);
+	jerr.mgr.error_exit = error_exit;
+
+	if (setjmp(jerr.jmp)) {
+		err = EIO;
+		goto out;
+	}
+
+	jpeg_create_compress(&cinfo);
+	jpeg_stdio_dest(&cinfo, fp);
+
+	cinfo.image_width      = width;
+	cinfo.image_height     = height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space   = JCS_RGB;
+
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, quality, TRUE);
+	jpeg_start_compress(&cinfo, TRUE);
+
+	while (cinfo.next_scanline < cinfo.image_height) {
+
+		const uint8_t *p = vf->data[0] +
+			cinfo.next_scanline * vf->linesize[0];
+
+		/* B G R A in memory */
+		for (x = 0; x < width; ++x) {
+			row[3*x]     = p[4*x + 2];
+			row[3*x + 1] = p[4*x + 1];
+			row[3*x + 2] = p[4*x];
+		}
+
+		(void)jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+
+	jpeg_finish_compress(&cinfo);
+
+	debug("jpeg: wrote %s\n", path);
+
+ out:
+	jpeg_destroy_compress(&cinfo);
+	if (fp)
+		fclose(fp);
+	mem_deref(row);
+	mem_deref(f2);
+
+	return err;
+}
@@ -0,0 +1,7 @@
+/**
+ * @file jpg_vf.h
+ */
+
+
+int jpg_save_vidframe(const struct vidframe *vf, const char *path,
+		      int quality);
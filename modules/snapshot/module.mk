@@ -11,4 +11,10 @@ $(MOD)_CFLAGS	+= -Wno-clobbered
 endif
 $(MOD)_LFLAGS	+= -lpng
 
+ifneq ($(USE_JPEG),)
+$(MOD)_SRCS	+= jpg_vf.c
+$(MOD)_CFLAGS	+= -DUSE_JPEG=1
+$(MOD)_LFLAGS	+= -ljpeg
+endif
+
 include mk/mod.mk
@@ -121,8 +121,6 @@ int png_save_vidframe(const struct vidframe *vf, const char *path)
 
 	info("png: wrote %s\n", path);
 
-	module_event("snapshot", "wrote", NULL, NULL, path);
-
  out:
 	/* Finish writing. */
 	mem_deref(f2);
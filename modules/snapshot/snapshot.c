@@ -3,18 +3,31 @@
  *
  * Copyright (C) 2010 Alfred E. Heggestad
  */
+#include <stdio.h>
 #include <string.h>
 #include <re.h>
+#include <re_atomic.h>
 #include <rem.h>
 #include <baresip.h>
 #include "png_vf.h"
+#ifdef USE_JPEG
+#include "jpg_vf.h"
+#endif
 #include <time.h>
 
 /**
  * @defgroup snapshot snapshot
  *
- * Take snapshot of the video stream and save it as PNG-files
+ * Take snapshot of the video stream and save it as PNG or JPEG files
  *
+ * The video filter only copies the frame into a pooled buffer, the image
+ * is compressed and written in a background thread. If the writer cannot
+ * keep up, new snapshots are dropped when the queue is full.
+ *
+ * With a snapshot interval, a snapshot of every video stream is written
+ * periodically to the same file, e.g. to show thumbnails of all calls.
+ * The files are named snapshot-<n>-recv.<ext> and snapshot-<n>-send.<ext>
+ * with one number per video stream, and replaced atomically.
  *
  * Commands:
  *
@@ -23,69 +36,614 @@
  snapshot_recv path Take snapshot of receiving video and save it to the path
  snapshot_send path Take snapshot of sending video and save it to the path
  \endverbatim
+ *
+ * Example config:
+ \verbatim
+  snapshot_interval       10          # Periodic snapshots [s], 0 is off
+  snapshot_format         jpeg        # {png,jpeg}
+  snapshot_path           /var/tmp
+  snapshot_queue          4
+  snapshot_jpeg_quality   75
+ \endverbatim
+ */
+
+
+enum snap_fmt {
+	SNAP_PNG,
+	SNAP_JPEG,
+};
+
+enum { PATH_SIZE = 256 };
+
+
+/* A snapshot that is queued or written, reused with its frame buffer */
+struct job {
+	struct le le;                  /**< Member of one of the job lists */
+	struct vidframe *frame;        /**< Pooled copy of the video frame */
+	const struct video *vid;       /**< Only compared, not accessed    */
+	enum snap_fmt fmt;
+	char path[PATH_SIZE];
+	int err;
+};
+
+/* Snapshot requested by a command */
+struct request {
+	RE_ATOMIC bool pending;
+	enum snap_fmt fmt;             /**< Protected by snap.mtx          */
+	char path[PATH_SIZE];          /**< Protected by snap.mtx          */
+};
+
+/* Periodic snapshots of one video stream */
+struct periodic {
+	struct le le;                  /**< Member of snap.perl            */
+	const struct video *vid;
+	unsigned idx;
+	uint64_t next;                 /**< Only used in the filter thread */
+	char path[PATH_SIZE];
+};
+
+struct enc_st {
+	struct vidfilt_enc_st vf;      /**< Inheritance                    */
+	struct periodic per;
+};
+
+struct dec_st {
+	struct vidfilt_dec_st vf;      /**< Inheritance                    */
+	struct periodic per;
+};
+
+
+static struct {
+	mtx_t mtx;                     /**< Protects the job lists and n   */
+	cnd_t cnd;                     /**< Signals a new job              */
+	thrd_t thread;
+	bool run;
+	struct list jobl;              /**< Jobs waiting for the writer    */
+	struct list donel;             /**< Written jobs, to be reported   */
+	struct list freel;             /**< Pool of unused jobs            */
+	unsigned n;                    /**< Jobs not in the pool           */
+	uint64_t dropped;
+	struct mqueue *mq;
+	struct request req_enc;
+	struct request req_dec;
+	struct list perl;              /**< Periodic states, main thread   */
+	unsigned idx;
+
+	/* config */
+	uint32_t interval;
+	uint32_t queue_max;
+	uint32_t quality;
+	enum snap_fmt fmt;
+	char dir[PATH_SIZE];
+} snap = {
+	.queue_max = 4,
+	.quality   = 75,
+	.fmt       = SNAP_PNG,
+	.dir       = ".",
+};
+
+
+static const char *fmt_ext(enum snap_fmt fmt)
+{
+	return fmt == SNAP_JPEG ? "jpg" : "png";
+}
+
+
+static bool fmt_supported(enum snap_fmt fmt)
+{
+#ifdef USE_JPEG
+	(void)fmt;
+	return true;
+#else
+	return fmt != SNAP_JPEG;
+#endif
+}
+
+
+static enum snap_fmt path_fmt(const char *path)
+{
+	const char *ext = strrchr(path, '.');
+
+	if (ext && (0 == str_casecmp(ext, ".jpg") ||
+		    0 == str_casecmp(ext, ".jpeg")))
+		return SNAP_JPEG;
+
+	return SNAP_PNG;
+}
+
+
+static void job_destructor(void *arg)
+{
+	struct job *job = arg;
+
+	mem_deref(job->frame);
+}
+
+
+/*
+ * Copy the frame into a pooled job and queue it for the writer.
+ * Called in the thread of the video filter.
  */
+static int job_put(const struct vidframe *frame, const struct video *vid,
+		   enum snap_fmt fmt, const char *path)
+{
+	struct job *job = NULL;
+	struct le *le;
+	int err = 0;
+
+	mtx_lock(&snap.mtx);
+
+	if (snap.n >= snap.queue_max) {
+		++snap.dropped;
+		mtx_unlock(&snap.mtx);
+		debug("snapshot: queue full, dropped %s\n", path);
+		return EOVERFLOW;
+	}
+
+	for (le = snap.freel.head; le; le = le->next) {
+		struct job *j = le->data;
+
+		if (j->frame->fmt == frame->fmt &&
+		    vidsz_cmp(&j->frame->size, &frame->size)) {
+			job = j;
+			break;
+		}
+	}
+
+	/* no matching buffer, recycle any job */
+	if (!job)
+		job = list_ledata(list_head(&snap.freel));
+
+	if (job)
+		list_unlink(&job->le);
+
+	++snap.n;
+
+	mtx_unlock(&snap.mtx);
+
+	if (!job) {
+		job = mem_zalloc(sizeof(*job), job_destructor);
+		if (!job) {
+			err = ENOMEM;
+			goto out;
+		}
+	}
+
+	if (!job->frame || job->frame->fmt != frame->fmt ||
+	    !vidsz_cmp(&job->frame->size, &frame->size)) {
+
+		job->frame = mem_deref(job->frame);
+
+		err = vidframe_alloc(&job->frame, frame->fmt, &frame->size);
+		if (err)
+			goto out;
+	}
+
+	vidframe_copy(job->frame, frame);
+
+	job->vid = vid;
+	job->fmt = fmt;
+	job->err = 0;
+	str_ncpy(job->path, path, sizeof(job->path));
+
+ out:
+	mtx_lock(&snap.mtx);
+
+	if (err) {
+		--snap.n;
+		mem_deref(job);
+	}
+	else {
+		list_append(&snap.jobl, &job->le, job);
+		cnd_signal(&snap.cnd);
+	}
+
+	mtx_unlock(&snap.mtx);
+
+	return err;
+}
+
+
+/* Write to a temporary file first, so that readers never see a partial
+ * image when a periodic snapshot replaces the previous one */
+static int job_write(const struct job *job)
+{
+	char tmp[PATH_SIZE + 4];
+	int err;
+
+	re_snprintf(tmp, sizeof(tmp), "%s.tmp", job->path);
+
+#ifdef USE_JPEG
+	if (job->fmt == SNAP_JPEG)
+		err = jpg_save_vidframe(job->frame, tmp, (int)snap.quality);
+	else
+#endif
+		err = png_save_vidframe(job->frame, tmp);
+
+	if (err) {
+		(void)remove(tmp);
+		return err;
+	}
+
+#ifdef WIN32
+	(void)remove(job->path);
+#endif
+	if (rename(tmp, job->path)) {
+		err = errno;
+		(void)remove(tmp);
+	}
+
+	return err;
+}
+
+
+static int writer_thread(void *arg)
+{
+	(void)arg;
+
+	mtx_lock(&snap.mtx);
+
+	/* pending snapshots are written before the thread exits */
+	for (;;) {
+		struct job *job = list_ledata(list_head(&snap.jobl));
+
+		if (!job) {
+			if (!snap.run)
+				break;
+
+			cnd_wait(&snap.cnd, &snap.mtx);
+			continue;
+		}
+
+		list_unlink(&job->le);
+		mtx_unlock(&snap.mtx);
+
+		job->err = job_write(job);
+
+		mtx_lock(&snap.mtx);
+		list_append(&snap.donel, &job->le, job);
+		(void)mqueue_push(snap.mq, 0, NULL);
+	}
+
+	mtx_unlock(&snap.mtx);
+
+	return 0;
+}
+
+
+struct wrote_event {
+	const struct video *vid;
+	const char *path;
+	bool sent;
+};
+
+
+/* The event is sent in the thread of the call */
+static void wrote_handler(void *arg)
+{
+	struct wrote_event *we = arg;
+	struct le *le, *lec;
+
+	for (le = list_head(uag_list()); le && !we->sent; le = le->next) {
+
+		for (lec = list_head(ua_calls(le->data)); lec;
+		     lec = lec->next) {
+
+			struct call *call = lec->data;
+
+			if (call_video(call) != we->vid)
+				continue;
+
+			module_event("snapshot", "wrote", call_get_ua(call),
+				     call, "%s", we->path);
+			we->sent = true;
+			break;
+		}
+	}
+}
+
+
+static void wrote_event(const struct video *vid, const char *path)
+{
+	struct wrote_event we = {vid, path, false};
+
+	if (shard_current())
+		wrote_handler(&we);
+	else
+		(void)shard_exec_all(wrote_handler, &we);
+
+	if (!we.sent)
+		module_event("snapshot", "wrote", NULL, NULL, "%s", path);
+}
+
+
+/* Report the written snapshots in the main thread */
+static void mqueue_handler(int id, void *data, void *arg)
+{
+	struct le *le;
+	(void)id;
+	(void)data;
+	(void)arg;
+
+	mtx_lock(&snap.mtx);
+
+	while ((le = list_head(&snap.donel))) {
+		struct job *job = le->data;
+		const struct video *vid = job->vid;
+		char path[PATH_SIZE];
+		int err = job->err;
+
+		str_ncpy(path, job->path, sizeof(path));
+
+		list_unlink(&job->le);
+		list_append(&snap.freel, &job->le, job);
+		--snap.n;
+
+		mtx_unlock(&snap.mtx);
+
+		if (err) {
+			warning("snapshot: could not write %s (%m)\n",
+				path, err);
+		}
+		else {
+			wrote_event(vid, path);
+		}
+
+		mtx_lock(&snap.mtx);
+	}
+
+	mtx_unlock(&snap.mtx);
+}
+
+
+static int request_set(struct request *req, const char *path)
+{
+	enum snap_fmt fmt = path_fmt(path);
+	int err = 0;
+
+	if (!fmt_supported(fmt))
+		return ENOTSUP;
+
+	mtx_lock(&snap.mtx);
+
+	if (re_atomic_rlx(&req->pending)) {
+		err = EALREADY;
+	}
+	else {
+		str_ncpy(req->path, path, sizeof(req->path));
+		req->fmt = fmt;
+		re_atomic_rlx_set(&req->pending, true);
+	}
+
+	mtx_unlock(&snap.mtx);
+
+	return err;
+}
+
+
+static void request_handle(struct request *req, const struct vidframe *frame,
+			   const struct video *vid)
+{
+	enum snap_fmt fmt = SNAP_PNG;
+	char path[PATH_SIZE];
+	bool pending;
+
+	if (!re_atomic_rlx(&req->pending))
+		return;
+
+	mtx_lock(&snap.mtx);
+
+	pending = re_atomic_rlx(&req->pending);
+	if (pending) {
+		str_ncpy(path, req->path, sizeof(path));
+		fmt = req->fmt;
+		re_atomic_rlx_set(&req->pending, false);
+	}
+
+	mtx_unlock(&snap.mtx);
+
+	if (pending)
+		(void)job_put(frame, vid, fmt, path);
+}
+
+
+static void periodic_init(struct periodic *per, const struct video *vid,
+			  bool tx)
+{
+	struct le *le;
+
+	/* the send and receive filters of one stream share the number */
+	for (le = snap.perl.head; le; le = le->next) {
+		const struct periodic *p = le->data;
+
+		if (p->vid == vid) {
+			per->idx = p->idx;
+			break;
+		}
+	}
+
+	if (!per->idx)
+		per->idx = ++snap.idx;
+
+	per->vid = vid;
+
+	re_snprintf(per->path, sizeof(per->path), "%s/snapshot-%u-%s.%s",
+		    snap.dir, per->idx, tx ? "send" : "recv",
+		    fmt_ext(snap.fmt));
+
+	list_append(&snap.perl, &per->le, per);
+}
+
+
+static void periodic_handle(struct periodic *per,
+			    const struct vidframe *frame)
+{
+	uint64_t now;
+
+	if (!snap.interval)
+		return;
+
+	now = tmr_jiffies();
+	if (now < per->next)
+		return;
+
+	per->next = now + snap.interval * 1000ULL;
+
+	(void)job_put(frame, per->vid, snap.fmt, per->path);
+}
+
+
+static void enc_destructor(void *arg)
+{
+	struct enc_st *st = arg;
+
+	list_unlink(&st->vf.le);
+	list_unlink(&st->per.le);
+}
 
 
-static bool flag_enc, flag_dec;
-static char path_enc[100], path_dec[100];
+static void dec_destructor(void *arg)
+{
+	struct dec_st *st = arg;
+
+	list_unlink(&st->vf.le);
+	list_unlink(&st->per.le);
+}
+
+
+static int encode_update(struct vidfilt_enc_st **stp, void **ctx,
+			 const struct vidfilt *vf, struct vidfilt_prm *prm,
+			 const struct video *vid)
+{
+	struct enc_st *st;
+	(void)ctx;
+	(void)prm;
+
+	if (!stp || !vf)
+		return EINVAL;
+
+	if (*stp)
+		return 0;
 
-static char *png_filename(const struct tm *tmx, const char *name,
-			char *buf, unsigned int length);
+	st = mem_zalloc(sizeof(*st), enc_destructor);
+	if (!st)
+		return ENOMEM;
 
-static int encode(struct vidfilt_enc_st *st, struct vidframe *frame,
-			uint64_t *timestamp)
+	periodic_init(&st->per, vid, true);
+
+	*stp = (struct vidfilt_enc_st *)st;
+
+	return 0;
+}
+
+
+static int decode_update(struct vidfilt_dec_st **stp, void **ctx,
+			 const struct vidfilt *vf, struct vidfilt_prm *prm,
+			 const struct video *vid)
 {
-	(void)st;
+	struct dec_st *st;
+	(void)ctx;
+	(void)prm;
+
+	if (!stp || !vf)
+		return EINVAL;
+
+	if (*stp)
+		return 0;
+
+	st = mem_zalloc(sizeof(*st), dec_destructor);
+	if (!st)
+		return ENOMEM;
+
+	periodic_init(&st->per, vid, false);
+
+	*stp = (struct vidfilt_dec_st *)st;
+
+	return 0;
+}
+
+
+static int encode(struct vidfilt_enc_st *vst, struct vidframe *frame,
+		  uint64_t *timestamp)
+{
+	struct enc_st *st = (struct enc_st *)vst;
 	(void)timestamp;
 
 	if (!frame)
 		return 0;
 
-	if (flag_enc) {
-		flag_enc = false;
-		png_save_vidframe(frame, path_enc);
-	}
+	request_handle(&snap.req_enc, frame, st->per.vid);
+	periodic_handle(&st->per, frame);
 
 	return 0;
 }
 
 
-static int decode(struct vidfilt_dec_st *st, struct vidframe *frame,
-			uint64_t *timestamp)
+static int decode(struct vidfilt_dec_st *vst, struct vidframe *frame,
+		  uint64_t *timestamp)
 {
-	(void)st;
+	struct dec_st *st = (struct dec_st *)vst;
 	(void)timestamp;
 
 	if (!frame)
 		return 0;
 
-	if (flag_dec) {
-		flag_dec = false;
-		png_save_vidframe(frame, path_dec);
-	}
+	request_handle(&snap.req_dec, frame, st->per.vid);
+	periodic_handle(&st->per, frame);
 
 	return 0;
 }
 
 
+static char *snap_filename(const struct tm *tmx, const char *name,
+			   const char *ext, char *buf, unsigned int length)
+{
+	/*
+	 * -2013-03-03-15-22-56.png - 24 chars
+	 */
+	if (strlen(name) + strlen(ext) + 21 >= length) {
+		buf[0] = '\0';
+		return buf;
+	}
+
+	sprintf(buf, (tmx->tm_mon < 9 ? "%s-%d-0%d" : "%s-%d-%d"), name,
+					1900 + tmx->tm_year, tmx->tm_mon + 1);
+
+	sprintf(buf + strlen(buf), (tmx->tm_mday < 10 ? "-0%d" : "-%d"),
+					tmx->tm_mday);
+
+	sprintf(buf + strlen(buf), (tmx->tm_hour < 10 ? "-0%d" : "-%d"),
+					tmx->tm_hour);
+
+	sprintf(buf + strlen(buf), (tmx->tm_min < 10 ? "-0%d" : "-%d"),
+					tmx->tm_min);
+
+	sprintf(buf + strlen(buf), (tmx->tm_sec < 10 ? "-0%d.%s" : "-%d.%s"),
+					tmx->tm_sec, ext);
+
+	return buf;
+}
+
+
 static int do_snapshot(struct re_printf *pf, void *arg)
 {
+	char path_enc[100], path_dec[100];
+	const char *ext = fmt_ext(snap.fmt);
 	time_t tnow;
 	struct tm *tmx;
 
 	(void)pf;
 	(void)arg;
 
-	if (flag_enc || flag_dec)
-		return 0;
-
 	tnow = time(NULL);
 	tmx = localtime(&tnow);
 
 	/* NOTE: not re-entrant */
-	png_filename(tmx, "snapshot-recv", path_dec, sizeof(path_dec));
-	png_filename(tmx, "snapshot-send", path_enc, sizeof(path_enc));
-	flag_enc = flag_dec = true;
+	snap_filename(tmx, "snapshot-recv", ext, path_dec, sizeof(path_dec));
+	snap_filename(tmx, "snapshot-send", ext, path_enc, sizeof(path_enc));
+
+	(void)request_set(&snap.req_dec, path_dec);
+	(void)request_set(&snap.req_enc, path_enc);
 
 	return 0;
 }
@@ -94,14 +652,11 @@ static int do_snapshot(struct re_printf *pf, void *arg)
 static int do_snapshot_recv(struct re_printf *pf, void *arg)
 {
 	const struct cmd_arg *carg = arg;
-	(void)pf;
+	int err;
 
-	if (flag_dec)
-		return 0;
-
-	/* NOTE: not re-entrant */
-	str_ncpy(path_dec, carg->prm, sizeof(path_dec));
-	flag_dec = true;
+	err = request_set(&snap.req_dec, carg->prm);
+	if (err == ENOTSUP)
+		return re_hprintf(pf, "snapshot: JPEG is not supported\n");
 
 	return 0;
 }
@@ -110,22 +665,21 @@ static int do_snapshot_recv(struct re_printf *pf, void *arg)
 static int do_snapshot_send(struct re_printf *pf, void *arg)
 {
 	const struct cmd_arg *carg = arg;
-	(void)pf;
+	int err;
 
-	if (flag_enc)
-		return 0;
-
-	/* NOTE: not re-entrant */
-	str_ncpy(path_enc, carg->prm, sizeof(path_enc));
-	flag_enc = true;
+	err = request_set(&snap.req_enc, carg->prm);
+	if (err == ENOTSUP)
+		return re_hprintf(pf, "snapshot: JPEG is not supported\n");
 
 	return 0;
 }
 
 static struct vidfilt snapshot = {
-	.name = "snapshot",
-	.ench = encode,
-	.dech = decode,
+	.name    = "snapshot",
+	.encupdh = encode_update,
+	.ench    = encode,
+	.decupdh = decode_update,
+	.dech    = decode,
 };
 
 
@@ -140,48 +694,102 @@ static const struct cmd cmdv[] = {
 };
 
 
+static void config_parse(void)
+{
+	struct pl pl;
+
+	(void)conf_get_u32(conf_cur(), "snapshot_interval", &snap.interval);
+	(void)conf_get_u32(conf_cur(), "snapshot_queue", &snap.queue_max);
+	(void)conf_get_u32(conf_cur(), "snapshot_jpeg_quality",
+			   &snap.quality);
+	(void)conf_get_str(conf_cur(), "snapshot_path",
+			   snap.dir, sizeof(snap.dir));
+
+	if (0 == conf_get(conf_cur(), "snapshot_format", &pl)) {
+
+		if (0 == pl_strcasecmp(&pl, "jpeg") ||
+		    0 == pl_strcasecmp(&pl, "jpg"))
+			snap.fmt = SNAP_JPEG;
+		else
+			snap.fmt = SNAP_PNG;
+	}
+
+	if (!fmt_supported(snap.fmt)) {
+		warning("snapshot: JPEG is not supported, using PNG\n");
+		snap.fmt = SNAP_PNG;
+	}
+
+	snap.queue_max = max(snap.queue_max, 1u);
+	snap.quality   = min(max(snap.quality, 1u), 100u);
+}
+
+
 static int module_init(void)
 {
+	int err;
+
+	config_parse();
+
+	if (mtx_init(&snap.mtx, mtx_plain) != thrd_success)
+		return ENOMEM;
+
+	if (cnd_init(&snap.cnd) != thrd_success) {
+		mtx_destroy(&snap.mtx);
+		return ENOMEM;
+	}
+
+	err = mqueue_alloc(&snap.mq, mqueue_handler, NULL);
+	if (err)
+		return err;
+
+	snap.run = true;
+	err = thread_create_name(&snap.thread, "snapshot", writer_thread,
+				 NULL);
+	if (err) {
+		snap.run = false;
+		return err;
+	}
+
 	vidfilt_register(baresip_vidfiltl(), &snapshot);
+
+	if (snap.interval) {
+		info("snapshot: %s every %u seconds to %s\n",
+		     fmt_ext(snap.fmt), snap.interval, snap.dir);
+	}
+
 	return cmd_register(baresip_commands(), cmdv, ARRAY_SIZE(cmdv));
 }
 
 
 static int module_close(void)
 {
+	bool run;
+
 	vidfilt_unregister(&snapshot);
 	cmd_unregister(baresip_commands(), cmdv);
-	return 0;
-}
 
+	mtx_lock(&snap.mtx);
+	run = snap.run;
+	snap.run = false;
+	cnd_signal(&snap.cnd);
+	mtx_unlock(&snap.mtx);
 
-static char *png_filename(const struct tm *tmx, const char *name,
-			char *buf, unsigned int length)
-{
-	/*
-	 * -2013-03-03-15-22-56.png - 24 chars
-	 */
-	if (strlen(name) + 24 >= length) {
-		buf[0] = '\0';
-		return buf;
-	}
+	if (run)
+		thrd_join(snap.thread, NULL);
 
-	sprintf(buf, (tmx->tm_mon < 9 ? "%s-%d-0%d" : "%s-%d-%d"), name,
-					1900 + tmx->tm_year, tmx->tm_mon + 1);
+	snap.mq = mem_deref(snap.mq);
 
-	sprintf(buf + strlen(buf), (tmx->tm_mday < 10 ? "-0%d" : "-%d"),
-					tmx->tm_mday);
-
-	sprintf(buf + strlen(buf), (tmx->tm_hour < 10 ? "-0%d" : "-%d"),
-					tmx->tm_hour);
+	if (snap.dropped)
+		info("snapshot: %llu snapshots dropped\n", snap.dropped);
 
-	sprintf(buf + strlen(buf), (tmx->tm_min < 10 ? "-0%d" : "-%d"),
-					tmx->tm_min);
+	list_flush(&snap.jobl);
+	list_flush(&snap.donel);
+	list_flush(&snap.freel);
 
-	sprintf(buf + strlen(buf), (tmx->tm_sec < 10 ? "-0%d.png" : "-%d.png"),
-					tmx->tm_sec);
+	cnd_destroy(&snap.cnd);
+	mtx_destroy(&snap.mtx);
 
-	return buf;
+	return 0;
 }
 
 
@@ -3,6 +3,10 @@
  *
  * Copyright (C) 2010 Alfred E. Heggestad
  */
+#if defined(__aarch64__) && defined(LINUX)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
 #include <re.h>
 #include <baresip.h>
 #include "sdes.h"
@@ -31,8 +35,19 @@ struct menc_sess {
 };
 
 
+/** Crypto statistics for one direction */
+struct srtp_stats {
+	uint32_t n_pkt;              /**< Number of packets processed      */
+	uint32_t n_err;              /**< Number of failed packets         */
+	uint32_t n_grow;             /**< Packets without trailer space    */
+	uint64_t usec;               /**< Total crypto time in [us]        */
+	uint64_t usec_max;           /**< Longest crypto time in [us]      */
+};
+
+
 struct menc_st {
 	/* one SRTP session per media line */
+	struct le le;
 	const struct menc_sess *sess;
 	uint8_t key_tx[32+12];
 	/* base64_decoding worst case encoded 32+12 key */
@@ -41,6 +56,7 @@ struct menc_st {
 	bool use_srtp;
 	bool got_sdp;
 	char *crypto_suite;
+	size_t trailer;              /**< SRTP authentication tag size     */
 
 	void *rtpsock;
 	void *rtcpsock;
@@ -48,6 +64,8 @@ struct menc_st {
 	struct udp_helper *uh_rtcp;  /**< UDP helper for RTCP encryption   */
 	struct sdp_media *sdpm;
 	const struct stream *strm;   /**< pointer to parent */
+	struct srtp_stats tx;        /**< Protect statistics               */
+	struct srtp_stats rx;        /**< Unprotect statistics             */
 };
 
 
@@ -57,12 +75,47 @@ static const char aes_128_gcm[]             = "AEAD_AES_128_GCM";
 static const char aes_256_gcm[]             = "AEAD_AES_256_GCM";
 
 static const char *preferred_suite = aes_cm_128_hmac_sha1_80;
+static struct list stl;          /**< Media streams with SRTP */
+
+
+static int stats_print(struct re_printf *pf, const struct srtp_stats *stats)
+{
+	double avg = stats->n_pkt ? (double)stats->usec / stats->n_pkt : 0.0;
+
+	return re_hprintf(pf, "pkts=%u avg=%.2fus max=%lluus err=%u grow=%u",
+			  stats->n_pkt, avg,
+			  stats->usec_max, stats->n_err, stats->n_grow);
+}
+
+
+static void stats_add(struct srtp_stats *stats, uint64_t t0, int err)
+{
+	uint64_t usec = tmr_jiffies_usec() - t0;
+
+	++stats->n_pkt;
+	stats->usec += usec;
+
+	if (usec > stats->usec_max)
+		stats->usec_max = usec;
+
+	if (err)
+		++stats->n_err;
+}
 
 
 static void destructor(void *arg)
 {
 	struct menc_st *st = arg;
 
+	list_unlink(&st->le);
+
+	if (st->tx.n_pkt || st->rx.n_pkt) {
+		info("srtp: %s: tx: %H\n", sdp_media_name(st->sdpm),
+		     stats_print, &st->tx);
+		info("srtp: %s: rx: %H\n", sdp_media_name(st->sdpm),
+		     stats_print, &st->rx);
+	}
+
 	mem_deref(st->sdpm);
 	mem_deref(st->crypto_suite);
 
@@ -141,6 +194,20 @@ static enum srtp_suite resolve_suite(const char *suite)
 }
 
 
+/* size of the authentication tag */
+static size_t get_trailer_len(enum srtp_suite suite)
+{
+	switch (suite) {
+
+	case SRTP_AES_CM_128_HMAC_SHA1_32: return 4;
+	case SRTP_AES_CM_128_HMAC_SHA1_80: return 10;
+	case SRTP_AES_128_GCM:             return 16;
+	case SRTP_AES_256_GCM:             return 16;
+	default: return 0;
+	}
+}
+
+
 static size_t get_master_keylen(enum srtp_suite suite)
 {
 	switch (suite) {
@@ -163,6 +230,7 @@ static int start_srtp(struct menc_st *st, const char *suite_name)
 	suite = resolve_suite(suite_name);
 
 	len = get_master_keylen(suite);
+	st->trailer = get_trailer_len(suite);
 
 	/* allocate and initialize the SRTP session */
 	if (!st->srtp_tx) {
@@ -192,19 +260,36 @@ static bool send_handler(int *err, struct sa *dst, struct mbuf *mb, void *arg)
 {
 	struct menc_st *st = arg;
 	size_t len = mbuf_get_left(mb);
+	size_t trailer;
+	uint64_t t0;
 	int lerr = 0;
 	(void)dst;
 
 	if (!st->use_srtp || !is_rtp_or_rtcp(mb))
 		return false;
 
+	trailer = st->trailer;
+
+	t0 = tmr_jiffies_usec();
+
 	if (is_rtcp_packet(mb)) {
+		/* E-flag and SRTCP index */
+		trailer += 4;
+
+		if (mb->size - mb->end < trailer)
+			++st->tx.n_grow;
+
 		lerr = srtcp_encrypt(st->srtp_tx, mb);
 	}
 	else {
+		if (mb->size - mb->end < trailer)
+			++st->tx.n_grow;
+
 		lerr = srtp_encrypt(st->srtp_tx, mb);
 	}
 
+	stats_add(&st->tx, t0, lerr);
+
 	if (lerr) {
 		warning("srtp: failed to encrypt %s-packet"
 			      " with %zu bytes (%m)\n",
@@ -222,6 +307,7 @@ static bool recv_handler(struct sa *src, struct mbuf *mb, void *arg)
 {
 	struct menc_st *st = arg;
 	size_t len = mbuf_get_left(mb);
+	uint64_t t0;
 	int err = 0;
 	(void)src;
 
@@ -231,6 +317,8 @@ static bool recv_handler(struct sa *src, struct mbuf *mb, void *arg)
 	if (!st->use_srtp || !is_rtp_or_rtcp(mb))
 		return false;
 
+	t0 = tmr_jiffies_usec();
+
 	if (is_rtcp_packet(mb)) {
 		err = srtcp_decrypt(st->srtp_rx, mb);
 		if (err) {
@@ -246,12 +334,14 @@ static bool recv_handler(struct sa *src, struct mbuf *mb, void *arg)
 		}
 	}
 
+	stats_add(&st->rx, t0, err);
+
 	return err ? true : false;
 }
 
 
 /* a=crypto:<tag> <crypto-suite> <key-params> [<session-params>] */
-static int sdp_enc(struct menc_st *st, struct sdp_media *m,
+static int sdp_enc(struct menc_st *st, struct sdp_media *m, bool replace,
 		   uint32_t tag, const char *suite)
 {
 	char key[128] = "";
@@ -265,7 +355,7 @@ static int sdp_enc(struct menc_st *st, struct sdp_media *m,
 	if (err)
 		return err;
 
-	return sdes_encode_crypto(m, tag, suite, key, olen);
+	return sdes_encode_crypto(m, replace, tag, suite, key, olen);
 }
 
 
@@ -333,7 +423,7 @@ static bool sdp_attr_handler(const char *name, const char *value, void *arg)
 	if (start_crypto(st, &c.key_info))
 		return false;
 
-	sdp_enc(st, st->sdpm, c.tag, st->crypto_suite);
+	sdp_enc(st, st->sdpm, true, c.tag, st->crypto_suite);
 
 	return true;
 }
@@ -427,6 +517,8 @@ static int media_alloc(struct menc_media **stp, struct menc_sess *sess,
 			goto out;
 
 		rand_bytes(st->key_tx, sizeof(st->key_tx));
+
+		list_append(&stl, &st->le, st);
 	}
 
 	/* SDP handling */
@@ -444,8 +536,16 @@ static int media_alloc(struct menc_media **stp, struct menc_sess *sess,
 		}
 	}
 
-	if (!rattr)
-		err = sdp_enc(st, sdpm, 1, st->crypto_suite);
+	if (!rattr) {
+		err = sdp_enc(st, sdpm, true, 1, st->crypto_suite);
+
+		/* offer a fallback for peers without GCM support */
+		if (!st->use_srtp &&
+		    0 == str_casecmp(st->crypto_suite, aes_128_gcm)) {
+			err |= sdp_enc(st, sdpm, false, 2,
+				       aes_cm_128_hmac_sha1_80);
+		}
+	}
 
  out:
 	if (err)
@@ -457,6 +557,56 @@ static int media_alloc(struct menc_media **stp, struct menc_sess *sess,
 }
 
 
+/* AES-GCM is only fast with AES and carry-less multiply instructions */
+static bool aes_gcm_hwaccel(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_cpu_init();
+
+	return __builtin_cpu_supports("aes") &&
+		__builtin_cpu_supports("pclmul");
+#elif defined(__aarch64__) && defined(LINUX)
+	unsigned long hwcap = getauxval(AT_HWCAP);
+
+	return (hwcap & HWCAP_AES) && (hwcap & HWCAP_PMULL);
+#else
+	return false;
+#endif
+}
+
+
+static int cmd_stats(struct re_printf *pf, void *unused)
+{
+	struct le *le;
+	int err = 0;
+	(void)unused;
+
+	err = re_hprintf(pf, "SRTP streams (%u), preferred suite %s:\n",
+			 list_count(&stl), preferred_suite);
+
+	for (le = stl.head; le; le = le->next) {
+
+		const struct menc_st *st = le->data;
+
+		err |= re_hprintf(pf, "  %-5s %s %s\n"
+				  "        tx: %H\n"
+				  "        rx: %H\n",
+				  sdp_media_name(st->sdpm),
+				  st->crypto_suite,
+				  st->use_srtp ? "(active)" : "",
+				  stats_print, &st->tx,
+				  stats_print, &st->rx);
+	}
+
+	return err;
+}
+
+
+static const struct cmd cmdv[] = {
+	{"srtp_stats", 0, 0, "SRTP crypto statistics", cmd_stats },
+};
+
+
 static struct menc menc_srtp_opt = {
 	.id        = "srtp",
 	.sdp_proto = "RTP/AVP",
@@ -482,17 +632,27 @@ static struct menc menc_srtp_mandf = {
 static int mod_srtp_init(void)
 {
 	struct list *mencl = baresip_mencl();
+	bool prefer_gcm = aes_gcm_hwaccel();
+
+	(void)conf_get_bool(conf_cur(), "srtp_prefer_gcm", &prefer_gcm);
+
+	if (prefer_gcm)
+		preferred_suite = aes_128_gcm;
+
+	info("srtp: preferred crypto suite %s\n", preferred_suite);
 
 	menc_register(mencl, &menc_srtp_opt);
 	menc_register(mencl, &menc_srtp_mand);
 	menc_register(mencl, &menc_srtp_mandf);
 
-	return 0;
+	return cmd_register(baresip_commands(), cmdv, ARRAY_SIZE(cmdv));
 }
 
 
 static int mod_srtp_close(void)
 {
+	cmd_unregister(baresip_commands(), cmdv);
+
 	menc_unregister(&menc_srtp_mandf);
 	menc_unregister(&menc_srtp_mand);
 	menc_unregister(&menc_srtp_opt);
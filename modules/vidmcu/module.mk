@@ -0,0 +1,10 @@
+#
+# module.mk
+#
+# Copyright (C) 2023 Alfred E. Heggestad
+#
+
+MOD		:= vidmcu
+$(MOD)_SRCS	+= vidmcu.c
+
+include mk/mod.mk
@@ -0,0 +1,469 @@
+/**
+ * @file vidmcu.c  Video composition mixer for conferences
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+
+
+/**
+ * @defgroup vidmcu vidmcu
+ *
+ * Video composition mixer (MCU) for multi-party video calls
+ *
+ * The decoded video of every call is put into a video mixer, which
+ * composes all calls into one picture at a fixed framerate in its own
+ * thread. The composed picture is the video source of every call, so
+ * that all participants see each other without an external media server.
+ *
+ * In the grid layout all calls have the same size. In the speaker layout
+ * the call with the loudest received audio is shown large, this needs
+ * the audio level to be enabled.
+ *
+ * Example config:
+ \verbatim
+  module                  vidmcu.so
+  video_source            vidmcu,mcu
+  audio_level             yes         # for the speaker layout
+
+  vidmcu_size             1280x720
+  vidmcu_fps              25
+  vidmcu_layout           grid        # {grid,speaker}
+ \endverbatim
+ */
+
+
+enum {
+	SPEAKER_INTERVAL = 500,   /* Speaker detection interval in [ms] */
+	SPEAKER_HOLD     = 2000,  /* Minimum time to show a speaker [ms] */
+};
+
+static const double SPEAKER_MIN_LEVEL = -45.0;  /* [dBov] */
+
+
+/* One call in the conference, the decoder filter of its video */
+struct participant {
+	struct vidfilt_dec_st vf;      /**< Inheritance                 */
+	struct le le;                  /**< Member of mcu.partl         */
+	struct vidmix_source *src;     /**< Mixer input                 */
+	const struct video *vid;       /**< Video stream of the call    */
+};
+
+/* The composed picture as video source of one call */
+struct vidsrc_st {
+	struct le le;                  /**< Member of mcu.srcl          */
+	struct vidframe *frame;        /**< Reused output frame         */
+	thrd_t thread;
+	bool run;                      /**< Protected by mcu.mtx        */
+	vidsrc_frame_h *frameh;
+	void *arg;
+};
+
+
+static struct {
+	struct vidmix *mix;
+	struct vidmix_source *out;     /**< Mixer output, composes all  */
+	struct vidframe *canvas;       /**< Last composed picture       */
+	uint64_t seq;                  /**< Canvas sequence number      */
+	mtx_t mtx;                     /**< Protects canvas, seq, run   */
+	cnd_t cnd;                     /**< Signals a new canvas        */
+	struct list partl;
+	struct list srcl;
+	struct participant *speaker;
+	uint64_t speaker_ts;
+	struct tmr tmr;
+	struct vidsz size;
+	uint32_t fps;
+	bool speaker_layout;
+} mcu = {
+	.size = {1280, 720},
+	.fps  = 25,
+};
+
+static struct vidsrc *vidsrc;
+
+
+/* Called in the mixer thread for each composed picture */
+static void mix_frame_handler(uint64_t ts, const struct vidframe *frame,
+			      void *arg)
+{
+	(void)ts;
+	(void)arg;
+
+	mtx_lock(&mcu.mtx);
+
+	vidframe_copy(mcu.canvas, frame);
+	++mcu.seq;
+
+	cnd_broadcast(&mcu.cnd);
+	mtx_unlock(&mcu.mtx);
+}
+
+
+/* Input sources are not started, they do not compose */
+static void input_frame_handler(uint64_t ts, const struct vidframe *frame,
+				void *arg)
+{
+	(void)ts;
+	(void)frame;
+	(void)arg;
+}
+
+
+static void set_speaker(struct participant *p)
+{
+	if (p == mcu.speaker)
+		return;
+
+	mcu.speaker    = p;
+	mcu.speaker_ts = tmr_jiffies();
+
+	vidmix_source_set_focus(mcu.out, p ? p->src : NULL, false);
+}
+
+
+struct audio_lookup {
+	const struct video *vid;
+	struct audio *au;
+};
+
+
+static void audio_lookup_handler(void *arg)
+{
+	struct audio_lookup *al = arg;
+	struct le *le, *lec;
+
+	for (le = list_head(uag_list()); le && !al->au; le = le->next) {
+
+		for (lec = list_head(ua_calls(le->data)); lec;
+		     lec = lec->next) {
+
+			const struct call *call = lec->data;
+
+			if (call_video(call) == al->vid) {
+				al->au = call_audio(call);
+				break;
+			}
+		}
+	}
+}
+
+
+static struct audio *participant_audio(const struct participant *p)
+{
+	struct audio_lookup al = {p->vid, NULL};
+
+	/* the calls of the shards are searched in their threads */
+	if (shard_current())
+		audio_lookup_handler(&al);
+	else
+		(void)shard_exec_all(audio_lookup_handler, &al);
+
+	return al.au;
+}
+
+
+static void speaker_handler(void *arg)
+{
+	struct participant *loudest = NULL;
+	double max_level = SPEAKER_MIN_LEVEL;
+	struct le *le;
+	(void)arg;
+
+	tmr_start(&mcu.tmr, SPEAKER_INTERVAL, speaker_handler, NULL);
+
+	if (tmr_jiffies() < mcu.speaker_ts + SPEAKER_HOLD)
+		return;
+
+	for (le = mcu.partl.head; le; le = le->next) {
+		struct participant *p = le->data;
+		double level;
+
+		if (audio_level_get(participant_audio(p), &level))
+			continue;
+
+		if (level > max_level) {
+			max_level = level;
+			loudest   = p;
+		}
+	}
+
+	/* keep the last speaker during silence */
+	if (loudest)
+		set_speaker(loudest);
+}
+
+
+static void participant_destructor(void *arg)
+{
+	struct participant *p = arg;
+
+	if (p == mcu.speaker)
+		set_speaker(NULL);
+
+	list_unlink(&p->vf.le);
+	list_unlink(&p->le);
+
+	vidmix_source_enable(p->src, false);
+	mem_deref(p->src);
+}
+
+
+static int decode_update(struct vidfilt_dec_st **stp, void **ctx,
+			 const struct vidfilt *vf, struct vidfilt_prm *prm,
+			 const struct video *vid)
+{
+	struct participant *p;
+	int err;
+	(void)ctx;
+	(void)prm;
+
+	if (!stp || !vf)
+		return EINVAL;
+
+	if (*stp)
+		return 0;
+
+	p = mem_zalloc(sizeof(*p), participant_destructor);
+	if (!p)
+		return ENOMEM;
+
+	p->vid = vid;
+
+	err = vidmix_source_alloc(&p->src, mcu.mix, NULL, mcu.fps, false,
+				  input_frame_handler, p);
+	if (err)
+		goto out;
+
+	vidmix_source_enable(p->src, true);
+
+	list_append(&mcu.partl, &p->le, p);
+
+	info("vidmcu: participant added (%u in conference)\n",
+	     list_count(&mcu.partl));
+
+ out:
+	if (err)
+		mem_deref(p);
+	else
+		*stp = (struct vidfilt_dec_st *)p;
+
+	return err;
+}
+
+
+/* Called in the video receive thread, the frame is shown unchanged */
+static int decode(struct vidfilt_dec_st *st, struct vidframe *frame,
+		  uint64_t *timestamp)
+{
+	struct participant *p = (struct participant *)st;
+	(void)timestamp;
+
+	if (frame)
+		vidmix_source_put(p->src, frame);
+
+	return 0;
+}
+
+
+static int src_thread(void *arg)
+{
+	struct vidsrc_st *st = arg;
+	uint64_t seq = 0;
+
+	mtx_lock(&mcu.mtx);
+
+	while (st->run) {
+
+		if (seq == mcu.seq) {
+			cnd_wait(&mcu.cnd, &mcu.mtx);
+			continue;
+		}
+
+		seq = mcu.seq;
+
+		if (vidsz_cmp(&st->frame->size, &mcu.canvas->size))
+			vidframe_copy(st->frame, mcu.canvas);
+		else
+			vidscale(st->frame, mcu.canvas, NULL);
+
+		mtx_unlock(&mcu.mtx);
+
+		st->frameh(st->frame, tmr_jiffies_usec(), st->arg);
+
+		mtx_lock(&mcu.mtx);
+	}
+
+	mtx_unlock(&mcu.mtx);
+
+	return 0;
+}
+
+
+static void src_destructor(void *arg)
+{
+	struct vidsrc_st *st = arg;
+	bool run;
+
+	mtx_lock(&mcu.mtx);
+	run = st->run;
+	st->run = false;
+	cnd_broadcast(&mcu.cnd);
+	mtx_unlock(&mcu.mtx);
+
+	if (run)
+		thrd_join(st->thread, NULL);
+
+	list_unlink(&st->le);
+	mem_deref(st->frame);
+
+	/* nobody is watching, stop composing */
+	if (list_isempty(&mcu.srcl))
+		vidmix_source_stop(mcu.out);
+}
+
+
+static int src_alloc(struct vidsrc_st **stp, const struct vidsrc *vs,
+		     struct vidsrc_prm *prm,
+		     const struct vidsz *size, const char *fmt,
+		     const char *dev, vidsrc_frame_h *frameh,
+		     vidsrc_packet_h *packeth,
+		     vidsrc_error_h *errorh, void *arg)
+{
+	struct vidsrc_st *st;
+	int err;
+	(void)vs;
+	(void)fmt;
+	(void)dev;
+	(void)packeth;
+	(void)errorh;
+
+	if (!stp || !prm || !size || !frameh)
+		return EINVAL;
+
+	st = mem_zalloc(sizeof(*st), src_destructor);
+	if (!st)
+		return ENOMEM;
+
+	st->frameh = frameh;
+	st->arg    = arg;
+
+	err = vidframe_alloc(&st->frame, VID_FMT_YUV420P, size);
+	if (err)
+		goto out;
+
+	vidframe_fill_color(st->frame, 0, 0, 0);
+
+	if (list_isempty(&mcu.srcl)) {
+		err = vidmix_source_start(mcu.out);
+		if (err)
+			goto out;
+	}
+
+	list_append(&mcu.srcl, &st->le, st);
+
+	st->run = true;
+	err = thread_create_name(&st->thread, "vidmcu", src_thread, st);
+	if (err)
+		st->run = false;
+
+ out:
+	if (err)
+		mem_deref(st);
+	else
+		*stp = st;
+
+	return err;
+}
+
+
+static struct vidfilt vidmcu = {
+	.name    = "vidmcu",
+	.decupdh = decode_update,
+	.dech    = decode,
+};
+
+
+static int module_init(void)
+{
+	struct pl layout;
+	int err;
+
+	(void)conf_get_vidsz(conf_cur(), "vidmcu_size", &mcu.size);
+	(void)conf_get_u32(conf_cur(), "vidmcu_fps", &mcu.fps);
+
+	if (0 == conf_get(conf_cur(), "vidmcu_layout", &layout))
+		mcu.speaker_layout = 0 == pl_strcasecmp(&layout, "speaker");
+
+	if (!mcu.size.w || !mcu.size.h || !mcu.fps)
+		return EINVAL;
+
+	if (mtx_init(&mcu.mtx, mtx_plain) != thrd_success)
+		return ENOMEM;
+
+	if (cnd_init(&mcu.cnd) != thrd_success) {
+		mtx_destroy(&mcu.mtx);
+		return ENOMEM;
+	}
+
+	err = vidframe_alloc(&mcu.canvas, VID_FMT_YUV420P, &mcu.size);
+	if (err)
+		return err;
+
+	vidframe_fill_color(mcu.canvas, 0, 0, 0);
+
+	err = vidmix_alloc(&mcu.mix);
+	if (err)
+		return err;
+
+	err = vidmix_source_alloc(&mcu.out, mcu.mix, &mcu.size, mcu.fps,
+				  false, mix_frame_handler, NULL);
+	if (err)
+		return err;
+
+	err = vidsrc_register(&vidsrc, baresip_vidsrcl(), "vidmcu",
+			      src_alloc, NULL);
+	if (err)
+		return err;
+
+	vidfilt_register(baresip_vidfiltl(), &vidmcu);
+
+	tmr_init(&mcu.tmr);
+	if (mcu.speaker_layout)
+		tmr_start(&mcu.tmr, SPEAKER_INTERVAL, speaker_handler, NULL);
+
+	info("vidmcu: %u x %u at %u fps, %s layout\n",
+	     mcu.size.w, mcu.size.h, mcu.fps,
+	     mcu.speaker_layout ? "speaker" : "grid");
+
+	return 0;
+}
+
+
+static int module_close(void)
+{
+	tmr_cancel(&mcu.tmr);
+
+	vidfilt_unregister(&vidmcu);
+	vidsrc = mem_deref(vidsrc);
+
+	mcu.out    = mem_deref(mcu.out);
+	mcu.mix    = mem_deref(mcu.mix);
+	mcu.canvas = mem_deref(mcu.canvas);
+
+	cnd_destroy(&mcu.cnd);
+	mtx_destroy(&mcu.mtx);
+
+	return 0;
+}
+
+
+EXPORT_SYM const struct mod_export DECL_EXPORTS(vidmcu) = {
+	"vidmcu",
+	"vidfilt",
+	module_init,
+	module_close
+};
@@ -19,6 +19,7 @@ enum {
 
 
 struct videnc_state {
+	const struct vp8_vidcodec *vp8;
 	vpx_codec_ctx_t ctx;
 	struct vidsz size;
 	unsigned fps;
@@ -28,6 +29,10 @@ struct videnc_state {
 	uint16_t picid;
 	videnc_packet_h *pkth;
 	void *arg;
+
+	unsigned n_frames;
+	uint64_t enc_usec;    /**< Total encode time in [us]   */
+	uint32_t enc_max;     /**< Longest encode time in [us] */
 };
 
 
@@ -35,8 +40,28 @@ static void destructor(void *arg)
 {
 	struct videnc_state *ves = arg;
 
-	if (ves->ctxup)
+	if (ves->ctxup) {
+
+		if (ves->n_frames)
+			debug("vp8: encoder stats: frames=%u,"
+			      " encode time avg=%llu us max=%u us\n",
+			      ves->n_frames, ves->enc_usec / ves->n_frames,
+			      ves->enc_max);
+
 		vpx_codec_destroy(&ves->ctx);
+	}
+}
+
+
+/* log2 of the thread count, capped at max */
+static unsigned log2_threads(unsigned threads, unsigned max)
+{
+	unsigned n = 0;
+
+	while ((2u << n) <= threads && n < max)
+		++n;
+
+	return n;
 }
 
 
@@ -47,7 +72,6 @@ int vp8_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 	const struct vp8_vidcodec *vp8 = (struct vp8_vidcodec *)vc;
 	struct videnc_state *ves;
 	uint32_t max_fs;
-	(void)vp8;
 
 	if (!vesp || !vc || !prm || prm->pktsize < (HDR_SIZE + 1))
 		return EINVAL;
@@ -61,6 +85,7 @@ int vp8_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 			return ENOMEM;
 
 		ves->picid = rand_u16();
+		ves->vp8   = vp8;
 
 		*vesp = ves;
 	}
@@ -89,9 +114,12 @@ int vp8_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 
 static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 {
+	const struct vp8_vidcodec *vp8 = ves->vp8;
 	vpx_codec_enc_cfg_t cfg;
 	vpx_codec_err_t res;
 	vpx_codec_flags_t flags = 0;
+	unsigned threads;
+	int parts;
 
 	res = vpx_codec_enc_config_default(&vpx_codec_vp8_cx_algo, &cfg, 0);
 	if (res)
@@ -111,6 +139,9 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 	cfg.rc_target_bitrate = ves->bitrate;
 	cfg.kf_mode           = VPX_KF_AUTO;
 
+	threads = vp8->threads ? vp8->threads : video_enc_threads(size);
+	cfg.g_threads         = threads;
+
 	if (ves->ctxup) {
 		debug("vp8: re-opening encoder\n");
 		vpx_codec_destroy(&ves->ctx);
@@ -130,7 +161,16 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 
 	ves->ctxup = true;
 
-	res = vpx_codec_control(&ves->ctx, VP8E_SET_CPUUSED, 16);
+	res = vpx_codec_control(&ves->ctx, VP8E_SET_CPUUSED, vp8->cpuused);
+	if (res) {
+		warning("vp8: codec ctrl: %s\n", vpx_codec_err_to_string(res));
+	}
+
+	/* the threads encode the token partitions in parallel */
+	parts = vp8->partitions >= 0 ? vp8->partitions :
+		(int)log2_threads(threads, 3);
+
+	res = vpx_codec_control(&ves->ctx, VP8E_SET_TOKEN_PARTITIONS, parts);
 	if (res) {
 		warning("vp8: codec ctrl: %s\n", vpx_codec_err_to_string(res));
 	}
@@ -140,6 +180,10 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 		warning("vp8: codec ctrl: %s\n", vpx_codec_err_to_string(res));
 	}
 
+	debug("vp8: encoder opened, picture size %u x %u,"
+	      " threads=%u, cpuused=%d, partitions=%d\n",
+	      size->w, size->h, threads, vp8->cpuused, 1 << parts);
+
 	return 0;
 }
 
@@ -192,6 +236,8 @@ int vp8_encode(struct videnc_state *ves, bool update,
 	vpx_codec_iter_t iter = NULL;
 	vpx_codec_err_t res;
 	vpx_image_t img;
+	uint64_t t0;
+	uint32_t usec;
 	int err, i;
 
 	if (!ves || !frame || frame->fmt != VID_FMT_YUV420P)
@@ -222,6 +268,8 @@ int vp8_encode(struct videnc_state *ves, bool update,
 		img.planes[i] = frame->data[i];
 	}
 
+	t0 = tmr_jiffies_usec();
+
 	res = vpx_codec_encode(&ves->ctx, &img, timestamp, 1,
 			       flags, VPX_DL_REALTIME);
 	if (res) {
@@ -229,6 +277,12 @@ int vp8_encode(struct videnc_state *ves, bool update,
 		return ENOMEM;
 	}
 
+	usec = (uint32_t)(tmr_jiffies_usec() - t0);
+
+	++ves->n_frames;
+	ves->enc_usec += usec;
+	ves->enc_max   = max(ves->enc_max, usec);
+
 	++ves->picid;
 
 	for (;;) {
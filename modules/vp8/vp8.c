@@ -22,6 +22,14 @@
  *     http://www.webmproject.org/
  *
  *     https://tools.ietf.org/html/rfc7741
+ *
+ * The following options can be configured:
+ *
+ \verbatim
+  vp8_threads      0    # Encoder threads, 0 for auto from size and cores
+  vp8_cpuused      16   # Encoder speed preset, -16 to 16
+  vp8_partitions   1    # Token partitions in log2, 0 to 3 (default auto)
+ \endverbatim
  */
 
 
@@ -36,11 +44,19 @@ static struct vp8_vidcodec vp8 = {
 		.packetizeh = vp8_encode_packetize,
 	},
 	.max_fs   = 3600,
+	.cpuused  = 16,
+	.partitions = -1,
 };
 
 
 static int module_init(void)
 {
+	struct conf *conf = conf_cur();
+
+	(void)conf_get_u32(conf, "vp8_threads", &vp8.threads);
+	(void)conf_get_i32(conf, "vp8_cpuused", &vp8.cpuused);
+	(void)conf_get_i32(conf, "vp8_partitions", &vp8.partitions);
+
 	vidcodec_register(baresip_vidcodecl(), (struct vidcodec *)&vp8);
 
 	return 0;
@@ -7,6 +7,9 @@
 struct vp8_vidcodec {
 	struct vidcodec vc;
 	uint32_t max_fs;
+	uint32_t threads;     /**< Encoder threads, 0 for auto            */
+	int32_t cpuused;      /**< Encoder speed preset, -16 to 16        */
+	int32_t partitions;   /**< Token partitions in log2, -1 for auto  */
 };
 
 /* Encode */
@@ -15,10 +15,12 @@
 
 enum {
 	HDR_SIZE = 3,
+	MIN_TILE_WIDTH = 256,
 };
 
 
 struct videnc_state {
+	const struct vp9_vidcodec *vp9;
 	vpx_codec_ctx_t ctx;
 	struct vidsz size;
 	unsigned fps;
@@ -32,6 +34,8 @@ struct videnc_state {
 	unsigned n_frames;
 	unsigned n_key_frames;
 	size_t n_bytes;
+	uint64_t enc_usec;    /**< Total encode time in [us]   */
+	uint32_t enc_max;     /**< Longest encode time in [us] */
 };
 
 
@@ -42,16 +46,32 @@ static void destructor(void *arg)
 	if (ves->ctxup) {
 
 		debug("vp9: encoder stats:"
-		      " frames=%u, key_frames=%u, bytes=%zu\n",
+		      " frames=%u, key_frames=%u, bytes=%zu,"
+		      " encode time avg=%llu us max=%u us\n",
 		      ves->n_frames,
 		      ves->n_key_frames,
-		      ves->n_bytes);
+		      ves->n_bytes,
+		      ves->n_frames ? ves->enc_usec / ves->n_frames : 0,
+		      ves->enc_max);
 
 		vpx_codec_destroy(&ves->ctx);
 	}
 }
 
 
+/* log2 of the tile columns, each tile is at least MIN_TILE_WIDTH wide */
+static int tile_columns(unsigned threads, unsigned width)
+{
+	int n = 0;
+
+	while ((2u << n) <= threads &&
+	       (unsigned)MIN_TILE_WIDTH << (n+1) <= width)
+		++n;
+
+	return n;
+}
+
+
 int vp9_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 		      struct videnc_param *prm, const char *fmtp,
 		      videnc_packet_h *pkth, void *arg)
@@ -59,7 +79,6 @@ int vp9_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 	const struct vp9_vidcodec *vp9 = (struct vp9_vidcodec *)vc;
 	struct videnc_state *ves;
 	uint32_t max_fs;
-	(void)vp9;
 
 	if (!vesp || !vc || !prm || prm->pktsize < (HDR_SIZE + 1))
 		return EINVAL;
@@ -73,6 +92,7 @@ int vp9_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 			return ENOMEM;
 
 		ves->picid = rand_u16();
+		ves->vp9   = vp9;
 
 		*vesp = ves;
 	}
@@ -101,8 +121,11 @@ int vp9_encode_update(struct videnc_state **vesp, const struct vidcodec *vc,
 
 static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 {
+	const struct vp9_vidcodec *vp9 = ves->vp9;
 	vpx_codec_enc_cfg_t cfg;
 	vpx_codec_err_t res;
+	unsigned threads;
+	int tiles;
 
 	res = vpx_codec_enc_config_default(&vpx_codec_vp9_cx_algo, &cfg, 0);
 	if (res)
@@ -127,6 +150,9 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 	cfg.rc_end_usage      = VPX_VBR;
 	cfg.kf_mode           = VPX_KF_AUTO;
 
+	threads = vp9->threads ? vp9->threads : video_enc_threads(size);
+	cfg.g_threads         = threads;
+
 	if (ves->ctxup) {
 		debug("vp9: re-opening encoder\n");
 		vpx_codec_destroy(&ves->ctx);
@@ -142,10 +168,25 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 
 	ves->ctxup = true;
 
-	res = vpx_codec_control(&ves->ctx, VP8E_SET_CPUUSED, 8);
+	res = vpx_codec_control(&ves->ctx, VP8E_SET_CPUUSED, vp9->cpuused);
 	if (res) {
 		warning("vp9: codec ctrl: %s\n", vpx_codec_err_to_string(res));
 	}
+
+	/* the threads encode the tile columns in parallel */
+	tiles = vp9->tile_cols >= 0 ? vp9->tile_cols :
+		tile_columns(threads, size->w);
+
+	res = vpx_codec_control(&ves->ctx, VP9E_SET_TILE_COLUMNS, tiles);
+	if (res) {
+		warning("vp9: codec ctrl: %s\n", vpx_codec_err_to_string(res));
+	}
+#ifdef VPX_CTRL_VP9E_SET_ROW_MT
+	res = vpx_codec_control(&ves->ctx, VP9E_SET_ROW_MT, vp9->row_mt);
+	if (res) {
+		warning("vp9: codec ctrl: %s\n", vpx_codec_err_to_string(res));
+	}
+#endif
 #ifdef VP9E_SET_NOISE_SENSITIVITY
 	res = vpx_codec_control(&ves->ctx, VP9E_SET_NOISE_SENSITIVITY, 0);
 	if (res) {
@@ -153,7 +194,10 @@ static int open_encoder(struct videnc_state *ves, const struct vidsz *size)
 	}
 #endif
 
-	info("vp9: encoder opened, picture size %u x %u\n", size->w, size->h);
+	info("vp9: encoder opened, picture size %u x %u,"
+	     " threads=%u, cpuused=%d, tile_columns=%d, row_mt=%d\n",
+	     size->w, size->h, threads, vp9->cpuused, 1 << tiles,
+	     vp9->row_mt);
 
 	return 0;
 }
@@ -220,6 +264,8 @@ int vp9_encode(struct videnc_state *ves, bool update,
 	vpx_codec_err_t res;
 	vpx_image_t *img = NULL;
 	vpx_img_fmt_t img_fmt;
+	uint64_t t0;
+	uint32_t usec;
 	int err = 0, i;
 
 	if (!ves || !frame)
@@ -266,6 +312,8 @@ int vp9_encode(struct videnc_state *ves, bool update,
 		img->planes[i] = frame->data[i];
 	}
 
+	t0 = tmr_jiffies_usec();
+
 	res = vpx_codec_encode(&ves->ctx, img, timestamp, 1,
 			       flags, VPX_DL_REALTIME);
 	if (res) {
@@ -274,6 +322,11 @@ int vp9_encode(struct videnc_state *ves, bool update,
 		goto out;
 	}
 
+	usec = (uint32_t)(tmr_jiffies_usec() - t0);
+
+	ves->enc_usec += usec;
+	ves->enc_max   = max(ves->enc_max, usec);
+
 	++ves->picid;
 
 	for (;;) {
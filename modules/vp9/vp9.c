@@ -26,6 +26,15 @@
  *     http://www.webmproject.org/
  *
  *     draft-ietf-payload-vp9-16
+ *
+ * The following options can be configured:
+ *
+ \verbatim
+  vp9_threads      0    # Encoder threads, 0 for auto from size and cores
+  vp9_cpuused      8    # Encoder speed preset, -9 to 9
+  vp9_tile_columns 1    # Tile columns in log2, 0 to 6 (default auto)
+  vp9_row_mt       yes  # Row based multi-threading
+ \endverbatim
  */
 
 
@@ -39,12 +48,22 @@ static struct vp9_vidcodec vp9 = {
 		.fmtp_ench = vp9_fmtp_enc,
 		.packetizeh = vp9_encode_packetize,
 	},
-	.max_fs = 3600
+	.max_fs = 3600,
+	.cpuused = 8,
+	.tile_cols = -1,
+	.row_mt = true,
 };
 
 
 static int module_init(void)
 {
+	struct conf *conf = conf_cur();
+
+	(void)conf_get_u32(conf, "vp9_threads", &vp9.threads);
+	(void)conf_get_i32(conf, "vp9_cpuused", &vp9.cpuused);
+	(void)conf_get_i32(conf, "vp9_tile_columns", &vp9.tile_cols);
+	(void)conf_get_bool(conf, "vp9_row_mt", &vp9.row_mt);
+
 	vidcodec_register(baresip_vidcodecl(), (struct vidcodec *)&vp9);
 	return 0;
 }
@@ -7,6 +7,10 @@
 struct vp9_vidcodec {
 	struct vidcodec vc;
 	uint32_t max_fs;
+	uint32_t threads;     /**< Encoder threads, 0 for auto            */
+	int32_t cpuused;      /**< Encoder speed preset, -9 to 9          */
+	int32_t tile_cols;    /**< Tile columns in log2, -1 for auto      */
+	bool row_mt;          /**< Row based multi-threading              */
 };
 
 /* Encode */
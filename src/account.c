@@ -645,6 +645,62 @@ int account_alloc(struct account **accp, const char *sipaddr)
 }
 
 
+/**
+ * Decode the Address-of-Record of a SIP address, without decoding the
+ * account parameters
+ *
+ * @param aorp    Pointer to allocated AOR string
+ * @param sipaddr SIP address with parameters
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int account_aor_decode(char **aorp, const struct pl *sipaddr)
+{
+	struct sip_addr addr;
+
+	if (!aorp || !sipaddr)
+		return EINVAL;
+
+	if (sip_addr_decode(&addr, sipaddr))
+		return EBADMSG;
+
+	return re_sdprintf(aorp, "%H", encode_uri_user, &addr.uri);
+}
+
+
+/**
+ * Check if two accounts have the same registration parameters
+ *
+ * @param a First account
+ * @param b Second account
+ *
+ * @return True if equal, false if the registration must be restarted
+ */
+bool account_reg_equal(const struct account *a, const struct account *b)
+{
+	size_t i;
+
+	if (!a || !b)
+		return false;
+
+	for (i=0; i<ARRAY_SIZE(a->outboundv); i++) {
+		if (str_cmp(a->outboundv[i], b->outboundv[i]))
+			return false;
+	}
+
+	return a->regint == b->regint &&
+		a->fbregint == b->fbregint &&
+		a->rwait == b->rwait &&
+		a->prio == b->prio &&
+		a->tcpsrcport == b->tcpsrcport &&
+		0 == str_cmp(a->regq, b->regq) &&
+		0 == str_cmp(a->sipnat, b->sipnat) &&
+		0 == str_cmp(a->auth_user, b->auth_user) &&
+		0 == str_cmp(a->auth_pass, b->auth_pass) &&
+		0 == pl_cmp(&a->luri.params, &b->luri.params);
+}
+
+
 /**
  * Set the authentication user for a SIP account
  *
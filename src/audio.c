@@ -7,6 +7,7 @@
 #define _DEFAULT_SOURCE 1
 #define _BSD_SOURCE 1
 #define _POSIX_C_SOURCE 199309L
+#include <math.h>
 #include <string.h>
 #include <stdlib.h>
 #ifdef HAVE_UNISTD_H
@@ -58,6 +59,8 @@ enum {
 	MAX_PTIME       =    60,  /* Maximum packet time in [ms] */
 
 	AUDIO_SAMPSZ    = MAX_SRATE * MAX_CHANNELS * MAX_PTIME / 1000,
+
+	AULAT_FILT_MAX  =     8,  /* Audio filters with latency  */
 };
 
 
@@ -85,8 +88,9 @@ struct autx {
 	const struct aucodec *ac;     /**< Current audio encoder           */
 	struct auenc_state *enc;      /**< Audio encoder state (optional)  */
 	struct aubuf *aubuf;          /**< Packetize outgoing stream       */
+	struct auring *ring;          /**< Lock-free ring instead of aubuf */
 	size_t aubuf_maxsz;           /**< Maximum aubuf size in [bytes]   */
-	volatile bool aubuf_started;  /**< Aubuf was started flag          */
+	RE_ATOMIC bool aubuf_started; /**< Aubuf was started flag          */
 	struct list filtl;            /**< Audio filters in encoding order */
 	struct mbuf *mb;              /**< Buffer for outgoing RTP packets */
 	char *module;                 /**< Audio source module name        */
@@ -99,6 +103,7 @@ struct autx {
 	size_t psize;                 /**< Packet size for sending         */
 	bool marker;                  /**< Marker bit for outgoing RTP     */
 	bool muted;                   /**< Audio source is muted           */
+	RE_ATOMIC bool relayed;       /**< Payload is relayed from a peer  */
 	int cur_key;                  /**< Currently transmitted event     */
 	enum aufmt src_fmt;           /**< Sample format for audio source  */
 	enum aufmt enc_fmt;           /**< Sample format for encoder       */
@@ -108,6 +113,25 @@ struct autx {
 		uint64_t aubuf_underrun;
 	} stats;
 
+	struct {
+		struct dtx_vad vad;   /**< Voice activity detector         */
+		RE_ATOMIC int cn_pt;  /**< Remote CN payload type, or -1   */
+		bool silent;          /**< Sending comfort noise           */
+		double level;         /**< Level of last SID [dBov]        */
+		uint64_t sid_time;    /**< Time of last SID [ms]           */
+		uint64_t n_frames;    /**< Number of suppressed frames     */
+		uint64_t n_sid;       /**< Number of SID packets sent      */
+	} dtx;
+
+	struct {
+		struct aulat ausrc;   /**< Capture delay, relative         */
+		struct aulat aubuf;   /**< Buffered audio at read          */
+		struct aulat filt[AULAT_FILT_MAX]; /**< Encode filters     */
+		struct aulat encode;  /**< Codec encode                    */
+		struct aulat send;    /**< Stream send                     */
+		struct aulat_rel rel; /**< Capture delay reference         */
+	} lat;
+
 	struct {
 		thrd_t tid;           /**< Audio transmit thread           */
 		RE_ATOMIC bool run;   /**< Audio transmit thread running   */
@@ -139,11 +163,13 @@ struct aurx {
 	const struct aucodec *ac;     /**< Current audio decoder           */
 	struct audec_state *dec;      /**< Audio decoder state (optional)  */
 	struct aubuf *aubuf;          /**< Audio buffer before auplay      */
+	struct auring *ring;          /**< Lock-free ring instead of aubuf */
+	struct playout *po;           /**< Playout controller (optional)   */
 	uint32_t ssrc;                /**< Incoming synchronization source */
 	size_t aubuf_minsz;           /**< Minimum aubuf size in [bytes]   */
 	size_t aubuf_maxsz;           /**< Maximum aubuf size in [bytes]   */
 	size_t num_bytes;             /**< Size of one frame in [bytes]    */
-	volatile bool aubuf_started;  /**< Aubuf was started flag          */
+	RE_ATOMIC bool aubuf_started; /**< Aubuf was started flag          */
 	struct list filtl;            /**< Audio filters in decoding order */
 	char *module;                 /**< Audio player module name        */
 	char *device;                 /**< Audio player device name        */
@@ -164,6 +190,24 @@ struct aurx {
 		uint64_t n_discard;
 	} stats;
 
+	struct {
+		RE_ATOMIC bool active; /**< Playing comfort noise          */
+		RE_ATOMIC int level;  /**< Noise level [dBov]              */
+		uint32_t seed;        /**< Noise generator state           */
+		uint64_t n_sid;       /**< Number of SID packets received  */
+		uint64_t n_frames;    /**< Number of noise frames played   */
+	} cn;
+
+	struct {
+		struct aulat jbuf;    /**< Transit and jitter buffer, rel. */
+		struct aulat decode;  /**< Codec decode                    */
+		struct aulat filt[AULAT_FILT_MAX]; /**< Decode filters     */
+		struct aulat aubuf;   /**< Buffered audio at read          */
+		struct aulat auplay;  /**< Player period deviation         */
+		struct aulat_rel rel; /**< Transit delay reference         */
+		uint64_t play_last;   /**< Time of last player callback    */
+	} lat;
+
 	enum jbuf_type jbtype;       /**< Jitter buffer type               */
 	volatile int32_t wcnt;       /**< Write handler call count         */
 
@@ -185,6 +229,17 @@ struct audio {
 	bool hold;                    /**< Local hold flag                 */
 	bool conference;              /**< Local conference flag           */
 	uint8_t extmap_aulevel;       /**< ID Range 1-14 inclusive         */
+
+	struct {
+		struct audio *peer;   /**< Relay received payload to peer  */
+		struct mbuf *mb;      /**< Buffer for relayed packets      */
+		uint32_t ssrc;        /**< Incoming SSRC of the offset     */
+		uint32_t ts_offset;   /**< Incoming to outgoing timestamp  */
+		bool set;             /**< Timestamp offset is set         */
+		uint64_t n_pkt;       /**< Number of relayed packets       */
+		struct le le_bridge;  /**< Member of the aubridge list     */
+	} relay;
+
 	audio_event_h *eventh;        /**< Event handler                   */
 	audio_level_h *levelh;        /**< Audio level handler             */
 	audio_err_h *errh;            /**< Audio error handler             */
@@ -195,6 +250,52 @@ struct audio {
 /* RFC 6464 */
 static const char *uri_aulevel = "urn:ietf:params:rtp-hdrext:ssrc-audio-level";
 
+/* RFC 3389 */
+static const char *cn_rtpfmt = "CN";
+
+/* Audio objects with the source and the player on aubridge devices */
+static struct {
+	struct list l;
+	mtx_t mtx;
+} bridges;
+
+static once_flag bridges_once = ONCE_FLAG_INIT;
+
+enum {
+	CN_PT       = 13,    /* Static payload type of CN at 8000 Hz  */
+	SID_REFRESH = 5000,  /* Resend an unchanged SID after [ms]    */
+};
+
+static const double SID_DELTA = 3.0;  /* Level change for a new SID [dB] */
+
+
+static size_t autx_buf_size(const struct autx *tx)
+{
+	return tx->ring ? auring_cur_size(tx->ring) :
+		aubuf_cur_size(tx->aubuf);
+}
+
+
+static size_t aurx_buf_size(const struct aurx *rx)
+{
+	return rx->ring ? auring_cur_size(rx->ring) :
+		aubuf_cur_size(rx->aubuf);
+}
+
+
+/* duration of buffered audio in [us] */
+static uint32_t buf_usec(size_t bytes, enum aufmt fmt, uint32_t srate,
+			 uint8_t ch)
+{
+	size_t sz = aufmt_sample_size(fmt);
+
+	if (!sz || !srate || !ch)
+		return 0;
+
+	return (uint32_t)((uint64_t)bytes / sz * AUDIO_TIMEBASE /
+			  (srate * ch));
+}
+
 
 /**
  * Get the current audio receive buffer length in milliseconds
@@ -212,7 +313,7 @@ uint64_t audio_jb_current_value(const struct audio *au)
 
 	rx = &au->rx;
 
-	if (rx->aubuf) {
+	if (rx->aubuf || rx->ring) {
 		uint64_t b_p_ms;  /* bytes per ms */
 
 		b_p_ms = aufmt_sample_size(rx->play_fmt) *
@@ -221,7 +322,7 @@ uint64_t audio_jb_current_value(const struct audio *au)
 		if (b_p_ms) {
 			uint64_t val;
 
-			val = aubuf_cur_size(rx->aubuf) / b_p_ms;
+			val = aurx_buf_size(rx) / b_p_ms;
 
 			return val;
 		}
@@ -271,6 +372,7 @@ static void stop_tx(struct autx *tx, struct audio *a)
 	/* audio source must be stopped first */
 	tx->ausrc = mem_deref(tx->ausrc);
 	tx->aubuf = mem_deref(tx->aubuf);
+	tx->ring  = mem_deref(tx->ring);
 
 	list_flush(&tx->filtl);
 }
@@ -284,6 +386,8 @@ static void stop_rx(struct aurx *rx)
 	/* audio player must be stopped first */
 	rx->auplay = mem_deref(rx->auplay);
 	rx->aubuf  = mem_deref(rx->aubuf);
+	rx->ring   = mem_deref(rx->ring);
+	rx->po     = mem_deref(rx->po);
 	if (rx->mtx)
 		mtx_lock(rx->mtx);
 
@@ -293,22 +397,90 @@ static void stop_rx(struct aurx *rx)
 }
 
 
+static void bridges_init(void)
+{
+	(void)mtx_init(&bridges.mtx, mtx_plain);
+}
+
+
+static bool on_aubridge(const struct audio *a)
+{
+	return 0 == str_casecmp(a->tx.module, "aubridge") &&
+		0 == str_casecmp(a->rx.module, "aubridge") &&
+		str_isset(a->tx.device) && str_isset(a->rx.device);
+}
+
+
+/*
+ * Two audio objects are bridged if the player device of each one is the
+ * source device of the other one. The received payload is relayed
+ * between the streams, aubridge carries the audio when it is decoded.
+ */
+static void bridge_join(struct audio *a)
+{
+	struct le *le;
+
+	if (!on_aubridge(a) || a->relay.le_bridge.list)
+		return;
+
+	call_once(&bridges_once, bridges_init);
+
+	mtx_lock(&bridges.mtx);
+
+	for (le = list_head(&bridges.l); le && !a->relay.peer; le = le->next) {
+		struct audio *peer = le->data;
+
+		if (peer->relay.peer ||
+		    str_cmp(peer->rx.device, a->tx.device) ||
+		    str_cmp(peer->tx.device, a->rx.device))
+			continue;
+
+		if (!audio_set_relay(a, peer))
+			info("audio: relay to bridged stream (%s/%s)\n",
+			     a->rx.device, a->tx.device);
+	}
+
+	list_append(&bridges.l, &a->relay.le_bridge, a);
+
+	mtx_unlock(&bridges.mtx);
+}
+
+
+static void bridge_leave(struct audio *a)
+{
+	if (!a->relay.le_bridge.list)
+		return;
+
+	mtx_lock(&bridges.mtx);
+	list_unlink(&a->relay.le_bridge);
+	(void)audio_set_relay(a, NULL);
+	mtx_unlock(&bridges.mtx);
+}
+
+
 static void audio_destructor(void *arg)
 {
 	struct audio *a = arg;
 
 	debug("audio: destroyed (started=%d)\n", a->started);
 
+	bridge_leave(a);
+	(void)audio_set_relay(a, NULL);
+
 	stop_tx(&a->tx, a);
 	stop_rx(&a->rx);
 
 	mem_deref(a->tx.enc);
 	mem_deref(a->rx.dec);
 	mem_deref(a->tx.aubuf);
+	mem_deref(a->tx.ring);
 	mem_deref(a->tx.mb);
+	mem_deref(a->relay.mb);
 	mem_deref(a->tx.sampv);
 	mem_deref(a->rx.sampv);
 	mem_deref(a->rx.aubuf);
+	mem_deref(a->rx.ring);
+	mem_deref(a->rx.po);
 	mem_deref(a->tx.module);
 	mem_deref(a->tx.device);
 	mem_deref(a->rx.module);
@@ -385,6 +557,84 @@ static int append_rtpext(struct audio *au, struct mbuf *mb,
 }
 
 
+/*
+ * Discontinuous transmission (RFC 3389)
+ *
+ * Returns true if the frame is silence and must not be encoded. A SID
+ * packet is sent at the start of the silence, when the noise level
+ * changes and periodically after that.
+ *
+ * @note This function has REAL-TIME properties
+ */
+static bool dtx_suppress(struct audio *a, struct autx *tx,
+			 const struct auframe *af)
+{
+	uint32_t ptime;
+	uint64_t now;
+	double level;
+	int cn_pt;
+	int err;
+
+	if (!a->cfg.dtx || !af->sampc)
+		return false;
+
+	cn_pt = re_atomic_rlx(&tx->dtx.cn_pt);
+	if (cn_pt < 0)
+		return false;
+
+	level = aulevel_calc_dbov(af->fmt, af->sampv, af->sampc);
+	ptime = (uint32_t)(af->sampc * 1000 / (af->srate * af->ch));
+
+	if (dtx_vad(&tx->dtx.vad, level, ptime)) {
+
+		/* first packet of a talkspurt */
+		if (tx->dtx.silent) {
+			tx->dtx.silent = false;
+			tx->marker = true;
+		}
+
+		return false;
+	}
+
+	now = tmr_jiffies();
+
+	if (!tx->dtx.silent || fabs(level - tx->dtx.level) >= SID_DELTA ||
+	    now >= tx->dtx.sid_time + SID_REFRESH) {
+
+		tx->mb->pos = tx->mb->end = STREAM_PRESZ;
+
+		err = dtx_cn_encode(tx->mb, level);
+		if (!err) {
+			tx->mb->pos = STREAM_PRESZ;
+
+			mtx_lock(tx->mtx);
+			err = stream_send(a->strm, false, false, cn_pt,
+					  tx->ts_ext & 0xffffffff, tx->mb);
+			mtx_unlock(tx->mtx);
+		}
+
+		if (err) {
+			warning("audio: dtx: stream_send %m\n", err);
+		}
+		else {
+			tx->dtx.level    = level;
+			tx->dtx.sid_time = now;
+			++tx->dtx.n_sid;
+		}
+	}
+
+	tx->dtx.silent = true;
+	++tx->dtx.n_frames;
+	stats_inc(STATS_DTX_FRAMES);
+
+	mtx_lock(tx->mtx);
+	tx->ts_ext += af->sampc * tx->ac->crate / tx->ac->srate / af->ch;
+	mtx_unlock(tx->mtx);
+
+	return true;
+}
+
+
 /*
  * Encode audio and send via stream
  *
@@ -400,7 +650,8 @@ static void encode_rtp_send(struct audio *a, struct autx *tx,
 	size_t len;
 	size_t ext_len = 0;
 	uint32_t ts_delta = 0;
-	bool marker = tx->marker;
+	bool marker;
+	uint64_t t0;
 	int err;
 
 	if (!tx->ac || !tx->ac->ench)
@@ -413,6 +664,15 @@ static void encode_rtp_send(struct audio *a, struct autx *tx,
 		return;
 	}
 
+	/* the peer sends the payload of its received stream */
+	if (re_atomic_rlx(&tx->relayed))
+		return;
+
+	if (dtx_suppress(a, tx, af))
+		return;
+
+	marker = tx->marker;
+
 	tx->mb->pos = tx->mb->end = STREAM_PRESZ;
 
 	if (a->level_enabled || bundled) {
@@ -447,10 +707,13 @@ static void encode_rtp_send(struct audio *a, struct autx *tx,
 		tx->mb->end = STREAM_PRESZ + ext_len;
 	}
 
-	len = mbuf_get_space(tx->mb);
+	/* leave room for an SRTP trailer at the end */
+	len = mbuf_get_space(tx->mb) - STREAM_TRAILSZ;
 
+	t0 = tmr_jiffies_usec();
 	err = tx->ac->ench(tx->enc, &marker, mbuf_buf(tx->mb), &len,
 			   af->fmt, af->sampv, af->sampc);
+	aulat_add_since(&tx->lat.encode, t0);
 
 	if ((err & 0xffff0000) == 0x00010000) {
 
@@ -468,37 +731,45 @@ static void encode_rtp_send(struct audio *a, struct autx *tx,
 	tx->mb->pos = STREAM_PRESZ;
 	tx->mb->end = STREAM_PRESZ + ext_len + len;
 
+	/* Convert from audio samplerate to RTP clockrate */
+	sampc_rtp = af->sampc * tx->ac->crate / tx->ac->srate;
+
+	/* The RTP clock rate used for generating the RTP timestamp is
+	 * independent of the number of channels and the encoding
+	 * However, MPA support variable packet durations. Thus, MPA
+	 * should update the ts according to its current internal state.
+	 */
+	frame_size = sampc_rtp / tx->ac->ch;
+
+	/* the relay of a bridged peer also advances the timestamp */
+	mtx_lock(tx->mtx);
+
+	if (re_atomic_rlx(&tx->relayed))
+		goto unlock;
+
 	if (mbuf_get_left(tx->mb)) {
 
 		uint32_t rtp_ts = tx->ts_ext & 0xffffffff;
 
 		if (len) {
-			mtx_lock(a->tx.mtx);
+			t0 = tmr_jiffies_usec();
 			err = stream_send(a->strm, ext_len!=0, marker, -1,
 					  rtp_ts, tx->mb);
-			mtx_unlock(a->tx.mtx);
+			aulat_add_since(&tx->lat.send, t0);
 			if (err)
-				goto out;
+				goto unlock;
 		}
 
 		if (ts_delta) {
 			tx->ts_ext += ts_delta;
-			goto out;
+			goto unlock;
 		}
 	}
 
-	/* Convert from audio samplerate to RTP clockrate */
-	sampc_rtp = af->sampc * tx->ac->crate / tx->ac->srate;
-
-	/* The RTP clock rate used for generating the RTP timestamp is
-	 * independent of the number of channels and the encoding
-	 * However, MPA support variable packet durations. Thus, MPA
-	 * should update the ts according to its current internal state.
-	 */
-	frame_size = sampc_rtp / tx->ac->ch;
-
 	tx->ts_ext += (uint32_t)frame_size;
 
+ unlock:
+	mtx_unlock(tx->mtx);
  out:
 	tx->marker = false;
 }
@@ -517,6 +788,7 @@ static void poll_aubuf_tx(struct audio *a)
 	struct le *le;
 	uint32_t srate;
 	uint8_t ch;
+	unsigned i = 0;
 	int err = 0;
 
 	sz = aufmt_sample_size(tx->src_fmt);
@@ -529,14 +801,28 @@ static void poll_aubuf_tx(struct audio *a)
 
 	/* timed read from audio-buffer */
 	auframe_init(&af, tx->src_fmt, sampv, sampc, srate, ch);
-	aubuf_read_auframe(tx->aubuf, &af);
+
+	aulat_add(&tx->lat.aubuf, buf_usec(autx_buf_size(tx), tx->src_fmt,
+					   srate, ch));
+
+	if (tx->ring)
+		(void)auring_read_auframe(tx->ring, &af);
+	else
+		aubuf_read_auframe(tx->aubuf, &af);
 
 	/* Process exactly one audio-frame in list order */
 	for (le = tx->filtl.head; le; le = le->next) {
 		struct aufilt_enc_st *st = le->data;
+		uint64_t t0;
 
-		if (st->af && st->af->ench)
-			err |= st->af->ench(st, &af);
+		if (!st->af || !st->af->ench)
+			continue;
+
+		t0 = tmr_jiffies_usec();
+		err |= st->af->ench(st, &af);
+
+		if (i < AULAT_FILT_MAX)
+			aulat_add_since(&tx->lat.filt[i++], t0);
 	}
 	if (err) {
 		warning("audio: aufilter encode: %m\n", err);
@@ -561,7 +847,7 @@ static void check_telev(struct audio *a, struct autx *tx)
 	bool marker = false;
 	int err;
 
-	mb = mbuf_alloc(STREAM_PRESZ + 64);
+	mb = mbuf_alloc(STREAM_PRESZ + 64 + STREAM_TRAILSZ);
 	if (!mb)
 		return;
 
@@ -569,13 +855,12 @@ static void check_telev(struct audio *a, struct autx *tx)
 
 	mtx_lock(tx->mtx);
 	err = telev_poll(a->telev, &marker, mb);
+	if (!err && marker)
+		tx->ts_tel = (uint32_t)tx->ts_ext;
 	mtx_unlock(tx->mtx);
 	if (err)
 		goto out;
 
-	if (marker)
-		tx->ts_tel = (uint32_t)tx->ts_ext;
-
 	fmt = sdp_media_rformat(stream_sdpmedia(audio_strm(a)), telev_rtpfmt);
 	if (!fmt)
 		goto out;
@@ -627,11 +912,54 @@ static void auplay_write_handler(struct auframe *af, void *arg)
 	struct audio *a = arg;
 	struct aurx *rx = &a->rx;
 	size_t num_bytes = auframe_size(af);
+	uint64_t now = tmr_jiffies_usec();
+
+	/* deviation of the player period from the packet time */
+	if (rx->lat.play_last) {
+		int64_t d = (int64_t)(now - rx->lat.play_last) -
+			rx->auplay_prm.ptime * 1000;
+
+		aulat_add(&rx->lat.auplay, (uint32_t)(d < 0 ? -d : d));
+	}
+
+	rx->lat.play_last = now;
+
+	aulat_add(&rx->lat.aubuf, buf_usec(aurx_buf_size(rx), af->fmt,
+					   af->srate, af->ch));
+
+	/* silence of the remote side, fill with comfort noise */
+	if (re_atomic_rlx(&rx->cn.active) && af->fmt == AUFMT_S16LE &&
+	    aurx_buf_size(rx) < num_bytes) {
+
+		dtx_cn_generate(&rx->cn.seed, af->sampv, af->sampc,
+				re_atomic_rlx(&rx->cn.level));
+		++rx->cn.n_frames;
+		return;
+	}
+
+	/* lock-free path, wait until the ring is filled to the minimum */
+	if (rx->ring) {
+
+		if (!re_atomic_rlx(&rx->aubuf_started)) {
+			auframe_mute(af);
+			return;
+		}
+
+		if (auring_read_auframe(rx->ring, af)) {
+			++rx->stats.aubuf_underrun;
+			stats_inc(STATS_AUBUF_UNDERRUN);
+			re_atomic_rlx_set(&rx->aubuf_started, false);
+		}
+
+		return;
+	}
 
 	mtx_lock(rx->mtx);
-	if (rx->aubuf_started && aubuf_cur_size(rx->aubuf) < num_bytes) {
+	if (re_atomic_rlx(&rx->aubuf_started) &&
+	    aubuf_cur_size(rx->aubuf) < num_bytes) {
 
 		++rx->stats.aubuf_underrun;
+		stats_inc(STATS_AUBUF_UNDERRUN);
 
 #if 0
 		debug("audio: rx aubuf underrun (total %llu)\n",
@@ -658,9 +986,20 @@ static void ausrc_read_handler(struct auframe *af, void *arg)
 	enum aufmt fmt;
 	unsigned i;
 
-	mtx_lock(tx->mtx);
-	fmt = tx->src_fmt;
-	mtx_unlock(tx->mtx);
+	if (af->timestamp) {
+		aulat_add(&tx->lat.ausrc,
+			  aulat_rel_delay(&tx->lat.rel, tmr_jiffies_usec(),
+					  af->timestamp));
+	}
+
+	if (tx->ring) {
+		fmt = tx->src_fmt;
+	}
+	else {
+		mtx_lock(tx->mtx);
+		fmt = tx->src_fmt;
+		mtx_unlock(tx->mtx);
+	}
 
 	if (fmt != af->fmt) {
 		warning("audio: ausrc format mismatch:"
@@ -673,25 +1012,33 @@ static void ausrc_read_handler(struct auframe *af, void *arg)
 	if (tx->muted)
 		auframe_mute(af);
 
-	if (aubuf_cur_size(tx->aubuf) >= tx->aubuf_maxsz) {
+	if (tx->ring) {
+		/* a full ring drops the new frame */
+		if (auring_write_auframe(tx->ring, af)) {
+			++tx->stats.aubuf_overrun;
+			stats_inc(STATS_AUBUF_OVERRUN);
+		}
+	}
+	else {
+		if (aubuf_cur_size(tx->aubuf) >= tx->aubuf_maxsz) {
 
-		++tx->stats.aubuf_overrun;
+			++tx->stats.aubuf_overrun;
+			stats_inc(STATS_AUBUF_OVERRUN);
 
-		debug("audio: tx aubuf overrun (total %llu)\n",
-		      tx->stats.aubuf_overrun);
-	}
+			debug("audio: tx aubuf overrun (total %llu)\n",
+			      tx->stats.aubuf_overrun);
+		}
 
-	(void)aubuf_write_auframe(tx->aubuf, af);
+		(void)aubuf_write_auframe(tx->aubuf, af);
+	}
 
-	mtx_lock(tx->mtx);
-	tx->aubuf_started = true;
-	mtx_unlock(tx->mtx);
+	re_atomic_rlx_set(&tx->aubuf_started, true);
 
 	if (a->cfg.txmode != AUDIO_MODE_POLL)
 		return;
 
 	for (i=0; i<16; i++) {
-		if (aubuf_cur_size(tx->aubuf) < tx->psize)
+		if (autx_buf_size(tx) < tx->psize)
 			break;
 
 		poll_aubuf_tx(a);
@@ -740,6 +1087,29 @@ static bool audio_is_telev(struct audio *a, int pt)
 }
 
 
+static void handle_cn(struct audio *a, struct mbuf *mb)
+{
+	struct aurx *rx = &a->rx;
+	double level;
+
+	if (dtx_cn_decode(&level, mb))
+		return;
+
+	re_atomic_rlx_set(&rx->cn.level, (int)level);
+	re_atomic_rlx_set(&rx->cn.active, true);
+	++rx->cn.n_sid;
+}
+
+
+static bool audio_is_cn(struct audio *a, int pt)
+{
+	const struct sdp_format *lc;
+
+	lc = sdp_media_lformat(stream_sdpmedia(a->strm), pt);
+	return  lc && !str_casecmp(lc->name, cn_rtpfmt);
+}
+
+
 static int stream_pt_handler(uint8_t pt, struct mbuf *mb, void *arg)
 {
 	struct audio *a = arg;
@@ -757,6 +1127,12 @@ static int stream_pt_handler(uint8_t pt, struct mbuf *mb, void *arg)
 		return ENODATA;
 	}
 
+	/* Comfort noise? */
+	if (lc && !str_casecmp(lc->name, cn_rtpfmt)) {
+		handle_cn(a, mb);
+		return ENODATA;
+	}
+
 	if (!lc)
 		return ENOENT;
 
@@ -770,15 +1146,23 @@ static int stream_pt_handler(uint8_t pt, struct mbuf *mb, void *arg)
 
 static int process_decfilt(struct aurx *rx, struct auframe *af)
 {
+	unsigned i = 0;
 	int err = 0;
 
 	/* Process exactly one audio-frame in reverse list order */
 	mtx_lock(rx->mtx);
 	for (struct le *le = rx->filtl.tail; le; le = le->prev) {
 		struct aufilt_dec_st *st = le->data;
+		uint64_t t0;
 
-		if (st->af && st->af->dech)
-			err = st->af->dech(st, af);
+		if (!st->af || !st->af->dech)
+			continue;
+
+		t0 = tmr_jiffies_usec();
+		err = st->af->dech(st, af);
+
+		if (i < AULAT_FILT_MAX)
+			aulat_add_since(&rx->lat.filt[i++], t0);
 
 		if (err)
 			break;
@@ -793,14 +1177,19 @@ static int rx_push_aubuf(struct aurx *rx, const struct auframe *af)
 {
 	int err;
 
-	if (aubuf_cur_size(rx->aubuf) >= rx->aubuf_maxsz) {
+	if (aurx_buf_size(rx) >= rx->aubuf_maxsz) {
 
 		++rx->stats.aubuf_overrun;
+		stats_inc(STATS_AUBUF_OVERRUN);
 
 #if 0
 		debug("audio: rx aubuf overrun (total %llu)\n",
 		      rx->stats.aubuf_overrun);
 #endif
+
+		/* the ring cannot drop old frames, drop the new one */
+		if (rx->ring)
+			return 0;
 	}
 
 	if (rx->auplay_prm.srate != af->srate || rx->auplay_prm.ch != af->ch) {
@@ -817,16 +1206,16 @@ static int rx_push_aubuf(struct aurx *rx, const struct auframe *af)
 		       );
 	}
 
-	err = aubuf_write_auframe(rx->aubuf, af);
+	if (rx->ring)
+		err = auring_write_auframe(rx->ring, af);
+	else
+		err = aubuf_write_auframe(rx->aubuf, af);
 	if (err)
 		return err;
 
-	mtx_lock(rx->mtx);
-	if (!rx->aubuf_started &&
-	    (aubuf_cur_size(rx->aubuf) >= rx->aubuf_minsz))
-		rx->aubuf_started = true;
-
-	mtx_unlock(rx->mtx);
+	if (!re_atomic_rlx(&rx->aubuf_started) &&
+	    (aurx_buf_size(rx) >= rx->aubuf_minsz))
+		re_atomic_rlx_set(&rx->aubuf_started, true);
 
 	return 0;
 }
@@ -841,6 +1230,7 @@ static int aurx_stream_decode(struct aurx *rx, const struct rtp_header *hdr,
 	int err = 0;
 	const struct aucodec *ac = rx->ac;
 	bool flush = rx->ssrc != hdr->ssrc;
+	uint64_t t0, ts;
 
 	/* No decoder set */
 	if (!ac)
@@ -848,6 +1238,23 @@ static int aurx_stream_decode(struct aurx *rx, const struct rtp_header *hdr,
 
 	rx->ssrc = hdr->ssrc;
 
+	t0 = tmr_jiffies_usec();
+
+	if (flush)
+		rx->lat.rel.set = false;
+
+	if (mbuf_get_left(mb) && !drop) {
+		uint32_t delay;
+
+		ts = timestamp_calc_extended(rx->ts_recv.num_wraps, hdr->ts);
+
+		delay = aulat_rel_delay(&rx->lat.rel, t0,
+					ts * AUDIO_TIMEBASE / ac->crate);
+
+		aulat_add(&rx->lat.jbuf, delay);
+		playout_arrival(rx->po, delay);
+	}
+
 	/* TODO: PLC */
 	if (lostc && ac->plch) {
 
@@ -872,36 +1279,206 @@ static int aurx_stream_decode(struct aurx *rx, const struct rtp_header *hdr,
 		}
 
 		rx->last_sampc = sampc;
+		re_atomic_rlx_set(&rx->cn.active, false);
 	}
 	else {
 		/* no PLC in the codec, might be done in filters below */
 		sampc = 0;
 	}
 
+	if (sampc)
+		aulat_add_since(&rx->lat.decode, t0);
+
 	auframe_init(&af, rx->dec_fmt, rx->sampv, sampc, ac->srate, ac->ch);
 	af.timestamp = ((uint64_t) hdr->ts) * AUDIO_TIMEBASE / ac->crate;
 
 	if (drop) {
-		aubuf_drop_auframe(rx->aubuf, &af);
+		if (!rx->ring)
+			aubuf_drop_auframe(rx->aubuf, &af);
 		goto out;
 	}
 
-	if (flush)
+	if (flush) {
 		aubuf_flush(rx->aubuf);
+		auring_flush(rx->ring);
+	}
 
 	err = process_decfilt(rx, &af);
 	if (err)
 		goto out;
 
-	if (!rx->aubuf)
+	if (!rx->aubuf && !rx->ring)
 		goto out;
 
+	/* stretch towards the target level once the buffer plays */
+	if (rx->po && re_atomic_rlx(&rx->aubuf_started)) {
+		err = playout_process(rx->po, &af,
+				      buf_usec(aurx_buf_size(rx), af.fmt,
+					       af.srate, af.ch));
+		if (err)
+			goto out;
+	}
+
 	err = rx_push_aubuf(rx, &af);
  out:
 	return err;
 }
 
 
+/* Filters that only adapt the sample format or rate */
+static bool relay_adapter(const struct aufilt *af)
+{
+	return af && (!str_casecmp(af->name, "auconv") ||
+		      !str_casecmp(af->name, "auresamp"));
+}
+
+
+static bool fmtp_equal(const char *p1, const char *p2)
+{
+	if (!str_isset(p1) || !str_isset(p2))
+		return str_isset(p1) == str_isset(p2);
+
+	return 0 == str_casecmp(p1, p2);
+}
+
+
+/* Both legs negotiated the same format parameters in both directions */
+static bool relay_fmtp_match(const struct audio *a, const struct audio *peer)
+{
+	const struct sdp_format *rxf, *txf;
+
+	rxf = sdp_media_lformat(stream_sdpmedia(a->strm), a->rx.pt);
+	txf = sdp_media_lformat(stream_sdpmedia(peer->strm),
+				stream_pt_enc(peer->strm));
+	if (!rxf || !txf)
+		return false;
+
+	return fmtp_equal(rxf->params, txf->params) &&
+		fmtp_equal(rxf->rparams, txf->rparams);
+}
+
+
+/* The peer sends with the codec of the received payload, no processing */
+static bool relay_compatible(const struct audio *a, const struct audio *peer)
+{
+	struct le *le;
+
+	if (!a->rx.ac || a->rx.ac != peer->tx.ac)
+		return false;
+
+	if (a->conference || peer->conference || peer->tx.muted)
+		return false;
+
+	if (a->tx.ptime != peer->tx.ptime || !relay_fmtp_match(a, peer))
+		return false;
+
+	/* the packets are sent without RTP header extensions */
+	if (peer->level_enabled ||
+	    bundle_state(stream_bundle(peer->strm)) != BUNDLE_NONE)
+		return false;
+
+	for (le = list_head(&a->rx.filtl); le; le = le->next) {
+		const struct aufilt_dec_st *st = le->data;
+
+		if (!relay_adapter(st->af))
+			return false;
+	}
+
+	for (le = list_head(&peer->tx.filtl); le; le = le->next) {
+		const struct aufilt_enc_st *st = le->data;
+
+		if (!relay_adapter(st->af))
+			return false;
+	}
+
+	return true;
+}
+
+
+/*
+ * Send the payload of a received packet with the RTP session of the
+ * peer. The peer renumbers the sequence, the timestamp continues the
+ * timeline of the peer. Returns false if the packet must be decoded.
+ *
+ * @note This function has REAL-TIME properties
+ */
+static bool relay_send(struct audio *a, const struct rtp_header *hdr,
+		       struct mbuf *mb)
+{
+	struct aurx *rx = &a->rx;
+	struct audio *peer;
+	bool relayed = false;
+	uint64_t ext;
+	uint32_t ts;
+	bool marker;
+	int err;
+
+	mtx_lock(rx->mtx);
+
+	peer = a->relay.peer;
+	if (!peer)
+		goto out;
+
+	mtx_lock(peer->tx.mtx);
+
+	if (hdr->pt != rx->pt || !relay_compatible(a, peer)) {
+
+		/* the encoder of the peer takes over */
+		if (re_atomic_rlx(&peer->tx.relayed)) {
+			re_atomic_rlx_set(&peer->tx.relayed, false);
+			peer->tx.marker = true;
+			a->relay.set = false;
+		}
+
+		goto unlock;
+	}
+
+	relayed = true;
+	marker  = hdr->m;
+
+	if (!a->relay.set || a->relay.ssrc != hdr->ssrc) {
+		a->relay.ts_offset = (uint32_t)peer->tx.ts_ext - hdr->ts;
+		a->relay.ssrc      = hdr->ssrc;
+		a->relay.set       = true;
+		marker = true;
+	}
+
+	ts = hdr->ts + a->relay.ts_offset;
+
+	a->relay.mb->pos = a->relay.mb->end = STREAM_PRESZ;
+	err = mbuf_write_mem(a->relay.mb, mbuf_buf(mb), mbuf_get_left(mb));
+	if (err)
+		goto unlock;
+
+	a->relay.mb->pos = STREAM_PRESZ;
+
+	re_atomic_rlx_set(&peer->tx.relayed, true);
+
+	/* nothing is decoded, the player must not count underruns */
+	re_atomic_rlx_set(&rx->aubuf_started, false);
+
+	err = stream_send(peer->strm, false, marker, -1, ts, a->relay.mb);
+	if (err)
+		warning("audio: relay: stream_send %m\n", err);
+	else
+		++a->relay.n_pkt;
+
+	/* the encoder continues after this packet if the relay stops */
+	ts += peer->tx.ptime * peer->tx.ac->crate / 1000;
+
+	ext = peer->tx.ts_ext;
+	if ((int32_t)(ts - (uint32_t)ext) > 0)
+		peer->tx.ts_ext = ext + (uint32_t)(ts - (uint32_t)ext);
+
+ unlock:
+	mtx_unlock(peer->tx.mtx);
+ out:
+	mtx_unlock(rx->mtx);
+
+	return relayed;
+}
+
+
 /* Handle incoming stream data from the network */
 static void stream_recv_handler(const struct rtp_header *hdr,
 				struct rtpext *extv, size_t extc,
@@ -921,7 +1498,7 @@ static void stream_recv_handler(const struct rtp_header *hdr,
 	if (!mb)
 		goto out;
 
-	if (audio_is_telev(a, hdr->pt)) {
+	if (audio_is_telev(a, hdr->pt) || audio_is_cn(a, hdr->pt)) {
 		*ignore = true;
 		return;
 	}
@@ -976,6 +1553,9 @@ static void stream_recv_handler(const struct rtp_header *hdr,
 		return;
 	}
 
+	if (!drop && relay_send(a, hdr, mb))
+		return;
+
  out:
 	/* TODO:  what if lostc > 1 ?*/
 	/* PLC should generate lostc frames here. Not only one.
@@ -1010,6 +1590,38 @@ static int add_telev_codec(struct audio *a)
 }
 
 
+/* Offer comfort noise once for each clock rate of the audio codecs */
+static int add_cn_codecs(struct audio *a, const struct list *aucodecl)
+{
+	struct sdp_media *m = stream_sdpmedia(audio_strm(a));
+	struct le *le;
+	char pts[11];
+	int err;
+
+	(void)re_snprintf(pts, sizeof(pts), "%u", CN_PT);
+
+	for (le = list_head(aucodecl); le; le = le->next) {
+
+		const struct aucodec *ac = le->data;
+		bool stat;
+
+		if (sdp_media_format(m, true, NULL, -1, cn_rtpfmt,
+				     ac->crate, -1))
+			continue;
+
+		stat = ac->crate == 8000 && !sdp_media_lformat(m, CN_PT);
+
+		err = sdp_format_add(NULL, m, false, stat ? pts : NULL,
+				     cn_rtpfmt, ac->crate, 1, NULL,
+				     NULL, NULL, false, NULL);
+		if (err)
+			return err;
+	}
+
+	return 0;
+}
+
+
 /**
  * Allocate an audio stream
  *
@@ -1122,6 +1734,8 @@ int audio_alloc(struct audio **ap, struct list *streaml,
 			goto out;
 	}
 
+	re_atomic_rlx_set(&tx->dtx.cn_pt, -1);
+
 	tx->mb = mbuf_alloc(STREAM_PRESZ + 4096);
 	tx->sampv = mem_zalloc(AUDIO_SAMPSZ * aufmt_sample_size(tx->enc_fmt),
 			       NULL);
@@ -1144,6 +1758,12 @@ int audio_alloc(struct audio **ap, struct list *streaml,
 	if (err)
 		goto out;
 
+	if (cfg->audio.dtx) {
+		err = add_cn_codecs(a, aucodecl);
+		if (err)
+			goto out;
+	}
+
 	if (acc && acc->ausrc_mod) {
 
 		tx->module = mem_ref(acc->ausrc_mod);
@@ -1215,7 +1835,7 @@ static int tx_thread(void *arg)
 		sys_msleep(4);
 		mtx_lock(tx->mtx);
 
-		if (!tx->aubuf_started) {
+		if (!re_atomic_rlx(&tx->aubuf_started)) {
 			mtx_unlock(tx->mtx);
 			goto loop;
 		}
@@ -1234,12 +1854,13 @@ static int tx_thread(void *arg)
 
 		/* Now is the time to send */
 
-		if (aubuf_cur_size(tx->aubuf) >= tx->psize) {
+		if (autx_buf_size(tx) >= tx->psize) {
 
 			poll_aubuf_tx(a);
 		}
 		else {
 			++tx->stats.aubuf_underrun;
+			stats_inc(STATS_AUBUF_UNDERRUN);
 
 			debug("audio: thread: tx aubuf underrun"
 			      " (total %llu)\n", tx->stats.aubuf_underrun);
@@ -1281,7 +1902,7 @@ static int autx_print_pipeline(struct re_printf *pf, const struct autx *autx)
 	err = re_hprintf(pf, "audio tx pipeline:  %10s",
 			 autx->as ? autx->as->name : "(src)");
 
-	err |= re_hprintf(pf, " ---> aubuf");
+	err |= re_hprintf(pf, " ---> %s", autx->ring ? "auring" : "aubuf");
 	for (le = list_head(&autx->filtl); le; le = le->next) {
 		struct aufilt_enc_st *st = le->data;
 
@@ -1307,7 +1928,7 @@ static int aurx_print_pipeline(struct re_printf *pf, const struct aurx *rx)
 	err = re_hprintf(pf, "audio rx pipeline:  %10s",
 			 rx->ap ? rx->ap->name : "(play)");
 
-	err |= re_hprintf(pf, " <--- aubuf");
+	err |= re_hprintf(pf, " <--- %s", rx->ring ? "auring" : "aubuf");
 	mtx_lock(rx->mtx);
 	for (le = list_head(&rx->filtl); le; le = le->next) {
 		struct aufilt_dec_st *st = le->data;
@@ -1324,6 +1945,70 @@ static int aurx_print_pipeline(struct re_printf *pf, const struct aurx *rx)
 }
 
 
+static int autx_print_latency(struct re_printf *pf, const struct autx *tx)
+{
+	struct le *le;
+	unsigned i = 0;
+	int err;
+
+	err  = re_hprintf(pf, " tx latency [us]:      p50     p99     max\n");
+	err |= re_hprintf(pf, "       %-10s %H\n", "ausrc",
+			  aulat_debug, &tx->lat.ausrc);
+	err |= re_hprintf(pf, "       %-10s %H\n",
+			  tx->ring ? "auring" : "aubuf",
+			  aulat_debug, &tx->lat.aubuf);
+	mtx_lock(tx->mtx);
+	for (le = list_head(&tx->filtl); le && i < AULAT_FILT_MAX;
+	     le = le->next) {
+		struct aufilt_enc_st *st = le->data;
+
+		if (st->af->ench)
+			err |= re_hprintf(pf, "       %-10s %H\n",
+					  st->af->name,
+					  aulat_debug, &tx->lat.filt[i++]);
+	}
+	mtx_unlock(tx->mtx);
+	err |= re_hprintf(pf, "       %-10s %H\n", "encode",
+			  aulat_debug, &tx->lat.encode);
+	err |= re_hprintf(pf, "       %-10s %H\n", "send",
+			  aulat_debug, &tx->lat.send);
+
+	return err;
+}
+
+
+static int aurx_print_latency(struct re_printf *pf, const struct aurx *rx)
+{
+	struct le *le;
+	unsigned i = 0;
+	int err;
+
+	err  = re_hprintf(pf, " rx latency [us]:      p50     p99     max\n");
+	err |= re_hprintf(pf, "       %-10s %H\n", "jbuf",
+			  aulat_debug, &rx->lat.jbuf);
+	err |= re_hprintf(pf, "       %-10s %H\n", "decode",
+			  aulat_debug, &rx->lat.decode);
+	mtx_lock(rx->mtx);
+	for (le = list_tail(&rx->filtl); le && i < AULAT_FILT_MAX;
+	     le = le->prev) {
+		struct aufilt_dec_st *st = le->data;
+
+		if (st->af->dech)
+			err |= re_hprintf(pf, "       %-10s %H\n",
+					  st->af->name,
+					  aulat_debug, &rx->lat.filt[i++]);
+	}
+	mtx_unlock(rx->mtx);
+	err |= re_hprintf(pf, "       %-10s %H\n",
+			  rx->ring ? "auring" : "aubuf",
+			  aulat_debug, &rx->lat.aubuf);
+	err |= re_hprintf(pf, "       %-10s %H\n", "auplay",
+			  aulat_debug, &rx->lat.auplay);
+
+	return err;
+}
+
+
 /**
  * Setup the audio-filter chain
  *
@@ -1379,7 +2064,9 @@ static int aufilt_setup(struct audio *a, struct list *aufiltl)
 			}
 			else {
 				encst->af = af;
+				mtx_lock(tx->mtx);
 				list_append(&tx->filtl, &encst->le, encst);
+				mtx_unlock(tx->mtx);
 			}
 		}
 
@@ -1442,7 +2129,7 @@ static int start_player(struct aurx *rx, struct audio *a,
 		prm.ptime      = rx->ptime;
 		prm.fmt        = rx->play_fmt;
 
-		if (!rx->aubuf) {
+		if (!rx->aubuf && !rx->ring) {
 			const uint16_t ptime_min = (uint16_t)a->cfg.buffer.min;
 			const uint16_t ptime_max = (uint16_t)a->cfg.buffer.max;
 			sz = aufmt_sample_size(rx->play_fmt);
@@ -1458,16 +2145,39 @@ static int start_player(struct aurx *rx, struct audio *a,
 			      " [%zu - %zu bytes]\n",
 			      ptime_min, ptime_max, min_sz, max_sz);
 
-			err = aubuf_alloc(&rx->aubuf, min_sz, max_sz);
-			if (err) {
-				warning("audio: aubuf alloc error (%m)\n",
-					err);
-				return err;
+			/* the ring has no adaptive mode */
+			if (a->cfg.ring && !a->cfg.adaptive) {
+				err = auring_alloc(&rx->ring, 2 * max_sz);
+				if (err) {
+					warning("audio: auring alloc error"
+						" (%m)\n", err);
+					return err;
+				}
+			}
+			else {
+				err = aubuf_alloc(&rx->aubuf, min_sz, max_sz);
+				if (err) {
+					warning("audio: aubuf alloc error"
+						" (%m)\n", err);
+					return err;
+				}
+
+				aubuf_set_mode(rx->aubuf, a->cfg.adaptive ?
+					       AUBUF_ADAPTIVE : AUBUF_FIXED);
+				aubuf_set_silence(rx->aubuf, a->cfg.silence);
+			}
+
+			if (a->cfg.stretch && rx->play_fmt != AUFMT_S16LE) {
+				warning("audio: time-stretching needs"
+					" s16 playback\n");
+			}
+			else if (a->cfg.stretch) {
+				err = playout_alloc(&rx->po, prm.srate,
+						    prm.ch, &a->cfg.buffer);
+				if (err)
+					return err;
 			}
 
-			aubuf_set_mode(rx->aubuf, a->cfg.adaptive ?
-				       AUBUF_ADAPTIVE : AUBUF_FIXED);
-			aubuf_set_silence(rx->aubuf, a->cfg.silence);
 			rx->aubuf_minsz = min_sz;
 			rx->aubuf_maxsz = max_sz;
 		}
@@ -1491,8 +2201,11 @@ static int start_player(struct aurx *rx, struct audio *a,
 	}
 
 out:
-	if (err)
+	if (err) {
 		rx->aubuf    = mem_deref(rx->aubuf);
+		rx->ring     = mem_deref(rx->ring);
+		rx->po       = mem_deref(rx->po);
+	}
 
 	return 0;
 }
@@ -1538,7 +2251,13 @@ static int start_source(struct autx *tx, struct audio *a, struct list *ausrcl)
 		tx->psize = psize_alloc;
 		tx->aubuf_maxsz = tx->psize * 30;
 
-		if (!tx->aubuf) {
+		/* room for a larger sample format set by ausrc_alloc */
+		if (a->cfg.ring && !tx->ring) {
+			err = auring_alloc(&tx->ring, 2 * tx->aubuf_maxsz);
+			if (err)
+				return err;
+		}
+		else if (!a->cfg.ring && !tx->aubuf) {
 			err = aubuf_alloc(&tx->aubuf, tx->psize,
 					  tx->aubuf_maxsz);
 			if (err)
@@ -1563,8 +2282,15 @@ static int start_source(struct autx *tx, struct audio *a, struct list *ausrcl)
 		if (psize_alloc != tx->psize) {
 			tx->ausrc_prm = prm;
 			tx->aubuf_maxsz = tx->psize * 30;
-			err = aubuf_resize(tx->aubuf, tx->psize,
-					   tx->aubuf_maxsz);
+
+			if (tx->ring) {
+				tx->aubuf_maxsz = min(tx->aubuf_maxsz,
+						      auring_size(tx->ring));
+			}
+			else {
+				err = aubuf_resize(tx->aubuf, tx->psize,
+						   tx->aubuf_maxsz);
+			}
 			if (err) {
 				mtx_unlock(tx->mtx);
 				return err;
@@ -1646,6 +2372,8 @@ int audio_start(struct audio *a)
 		}
 
 		a->started = true;
+
+		bridge_join(a);
 	}
 
 	return err;
@@ -1760,10 +2488,13 @@ int audio_encoder_set(struct audio *a, const struct aucodec *ac,
 			list_flush(&tx->filtl);
 			mtx_unlock(a->tx.mtx);
 			aubuf_flush(tx->aubuf);
+			auring_flush(tx->ring);
 		}
 
+		mtx_lock(tx->mtx);
 		tx->enc = mem_deref(tx->enc);
 		tx->ac = ac;
+		mtx_unlock(tx->mtx);
 	}
 
 	if (ac->encupdh) {
@@ -1786,6 +2517,15 @@ int audio_encoder_set(struct audio *a, const struct aucodec *ac,
 
 	telev_set_srate(a->telev, ac->crate);
 
+	/* the CN payload type of the remote side, for the tx thread */
+	if (a->cfg.dtx) {
+		const struct sdp_format *cn;
+
+		cn = sdp_media_format(stream_sdpmedia(a->strm), false, NULL,
+				      -1, cn_rtpfmt, ac->crate, -1);
+		re_atomic_rlx_set(&tx->dtx.cn_pt, cn ? cn->pt : -1);
+	}
+
 	/* use a codec-specific ptime */
 	if (ac->ptime) {
 		const size_t sz = aufmt_sample_size(tx->src_fmt);
@@ -1832,6 +2572,7 @@ int audio_decoder_set(struct audio *a, const struct aucodec *ac,
 	if (reset || ac != rx->ac) {
 		rx->auplay = mem_deref(rx->auplay);
 		aubuf_flush(rx->aubuf);
+		auring_flush(rx->ring);
 		stream_flush(a->strm);
 
 		/* Reset audio filter chain */
@@ -2120,7 +2861,7 @@ int audio_debug(struct re_printf *pf, const struct audio *a)
 	err |= re_hprintf(pf, "       aubuf: %H"
 			  " (cur %.2fms, max %.2fms, or %llu, ur %llu)\n",
 			  aubuf_debug, tx->aubuf,
-			  calc_ptime(aubuf_cur_size(tx->aubuf)/sztx,
+			  calc_ptime(autx_buf_size(tx)/sztx,
 				     tx->ausrc_prm.srate,
 				     tx->ausrc_prm.ch),
 			  calc_ptime(tx->aubuf_maxsz/sztx,
@@ -2128,6 +2869,14 @@ int audio_debug(struct re_printf *pf, const struct audio *a)
 				     tx->ausrc_prm.ch),
 			  tx->stats.aubuf_overrun,
 			  tx->stats.aubuf_underrun);
+	if (tx->ring)
+		err |= re_hprintf(pf, "       auring: %zu bytes\n",
+				  auring_size(tx->ring));
+	if (a->cfg.dtx)
+		err |= re_hprintf(pf, "       dtx: %s, suppressed %llu,"
+				  " sid %llu\n",
+				  tx->dtx.silent ? "silence" : "speech",
+				  tx->dtx.n_frames, tx->dtx.n_sid);
 	err |= re_hprintf(pf, "       source: %s,%s %s\n",
 			  tx->as ? tx->as->name : "none",
 			  tx->device,
@@ -2141,7 +2890,7 @@ int audio_debug(struct re_printf *pf, const struct audio *a)
 	err |= re_hprintf(pf, "       aubuf: %H"
 			  " (cur %.2fms, max %.2fms, or %llu, ur %llu)\n",
 			  aubuf_debug, rx->aubuf,
-			  calc_ptime(aubuf_cur_size(rx->aubuf)/szrx,
+			  calc_ptime(aurx_buf_size(rx)/szrx,
 				     rx->auplay_prm.srate,
 				     rx->auplay_prm.ch),
 			  calc_ptime(rx->aubuf_maxsz/szrx,
@@ -2150,6 +2899,21 @@ int audio_debug(struct re_printf *pf, const struct audio *a)
 			  rx->stats.aubuf_overrun,
 			  rx->stats.aubuf_underrun
 			  );
+	if (rx->ring)
+		err |= re_hprintf(pf, "       auring: %zu bytes\n",
+				  auring_size(rx->ring));
+	if (rx->po)
+		err |= re_hprintf(pf, "       stretch: %H\n",
+				  playout_debug, rx->po);
+	if (a->relay.peer)
+		err |= re_hprintf(pf, "       relay: %s, %llu packets\n",
+				  re_atomic_rlx(&a->relay.peer->tx.relayed) ?
+				  "active" : "decoding", a->relay.n_pkt);
+	if (rx->cn.n_sid)
+		err |= re_hprintf(pf, "       cn: level %d dBov, sid %llu,"
+				  " noise frames %llu\n",
+				  re_atomic_rlx(&rx->cn.level),
+				  rx->cn.n_sid, rx->cn.n_frames);
 	err |= re_hprintf(pf, "       player: %s,%s %s\n",
 			  rx->ap ? rx->ap->name : "none",
 			  rx->device,
@@ -2174,12 +2938,124 @@ int audio_debug(struct re_printf *pf, const struct audio *a)
 			  autx_print_pipeline, tx,
 			  aurx_print_pipeline, rx);
 
+	err |= re_hprintf(pf, "%H%H",
+			  autx_print_latency, tx,
+			  aurx_print_latency, rx);
+
 	err |= stream_debug(pf, a->strm);
 
 	return err;
 }
 
 
+static int autx_latency_json(struct odict *od, const struct autx *tx)
+{
+	struct odict *filt = NULL;
+	struct le *le;
+	unsigned i = 0;
+	int err;
+
+	err = odict_alloc(&filt, 8);
+	if (err)
+		return err;
+
+	mtx_lock(tx->mtx);
+	for (le = list_head(&tx->filtl); le && i < AULAT_FILT_MAX;
+	     le = le->next) {
+		struct aufilt_enc_st *st = le->data;
+
+		if (st->af->ench)
+			err |= aulat_json_api(filt, st->af->name,
+					      &tx->lat.filt[i++]);
+	}
+	mtx_unlock(tx->mtx);
+
+	err |= aulat_json_api(od, "ausrc", &tx->lat.ausrc);
+	err |= aulat_json_api(od, "aubuf", &tx->lat.aubuf);
+	err |= odict_entry_add(od, "filters", ODICT_OBJECT, filt);
+	err |= aulat_json_api(od, "encode", &tx->lat.encode);
+	err |= aulat_json_api(od, "send", &tx->lat.send);
+
+	mem_deref(filt);
+
+	return err;
+}
+
+
+static int aurx_latency_json(struct odict *od, const struct aurx *rx)
+{
+	struct odict *filt = NULL;
+	struct le *le;
+	unsigned i = 0;
+	int err;
+
+	err = odict_alloc(&filt, 8);
+	if (err)
+		return err;
+
+	mtx_lock(rx->mtx);
+	for (le = list_tail(&rx->filtl); le && i < AULAT_FILT_MAX;
+	     le = le->prev) {
+		struct aufilt_dec_st *st = le->data;
+
+		if (st->af->dech)
+			err |= aulat_json_api(filt, st->af->name,
+					      &rx->lat.filt[i++]);
+	}
+	mtx_unlock(rx->mtx);
+
+	err |= aulat_json_api(od, "jbuf", &rx->lat.jbuf);
+	err |= aulat_json_api(od, "decode", &rx->lat.decode);
+	err |= odict_entry_add(od, "filters", ODICT_OBJECT, filt);
+	err |= aulat_json_api(od, "aubuf", &rx->lat.aubuf);
+	err |= aulat_json_api(od, "auplay", &rx->lat.auplay);
+
+	mem_deref(filt);
+
+	return err;
+}
+
+
+/**
+ * Encode the per-stage latency of the audio pipeline in JSON
+ *
+ * Each stage has the keys "p50", "p99" and "max" in [us] and the number
+ * of samples "n".
+ *
+ * @param od  Dictionary to encode into
+ * @param a   Audio object
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int audio_latency_json_api(struct odict *od, const struct audio *a)
+{
+	struct odict *tx = NULL, *rx = NULL;
+	int err;
+
+	if (!od || !a)
+		return EINVAL;
+
+	err  = odict_alloc(&tx, 8);
+	err |= odict_alloc(&rx, 8);
+	if (err)
+		goto out;
+
+	err  = autx_latency_json(tx, &a->tx);
+	err |= aurx_latency_json(rx, &a->rx);
+	if (err)
+		goto out;
+
+	err  = odict_entry_add(od, "tx", ODICT_OBJECT, tx);
+	err |= odict_entry_add(od, "rx", ODICT_OBJECT, rx);
+
+ out:
+	mem_deref(tx);
+	mem_deref(rx);
+
+	return err;
+}
+
+
 /**
  * Set the audio source and player device name. This function does not
  * change the state of the audio source/player.
@@ -2228,6 +3104,7 @@ int audio_set_source(struct audio *au, const char *mod, const char *device)
 	tx = &au->tx;
 
 	/* stop the audio device first */
+	bridge_leave(au);
 	tx->ausrc = mem_deref(tx->ausrc);
 
 	if (str_isset(mod)) {
@@ -2269,6 +3146,7 @@ int audio_set_player(struct audio *a, const char *mod, const char *device)
 	rx = &a->rx;
 
 	/* stop the audio device first */
+	bridge_leave(a);
 	rx->auplay = mem_deref(rx->auplay);
 
 	if (str_isset(mod)) {
@@ -2351,7 +3229,7 @@ bool audio_rxaubuf_started(const struct audio *au)
 
 	rx = &au->rx;
 
-	return rx->aubuf_started;
+	return re_atomic_rlx(&rx->aubuf_started);
 }
 
 
@@ -2402,6 +3280,90 @@ bool audio_is_conference(const struct audio *au)
 }
 
 
+static void relay_set(struct audio *a, struct audio *peer)
+{
+	struct audio *old;
+
+	mtx_lock(a->rx.mtx);
+	old = a->relay.peer;
+	a->relay.peer = peer;
+	a->relay.set  = false;
+	mtx_unlock(a->rx.mtx);
+
+	if (old && old != peer)
+		re_atomic_rlx_set(&old->tx.relayed, false);
+}
+
+
+static void relay_detach(struct audio *a)
+{
+	struct audio *old = a->relay.peer;
+
+	if (!old)
+		return;
+
+	relay_set(a, NULL);
+
+	if (old != a && old->relay.peer == a)
+		relay_set(old, NULL);
+}
+
+
+static int relay_mb_alloc(struct audio *a)
+{
+	if (a->relay.mb)
+		return 0;
+
+	a->relay.mb = mbuf_alloc(STREAM_PRESZ + 4096 + STREAM_TRAILSZ);
+
+	return a->relay.mb ? 0 : ENOMEM;
+}
+
+
+/**
+ * Relay the received audio payload between two audio streams
+ *
+ * The RTP payload received on one stream is sent unchanged on the other
+ * stream, in both directions, while both use the same codec and no audio
+ * filter other than format and rate adapters is active. Otherwise the
+ * payload is decoded and encoded as usual, so the audio devices of the
+ * two streams should be bridged as well (e.g. with aubridge). Two streams
+ * on crossed aubridge devices are relayed when they are started.
+ *
+ * @param a    Audio object
+ * @param peer Peer audio object, a itself for echo, NULL to stop
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int audio_set_relay(struct audio *a, struct audio *peer)
+{
+	int err;
+
+	if (!a)
+		return EINVAL;
+
+	if (peer) {
+		err  = relay_mb_alloc(a);
+		err |= relay_mb_alloc(peer);
+		if (err)
+			return err;
+	}
+
+	relay_detach(a);
+
+	if (!peer)
+		return 0;
+
+	relay_detach(peer);
+
+	relay_set(a, peer);
+	if (peer != a)
+		relay_set(peer, a);
+
+	return 0;
+}
+
+
 /**
  * Get audio codec of audio stream
  *
@@ -0,0 +1,272 @@
+/**
+ * @file aug711.c  G.711 batch encode and decode
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined (__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+
+
+/*
+ * The scalar G.711 functions of librem branch on the sign of every
+ * sample, which speech makes unpredictable. The encoder here uses one
+ * table for all 65536 sample values, built once from the scalar
+ * functions, so the result is the same by construction.
+ *
+ * The decoder expands the code with shifts and masks, eight samples at
+ * a time with SSE2 or NEON when the compiler targets them. The portable
+ * fallback uses the tables of librem.
+ */
+
+
+static uint8_t ulaw_tab[65536];
+static uint8_t alaw_tab[65536];
+static once_flag tab_once = ONCE_FLAG_INIT;
+
+
+static void tab_init(void)
+{
+	uint32_t i;
+
+	for (i=0; i<65536; i++) {
+		ulaw_tab[i] = g711_pcm2ulaw((int16_t)i);
+		alaw_tab[i] = g711_pcm2alaw((int16_t)i);
+	}
+}
+
+
+/**
+ * Encode 16-bit samples to U-law
+ *
+ * @param dst Buffer for n U-law bytes
+ * @param src Signed 16-bit samples
+ * @param n   Number of samples
+ */
+void aug711_pcm2ulaw(uint8_t *dst, const int16_t *src, size_t n)
+{
+	size_t i;
+
+	if (!dst || !src)
+		return;
+
+	call_once(&tab_once, tab_init);
+
+	for (i=0; i<n; i++)
+		dst[i] = ulaw_tab[(uint16_t)src[i]];
+}
+
+
+/**
+ * Encode 16-bit samples to A-law
+ *
+ * @param dst Buffer for n A-law bytes
+ * @param src Signed 16-bit samples
+ * @param n   Number of samples
+ */
+void aug711_pcm2alaw(uint8_t *dst, const int16_t *src, size_t n)
+{
+	size_t i;
+
+	if (!dst || !src)
+		return;
+
+	call_once(&tab_once, tab_init);
+
+	for (i=0; i<n; i++)
+		dst[i] = alaw_tab[(uint16_t)src[i]];
+}
+
+
+#if defined (__SSE2__)
+/* Shift each lane of v left by the lane of s, s in [0, 7] */
+static inline __m128i sllv_epi16(__m128i v, __m128i s)
+{
+	const __m128i one = _mm_set1_epi16(1);
+	const __m128i two = _mm_set1_epi16(2);
+	const __m128i four = _mm_set1_epi16(4);
+	__m128i m;
+
+	m = _mm_cmpeq_epi16(_mm_and_si128(s, one), one);
+	v = _mm_add_epi16(v, _mm_and_si128(v, m));
+
+	m = _mm_cmpeq_epi16(_mm_and_si128(s, two), two);
+	v = _mm_or_si128(_mm_andnot_si128(m, v),
+			 _mm_and_si128(m, _mm_slli_epi16(v, 2)));
+
+	m = _mm_cmpeq_epi16(_mm_and_si128(s, four), four);
+	v = _mm_or_si128(_mm_andnot_si128(m, v),
+			 _mm_and_si128(m, _mm_slli_epi16(v, 4)));
+
+	return v;
+}
+
+
+/* u is the complemented U-law code in 16-bit lanes */
+static inline __m128i ulaw_expand(__m128i u)
+{
+	const __m128i bias = _mm_set1_epi16(0x84);
+	__m128i sign, t;
+
+	sign = _mm_cmpgt_epi16(_mm_and_si128(u, _mm_set1_epi16(0x80)),
+			       _mm_setzero_si128());
+
+	t = _mm_slli_epi16(_mm_and_si128(u, _mm_set1_epi16(0x0f)), 3);
+	t = _mm_add_epi16(t, bias);
+	t = sllv_epi16(t, _mm_and_si128(_mm_srli_epi16(u, 4),
+					_mm_set1_epi16(7)));
+	t = _mm_sub_epi16(t, bias);
+
+	/* negate where the sign bit is set */
+	return _mm_sub_epi16(_mm_xor_si128(t, sign), sign);
+}
+
+
+/* a is the A-law code with the even bits inverted, in 16-bit lanes */
+static inline __m128i alaw_expand(__m128i a)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sign, seg, nz, t;
+
+	sign = _mm_cmpeq_epi16(_mm_and_si128(a, _mm_set1_epi16(0x80)), zero);
+	seg  = _mm_and_si128(_mm_srli_epi16(a, 4), _mm_set1_epi16(7));
+	nz   = _mm_cmpgt_epi16(seg, zero);
+
+	t = _mm_slli_epi16(_mm_and_si128(a, _mm_set1_epi16(0x0f)), 4);
+	t = _mm_add_epi16(t, _mm_set1_epi16(8));
+	t = _mm_add_epi16(t, _mm_and_si128(nz, _mm_set1_epi16(0x100)));
+	t = sllv_epi16(t, _mm_add_epi16(seg, nz));
+
+	/* positive values have the sign bit set */
+	return _mm_sub_epi16(_mm_xor_si128(t, sign), sign);
+}
+#elif defined (__ARM_NEON)
+static inline int16x8_t ulaw_expand(uint16x8_t u)
+{
+	const int16x8_t bias = vdupq_n_s16(0x84);
+	int16x8_t sign, t, s;
+
+	sign = vreinterpretq_s16_u16(vtstq_u16(u, vdupq_n_u16(0x80)));
+	s = vreinterpretq_s16_u16(vandq_u16(vshrq_n_u16(u, 4),
+					    vdupq_n_u16(7)));
+
+	t = vreinterpretq_s16_u16(vshlq_n_u16(vandq_u16(u, vdupq_n_u16(0x0f)),
+					      3));
+	t = vsubq_s16(vshlq_s16(vaddq_s16(t, bias), s), bias);
+
+	return vsubq_s16(veorq_s16(t, sign), sign);
+}
+
+
+static inline int16x8_t alaw_expand(uint16x8_t a)
+{
+	int16x8_t sign, seg, nz, t;
+
+	sign = vreinterpretq_s16_u16(vceqq_u16(vandq_u16(a,
+							 vdupq_n_u16(0x80)),
+					       vdupq_n_u16(0)));
+	seg = vreinterpretq_s16_u16(vandq_u16(vshrq_n_u16(a, 4),
+					      vdupq_n_u16(7)));
+	nz = vreinterpretq_s16_u16(vcgtq_s16(seg, vdupq_n_s16(0)));
+
+	t = vreinterpretq_s16_u16(vshlq_n_u16(vandq_u16(a, vdupq_n_u16(0x0f)),
+					      4));
+	t = vaddq_s16(t, vdupq_n_s16(8));
+	t = vaddq_s16(t, vandq_s16(nz, vdupq_n_s16(0x100)));
+	t = vshlq_s16(t, vaddq_s16(seg, nz));
+
+	return vsubq_s16(veorq_s16(t, sign), sign);
+}
+#endif
+
+
+/**
+ * Decode U-law to 16-bit samples
+ *
+ * @param dst Buffer for n signed 16-bit samples
+ * @param src U-law bytes
+ * @param n   Number of samples
+ */
+void aug711_ulaw2pcm(int16_t *dst, const uint8_t *src, size_t n)
+{
+	size_t i = 0;
+
+	if (!dst || !src)
+		return;
+
+#if defined (__SSE2__)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i ones = _mm_set1_epi8(-1);
+
+		for (; i + 16 <= n; i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+
+			v = _mm_xor_si128(v, ones);
+
+			_mm_storeu_si128((__m128i *)&dst[i],
+				ulaw_expand(_mm_unpacklo_epi8(v, zero)));
+			_mm_storeu_si128((__m128i *)&dst[i + 8],
+				ulaw_expand(_mm_unpackhi_epi8(v, zero)));
+		}
+	}
+#elif defined (__ARM_NEON)
+	for (; i + 8 <= n; i += 8) {
+		uint8x8_t v = vmvn_u8(vld1_u8(&src[i]));
+
+		vst1q_s16(&dst[i], ulaw_expand(vmovl_u8(v)));
+	}
+#endif
+
+	for (; i < n; i++)
+		dst[i] = g711_ulaw2pcm(src[i]);
+}
+
+
+/**
+ * Decode A-law to 16-bit samples
+ *
+ * @param dst Buffer for n signed 16-bit samples
+ * @param src A-law bytes
+ * @param n   Number of samples
+ */
+void aug711_alaw2pcm(int16_t *dst, const uint8_t *src, size_t n)
+{
+	size_t i = 0;
+
+	if (!dst || !src)
+		return;
+
+#if defined (__SSE2__)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i even = _mm_set1_epi8(0x55);
+
+		for (; i + 16 <= n; i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *)&src[i]);
+
+			v = _mm_xor_si128(v, even);
+
+			_mm_storeu_si128((__m128i *)&dst[i],
+				alaw_expand(_mm_unpacklo_epi8(v, zero)));
+			_mm_storeu_si128((__m128i *)&dst[i + 8],
+				alaw_expand(_mm_unpackhi_epi8(v, zero)));
+		}
+	}
+#elif defined (__ARM_NEON)
+	for (; i + 8 <= n; i += 8) {
+		uint8x8_t v = veor_u8(vld1_u8(&src[i]), vdup_n_u8(0x55));
+
+		vst1q_s16(&dst[i], alaw_expand(vmovl_u8(v)));
+	}
+#endif
+
+	for (; i < n; i++)
+		dst[i] = g711_alaw2pcm(src[i]);
+}
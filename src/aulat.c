@@ -0,0 +1,273 @@
+/**
+ * @file aulat.c  Audio pipeline latency histograms
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <re.h>
+#include <re_atomic.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * A latency histogram has log-linear bins in [us]: values below 4 have
+ * their own bin, every power of two above is split into 4 bins. This
+ * gives a resolution of 25% or better up to 16 seconds.
+ *
+ * Each histogram has exactly one writer (the thread of its pipeline
+ * stage), readers may run in any thread and see relaxed counters.
+ */
+
+
+static unsigned bin_index(uint32_t usec)
+{
+	unsigned e = 0;
+	uint32_t v;
+
+	if (usec < 4)
+		return usec;
+
+	for (v = usec; v > 1; v >>= 1)
+		++e;
+
+	if (e > 23)
+		return AULAT_BINS - 1;
+
+	return 4 * (e - 1) + ((usec >> (e - 2)) & 3);
+}
+
+
+static uint32_t bin_upper(unsigned bin)
+{
+	unsigned e, sub;
+
+	if (bin < 4)
+		return bin;
+
+	e   = bin / 4 + 1;
+	sub = bin % 4;
+
+	return ((4 + sub + 1) << (e - 2)) - 1;
+}
+
+
+/**
+ * Add a latency sample to the histogram
+ *
+ * @param lat  Latency histogram
+ * @param usec Latency in [us]
+ */
+void aulat_add(struct aulat *lat, uint32_t usec)
+{
+	if (!lat)
+		return;
+
+	re_atomic_rlx_add(&lat->binv[bin_index(usec)], 1);
+	re_atomic_rlx_add(&lat->sum, usec);
+	re_atomic_rlx_add(&lat->n, 1);
+
+	if (usec > re_atomic_rlx(&lat->max))
+		re_atomic_rlx_set(&lat->max, usec);
+}
+
+
+/**
+ * Add the elapsed time since a start time to the histogram
+ *
+ * @param lat Latency histogram
+ * @param t0  Start time from tmr_jiffies_usec()
+ */
+void aulat_add_since(struct aulat *lat, uint64_t t0)
+{
+	aulat_add(lat, (uint32_t)min(tmr_jiffies_usec() - t0,
+				     (uint64_t)UINT32_MAX));
+}
+
+
+/**
+ * Get a percentile of the histogram, rounded up to the bin limit
+ *
+ * @param lat Latency histogram
+ * @param pct Percentile (0-100)
+ *
+ * @return Latency in [us]
+ */
+uint32_t aulat_percentile(const struct aulat *lat, unsigned pct)
+{
+	uint32_t n, cnt = 0, lim;
+	unsigned i;
+
+	if (!lat)
+		return 0;
+
+	n = re_atomic_rlx(&lat->n);
+	if (!n)
+		return 0;
+
+	lim = (uint32_t)((uint64_t)n * min(pct, 100u) / 100);
+
+	for (i=0; i<AULAT_BINS; i++) {
+
+		cnt += re_atomic_rlx(&lat->binv[i]);
+		if (cnt > lim)
+			return min(bin_upper(i), re_atomic_rlx(&lat->max));
+	}
+
+	return re_atomic_rlx(&lat->max);
+}
+
+
+/**
+ * Get the relative delay of a timestamped frame
+ *
+ * The delay is relative to the fastest frame seen so far. The reference
+ * creeps by 1 us per frame to follow a clock drift of up to 50 ppm with
+ * 20 ms frames.
+ *
+ * @param rel  Relative delay state
+ * @param now  Current time in [us]
+ * @param ts   Frame timestamp in [us]
+ *
+ * @return Relative delay in [us]
+ */
+uint32_t aulat_rel_delay(struct aulat_rel *rel, uint64_t now, uint64_t ts)
+{
+	int64_t d = (int64_t)(now - ts);
+
+	if (!rel)
+		return 0;
+
+	if (!rel->set || d < rel->ref) {
+		rel->ref = d;
+		rel->set = true;
+	}
+	else {
+		rel->ref = min(rel->ref + 1, d);
+	}
+
+	return (uint32_t)min(d - rel->ref, (int64_t)UINT32_MAX);
+}
+
+
+/**
+ * Print a latency histogram as "p50 p99 max" in [us]
+ *
+ * @param pf  Print function
+ * @param lat Latency histogram
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aulat_debug(struct re_printf *pf, const struct aulat *lat)
+{
+	if (!lat)
+		return 0;
+
+	return re_hprintf(pf, "%7u %7u %7u  (n=%u)",
+			  aulat_percentile(lat, 50),
+			  aulat_percentile(lat, 99),
+			  re_atomic_rlx(&lat->max),
+			  re_atomic_rlx(&lat->n));
+}
+
+
+/**
+ * Encode a latency histogram in JSON
+ *
+ * @param od   Parent dictionary
+ * @param name Name of the stage
+ * @param lat  Latency histogram
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aulat_json_api(struct odict *od, const char *name,
+		   const struct aulat *lat)
+{
+	struct odict *o = NULL;
+	int err;
+
+	if (!od || !name || !lat)
+		return EINVAL;
+
+	err = odict_alloc(&o, 8);
+	if (err)
+		return err;
+
+	err |= odict_entry_add(o, "p50", ODICT_INT,
+			       (int64_t)aulat_percentile(lat, 50));
+	err |= odict_entry_add(o, "p99", ODICT_INT,
+			       (int64_t)aulat_percentile(lat, 99));
+	err |= odict_entry_add(o, "max", ODICT_INT,
+			       (int64_t)re_atomic_rlx(&lat->max));
+	err |= odict_entry_add(o, "n", ODICT_INT,
+			       (int64_t)re_atomic_rlx(&lat->n));
+	if (err)
+		goto out;
+
+	err = odict_entry_add(od, name, ODICT_OBJECT, o);
+
+ out:
+	mem_deref(o);
+
+	return err;
+}
+
+
+static int print_seconds(struct re_printf *pf, const uint64_t *usec)
+{
+	return re_hprintf(pf, "%llu.%06llu", *usec / 1000000,
+			  *usec % 1000000);
+}
+
+
+/**
+ * Print a latency histogram in the Prometheus text format
+ *
+ * The buckets are in [s] at the power of two bin limits. The HELP and
+ * TYPE lines of the metric family are printed by the caller.
+ *
+ * @param pf     Print function
+ * @param name   Metric name
+ * @param labels Labels without braces, e.g. media="audio" (optional)
+ * @param lat    Latency histogram
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aulat_prometheus(struct re_printf *pf, const char *name,
+		     const char *labels, const struct aulat *lat)
+{
+	const char *sep = str_isset(labels) ? "," : "";
+	uint64_t cnt = 0, le, sum;
+	unsigned i;
+	int err = 0;
+
+	if (!pf || !name || !lat)
+		return EINVAL;
+
+	if (!labels)
+		labels = "";
+
+	for (i=0; i<AULAT_BINS - 1; i++) {
+
+		cnt += re_atomic_rlx(&lat->binv[i]);
+
+		if (i % 4 != 3)
+			continue;
+
+		le = (uint64_t)bin_upper(i) + 1;
+
+		err |= re_hprintf(pf, "%s_bucket{%s%sle=\"%H\"} %llu\n",
+				  name, labels, sep, print_seconds, &le, cnt);
+	}
+
+	cnt += re_atomic_rlx(&lat->binv[AULAT_BINS - 1]);
+	sum  = re_atomic_rlx(&lat->sum);
+
+	err |= re_hprintf(pf, "%s_bucket{%s%sle=\"+Inf\"} %llu\n",
+			  name, labels, sep, cnt);
+	err |= re_hprintf(pf, "%s_sum{%s} %H\n", name, labels,
+			  print_seconds, &sum);
+	err |= re_hprintf(pf, "%s_count{%s} %llu\n", name, labels, cnt);
+
+	return err;
+}
@@ -0,0 +1,593 @@
+/**
+ * @file aupoly.c  Polyphase audio resampler
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <math.h>
+#include <string.h>
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined (__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+
+
+/*
+ * The resampler converts between any two sample rates with the ratio
+ * L/M = orate/irate, reduced by the greatest common divisor. It works
+ * like upsampling by L, low-pass filtering and downsampling by M, but
+ * only computes the outputs that are kept. The low-pass is a Kaiser
+ * windowed sinc, split into L phases of NTAPS coefficients each.
+ *
+ * The filter banks only depend on L, M and the quality, they are computed
+ * once and shared by all resamplers of the process.
+ *
+ * The coefficients are Q14 and stored in reverse order, so that each
+ * output sample is a dot product over the contiguous input history,
+ * which is done with SSE2 or NEON when the compiler targets them.
+ */
+
+
+enum {
+	COEF_BITS = 14,
+	MAX_TAPS  = 256,   /* Maximum number of taps per phase       */
+	MAX_PHASE = 1024,  /* Maximum L, limits the bank size        */
+	TAP_ALIGN = 8,     /* The taps are a multiple of the vector  */
+};
+
+
+static const double PI = 3.14159265358979323846;
+
+
+/* Filter design per quality level */
+static const struct {
+	unsigned taps;     /* Taps per phase when upsampling          */
+	double beta;       /* Kaiser window shape                     */
+	double rolloff;    /* Passband edge relative to Nyquist       */
+} designv[] = {
+	{ 8, 5.0, 0.80},   /* AUPOLY_LOW    */
+	{16, 7.0, 0.90},   /* AUPOLY_MEDIUM */
+	{32, 9.0, 0.95},   /* AUPOLY_HIGH   */
+};
+
+
+/** Filter bank, shared by all resamplers with the same ratio */
+struct bank {
+	struct le le;
+	uint32_t l;
+	uint32_t m;
+	enum aupoly_quality q;
+	unsigned ntaps;
+	int16_t *coefv;      /**< L phases of ntaps coefficients      */
+	unsigned users;      /**< Protected by banks.mtx              */
+};
+
+/** Polyphase resampler */
+struct aupoly {
+	struct bank *bank;
+	uint8_t ich;
+	uint8_t och;
+	uint8_t nch;         /**< Number of filtered channels         */
+	int16_t *bufv;       /**< Input history, one row per channel  */
+	size_t bufsz;        /**< Row size in samples                 */
+	size_t fill;         /**< Samples in each row                 */
+	uint64_t pos;        /**< Next output, in upsampled units     */
+};
+
+
+static struct {
+	struct list l;
+	mtx_t mtx;
+} banks;
+
+static once_flag banks_once = ONCE_FLAG_INIT;
+
+
+static void banks_init(void)
+{
+	(void)mtx_init(&banks.mtx, mtx_plain);
+}
+
+
+static uint32_t gcd(uint32_t a, uint32_t b)
+{
+	while (b) {
+		uint32_t t = a % b;
+		a = b;
+		b = t;
+	}
+
+	return a;
+}
+
+
+/* Modified Bessel function of the first kind, order 0 */
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	unsigned k;
+
+	for (k=1; k<32; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum  += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+
+	return sum;
+}
+
+
+static int16_t coef_q14(double v)
+{
+	v = v * (1 << COEF_BITS);
+	v = v < 0 ? v - 0.5 : v + 0.5;
+
+	if (v > INT16_MAX)
+		return INT16_MAX;
+	if (v < INT16_MIN)
+		return INT16_MIN;
+
+	return (int16_t)v;
+}
+
+
+static void bank_destructor(void *arg)
+{
+	struct bank *b = arg;
+
+	mem_deref(b->coefv);
+}
+
+
+static int bank_alloc(struct bank **bp, uint32_t l, uint32_t m,
+		      enum aupoly_quality q)
+{
+	const double beta = designv[q].beta;
+	struct bank *b;
+	unsigned ntaps, p, j;
+	double fc, c, n, i0b;
+
+	b = mem_zalloc(sizeof(*b), bank_destructor);
+	if (!b)
+		return ENOMEM;
+
+	/* widen the filter when downsampling, the cutoff is lower */
+	ntaps = designv[q].taps * ((m + l - 1) / l);
+	ntaps = (ntaps + TAP_ALIGN - 1) / TAP_ALIGN * TAP_ALIGN;
+	ntaps = min(ntaps, (unsigned)MAX_TAPS);
+
+	b->l     = l;
+	b->m     = m;
+	b->q     = q;
+	b->ntaps = ntaps;
+
+	b->coefv = mem_alloc(l * ntaps * sizeof(*b->coefv), NULL);
+	if (!b->coefv) {
+		mem_deref(b);
+		return ENOMEM;
+	}
+
+	/* cutoff relative to the upsampled rate */
+	fc  = 0.5 * designv[q].rolloff * min(1.0, (double)l / m) / l;
+	n   = (double)l * ntaps;
+	c   = (n - 1) / 2;
+	i0b = bessel_i0(beta);
+
+	for (p=0; p<l; p++) {
+
+		int16_t *coef = &b->coefv[p * ntaps];
+
+		for (j=0; j<ntaps; j++) {
+
+			double k = p + (double)l * j;
+			double x = k - c;
+			double r = 2 * x / n;
+			double h, w;
+
+			h = x ? sin(2 * PI * fc * x) / (PI * x) : 2 * fc;
+			w = bessel_i0(beta * sqrt(max(0.0, 1 - r * r))) / i0b;
+
+			coef[ntaps - 1 - j] = coef_q14(h * w * l);
+		}
+	}
+
+	*bp = b;
+
+	return 0;
+}
+
+
+static int bank_get(struct bank **bp, uint32_t l, uint32_t m,
+		    enum aupoly_quality q)
+{
+	struct bank *b = NULL;
+	struct le *le;
+	int err = 0;
+
+	call_once(&banks_once, banks_init);
+
+	mtx_lock(&banks.mtx);
+
+	for (le = banks.l.head; le; le = le->next) {
+
+		struct bank *x = le->data;
+
+		if (x->l == l && x->m == m && x->q == q) {
+			b = x;
+			break;
+		}
+	}
+
+	if (!b) {
+		err = bank_alloc(&b, l, m, q);
+		if (err)
+			goto out;
+
+		list_append(&banks.l, &b->le, b);
+	}
+
+	++b->users;
+	*bp = b;
+
+ out:
+	mtx_unlock(&banks.mtx);
+
+	return err;
+}
+
+
+static void bank_put(struct bank *b)
+{
+	if (!b)
+		return;
+
+	mtx_lock(&banks.mtx);
+
+	if (--b->users == 0) {
+		list_unlink(&b->le);
+		mem_deref(b);
+	}
+
+	mtx_unlock(&banks.mtx);
+}
+
+
+/* Sum of a[i] * b[i], n is a multiple of TAP_ALIGN */
+static int32_t dot_s16(const int16_t *a, const int16_t *b, unsigned n)
+{
+	unsigned i = 0;
+	int32_t sum = 0;
+
+#if defined (__SSE2__)
+	{
+		__m128i acc = _mm_setzero_si128();
+
+		for (; i + 8 <= n; i += 8) {
+			__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+			__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+
+			acc = _mm_add_epi32(acc, _mm_madd_epi16(va, vb));
+		}
+
+		acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 8));
+		acc = _mm_add_epi32(acc, _mm_srli_si128(acc, 4));
+		sum = _mm_cvtsi128_si32(acc);
+	}
+#elif defined (__ARM_NEON)
+	{
+		int32x4_t acc = vdupq_n_s32(0);
+		int32x2_t s;
+
+		for (; i + 8 <= n; i += 8) {
+			int16x8_t va = vld1q_s16(a + i);
+			int16x8_t vb = vld1q_s16(b + i);
+
+			acc = vmlal_s16(acc, vget_low_s16(va),
+					vget_low_s16(vb));
+			acc = vmlal_s16(acc, vget_high_s16(va),
+					vget_high_s16(vb));
+		}
+
+		s   = vadd_s32(vget_low_s32(acc), vget_high_s32(acc));
+		s   = vpadd_s32(s, s);
+		sum = vget_lane_s32(s, 0);
+	}
+#endif
+
+	for (; i<n; i++)
+		sum += (int32_t)a[i] * b[i];
+
+	return sum;
+}
+
+
+static inline int16_t saturate(int32_t v)
+{
+	v = (v + (1 << (COEF_BITS - 1))) >> COEF_BITS;
+
+	if (v > INT16_MAX)
+		return INT16_MAX;
+	if (v < INT16_MIN)
+		return INT16_MIN;
+
+	return (int16_t)v;
+}
+
+
+static void destructor(void *arg)
+{
+	struct aupoly *rs = arg;
+
+	bank_put(rs->bank);
+	mem_deref(rs->bufv);
+}
+
+
+static void reset(struct aupoly *rs)
+{
+	const unsigned ntaps = rs->bank->ntaps;
+
+	memset(rs->bufv, 0, rs->nch * rs->bufsz * sizeof(*rs->bufv));
+
+	/* the history starts with ntaps - 1 samples of silence */
+	rs->fill = ntaps - 1;
+	rs->pos  = (uint64_t)(ntaps - 1) * rs->bank->l;
+}
+
+
+/**
+ * Allocate a polyphase resampler
+ *
+ * Mono and stereo can be converted in both directions, stereo is mixed
+ * down before and mono is duplicated after the filter.
+ *
+ * @param rsp     Pointer to allocated resampler
+ * @param irate   Input sample rate in [Hz]
+ * @param ich     Input channels
+ * @param orate   Output sample rate in [Hz]
+ * @param och     Output channels
+ * @param quality Filter quality
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aupoly_alloc(struct aupoly **rsp, uint32_t irate, uint8_t ich,
+		 uint32_t orate, uint8_t och, enum aupoly_quality quality)
+{
+	struct aupoly *rs;
+	uint32_t g;
+	int err;
+
+	if (!rsp || !irate || !orate || !ich || !och)
+		return EINVAL;
+
+	if (ich != och && ich != 1 && och != 1)
+		return ENOTSUP;
+
+	if ((unsigned)quality >= ARRAY_SIZE(designv))
+		return EINVAL;
+
+	g = gcd(irate, orate);
+	if (orate / g > MAX_PHASE)
+		return ENOTSUP;
+
+	rs = mem_zalloc(sizeof(*rs), destructor);
+	if (!rs)
+		return ENOMEM;
+
+	rs->ich   = ich;
+	rs->och   = och;
+	rs->nch   = min(ich, och);
+
+	err = bank_get(&rs->bank, orate / g, irate / g, quality);
+	if (err)
+		goto out;
+
+	rs->bufsz = rs->bank->ntaps - 1 + irate / 50;
+
+	rs->bufv = mem_alloc(rs->nch * rs->bufsz * sizeof(*rs->bufv), NULL);
+	if (!rs->bufv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	reset(rs);
+
+ out:
+	if (err)
+		mem_deref(rs);
+	else
+		*rsp = rs;
+
+	return err;
+}
+
+
+/**
+ * Get the maximum number of output samples for a number of input samples
+ *
+ * @param rs  Polyphase resampler
+ * @param inc Number of input samples, all channels
+ *
+ * @return Maximum number of output samples, all channels
+ */
+size_t aupoly_maxout(const struct aupoly *rs, size_t inc)
+{
+	uint64_t frames;
+
+	if (!rs)
+		return 0;
+
+	frames = (uint64_t)(inc / rs->ich) * rs->bank->l / rs->bank->m + 1;
+
+	return (size_t)frames * rs->och;
+}
+
+
+static int grow(struct aupoly *rs, size_t frames)
+{
+	size_t sz = rs->fill + frames;
+	int16_t *bufv;
+	uint8_t c;
+
+	if (sz <= rs->bufsz)
+		return 0;
+
+	bufv = mem_zalloc(rs->nch * sz * sizeof(*bufv), NULL);
+	if (!bufv)
+		return ENOMEM;
+
+	for (c=0; c<rs->nch; c++) {
+		memcpy(&bufv[c * sz], &rs->bufv[c * rs->bufsz],
+		       rs->fill * sizeof(*bufv));
+	}
+
+	mem_deref(rs->bufv);
+	rs->bufv  = bufv;
+	rs->bufsz = sz;
+
+	return 0;
+}
+
+
+/* Append interleaved input to the history rows */
+static void append(struct aupoly *rs, const int16_t *inv, size_t frames)
+{
+	size_t i;
+	uint8_t c;
+
+	if (rs->nch == rs->ich) {
+
+		for (c=0; c<rs->nch; c++) {
+
+			int16_t *row = &rs->bufv[c * rs->bufsz + rs->fill];
+
+			if (rs->ich == 1) {
+				memcpy(row, inv, frames * sizeof(*row));
+				continue;
+			}
+
+			for (i=0; i<frames; i++)
+				row[i] = inv[i * rs->ich + c];
+		}
+	}
+	else {
+		int16_t *row = &rs->bufv[rs->fill];
+
+		/* mix down to mono */
+		for (i=0; i<frames; i++) {
+
+			int32_t v = 0;
+
+			for (c=0; c<rs->ich; c++)
+				v += inv[i * rs->ich + c];
+
+			row[i] = (int16_t)(v / rs->ich);
+		}
+	}
+
+	rs->fill += frames;
+}
+
+
+/**
+ * Resample a block of interleaved audio samples
+ *
+ * The resampler keeps its history between calls, so that a stream can be
+ * processed in blocks of any size.
+ *
+ * @param rs   Polyphase resampler
+ * @param outv Output samples
+ * @param outc Size of output buffer in samples, on return the number of
+ *             output samples
+ * @param inv  Input samples
+ * @param inc  Number of input samples, all channels
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int aupoly_process(struct aupoly *rs, int16_t *outv, size_t *outc,
+		   const int16_t *inv, size_t inc)
+{
+	const struct bank *b;
+	size_t frames, n = 0, drop;
+	uint64_t end;
+	uint8_t c;
+	int err;
+
+	if (!rs || !outv || !outc || (inc && !inv))
+		return EINVAL;
+
+	if (*outc < aupoly_maxout(rs, inc))
+		return ENOMEM;
+
+	b = rs->bank;
+	frames = inc / rs->ich;
+
+	err = grow(rs, frames);
+	if (err)
+		return err;
+
+	append(rs, inv, frames);
+
+	end = (uint64_t)rs->fill * b->l;
+
+	for (; rs->pos < end; rs->pos += b->m, ++n) {
+
+		const size_t i = (size_t)(rs->pos / b->l);
+		const int16_t *coef = &b->coefv[(rs->pos % b->l) * b->ntaps];
+		int16_t *out = &outv[n * rs->och];
+
+		for (c=0; c<rs->nch; c++) {
+
+			const int16_t *x = &rs->bufv[c * rs->bufsz + i + 1
+						     - b->ntaps];
+
+			out[c] = saturate(dot_s16(coef, x, b->ntaps));
+		}
+
+		/* mono to multi-channel */
+		for (; c<rs->och; c++)
+			out[c] = out[0];
+	}
+
+	/* keep the last ntaps - 1 samples as history */
+	drop = (size_t)(rs->pos / b->l) - (b->ntaps - 1);
+	drop = min(drop, rs->fill);
+
+	for (c=0; c<rs->nch; c++) {
+
+		int16_t *row = &rs->bufv[c * rs->bufsz];
+
+		memmove(row, &row[drop], (rs->fill - drop) * sizeof(*row));
+	}
+
+	rs->fill -= drop;
+	rs->pos  -= (uint64_t)drop * b->l;
+
+	*outc = n * rs->och;
+
+	return 0;
+}
+
+
+/**
+ * Get the name of a resampler quality
+ *
+ * @param quality Filter quality
+ *
+ * @return Name of the quality
+ */
+const char *aupoly_quality_name(enum aupoly_quality quality)
+{
+	switch (quality) {
+
+	case AUPOLY_LOW:    return "low";
+	case AUPOLY_MEDIUM: return "medium";
+	case AUPOLY_HIGH:   return "high";
+	default:            return "?";
+	}
+}
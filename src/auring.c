@@ -0,0 +1,274 @@
+/**
+ * @file auring.c  Lock-free single-producer/single-consumer audio ring
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <re_atomic.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The ring holds PCM samples written by exactly one thread (the producer)
+ * and read by exactly one other thread (the consumer). Both positions are
+ * free running byte counters, so the fill level is wpos - rpos. The
+ * producer only writes wpos and the consumer only writes rpos, so no lock
+ * is needed and neither side ever waits for the other.
+ *
+ * Each written frame also stores a metadata slot with the position of its
+ * first byte and its timestamp, which gives the timestamp of any read
+ * position. A full ring drops the new frame, since only the consumer may
+ * move the read position. A flush is requested by either side and done
+ * by the consumer on its next read.
+ */
+
+
+enum { AURING_META = 256 };  /* metadata slots, must be a power of 2 */
+
+
+/** Metadata of one written frame */
+struct auring_meta {
+	size_t pos;               /**< Write position of first byte       */
+	uint64_t timestamp;       /**< Timestamp of first sample          */
+	uint32_t srate;           /**< Sample rate in [Hz]                */
+	uint8_t ch;               /**< Number of channels                 */
+	enum aufmt fmt;           /**< Sample format                      */
+};
+
+
+/** Audio ring */
+struct auring {
+	uint8_t *buf;             /**< Sample buffer                      */
+	size_t size;              /**< Size of buffer, a power of 2       */
+	struct auring_meta metav[AURING_META];
+	RE_ATOMIC size_t wpos;    /**< Write position, set by producer    */
+	RE_ATOMIC size_t wmeta;   /**< Metadata count, set by producer    */
+	RE_ATOMIC size_t rpos;    /**< Read position, set by consumer     */
+	RE_ATOMIC size_t rmeta;   /**< Current metadata, set by consumer  */
+	RE_ATOMIC bool flush;     /**< Flush requested                    */
+};
+
+
+static void destructor(void *arg)
+{
+	struct auring *ar = arg;
+
+	mem_deref(ar->buf);
+}
+
+
+static void ring_write(struct auring *ar, size_t pos, const uint8_t *p,
+		       size_t n)
+{
+	size_t off = pos & (ar->size - 1);
+	size_t n1  = min(n, ar->size - off);
+
+	memcpy(ar->buf + off, p, n1);
+	memcpy(ar->buf, p + n1, n - n1);
+}
+
+
+static void ring_read(const struct auring *ar, size_t pos, uint8_t *p,
+		      size_t n)
+{
+	size_t off = pos & (ar->size - 1);
+	size_t n1  = min(n, ar->size - off);
+
+	memcpy(p, ar->buf + off, n1);
+	memcpy(p + n1, ar->buf, n - n1);
+}
+
+
+/**
+ * Allocate a lock-free audio ring
+ *
+ * @param arp  Pointer to allocated audio ring
+ * @param size Minimum size in [bytes], rounded up to a power of 2
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int auring_alloc(struct auring **arp, size_t size)
+{
+	struct auring *ar;
+	size_t sz = 1;
+
+	if (!arp || !size)
+		return EINVAL;
+
+	while (sz < size)
+		sz <<= 1;
+
+	ar = mem_zalloc(sizeof(*ar), destructor);
+	if (!ar)
+		return ENOMEM;
+
+	ar->buf = mem_alloc(sz, NULL);
+	if (!ar->buf) {
+		mem_deref(ar);
+		return ENOMEM;
+	}
+
+	ar->size = sz;
+
+	*arp = ar;
+
+	return 0;
+}
+
+
+/**
+ * Write an audio frame to the ring (producer)
+ *
+ * @param ar Audio ring
+ * @param af Audio frame
+ *
+ * @return 0 if success, ENOSPC if the ring is full and the frame dropped
+ */
+int auring_write_auframe(struct auring *ar, const struct auframe *af)
+{
+	struct auring_meta *meta;
+	size_t w, r, mw, mr, n;
+
+	if (!ar || !af)
+		return EINVAL;
+
+	n = auframe_size(af);
+	if (!n)
+		return 0;
+
+	w  = re_atomic_rlx(&ar->wpos);
+	r  = re_atomic_acq(&ar->rpos);
+	mw = re_atomic_rlx(&ar->wmeta);
+	mr = re_atomic_acq(&ar->rmeta);
+
+	if (n > ar->size - (w - r) || mw - mr >= AURING_META - 1)
+		return ENOSPC;
+
+	ring_write(ar, w, af->sampv, n);
+
+	meta = &ar->metav[mw & (AURING_META - 1)];
+	meta->pos       = w;
+	meta->timestamp = af->timestamp;
+	meta->srate     = af->srate;
+	meta->ch        = af->ch;
+	meta->fmt       = af->fmt;
+
+	/* the metadata must be visible before the samples */
+	re_atomic_rls_set(&ar->wmeta, mw + 1);
+	re_atomic_rls_set(&ar->wpos, w + n);
+
+	return 0;
+}
+
+
+/**
+ * Read an audio frame from the ring (consumer)
+ *
+ * The number of samples to read is given by af->sampc. On underrun the
+ * frame is filled with silence and nothing is consumed.
+ *
+ * @param ar Audio ring
+ * @param af Audio frame, timestamp is set to the first sample read
+ *
+ * @return 0 if success, ENODATA on underrun
+ */
+int auring_read_auframe(struct auring *ar, struct auframe *af)
+{
+	const struct auring_meta *meta;
+	size_t w, r, mw, mr, n, sz;
+
+	if (!ar || !af)
+		return EINVAL;
+
+	n = auframe_size(af);
+
+	w  = re_atomic_acq(&ar->wpos);
+	mw = re_atomic_acq(&ar->wmeta);
+	r  = re_atomic_rlx(&ar->rpos);
+	mr = re_atomic_rlx(&ar->rmeta);
+
+	if (re_atomic_rlx(&ar->flush)) {
+		re_atomic_rlx_set(&ar->flush, false);
+		r = w;
+	}
+
+	/* advance to the last frame starting at or before the read position */
+	while (mw - mr > 1 &&
+	       r - ar->metav[(mr + 1) & (AURING_META - 1)].pos < ar->size)
+		++mr;
+
+	re_atomic_rls_set(&ar->rmeta, mr);
+
+	if (w - r < n) {
+		memset(af->sampv, 0, n);
+		re_atomic_rls_set(&ar->rpos, r);
+		return ENODATA;
+	}
+
+	meta = &ar->metav[mr & (AURING_META - 1)];
+	sz = aufmt_sample_size(meta->fmt);
+
+	if (sz && meta->srate && meta->ch) {
+		uint64_t sampc = (r - meta->pos) / sz;
+
+		af->timestamp = meta->timestamp +
+			sampc * AUDIO_TIMEBASE / (meta->srate * meta->ch);
+	}
+
+	ring_read(ar, r, af->sampv, n);
+
+	re_atomic_rls_set(&ar->rpos, r + n);
+
+	return 0;
+}
+
+
+/**
+ * Request a flush of the ring, done by the consumer on its next read
+ *
+ * @param ar Audio ring
+ */
+void auring_flush(struct auring *ar)
+{
+	if (!ar)
+		return;
+
+	re_atomic_rlx_set(&ar->flush, true);
+}
+
+
+/**
+ * Get the number of bytes in the ring
+ *
+ * @param ar Audio ring
+ *
+ * @return Number of bytes
+ */
+size_t auring_cur_size(const struct auring *ar)
+{
+	struct auring *arm = (struct auring *)ar;
+	size_t r;
+
+	if (!ar)
+		return 0;
+
+	r = re_atomic_acq(&arm->rpos);
+
+	return re_atomic_acq(&arm->wpos) - r;
+}
+
+
+/**
+ * Get the size of the ring
+ *
+ * @param ar Audio ring
+ *
+ * @return Size in [bytes]
+ */
+size_t auring_size(const struct auring *ar)
+{
+	return ar ? ar->size : 0;
+}
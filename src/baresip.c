@@ -14,6 +14,8 @@
  */
 static struct baresip {
 	struct network *net;
+	struct rtpport *rtpport;
+	struct strmpool *strmpool;
 	struct contacts *contacts;
 	struct commands *commands;
 	struct player *player;
@@ -97,7 +99,9 @@ int baresip_init(struct config *cfg)
 	if (!cfg)
 		return EINVAL;
 
+	baresip.strmpool = mem_deref(baresip.strmpool);
 	baresip.net = mem_deref(baresip.net);
+	baresip.rtpport = mem_deref(baresip.rtpport);
 
 	list_init(&baresip.mnatl);
 	list_init(&baresip.mencl);
@@ -116,6 +120,14 @@ int baresip_init(struct config *cfg)
 		return err;
 	}
 
+	err = rtpport_alloc(&baresip.rtpport);
+	if (err)
+		return err;
+
+	err = strmpool_alloc(&baresip.strmpool, &cfg->avt);
+	if (err)
+		return err;
+
 	err = contact_init(&baresip.contacts);
 	if (err)
 		return err;
@@ -154,7 +166,9 @@ void baresip_close(void)
 	baresip.commands = mem_deref(baresip.commands);
 	baresip.contacts = mem_deref(baresip.contacts);
 
+	baresip.strmpool = mem_deref(baresip.strmpool);
 	baresip.net = mem_deref(baresip.net);
+	baresip.rtpport = mem_deref(baresip.rtpport);
 
 	ui_reset(&baresip.uis);
 }
@@ -171,6 +185,28 @@ struct network *baresip_network(void)
 }
 
 
+/**
+ * Get the RTP port allocator
+ *
+ * @return RTP port allocator
+ */
+struct rtpport *baresip_rtpport(void)
+{
+	return baresip.rtpport;
+}
+
+
+/**
+ * Get the stream pool
+ *
+ * @return Stream pool
+ */
+struct strmpool *baresip_strmpool(void)
+{
+	return baresip.strmpool;
+}
+
+
 /**
  * Get the contacts subsystem
  *
@@ -403,6 +403,7 @@ static void call_destructor(void *arg)
 
 	call_stream_stop(call);
 	list_unlink(&call->le);
+	stats_inc(STATS_CALLS_DESTROYED);
 	tmr_cancel(&call->tmr_dtmf);
 	tmr_cancel(&call->tmr_answ);
 	tmr_cancel(&call->tmr_reinv);
@@ -921,6 +922,8 @@ int call_alloc(struct call **callp, const struct config *cfg, struct list *lst,
 
 	MAGIC_INIT(call);
 
+	stats_inc(STATS_CALLS_CREATED);
+
 	call->config_avt = cfg->avt;
 	call->config_call = cfg->call;
 
@@ -1102,6 +1105,7 @@ int call_connect(struct call *call, const struct pl *paddr)
 	info("call: connecting to '%r'..\n", paddr);
 
 	call->outgoing = true;
+	stats_inc(STATS_CALLS_OUTGOING);
 	err = str_x64dup(&call->id, rand_u64());
 	if (err)
 		return err;
@@ -1867,6 +1871,7 @@ static void sipsess_estab_handler(const struct sip_msg *msg, void *arg)
 		return;
 
 	set_state(call, CALL_STATE_ESTABLISHED);
+	stats_inc(STATS_CALLS_ESTABLISHED);
 
 	call_stream_start(call, true);
 
@@ -2142,6 +2147,8 @@ int call_accept(struct call *call, struct sipsess_sock *sess_sock,
 		return EINVAL;
 
 	call->outgoing = false;
+	stats_inc(STATS_CALLS_INCOMING);
+
 	if (pl_isset(&msg->from.dname)) {
 		err = pl_strdup(&call->peer_name, &msg->from.dname);
 		if (err)
@@ -274,6 +274,23 @@ static int editor_input(struct commands *commands, struct mbuf *mb, char key,
 }
 
 
+static int cmd_call(const struct cmd *cmd, struct re_printf *pf,
+		    struct cmd_arg *arg)
+{
+	struct prof_ctx prof;
+	char key[2] = {cmd->key, '\0'};
+	int err;
+
+	prof_begin(&prof, NULL);
+
+	err = cmd->h(pf, arg);
+
+	prof_end(&prof, "cmd", cmd->name ? cmd->name : key);
+
+	return err;
+}
+
+
 static int cmd_report(const struct cmd *cmd, struct re_printf *pf,
 		      struct mbuf *mb, void *data)
 {
@@ -290,7 +307,7 @@ static int cmd_report(const struct cmd *cmd, struct re_printf *pf,
 	arg.key      = cmd->key;
 	arg.data     = data;
 
-	err = cmd->h(pf, &arg);
+	err = cmd_call(cmd, pf, &arg);
 
 	mem_deref(arg.prm);
 
@@ -342,7 +359,7 @@ int cmd_process_long(struct commands *commands, const char *str, size_t len,
 		arg.data     = data;
 
 		if (cmd_long->h)
-			err = cmd_long->h(pf_resp, &arg);
+			err = cmd_call(cmd_long, pf_resp, &arg);
 	}
 	else {
 		(void)re_hprintf(pf_resp, "command not found (%s)\n", name);
@@ -563,7 +580,7 @@ int cmd_process(struct commands *commands, struct cmd_ctx **ctxp, char key,
 		arg.prm      = NULL;
 		arg.data     = data;
 
-		return cmd->h(pf, &arg);
+		return cmd_call(cmd, pf, &arg);
 	}
 	else if (key == LONG_PREFIX) {
 
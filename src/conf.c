@@ -9,6 +9,7 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+#include <stddef.h>
 #include <stdio.h>
 #include <sys/stat.h>
 #ifdef HAVE_IO_H
@@ -106,7 +107,6 @@ int conf_loadfile(struct mbuf **mbp, const char *filename)
  */
 int conf_parse(const char *filename, confline_h *ch, void *arg)
 {
-	struct pl pl, val;
 	struct mbuf *mb = NULL;
 	int err;
 
@@ -114,7 +114,29 @@ int conf_parse(const char *filename, confline_h *ch, void *arg)
 	if (err)
 		return err;
 
-	if (!mb)
+	err = conf_parse_buf(mb, ch, arg);
+
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/**
+ * Parse a config buffer, calling handler for each line
+ *
+ * @param mb  Buffer with the config
+ * @param ch  Line handler
+ * @param arg Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int conf_parse_buf(const struct mbuf *mb, confline_h *ch, void *arg)
+{
+	struct pl pl, val;
+	int err = 0;
+
+	if (!mb || !ch)
 		return EINVAL;
 
 	pl.p = (const char *)mb->buf;
@@ -133,8 +155,6 @@ int conf_parse(const char *filename, confline_h *ch, void *arg)
 		err = ch(&val, arg);
 	}
 
-	mem_deref(mb);
-
 	return err;
 }
 
@@ -354,14 +374,171 @@ bool conf_aubuf_adaptive(const struct pl *pl)
 }
 
 
+/* a changed layout of struct config invalidates the cache */
+static uint32_t cache_layout(void)
+{
+	const uint32_t v[] = {
+		sizeof(struct config),
+		offsetof(struct config, call),
+		offsetof(struct config, audio),
+		offsetof(struct config, video),
+		offsetof(struct config, avt),
+		offsetof(struct config, net),
+		offsetof(struct config, sip.shards),
+		offsetof(struct config, call.hold_other_calls),
+		offsetof(struct config, audio.dtx),
+		offsetof(struct config, video.rtx),
+		offsetof(struct config, avt.stream_pool),
+		offsetof(struct config, net.use_getaddrinfo),
+	};
+
+	return hash_joaat((const uint8_t *)v, sizeof(v));
+}
+
+
+/**
+ * Compute the key of the binary config cache
+ *
+ * @param key Cache key to compute
+ * @param src Content of the config file
+ * @param cfg Core config before the config file is parsed
+ */
+void conf_cache_key(struct conf_cache_hdr *key, const struct mbuf *src,
+		    const struct config *cfg)
+{
+	if (!key || !src || !cfg)
+		return;
+
+	memset(key, 0, sizeof(*key));
+
+	memcpy(key->magic, "BSCC", sizeof(key->magic));
+	key->version = CONF_CACHE_VERSION;
+	key->layout  = cache_layout();
+	str_ncpy(key->build, BARESIP_VERSION, sizeof(key->build));
+
+	md5(src->buf, src->end, key->src);
+	md5((const uint8_t *)cfg, sizeof(*cfg), key->base);
+}
+
+
+/**
+ * Load the core config from the binary config cache
+ *
+ * The core config is only changed if the cache is intact and was written
+ * with the same key.
+ *
+ * @param file Cache file
+ * @param key  Expected cache key
+ * @param cfg  Core config to load
+ *
+ * @return 0 if success, ENOENT if the cache is missing, stale or corrupt
+ */
+int conf_cache_load(const char *file, const struct conf_cache_hdr *key,
+		    struct config *cfg)
+{
+	uint8_t md[MD5_SIZE];
+	struct mbuf *mb = NULL;
+	const uint8_t *data;
+	int err;
+
+	if (!file || !key || !cfg)
+		return EINVAL;
+
+	if (!fs_isfile(file))
+		return ENOENT;
+
+	err = conf_loadfile(&mb, file);
+	if (err)
+		return err;
+
+	if (mb->end != sizeof(*key) + sizeof(*cfg) + sizeof(md) ||
+	    memcmp(mb->buf, key, sizeof(*key))) {
+		err = ENOENT;
+		goto out;
+	}
+
+	data = mb->buf + sizeof(*key);
+
+	md5(data, sizeof(*cfg), md);
+	if (memcmp(data + sizeof(*cfg), md, sizeof(md))) {
+		err = ENOENT;
+		goto out;
+	}
+
+	memcpy(cfg, data, sizeof(*cfg));
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
+
+
+/**
+ * Save the core config to the binary config cache
+ *
+ * The cache is written to a temporary file and renamed into place,
+ * followed by a digest of the core config.
+ *
+ * @param file Cache file
+ * @param key  Cache key
+ * @param cfg  Parsed core config
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int conf_cache_save(const char *file, const struct conf_cache_hdr *key,
+		    const struct config *cfg)
+{
+	char tmp[FS_PATH_MAX];
+	uint8_t md[MD5_SIZE];
+	FILE *f;
+	int err = 0;
+
+	if (!file || !key || !cfg)
+		return EINVAL;
+
+	if (re_snprintf(tmp, sizeof(tmp), "%s.tmp", file) < 0)
+		return ENOMEM;
+
+	md5((const uint8_t *)cfg, sizeof(*cfg), md);
+
+	f = fopen(tmp, "wb");
+	if (!f)
+		return errno;
+
+	if (1 != fwrite(key, sizeof(*key), 1, f) ||
+	    1 != fwrite(cfg, sizeof(*cfg), 1, f) ||
+	    1 != fwrite(md, sizeof(md), 1, f))
+		err = EIO;
+
+	if (fclose(f) && !err)
+		err = errno;
+
+	if (!err && rename(tmp, file))
+		err = errno;
+
+	if (err)
+		(void)remove(tmp);
+
+	return err;
+}
+
+
 /**
  * Configure the system with default settings
  *
+ * If "conf_cache" is enabled the parsed core config is stored in a binary
+ * cache next to the config file, and loaded from there if the config file
+ * has not changed. Otherwise the config file is parsed.
+ *
  * @return 0 if success, otherwise errorcode
  */
 int conf_configure(void)
 {
-	char path[FS_PATH_MAX], file[FS_PATH_MAX];
+	char path[FS_PATH_MAX], file[FS_PATH_MAX], cache[FS_PATH_MAX];
+	struct conf_cache_hdr key;
+	struct mbuf *mb = NULL;
+	bool use_cache = false;
 	int err;
 
 #if defined (WIN32)
@@ -386,16 +563,48 @@ int conf_configure(void)
 			goto out;
 	}
 
+	err = conf_loadfile(&mb, file);
+	if (err)
+		goto out;
+
 	conf_obj = mem_deref(conf_obj);
-	err = conf_alloc(&conf_obj, file);
+	err = conf_alloc_buf(&conf_obj, mb->buf, mb->end);
 	if (err)
 		goto out;
 
+	(void)conf_get_bool(conf_obj, "conf_cache", &use_cache);
+
+	if (use_cache) {
+		if (re_snprintf(cache, sizeof(cache), "%s" DIR_SEP
+				"config.cache", path) < 0) {
+			err = ENOMEM;
+			goto out;
+		}
+
+		conf_cache_key(&key, mb, conf_config());
+
+		if (0 == conf_cache_load(cache, &key, conf_config())) {
+			debug("conf: core config loaded from %s\n", cache);
+			err = config_parse_core(conf_obj);
+			goto out;
+		}
+	}
+
 	err = config_parse_conf(conf_config(), conf_obj);
 	if (err)
 		goto out;
 
+	if (use_cache) {
+		int e = conf_cache_save(cache, &key, conf_config());
+		if (e) {
+			warning("conf: could not write config cache %s (%m)\n",
+				cache, e);
+		}
+	}
+
  out:
+	mem_deref(mb);
+
 	return err;
 }
 
@@ -37,6 +37,7 @@ static struct config core_config = {
 		SIP_TRANSP_UDP,
 		false,
 		0xa0,
+		0,
 	},
 
 	/** Call config */
@@ -64,8 +65,12 @@ static struct config core_config = {
 		AUFMT_S16LE,
 		{20, 160},
 		false,
+		false,
 		-35.0,
-		101
+		101,
+		false,
+		AUPOLY_MEDIUM,
+		false
 	},
 
 	/** Video */
@@ -77,6 +82,7 @@ static struct config core_config = {
 		30,
 		true,
 		VID_FMT_YUV420P,
+		false,
 	},
 
 	/** Audio/Video Transport */
@@ -90,7 +96,8 @@ static struct config core_config = {
 		{5, 10},
 		false,
 		0,
-		false
+		false,
+		0
 	},
 
 	/* Network */
@@ -227,6 +234,15 @@ static int conf_get_vidfmt(const struct conf *conf, const char *name,
 }
 
 
+static const char *aubuf_mode_str(const struct config_audio *cfg)
+{
+	if (cfg->stretch)
+		return "stretch";
+
+	return cfg->adaptive ? "adaptive" : "fixed";
+}
+
+
 static const char *jbuf_type_str(enum jbuf_type jbtype)
 {
 	switch (jbtype) {
@@ -284,29 +300,25 @@ static int sip_transports_print(struct re_printf *pf, uint32_t *mask)
 
 
 /**
- * Parse the core configuration file and update baresip core config
+ * Apply the process-wide settings of the core configuration file
+ *
+ * These settings are not stored in the baresip core config, they must be
+ * applied also when the core config is loaded from the config cache.
  *
- * @param cfg  Baresip core config to update
  * @param conf Configuration file to parse
  *
  * @return 0 if success, otherwise errorcode
  */
-int config_parse_conf(struct config *cfg, const struct conf *conf)
+int config_parse_core(const struct conf *conf)
 {
 	struct pl pollm;
 	enum poll_method method;
-	struct vidsz size = {0, 0};
-	struct pl txmode;
-	struct pl jbtype;
-	struct pl tr;
-	struct pl pl;
 	uint32_t v;
+	bool en;
 	int err = 0;
 
-	if (!cfg || !conf)
+	if (!conf)
 		return EINVAL;
-
-	/* Core */
 	if (0 == conf_get(conf, "poll_method", &pollm)) {
 		if (0 == poll_method_type(&method, &pollm)) {
 			err = poll_method_set(method);
@@ -320,6 +332,52 @@ int config_parse_conf(struct config *cfg, const struct conf *conf)
 		}
 	}
 
+	if (0 == conf_get_u32(conf, "log_ratelimit", &v))
+		log_set_ratelimit(v);
+
+	if (0 == conf_get_bool(conf, "log_async", &en)) {
+		err = log_enable_async(en);
+		if (err)
+			warning("config: async logging: %m\n", err);
+	}
+
+	if (0 == conf_get_u32(conf, "main_prof_budget", &v))
+		prof_set_budget(v);
+
+	if (0 == conf_get_bool(conf, "main_prof", &en)) {
+		err = prof_enable(en);
+		if (err)
+			warning("config: main loop profiler: %m\n", err);
+	}
+
+	return err;
+}
+
+
+/**
+ * Parse the core configuration file and update baresip core config
+ *
+ * @param cfg  Baresip core config to update
+ * @param conf Configuration file to parse
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int config_parse_conf(struct config *cfg, const struct conf *conf)
+{
+	struct vidsz size = {0, 0};
+	struct pl txmode;
+	struct pl jbtype;
+	struct pl tr;
+	struct pl pl;
+	uint32_t v;
+	int err = 0;
+
+	if (!cfg || !conf)
+		return EINVAL;
+
+	/* Core */
+	err = config_parse_core(conf);
+
 	/* SIP */
 	(void)conf_get_str(conf, "sip_listen", cfg->sip.local,
 			   sizeof(cfg->sip.local));
@@ -345,6 +403,8 @@ int config_parse_conf(struct config *cfg, const struct conf *conf)
 	if (0 == conf_get_u32(conf, "sip_tos", &v))
 		cfg->sip.tos = v;
 
+	(void)conf_get_u32(conf, "sip_shards", &cfg->sip.shards);
+
 	/* Call */
 	(void)conf_get_u32(conf, "call_local_timeout",
 			   &cfg->call.local_timeout);
@@ -401,11 +461,30 @@ int config_parse_conf(struct config *cfg, const struct conf *conf)
 		return EINVAL;
 	}
 
-	if (0 == conf_get(conf, "audio_buffer_mode", &pl))
-		cfg->audio.adaptive = conf_aubuf_adaptive(&pl);
+	if (0 == conf_get(conf, "audio_buffer_mode", &pl)) {
+
+		cfg->audio.stretch = 0 == pl_strcasecmp(&pl, "stretch");
+		if (!cfg->audio.stretch)
+			cfg->audio.adaptive = conf_aubuf_adaptive(&pl);
+	}
 
 	(void)conf_get_float(conf, "audio_silence", &cfg->audio.silence);
 	(void)conf_get_u32(conf, "audio_telev_pt", &cfg->audio.telev_pt);
+	(void)conf_get_bool(conf, "audio_ring", &cfg->audio.ring);
+
+	(void)conf_get_bool(conf, "audio_dtx", &cfg->audio.dtx);
+
+	if (0 == conf_get(conf, "audio_resampler", &pl)) {
+
+		if (0 == pl_strcasecmp(&pl, "low"))
+			cfg->audio.resamp = AUPOLY_LOW;
+		else if (0 == pl_strcasecmp(&pl, "medium"))
+			cfg->audio.resamp = AUPOLY_MEDIUM;
+		else if (0 == pl_strcasecmp(&pl, "high"))
+			cfg->audio.resamp = AUPOLY_HIGH;
+		else
+			warning("unsupported audio resampler (%r)\n", &pl);
+	}
 
 	/* Video */
 	(void)conf_get_csv(conf, "video_source",
@@ -423,6 +502,7 @@ int config_parse_conf(struct config *cfg, const struct conf *conf)
 	(void)conf_get_bool(conf, "video_fullscreen", &cfg->video.fullscreen);
 
 	conf_get_vidfmt(conf, "videnc_format", &cfg->video.enc_fmt);
+	(void)conf_get_bool(conf, "video_rtx", &cfg->video.rtx);
 
 	/* AVT - Audio/Video Transport */
 	if (0 == conf_get_u32(conf, "rtp_tos", &v))
@@ -446,6 +526,7 @@ int config_parse_conf(struct config *cfg, const struct conf *conf)
 	(void)conf_get_u32(conf, "rtp_timeout", &cfg->avt.rtp_timeout);
 
 	(void)conf_get_bool(conf, "avt_bundle", &cfg->avt.bundle);
+	(void)conf_get_u32(conf, "stream_pool", &cfg->avt.stream_pool);
 
 	if (err) {
 		warning("config: configure parse error (%m)\n", err);
@@ -490,6 +571,7 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 "sip_trans_def\t%s\n"
 			 "sip_verify_server\t\t\t%s\n"
 			 "sip_tos\t%u\n"
+			 "sip_shards\t\t%u\n"
 			 "\n"
 			 "# Call\n"
 			 "call_local_timeout\t%u\n"
@@ -512,9 +594,13 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 "auenc_format\t\t%s\n"
 			 "audec_format\t\t%s\n"
 			 "audio_buffer\t\t%H\t\t# ms\n"
-			 "audio_buffer_mode\t%s\t\t# fixed, adaptive\n"
+			 "audio_buffer_mode\t%s\t\t"
+			 "# fixed, adaptive, stretch\n"
 			 "audio_silence\t\t%.1lf\t\t# in [dB]\n"
 			 "audio_telev_pt\t\t%u\n"
+			 "audio_ring\t\t%s\n"
+			 "audio_resampler\t\t%s\n"
+			 "audio_dtx\t\t%s\n"
 			 "\n"
 			 "# Video\n"
 			 "video_source\t\t%s,%s\n"
@@ -525,6 +611,7 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 "video_fps\t\t%.2f\n"
 			 "video_fullscreen\t%s\n"
 			 "videnc_format\t\t%s\n"
+			 "video_rtx\t\t%s\n"
 			 "\n"
 			 "# AVT\n"
 			 "rtp_tos\t\t\t%u\n"
@@ -536,6 +623,7 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 "jitter_buffer_delay\t%H\n"
 			 "rtp_stats\t\t%s\n"
 			 "rtp_timeout\t\t%u # in seconds\n"
+			 "stream_pool\t\t%u\n"
 			 "\n"
 			 "# Network\n"
 			 "net_interface\t\t%s\n"
@@ -548,6 +636,7 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 sip_transp_name(cfg->sip.transp),
 			 cfg->sip.verify_server ? "yes" : "no",
 			 cfg->sip.tos,
+			 cfg->sip.shards,
 
 			 cfg->call.local_timeout,
 			 cfg->call.max_calls,
@@ -567,9 +656,12 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 aufmt_name(cfg->audio.enc_fmt),
 			 aufmt_name(cfg->audio.dec_fmt),
 			 range_print, &cfg->audio.buffer,
-			 cfg->audio.adaptive ? "adaptive" : "fixed",
+			 aubuf_mode_str(&cfg->audio),
 			 cfg->audio.silence,
 			 cfg->audio.telev_pt,
+			 cfg->audio.ring ? "yes" : "no",
+			 aupoly_quality_name(cfg->audio.resamp),
+			 cfg->audio.dtx ? "yes" : "no",
 
 			 cfg->video.src_mod, cfg->video.src_dev,
 			 cfg->video.disp_mod, cfg->video.disp_dev,
@@ -577,6 +669,7 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 cfg->video.bitrate, cfg->video.fps,
 			 cfg->video.fullscreen ? "yes" : "no",
 			 vidfmt_name(cfg->video.enc_fmt),
+			 cfg->video.rtx ? "yes" : "no",
 
 			 cfg->avt.rtp_tos,
 			 cfg->avt.rtpv_tos,
@@ -587,6 +680,7 @@ int config_print(struct re_printf *pf, const struct config *cfg)
 			 range_print, &cfg->avt.jbuf_del,
 			 cfg->avt.rtp_stats ? "yes" : "no",
 			 cfg->avt.rtp_timeout,
+			 cfg->avt.stream_pool,
 
 			 cfg->net.ifname
 		   );
@@ -699,6 +793,14 @@ static int core_config_template(struct re_printf *pf, const struct config *cfg)
 				", kqueue .."
 #endif
 				"\n"
+			  "#log_async\t\tno\t\t# log from a separate thread\n"
+			  "#log_ratelimit\t\t10\t\t# messages per second"
+				" and call site\n"
+			  "#main_prof\t\tno\t\t# main loop profiler\n"
+			  "#main_prof_budget\t5000\t\t# handler budget"
+				" in [us]\n"
+			  "#conf_cache\t\tno\t\t# binary cache of"
+				" this config\n"
 			  "\n# SIP\n"
 			  "#sip_listen\t\t0.0.0.0:5060\n"
 			  "#sip_certificate\tcert.pem\n"
@@ -712,6 +814,8 @@ static int core_config_template(struct re_printf *pf, const struct config *cfg)
 			  "#sip_trans_def\t\tudp\n"
 			  "#sip_verify_server\tyes\n"
 			  "sip_tos\t\t\t160\n"
+			  "#sip_shards\t\t0\t\t# UA worker threads,"
+				" 0 is off\n"
 			  "\n"
 			  "# Call\n"
 			  "call_local_timeout\t%u\n"
@@ -740,10 +844,14 @@ static int core_config_template(struct re_printf *pf, const struct config *cfg)
 			  "auenc_format\t\ts16\t\t# s16, float, ..\n"
 			  "audec_format\t\ts16\t\t# s16, float, ..\n"
 			  "audio_buffer\t\t%H\t\t# ms\n"
-			  "audio_buffer_mode\t%s\t\t# fixed, adaptive\n"
+			  "audio_buffer_mode\t%s\t\t"
+			  "# fixed, adaptive, stretch\n"
 			  "audio_silence\t\t%.1lf\t\t# in [dB]\n"
 			  "audio_telev_pt\t\t%u\t\t"
 			  "# payload type for telephone-event\n"
+			  "audio_ring\t\tno\t\t# lock-free audio buffer\n"
+			  "audio_resampler\t\tmedium\t\t# low, medium, high\n"
+			  "audio_dtx\t\tno\t\t# VAD and comfort noise\n"
 			  ,
 			  poll_method_name(poll_method_best()),
 			  default_cafile(),
@@ -753,7 +861,7 @@ static int core_config_template(struct re_printf *pf, const struct config *cfg)
 			  default_audio_device(),
 			  default_audio_device(),
 			  range_print, &cfg->audio.buffer,
-			  cfg->audio.adaptive ? "adaptive" : "fixed",
+			  aubuf_mode_str(&cfg->audio),
 			  cfg->audio.silence,
 			  cfg->audio.telev_pt);
 
@@ -766,6 +874,7 @@ static int core_config_template(struct re_printf *pf, const struct config *cfg)
 			  "video_fps\t\t%.2f\n"
 			  "video_fullscreen\tno\n"
 			  "videnc_format\t\t%s\n"
+			  "video_rtx\t\tno\t\t# RTP retransmission\n"
 			  ,
 			  default_video_device(),
 			  default_video_display(),
@@ -785,6 +894,8 @@ static int core_config_template(struct re_printf *pf, const struct config *cfg)
 			  "jitter_buffer_delay\t%u-%u\t\t# frames\n"
 			  "rtp_stats\t\tno\n"
 			  "#rtp_timeout\t\t60\n"
+			  "#stream_pool\t\t4\t\t# pre-bound streams,"
+			  " off with sip_shards\n"
 			  "\n# Network\n"
 			  "#dns_server\t\t1.1.1.1:53\n"
 			  "#dns_server\t\t1.0.0.1:53\n"
@@ -1022,6 +1133,7 @@ int config_write_template(const char *file, const struct config *cfg)
 	(void)re_fprintf(f, "#module\t\t\t" "v4l2" MOD_EXT "\n");
 #endif
 	(void)re_fprintf(f, "#module\t\t\t" "vidbridge" MOD_EXT "\n");
+	(void)re_fprintf(f, "#module\t\t\t" "vidmcu" MOD_EXT "\n");
 
 	(void)re_fprintf(f, "\n# Video display modules\n");
 #ifdef LINUX
@@ -1065,6 +1177,7 @@ int config_write_template(const char *file, const struct config *cfg)
 	(void)re_fprintf(f, "module_app\t\t"  "menu"MOD_EXT"\n");
 	(void)re_fprintf(f, "#module_app\t\t"  "mwi"MOD_EXT"\n");
 	(void)re_fprintf(f, "#module_app\t\t" "presence"MOD_EXT"\n");
+	(void)re_fprintf(f, "#module_app\t\t" "prometheus"MOD_EXT"\n");
 	(void)re_fprintf(f, "#module_app\t\t" "serreg"MOD_EXT"\n");
 	(void)re_fprintf(f, "#module_app\t\t" "syslog"MOD_EXT"\n");
 	(void)re_fprintf(f, "#module_app\t\t" "mqtt" MOD_EXT "\n");
@@ -1080,10 +1193,19 @@ int config_write_template(const char *file, const struct config *cfg)
 	(void)re_fprintf(f, "# Module parameters\n");
 	(void)re_fprintf(f, "\n");
 
+	(void)re_fprintf(f, "# Account parameters\n");
+	(void)re_fprintf(f, "#account_reg_rate\t50 # registrations per"
+				" second on uareload\n");
+	(void)re_fprintf(f, "\n");
+
 	(void)re_fprintf(f, "# DTLS SRTP parameters\n");
 	(void)re_fprintf(f, "#dtls_srtp_use_ec\tprime256v1\n");
 	(void)re_fprintf(f, "\n");
 
+	(void)re_fprintf(f, "# SRTP parameters\n");
+	(void)re_fprintf(f, "#srtp_prefer_gcm\tyes # default if AES-NI\n");
+	(void)re_fprintf(f, "\n");
+
 	(void)re_fprintf(f, "\n# UI Modules parameters\n");
 	(void)re_fprintf(f, "cons_listen\t\t0.0.0.0:5555 # cons - "
 				"Console UI UDP/TCP sockets\n");
@@ -1092,6 +1214,10 @@ int config_write_template(const char *file, const struct config *cfg)
 	(void)re_fprintf(f, "http_listen\t\t0.0.0.0:8000 # httpd - "
 				"HTTP Server\n");
 
+	(void)re_fprintf(f, "\n");
+	(void)re_fprintf(f, "#prometheus_listen\t0.0.0.0:9091 # prometheus - "
+				"/metrics\n");
+
 	(void)re_fprintf(f, "\n");
 	(void)re_fprintf(f, "ctrl_tcp_listen\t\t0.0.0.0:4444 # ctrl_tcp - "
 				"TCP interface JSON\n");
@@ -1132,6 +1258,20 @@ int config_write_template(const char *file, const struct config *cfg)
 			"video_selfview\t\twindow # {window,pip}\n"
 			"#selfview_size\t\t64x64\n");
 
+	(void)re_fprintf(f,
+			"\n# Video conference mixer\n"
+			"#vidmcu_size\t\t1280x720\n"
+			"#vidmcu_fps\t\t25\n"
+			"#vidmcu_layout\t\tgrid # {grid,speaker}\n");
+
+	(void)re_fprintf(f,
+			"\n# Snapshot\n"
+			"#snapshot_interval\t0 # Periodic snapshots [s]\n"
+			"#snapshot_format\tpng # {png,jpeg}\n"
+			"#snapshot_path\t\t.\n"
+			"#snapshot_queue\t\t4\n"
+			"#snapshot_jpeg_quality\t75\n");
+
 	(void)re_fprintf(f,
 			"\n# ZRTP\n"
 			"#zrtp_hash\t\tno  # Disable SDP zrtp-hash "
@@ -1171,6 +1311,20 @@ int config_write_template(const char *file, const struct config *cfg)
 			default_avcodec_hwaccel()
 			);
 
+	(void)re_fprintf(f,
+			"\n# vp8, vp9 and av1 encoder\n"
+			"#vp8_threads\t\t0\t# 0 = auto from size and cores\n"
+			"#vp8_cpuused\t\t16\n"
+			"#vp8_partitions\t\t1\t# log2, default auto\n"
+			"#vp9_threads\t\t0\n"
+			"#vp9_cpuused\t\t8\n"
+			"#vp9_tile_columns\t1\t# log2, default auto\n"
+			"#vp9_row_mt\t\tyes\n"
+			"#av1_threads\t\t0\n"
+			"#av1_cpuused\t\t8\n"
+			"#av1_tile_columns\t1\t# log2, default auto\n"
+			"#av1_row_mt\t\tyes\n");
+
 	(void)re_fprintf(f,
 			"\n# ctrl_dbus\n"
 			"#ctrl_dbus_use\tsystem\t\t# system, session\n");
@@ -1213,6 +1367,9 @@ int config_write_template(const char *file, const struct config *cfg)
 			 "#multicast_jbuf_type\tfixed\t\t"
 				"# off, fixed, adaptive\n"
 			 "#multicast_jbuf_delay\t5-10\t\t# frames\n"
+			 "#multicast_mix\t\tno\t\t# mix all streams\n"
+			 "#multicast_duck\t\t20\t\t# gain of lower prio"
+				" streams in mix [%%]\n"
 			 "#multicast_listener\t224.0.2.21:50000\n"
 			 "#multicast_listener\t224.0.2.21:50002\n");
 
@@ -6,6 +6,7 @@
 
 
 #include <limits.h>
+#include <re_atomic.h>
 
 
 /* max bytes in pathname */
@@ -93,6 +94,8 @@ struct account {
 	bool rtcp_mux;               /**< RTCP multiplexing                  */
 };
 
+bool account_reg_equal(const struct account *a, const struct account *b);
+
 
 /*
  * Audio Stream
@@ -104,6 +107,81 @@ int  audio_send_digit(struct audio *a, char key);
 void audio_sdp_attr_decode(struct audio *a);
 
 
+/*
+ * Audio ring
+ */
+
+struct auring;
+
+int    auring_alloc(struct auring **arp, size_t size);
+int    auring_write_auframe(struct auring *ar, const struct auframe *af);
+int    auring_read_auframe(struct auring *ar, struct auframe *af);
+void   auring_flush(struct auring *ar);
+size_t auring_cur_size(const struct auring *ar);
+size_t auring_size(const struct auring *ar);
+
+
+/*
+ * Audio latency histogram
+ */
+
+enum { AULAT_BINS = 96 };
+
+struct aulat {
+	RE_ATOMIC uint32_t binv[AULAT_BINS];  /**< Bins, log-linear [us]  */
+	RE_ATOMIC uint32_t max;               /**< Maximum latency [us]   */
+	RE_ATOMIC uint32_t n;                 /**< Number of samples      */
+	RE_ATOMIC uint64_t sum;               /**< Sum of samples [us]    */
+};
+
+struct aulat_rel {
+	int64_t ref;      /**< Reference delay of the fastest frame   */
+	bool set;         /**< Reference is set                       */
+};
+
+void     aulat_add(struct aulat *lat, uint32_t usec);
+void     aulat_add_since(struct aulat *lat, uint64_t t0);
+uint32_t aulat_percentile(const struct aulat *lat, unsigned pct);
+uint32_t aulat_rel_delay(struct aulat_rel *rel, uint64_t now, uint64_t ts);
+int      aulat_debug(struct re_printf *pf, const struct aulat *lat);
+int      aulat_json_api(struct odict *od, const char *name,
+			const struct aulat *lat);
+int      aulat_prometheus(struct re_printf *pf, const char *name,
+			  const char *labels, const struct aulat *lat);
+
+
+/*
+ * DTX -- Voice activity detection and comfort noise
+ */
+
+struct dtx_vad {
+	double floor;      /**< Noise floor in [dBov]                  */
+	uint32_t hang;     /**< Hangover left in [ms]                  */
+	bool set;          /**< Noise floor is set                     */
+};
+
+bool dtx_vad(struct dtx_vad *vad, double level, uint32_t ptime);
+int  dtx_cn_encode(struct mbuf *mb, double level);
+int  dtx_cn_decode(double *levelp, struct mbuf *mb);
+void dtx_cn_generate(uint32_t *seed, int16_t *sampv, size_t sampc,
+		     double level);
+
+
+/*
+ * Playout controller
+ */
+
+struct playout;
+
+int      playout_alloc(struct playout **pop, uint32_t srate, uint8_t ch,
+		       const struct range *buffer);
+void     playout_arrival(struct playout *po, uint32_t delay);
+int      playout_process(struct playout *po, struct auframe *af,
+			 uint32_t buffered);
+uint32_t playout_target(const struct playout *po);
+int      playout_debug(struct re_printf *pf, const struct playout *po);
+
+
 /*
  * Call Control
  */
@@ -155,6 +233,34 @@ int conf_get_csv(const struct conf *conf, const char *name,
 		 char *str1, size_t sz1, char *str2, size_t sz2);
 int conf_get_float(const struct conf *conf, const char *name, double *val);
 
+enum {
+	CONF_CACHE_VERSION = 2,  /* bump on a changed struct config */
+};
+
+/**
+ * Header of the binary config cache, followed by the core config and
+ * its digest
+ *
+ * The cache is valid if the config file and the core config before
+ * parsing are unchanged, and it was written by the same build with the
+ * same layout of struct config.
+ */
+struct conf_cache_hdr {
+	char magic[4];
+	uint32_t version;
+	uint32_t layout;            /**< Fingerprint of struct config   */
+	char build[32];             /**< Baresip version                */
+	uint8_t src[MD5_SIZE];      /**< Digest of the config file      */
+	uint8_t base[MD5_SIZE];     /**< Digest of the initial config   */
+};
+
+void conf_cache_key(struct conf_cache_hdr *key, const struct mbuf *src,
+		    const struct config *cfg);
+int  conf_cache_load(const char *file, const struct conf_cache_hdr *key,
+		     struct config *cfg);
+int  conf_cache_save(const char *file, const struct conf_cache_hdr *key,
+		     const struct config *cfg);
+
 
 struct metric;
 
@@ -243,6 +349,82 @@ int  bundle_debug(struct re_printf *pf, const struct bundle *bun);
 const char *bundle_state_name(enum bundle_state st);
 
 
+/*
+ * RTP port allocator
+ */
+
+int  rtpport_alloc(struct rtpport **rpp);
+int  rtpport_reserve(struct rtpport *rp, int af, const struct range *ports,
+		     uint16_t *portp);
+void rtpport_release(struct rtpport *rp, int af, uint16_t port,
+		     bool bindfail);
+int  rtpport_listen(struct rtpport *rp, struct rtp_sock **rtpp,
+		    const struct sa *laddr, const struct range *ports,
+		    uint16_t *portp, rtp_recv_h *rtph, rtcp_recv_h *rtcph,
+		    void *arg);
+
+
+/*
+ * Stream pool
+ */
+
+struct strmpool_ent;
+
+int  strmpool_alloc(struct strmpool **spp, const struct config_avt *cfg);
+void strmpool_set_size(struct strmpool *sp, uint32_t size);
+int  strmpool_take(struct strmpool *sp, const struct config_avt *cfg, int af,
+		   struct strmpool_ent **entp,
+		   rtp_recv_h *rtph, rtcp_recv_h *rtcph, void *arg);
+struct rtp_sock *strmpool_ent_rtp(const struct strmpool_ent *ent);
+struct jbuf *strmpool_ent_jbuf(struct strmpool_ent *ent,
+			       const struct config_avt *cfg);
+uint32_t strmpool_hits(const struct strmpool *sp);
+uint32_t strmpool_idle(const struct strmpool *sp, int af);
+
+
+/*
+ * RTP Retransmission
+ */
+
+enum {
+	RTX_HIST_SIZE = 512,  /**< Packets kept in the send history     */
+	RTX_NACK_MAX  = 128,  /**< Missing packets tracked for NACK     */
+};
+
+/** Cached outgoing RTP packet */
+struct rtx_pkt {
+	struct mbuf *mb;  /**< RTP payload, including header extension */
+	uint32_t ts;      /**< RTP timestamp                           */
+	uint16_t seq;     /**< RTP sequence number                     */
+	bool ext;         /**< Extension bit                           */
+	bool marker;      /**< Marker bit                              */
+	bool valid;       /**< Slot contains a packet                  */
+};
+
+struct rtx_hist;
+struct rtx_nack;
+
+typedef int (rtx_nack_h)(uint16_t pid, uint16_t blp, void *arg);
+
+int  rtx_hist_alloc(struct rtx_hist **rhp, uint16_t size);
+int  rtx_hist_stage(struct rtx_hist *rh, const struct mbuf *mb);
+void rtx_hist_commit(struct rtx_hist *rh, uint16_t seq, bool ext,
+		     bool marker, uint32_t ts);
+const struct rtx_pkt *rtx_hist_lookup(struct rtx_hist *rh, uint16_t seq);
+int  rtx_hist_debug(struct re_printf *pf, const struct rtx_hist *rh);
+int  rtx_encode(struct mbuf *mb, const struct rtx_pkt *pkt, uint8_t pt,
+		uint16_t seq, uint32_t ssrc);
+int  rtx_decode(struct rtp_header *hdr, struct mbuf *mb, uint8_t apt);
+
+int  rtx_nack_alloc(struct rtx_nack **rnp);
+void rtx_nack_reset(struct rtx_nack *rn);
+unsigned rtx_nack_recv(struct rtx_nack *rn, uint16_t seq, uint64_t now);
+unsigned rtx_nack_poll(struct rtx_nack *rn, uint64_t now,
+		       rtx_nack_h *nackh, void *arg);
+bool rtx_nack_pending(const struct rtx_nack *rn);
+int  rtx_nack_debug(struct re_printf *pf, const struct rtx_nack *rn);
+
+
 /*
  * Stream
  */
@@ -258,12 +440,14 @@ struct stream;
 struct rtp_header;
 
 enum {STREAM_PRESZ = 4+12}; /* same as RTP_HEADER_SIZE */
+enum {STREAM_TRAILSZ = 16+4}; /* SRTP/SRTCP trailer */
 
 typedef void (stream_rtp_h)(const struct rtp_header *hdr,
 			    struct rtpext *extv, size_t extc,
 			    struct mbuf *mb, unsigned lostc, bool *ignore,
 			    void *arg);
 typedef int (stream_pt_h)(uint8_t pt, struct mbuf *mb, void *arg);
+typedef void (stream_lost_h)(unsigned lostc, void *arg);
 
 
 int  stream_alloc(struct stream **sp, struct list *streaml,
@@ -299,6 +483,10 @@ void stream_flush(struct stream *s);
 int  stream_decode(struct stream *s);
 int  stream_ssrc_rx(const struct stream *strm, uint32_t *ssrc);
 
+/* Retransmission */
+int  stream_enable_rtx(struct stream *strm, bool nack, stream_lost_h *losth);
+int  stream_resend(struct stream *s, uint16_t seq);
+
 
 struct bundle *stream_bundle(const struct stream *strm);
 void stream_parse_mid(struct stream *strm);
@@ -322,6 +510,8 @@ bool ua_handle_refer(struct ua *ua, const struct sip_msg *msg);
 void sipsess_conn_handler(const struct sip_msg *msg, void *arg);
 bool ua_catchall(struct ua *ua);
 bool ua_reghasladdr(const struct ua *ua, const struct sa *laddr);
+void ua_event_emit(struct ua *ua, enum ua_event ev, struct call *call,
+		   const char *buf);
 
 /*
  * User-Agent Group
@@ -346,17 +536,43 @@ struct uag {
 	struct tls *tls;               /**< TLS Context                     */
 	struct tls *wss_tls;           /**< Secure websocket TLS Context    */
 #endif
+	char *software;                /**< SIP User-Agent string           */
+};
+
+/** SIP Stack of a shard */
+struct uag_stack {
+	struct dnsc *dnsc;             /**< DNS Client                      */
+	struct sip *sip;               /**< SIP Stack                       */
+	struct sip_lsnr *lsnr;         /**< SIP Listener                    */
+	struct sipsess_sock *sock;     /**< SIP Session socket              */
+	struct sipevent_sock *evsock;  /**< SIP Event socket                */
 };
 
 struct config_sip *uag_cfg(void);
 const char *uag_eprm(void);
 bool uag_delayed_close(void);
 int uag_raise(struct ua *ua, struct le *le);
+int  uag_stack_alloc(struct uag_stack *st, sip_exit_h *exith, void *arg);
+void uag_stack_close(struct uag_stack *st);
 
 void u32mask_enable(uint32_t *mask, uint8_t bit, bool enable);
 bool u32mask_enabled(uint32_t mask, uint8_t bit);
 
 
+/*
+ * Shards
+ */
+
+int  shard_init(unsigned n);
+void shard_close(void);
+void shard_stop_all(bool forced);
+int  shard_ua_alloc(struct ua **uap, const char *aor);
+void shard_event_post(struct ua *ua, enum ua_event ev, struct call *call,
+		      const char *buf);
+struct list *shard_ual(struct shard *sh);
+struct uag_stack *shard_stack(struct shard *sh);
+
+
 /*
  * Video Stream
  */
@@ -438,3 +654,40 @@ struct media_track *mediatrack_lookup_media(const struct list *medial,
 					    struct stream *strm);
 void mediatrack_close(struct media_track *media, int err);
 void mediatrack_sdp_attr_decode(struct media_track *media);
+
+
+/*
+ * Stats
+ */
+
+enum stats_counter {
+	STATS_CALLS_CREATED = 0,
+	STATS_CALLS_DESTROYED,
+	STATS_CALLS_INCOMING,
+	STATS_CALLS_OUTGOING,
+	STATS_CALLS_ESTABLISHED,
+	STATS_REG_OK,
+	STATS_REG_FAIL,
+	STATS_AUBUF_UNDERRUN,
+	STATS_AUBUF_OVERRUN,
+	STATS_DTX_FRAMES,
+
+	STATS_N
+};
+
+enum stats_rtp {
+	STATS_RTP_TX_PACKETS = 0,
+	STATS_RTP_TX_BYTES,
+	STATS_RTP_RX_PACKETS,
+	STATS_RTP_RX_BYTES,
+	STATS_RTP_RX_LOST,
+	STATS_RTP_RX_ERRORS,
+
+	STATS_RTP_N
+};
+
+void stats_inc(enum stats_counter c);
+uint32_t stats_calls(void);
+void stats_rtp_add(enum media_type type, enum stats_rtp c, uint64_t n);
+void stats_jitter(enum media_type type, uint32_t usec);
+void stats_jbuf_delay(enum media_type type, uint32_t usec);
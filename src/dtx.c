@@ -0,0 +1,153 @@
+/**
+ * @file dtx.c  Voice activity detection and comfort noise (RFC 3389)
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <math.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The voice activity detector compares the level of each frame with a
+ * noise floor. The floor follows a lower level at once and rises slowly,
+ * so that it settles on the background noise between words. A frame is
+ * speech if it is clearly above the floor, the hangover keeps the end
+ * of words and short pauses.
+ *
+ * During silence the encoder is not called. A comfort noise packet (SID)
+ * with the noise level is sent instead, the receiver plays noise of that
+ * level until the next speech packet arrives. Only the level of the
+ * noise is used, the spectral information of RFC 3389 is not sent.
+ */
+
+
+enum {
+	VAD_HANGOVER = 200,     /* Hangover after speech in [ms]      */
+};
+
+static const double VAD_MIN    = -60.0;  /* Always silence below [dBov] */
+static const double VAD_MAX    = -30.0;  /* Always speech above [dBov]  */
+static const double VAD_MARGIN =   9.0;  /* Speech above floor [dB]     */
+static const double FLOOR_RISE =   1.0;  /* Noise floor rise [dB/s]     */
+
+
+/**
+ * Detect voice activity in one frame
+ *
+ * @param vad   Voice activity detector state
+ * @param level Level of the frame in [dBov]
+ * @param ptime Duration of the frame in [ms]
+ *
+ * @return True for speech, false for silence
+ */
+bool dtx_vad(struct dtx_vad *vad, double level, uint32_t ptime)
+{
+	bool speech;
+
+	if (!vad)
+		return true;
+
+	if (!vad->set) {
+		vad->floor = max(level, VAD_MIN);
+		vad->set   = true;
+	}
+
+	if (level < vad->floor)
+		vad->floor = level;
+	else
+		vad->floor = min(vad->floor + FLOOR_RISE * ptime/1000, level);
+
+	vad->floor = max(vad->floor, VAD_MIN);
+
+	speech = level > VAD_MAX ||
+		(level > VAD_MIN && level > vad->floor + VAD_MARGIN);
+
+	if (speech) {
+		vad->hang = VAD_HANGOVER;
+	}
+	else if (vad->hang) {
+		vad->hang -= min(vad->hang, ptime);
+		speech = true;
+	}
+
+	return speech;
+}
+
+
+/**
+ * Encode a comfort noise payload
+ *
+ * @param mb    Buffer to encode into
+ * @param level Noise level in [dBov]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dtx_cn_encode(struct mbuf *mb, double level)
+{
+	int lvl;
+
+	if (!mb)
+		return EINVAL;
+
+	lvl = (int)-level;
+	lvl = min(max(lvl, 0), 127);
+
+	return mbuf_write_u8(mb, (uint8_t)lvl);
+}
+
+
+/**
+ * Decode a comfort noise payload
+ *
+ * @param levelp Pointer to noise level in [dBov]
+ * @param mb     Buffer with the payload
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int dtx_cn_decode(double *levelp, struct mbuf *mb)
+{
+	if (!levelp || !mb)
+		return EINVAL;
+
+	if (mbuf_get_left(mb) < 1)
+		return EBADMSG;
+
+	/* the reflection coefficients are ignored */
+	*levelp = -(double)(mbuf_buf(mb)[0] & 0x7f);
+
+	return 0;
+}
+
+
+/**
+ * Generate white comfort noise
+ *
+ * @param seed  Noise generator state
+ * @param sampv Buffer for 16-bit samples
+ * @param sampc Number of samples
+ * @param level Noise level in [dBov]
+ */
+void dtx_cn_generate(uint32_t *seed, int16_t *sampv, size_t sampc,
+		     double level)
+{
+	int32_t amp;
+	size_t i;
+
+	if (!seed || !sampv)
+		return;
+
+	/* a uniform distribution has an RMS of amplitude / sqrt(3) */
+	amp = (int32_t)(32768.0 * pow(10.0, level / 20) * sqrt(3.0));
+	amp = min(amp, 32767);
+
+	for (i=0; i<sampc; i++) {
+
+		*seed = *seed * 1664525 + 1013904223;
+
+		sampv[i] = (int16_t)(((int32_t)(*seed >> 16) - 32768) *
+				     amp / 32768);
+	}
+}
@@ -123,6 +123,31 @@ static int add_rtcp_stats(struct odict *od_parent, const struct rtcp_stats *rs)
 }
 
 
+static int add_audio_latency(struct odict *od_parent, const struct audio *a)
+{
+	struct odict *od = NULL;
+	int err;
+
+	if (!od_parent || !a)
+		return EINVAL;
+
+	err = odict_alloc(&od, 8);
+	if (err)
+		return err;
+
+	err = audio_latency_json_api(od, a);
+	if (err)
+		goto out;
+
+	err = odict_entry_add(od_parent, "audio_latency", ODICT_OBJECT, od);
+
+ out:
+	mem_deref(od);
+
+	return err;
+}
+
+
 /**
  * Encode an event to a dictionary
  *
@@ -235,6 +260,11 @@ int event_encode_dict(struct odict *od, struct ua *ua, enum ua_event ev,
 		err = add_rtcp_stats(od, stream_rtcp_stats(strm));
 		if (err)
 			goto out;
+
+		if (0 == str_casecmp(prm, "audio"))
+			err = add_audio_latency(od, call_audio(call));
+		if (err)
+			goto out;
 	}
 
  out:
@@ -312,24 +342,18 @@ void uag_event_unregister(ua_event_h *h)
 
 
 /**
- * Send a User-Agent event to all UA event handlers
+ * Call all UA event handlers in the current thread
  *
  * @param ua   User-Agent object (optional)
  * @param ev   User-agent event
  * @param call Call object (optional)
- * @param fmt  Formatted arguments
- * @param ...  Variable arguments
+ * @param buf  Event parameters
  */
-void ua_event(struct ua *ua, enum ua_event ev, struct call *call,
-	      const char *fmt, ...)
+void ua_event_emit(struct ua *ua, enum ua_event ev, struct call *call,
+		   const char *buf)
 {
+	struct prof_ctx prof;
 	struct le *le;
-	char buf[256];
-	va_list ap;
-
-	va_start(ap, fmt);
-	(void)re_vsnprintf(buf, sizeof(buf), fmt, ap);
-	va_end(ap);
 
 	/* send event to all clients */
 	le = ehl.head;
@@ -342,11 +366,41 @@ void ua_event(struct ua *ua, enum ua_event ev, struct call *call,
 			break;
 		}
 
+		prof_begin(&prof, NULL);
 		eh->h(ua, ev, call, buf, eh->arg);
+		prof_end(&prof, "event", uag_event_str(ev));
 	}
 }
 
 
+/**
+ * Send a User-Agent event to all UA event handlers
+ *
+ * Events from a shard are passed to the main thread.
+ *
+ * @param ua   User-Agent object (optional)
+ * @param ev   User-agent event
+ * @param call Call object (optional)
+ * @param fmt  Formatted arguments
+ * @param ...  Variable arguments
+ */
+void ua_event(struct ua *ua, enum ua_event ev, struct call *call,
+	      const char *fmt, ...)
+{
+	char buf[256];
+	va_list ap;
+
+	va_start(ap, fmt);
+	(void)re_vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (shard_current())
+		shard_event_post(ua, ev, call, buf);
+	else
+		ua_event_emit(ua, ev, call, buf);
+}
+
+
 /**
  * Send a UA_EVENT_MODULE event with a general format for modules
  *
@@ -360,6 +414,7 @@ void ua_event(struct ua *ua, enum ua_event ev, struct call *call,
 void module_event(const char *module, const char *event, struct ua *ua,
 		struct call *call, const char *fmt, ...)
 {
+	struct prof_ctx prof;
 	struct le *le;
 	char *buf;
 	char *p;
@@ -383,13 +438,20 @@ void module_event(const char *module, const char *event, struct ua *ua,
 	(void)re_vsnprintf(p, len, fmt, ap);
 	va_end(ap);
 
+	if (shard_current()) {
+		shard_event_post(ua, UA_EVENT_MODULE, call, buf);
+		goto out;
+	}
+
 	/* send event to all clients */
 	le = ehl.head;
 	while (le) {
 		struct ua_eh *eh = le->data;
 		le = le->next;
 
+		prof_begin(&prof, NULL);
 		eh->h(ua, UA_EVENT_MODULE, call, buf, eh->arg);
+		prof_end(&prof, module, event);
 	}
 
 out:
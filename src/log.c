@@ -4,25 +4,109 @@
  * Copyright (C) 2010 Alfred E. Heggestad
  */
 
+#include <string.h>
+#if defined (_MSC_VER)
+#include <intrin.h>
+#endif
 #include <re.h>
+#include <re_atomic.h>
 #include <baresip.h>
 
 
+/*
+ * In asynchronous mode the log messages are formatted by the calling
+ * thread into a fixed size record of a multi-producer/single-consumer
+ * ring, and written to stdout and the log handlers by a drain thread.
+ * Logging from a real-time thread never blocks on I/O.
+ *
+ * The ring is a bounded queue with a sequence number per record. A
+ * producer claims the record at the tail with a compare-and-swap, but
+ * only if its sequence number says that the drain thread has released
+ * it. Otherwise the ring is full, and the message is dropped and
+ * counted. The drain thread sets the sequence number one lap ahead
+ * after writing a record.
+ *
+ * Producers are counted while they use the ring, so that disabling
+ * asynchronous mode can wait for them before the final drain.
+ *
+ * Rate limiting is done per call site, identified by the return address
+ * of the log function. Different call sites with the same format string
+ * are limited separately. Warnings and errors are never suppressed.
+ */
+
+
+#if defined (__GNUC__) || defined (__clang__)
+#define CALL_SITE() ((uintptr_t)__builtin_return_address(0))
+#elif defined (_MSC_VER)
+#define CALL_SITE() ((uintptr_t)_ReturnAddress())
+#else
+#define CALL_SITE() ((uintptr_t)0)  /* the format string is used */
+#endif
+
+
+enum {
+	LOG_BUF_SIZE     = 8192,
+	LOG_REC_SIZE     = 1024,   /* max message length in async mode  */
+	LOG_RING_SIZE    = 256,    /* records, must be a power of 2     */
+	LOG_SITES        = 256,    /* rate limit slots, a power of 2    */
+	LOG_RL_INTERVAL  = 1000,   /* rate limit interval [ms]          */
+	LOG_DRAIN_SLEEP  = 5000,   /* drain thread idle sleep [us]      */
+};
+
+
+/** Log record in the asynchronous ring */
+struct log_rec {
+	RE_ATOMIC size_t seq;     /**< Position if free, + 1 if written  */
+	enum log_level level;     /**< Log level                         */
+	char msg[LOG_REC_SIZE];   /**< Formatted message                 */
+};
+
+
+/** Rate limit state of one call site */
+struct log_site {
+	RE_ATOMIC uintptr_t key;  /**< Return address of the call site   */
+	RE_ATOMIC uint64_t win;   /**< Current rate limit interval       */
+	RE_ATOMIC uint32_t n;     /**< Messages in current interval      */
+	RE_ATOMIC uint32_t supp;  /**< Suppressed, not yet reported      */
+};
+
+
 static struct {
 	struct list logl;
-	enum log_level level;
+	RE_ATOMIC enum log_level level;
 	bool enable_stdout;
 	bool timestamps;
 	bool color;
+	RE_ATOMIC uint32_t ratelimit;
+	RE_ATOMIC uint64_t suppressed;
 } lg = {
 	LIST_INIT,
 	LEVEL_INFO,
 	true,
 	false,
-	true
+	true,
+	0,
+	0
 };
 
 
+/** Asynchronous logging */
+static struct {
+	size_t head;              /**< Next position to drain            */
+	RE_ATOMIC size_t tail;    /**< Next position to write            */
+	RE_ATOMIC bool enabled;   /**< Asynchronous logging enabled      */
+	RE_ATOMIC uint32_t producers; /**< Producers using the ring      */
+	RE_ATOMIC bool run;       /**< Drain thread is running           */
+	RE_ATOMIC uint64_t dropped; /**< Messages dropped, ring full     */
+	mtx_t *mtx;               /**< Protects the log handlers         */
+	thrd_t thr;               /**< Drain thread                      */
+	struct log_rec recv[LOG_RING_SIZE];
+} ring;
+
+
+static struct log_site sitev[LOG_SITES];
+
+
 /**
  * Register a log handler
  *
@@ -33,7 +117,13 @@ void log_register_handler(struct log *log)
 	if (!log)
 		return;
 
+	if (ring.mtx)
+		mtx_lock(ring.mtx);
+
 	list_append(&lg.logl, &log->le, log);
+
+	if (ring.mtx)
+		mtx_unlock(ring.mtx);
 }
 
 
@@ -47,7 +137,13 @@ void log_unregister_handler(struct log *log)
 	if (!log)
 		return;
 
+	if (ring.mtx)
+		mtx_lock(ring.mtx);
+
 	list_unlink(&log->le);
+
+	if (ring.mtx)
+		mtx_unlock(ring.mtx);
 }
 
 
@@ -58,7 +154,7 @@ void log_unregister_handler(struct log *log)
  */
 void log_level_set(enum log_level level)
 {
-	lg.level = level;
+	re_atomic_rlx_set(&lg.level, level);
 }
 
 
@@ -69,7 +165,7 @@ void log_level_set(enum log_level level)
  */
 enum log_level log_level_get(void)
 {
-	return lg.level;
+	return re_atomic_rlx(&lg.level);
 }
 
 
@@ -99,7 +195,7 @@ const char *log_level_name(enum log_level level)
  */
 void log_enable_debug(bool enable)
 {
-	lg.level = enable ? LEVEL_DEBUG : LEVEL_INFO;
+	re_atomic_rlx_set(&lg.level, enable ? LEVEL_DEBUG : LEVEL_INFO);
 }
 
 
@@ -110,7 +206,7 @@ void log_enable_debug(bool enable)
  */
 void log_enable_info(bool enable)
 {
-	lg.level = enable ? LEVEL_INFO : LEVEL_WARN;
+	re_atomic_rlx_set(&lg.level, enable ? LEVEL_INFO : LEVEL_WARN);
 }
 
 
@@ -148,34 +244,46 @@ void log_enable_color(bool enable)
 
 
 /**
- * Print a message to the logging system
+ * Limit the number of debug and info messages per call site and interval
  *
- * @param level Log level
- * @param fmt   Formatted message
- * @param ap    Variable argument list
+ * @param limit Max messages per call site and second, 0 to disable
  */
-void vlog(enum log_level level, const char *fmt, va_list ap)
+void log_set_ratelimit(uint32_t limit)
 {
-	char buf[8192];
-	char *p = buf;
-	size_t s = sizeof(buf);
-	int n;
-	struct le *le;
+	size_t i;
 
-	if (level < lg.level)
-		return;
+	re_atomic_rlx_set(&lg.ratelimit, limit);
 
-	if (lg.timestamps) {
-		n = re_snprintf(p, s, "%H|", fmt_timestamp, NULL);
-		if (n < 0)
-			return;
+	for (i=0; i<LOG_SITES; i++)
+		re_atomic_rlx_set(&sitev[i].key, 0);
+}
 
-		p += n;
-		s -= n;
-	}
 
-	if (re_vsnprintf(p, s, fmt, ap) < 0)
-		return;
+/**
+ * Get the number of messages dropped because the async ring was full
+ *
+ * @return Number of dropped messages
+ */
+uint64_t log_dropped(void)
+{
+	return re_atomic_rlx(&ring.dropped);
+}
+
+
+/**
+ * Get the number of messages suppressed by the rate limit
+ *
+ * @return Number of suppressed messages
+ */
+uint64_t log_suppressed(void)
+{
+	return re_atomic_rlx(&lg.suppressed);
+}
+
+
+static void write_msg(enum log_level level, const char *msg)
+{
+	struct le *le;
 
 	if (lg.enable_stdout) {
 
@@ -185,7 +293,7 @@ void vlog(enum log_level level, const char *fmt, va_list ap)
 		if (color)
 			(void)re_fprintf(stdout, "\x1b[31m"); /* Red */
 
-		(void)re_fprintf(stdout, "%s", buf);
+		(void)re_fprintf(stdout, "%s", msg);
 
 		if (color)
 			(void)re_fprintf(stdout, "\x1b[;m");
@@ -199,8 +307,274 @@ void vlog(enum log_level level, const char *fmt, va_list ap)
 		le = le->next;
 
 		if (log->h)
-			log->h(level, buf);
+			log->h(level, msg);
+	}
+}
+
+
+/*
+ * Returns true if the message from this call site is suppressed, and
+ * the number of earlier suppressed messages to report otherwise
+ */
+static bool ratelimit(uintptr_t key, uint32_t limit, uint32_t *suppp)
+{
+	struct log_site *site;
+	uint64_t win;
+	uint32_t supp;
+
+	site = &sitev[((key >> 3) * 2654435761u) & (LOG_SITES - 1)];
+	win  = tmr_jiffies() / LOG_RL_INTERVAL;
+
+	/* a colliding call site takes over the slot */
+	if (re_atomic_rlx(&site->key) != key) {
+		re_atomic_rlx_set(&site->key, key);
+		re_atomic_rlx_set(&site->supp, 0);
+		re_atomic_rlx_set(&site->win, win);
+		re_atomic_rlx_set(&site->n, 0);
+	}
+	else if (re_atomic_rlx(&site->win) != win) {
+		re_atomic_rlx_set(&site->win, win);
+		re_atomic_rlx_set(&site->n, 0);
+	}
+
+	if (re_atomic_rlx_add(&site->n, 1) >= limit) {
+		re_atomic_rlx_add(&site->supp, 1);
+		re_atomic_rlx_add(&lg.suppressed, 1);
+		return true;
+	}
+
+	supp = re_atomic_rlx(&site->supp);
+	if (supp)
+		re_atomic_rlx_sub(&site->supp, supp);
+
+	*suppp = supp;
+
+	return false;
+}
+
+
+static void async_write(enum log_level level, const char *msg, size_t len)
+{
+	struct log_rec *rec;
+	size_t t = re_atomic_rlx(&ring.tail);
+
+	for (;;) {
+		intptr_t diff;
+
+		rec  = &ring.recv[t & (LOG_RING_SIZE - 1)];
+		diff = (intptr_t)(re_atomic_acq(&rec->seq) - t);
+
+		if (diff == 0) {
+			/* on failure t is set to the current tail */
+			if (re_atomic_acq_rel_cmpxchg(&ring.tail, &t, t + 1))
+				break;
+		}
+		else if (diff < 0) {
+			/* not yet released by the drain thread */
+			re_atomic_rlx_add(&ring.dropped, 1);
+			return;
+		}
+		else {
+			/* claimed by another producer */
+			t = re_atomic_rlx(&ring.tail);
+		}
+	}
+
+	/* a truncated message keeps its line ending */
+	if (len >= sizeof(rec->msg)) {
+		len = sizeof(rec->msg) - 1;
+		memcpy(rec->msg, msg, len);
+		rec->msg[len - 1] = '\n';
+	}
+	else {
+		memcpy(rec->msg, msg, len);
+	}
+
+	rec->msg[len] = '\0';
+	rec->level    = level;
+
+	re_atomic_rls_set(&rec->seq, t + 1);
+}
+
+
+/* Write all records which are ready, returns the number of records */
+static size_t drain(void)
+{
+	static uint64_t dropped;
+	size_t h = ring.head;
+	size_t n = 0;
+	uint64_t d;
+
+	if (ring.mtx)
+		mtx_lock(ring.mtx);
+
+	for (;;) {
+		struct log_rec *rec = &ring.recv[h & (LOG_RING_SIZE - 1)];
+
+		if (re_atomic_acq(&rec->seq) != h + 1)
+			break;
+
+		write_msg(rec->level, rec->msg);
+
+		/* free for the producer one lap ahead */
+		re_atomic_rls_set(&rec->seq, h + LOG_RING_SIZE);
+		ring.head = ++h;
+		++n;
 	}
+
+	d = re_atomic_rlx(&ring.dropped);
+	if (d != dropped) {
+		char buf[64];
+
+		(void)re_snprintf(buf, sizeof(buf),
+				  "log: %llu messages dropped\n",
+				  (unsigned long long)(d - dropped));
+		write_msg(LEVEL_WARN, buf);
+		dropped = d;
+	}
+
+	if (ring.mtx)
+		mtx_unlock(ring.mtx);
+
+	return n;
+}
+
+
+static int drain_thread(void *arg)
+{
+	(void)arg;
+
+	while (re_atomic_acq(&ring.run)) {
+
+		if (!drain())
+			sys_usleep(LOG_DRAIN_SLEEP);
+	}
+
+	return 0;
+}
+
+
+/**
+ * Enable asynchronous logging from a separate thread
+ *
+ * @param enable True to enable, false to disable and write pending
+ *               messages
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int log_enable_async(bool enable)
+{
+	size_t i;
+	int err;
+
+	if (enable == re_atomic_rlx(&ring.enabled))
+		return 0;
+
+	if (!enable) {
+		re_atomic_seq_set(&ring.enabled, false);
+
+		/* producers which have seen the ring as enabled */
+		while (re_atomic_seq(&ring.producers))
+			sys_usleep(100);
+
+		re_atomic_rls_set(&ring.run, false);
+		thrd_join(ring.thr, NULL);
+
+		drain();
+
+		ring.mtx = mem_deref(ring.mtx);
+
+		return 0;
+	}
+
+	err = mutex_alloc(&ring.mtx);
+	if (err)
+		return err;
+
+	/* no producer or drain thread uses the ring here */
+	ring.head = 0;
+	re_atomic_rlx_set(&ring.tail, 0);
+	for (i=0; i<LOG_RING_SIZE; i++)
+		re_atomic_rlx_set(&ring.recv[i].seq, i);
+
+	re_atomic_rls_set(&ring.run, true);
+
+	err = thread_create_name(&ring.thr, "log", drain_thread, NULL);
+	if (err) {
+		re_atomic_rlx_set(&ring.run, false);
+		ring.mtx = mem_deref(ring.mtx);
+		return err;
+	}
+
+	re_atomic_rls_set(&ring.enabled, true);
+
+	return 0;
+}
+
+
+static void vlog_site(enum log_level level, uintptr_t site,
+		      const char *fmt, va_list ap)
+{
+	char buf[LOG_BUF_SIZE];
+	char *p = buf;
+	size_t s = sizeof(buf);
+	uint32_t limit, supp = 0;
+	int n;
+
+	if (level < re_atomic_rlx(&lg.level))
+		return;
+
+	/* suppressed messages are not formatted */
+	limit = level < LEVEL_WARN ? re_atomic_rlx(&lg.ratelimit) : 0;
+	if (limit && ratelimit(site ? site : (uintptr_t)fmt, limit, &supp))
+		return;
+
+	if (lg.timestamps) {
+		n = re_snprintf(p, s, "%H|", fmt_timestamp, NULL);
+		if (n < 0)
+			return;
+
+		p += n;
+		s -= n;
+	}
+
+	if (supp) {
+		n = re_snprintf(p, s, "(%u suppressed) ", supp);
+		if (n < 0)
+			return;
+
+		p += n;
+		s -= n;
+	}
+
+	n = re_vsnprintf(p, s, fmt, ap);
+	if (n < 0)
+		return;
+
+	re_atomic_seq_add(&ring.producers, 1);
+
+	if (re_atomic_seq(&ring.enabled)) {
+		async_write(level, buf, strlen(buf));
+		re_atomic_acq_rel_sub(&ring.producers, 1);
+		return;
+	}
+
+	re_atomic_acq_rel_sub(&ring.producers, 1);
+
+	write_msg(level, buf);
+}
+
+
+/**
+ * Print a message to the logging system
+ *
+ * @param level Log level
+ * @param fmt   Formatted message
+ * @param ap    Variable argument list
+ */
+void vlog(enum log_level level, const char *fmt, va_list ap)
+{
+	vlog_site(level, CALL_SITE(), fmt, ap);
 }
 
 
@@ -216,7 +590,7 @@ void loglv(enum log_level level, const char *fmt, ...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	vlog(level, fmt, ap);
+	vlog_site(level, CALL_SITE(), fmt, ap);
 	va_end(ap);
 }
 
@@ -232,7 +606,7 @@ void debug(const char *fmt, ...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	vlog(LEVEL_DEBUG, fmt, ap);
+	vlog_site(LEVEL_DEBUG, CALL_SITE(), fmt, ap);
 	va_end(ap);
 }
 
@@ -248,7 +622,7 @@ void info(const char *fmt, ...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	vlog(LEVEL_INFO, fmt, ap);
+	vlog_site(LEVEL_INFO, CALL_SITE(), fmt, ap);
 	va_end(ap);
 }
 
@@ -264,6 +638,6 @@ void warning(const char *fmt, ...)
 	va_list ap;
 
 	va_start(ap, fmt);
-	vlog(LEVEL_WARN, fmt, ap);
+	vlog_site(LEVEL_WARN, CALL_SITE(), fmt, ap);
 	va_end(ap);
 }
@@ -343,6 +343,11 @@ int main(int argc, char *argv[])
 	debug("main: unloading modules..\n");
 	mod_close();
 
+	prof_enable(false);
+
+	/* write pending log messages */
+	log_enable_async(false);
+
 	re_thread_async_close();
 
 	/* Check for open timers */
@@ -777,6 +777,34 @@ struct dnsc *net_dnsc(const struct network *net)
 }
 
 
+/**
+ * Allocate a new DNS Client with the name servers of the network
+ *
+ * The DNS Client of the network belongs to the main thread, a thread
+ * with its own re main loop must use its own DNS Client.
+ *
+ * @param dnscp Pointer to allocated DNS Client
+ * @param net   Network instance
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int net_dnsc_alloc(struct dnsc **dnscp, const struct network *net)
+{
+	struct sa nsv[NET_MAX_NS];
+	uint32_t nsn = ARRAY_SIZE(nsv);
+	int err;
+
+	if (!dnscp || !net)
+		return EINVAL;
+
+	err = net_dns_srv_get(net, nsv, &nsn, NULL);
+	if (err)
+		return err;
+
+	return dnsc_alloc(dnscp, NULL, nsv, nsn);
+}
+
+
 bool net_laddr_apply(const struct network *net, net_ifaddr_h *ifh, void *arg)
 {
 	struct le *le;
@@ -0,0 +1,374 @@
+/**
+ * @file playout.c  Adaptive playout delay with time-stretching
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <math.h>
+#include <string.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The playout controller keeps the receive audio buffer close to the
+ * current network jitter. The jitter is the peak of the relative delay
+ * of the arriving packets, it follows an increase at once and decays
+ * slowly when the network calms down.
+ *
+ * The buffer level is moved towards the target by time-stretching the
+ * decoded frames before they are written to the buffer, similar to
+ * WSOLA: one pitch period is removed (accelerate) or repeated
+ * (preemptive expand) with a cross-fade. This is only done on periodic
+ * speech, where the change is inaudible, or on silence. Other frames
+ * are passed on unchanged.
+ *
+ * Only 16-bit samples are stretched.
+ */
+
+
+enum {
+	PERIOD_MIN    =  2500,  /* Shortest pitch period in [us]          */
+	PERIOD_MAX    = 15000,  /* Longest pitch period in [us]           */
+	SEARCH_RATE   =  8000,  /* Sample rate of the pitch search [Hz]   */
+	JITTER_DECAY  =   256,  /* Jitter release, in packets             */
+	LEVEL_SMOOTH  =     8,  /* Buffer level smoothing, in frames      */
+	HYSTERESIS    =  5000,  /* Minimum hysteresis of the level [us]   */
+	SILENCE_POWER = 256*256,/* Mean square power of silence           */
+};
+
+static const double CORR_MIN = 0.8;  /* Normalized correlation */
+
+
+/** Playout controller */
+struct playout {
+	uint32_t srate;       /**< Sample rate in [Hz]                   */
+	uint8_t ch;           /**< Number of channels                    */
+	uint32_t min;         /**< Minimum buffer in [us]                */
+	uint32_t max;         /**< Maximum buffer in [us]                */
+	uint32_t jitter;      /**< Peak relative delay in [us]           */
+	uint32_t target;      /**< Target buffer level in [us]           */
+	int64_t level;        /**< Smoothed buffer level in [us]         */
+	bool level_set;       /**< Level has a value                     */
+	int16_t *sampv;       /**< Stretched samples                     */
+	size_t sampsz;        /**< Size of sampv in samples              */
+	uint64_t n_accel;     /**< Number of accelerated frames          */
+	uint64_t n_expand;    /**< Number of expanded frames             */
+};
+
+
+static void destructor(void *arg)
+{
+	struct playout *po = arg;
+
+	mem_deref(po->sampv);
+}
+
+
+/**
+ * Allocate a playout controller
+ *
+ * @param pop    Pointer to allocated playout controller
+ * @param srate  Sample rate in [Hz]
+ * @param ch     Number of channels
+ * @param buffer Minimum and maximum buffer in [ms]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int playout_alloc(struct playout **pop, uint32_t srate, uint8_t ch,
+		  const struct range *buffer)
+{
+	struct playout *po;
+
+	if (!pop || !srate || !ch || !buffer)
+		return EINVAL;
+
+	po = mem_zalloc(sizeof(*po), destructor);
+	if (!po)
+		return ENOMEM;
+
+	po->srate  = srate;
+	po->ch     = ch;
+	po->min    = buffer->min * 1000;
+	po->max    = buffer->max * 1000;
+	po->target = po->min;
+
+	*pop = po;
+
+	return 0;
+}
+
+
+/**
+ * Add the relative delay of an arriving packet
+ *
+ * @param po    Playout controller
+ * @param delay Relative delay in [us]
+ */
+void playout_arrival(struct playout *po, uint32_t delay)
+{
+	if (!po)
+		return;
+
+	if (delay > po->jitter)
+		po->jitter = delay;
+	else
+		po->jitter -= (po->jitter - delay) / JITTER_DECAY;
+}
+
+
+static uint32_t frame_usec(const struct playout *po, size_t frames)
+{
+	return (uint32_t)(frames * 1000000ULL / po->srate);
+}
+
+
+/*
+ * Find the pitch period in [samples] with the highest normalized
+ * correlation between the first two periods of the first channel
+ */
+static size_t pitch_period(const struct playout *po, const int16_t *x,
+			   size_t frames, double *corr)
+{
+	const size_t ds = max(po->srate / SEARCH_RATE, 1u);
+	const size_t ch = po->ch;
+	size_t tmin, tmax, t, i, best = 0;
+	double best_c = -1.0;
+
+	tmin = (size_t)po->srate * PERIOD_MIN / 1000000;
+	tmax = (size_t)po->srate * PERIOD_MAX / 1000000;
+	tmax = min(tmax, frames / 2);
+
+	for (t=tmin; t<=tmax; t+=ds) {
+
+		int64_t xy = 0, xx = 0, yy = 0;
+		double c;
+
+		for (i=0; i<t; i+=ds) {
+			int32_t a = x[i * ch];
+			int32_t b = x[(i + t) * ch];
+
+			xy += a * b;
+			xx += a * a;
+			yy += b * b;
+		}
+
+		if (!xx || !yy)
+			continue;
+
+		c = (double)xy / sqrt((double)xx * (double)yy);
+		if (c > best_c) {
+			best_c = c;
+			best   = t;
+		}
+	}
+
+	*corr = best_c;
+
+	return best;
+}
+
+
+static bool is_silence(const struct playout *po, const int16_t *x,
+		       size_t frames)
+{
+	int64_t pwr = 0;
+	size_t i;
+
+	for (i=0; i<frames; i++)
+		pwr += (int32_t)x[i * po->ch] * x[i * po->ch];
+
+	return pwr < (int64_t)frames * SILENCE_POWER;
+}
+
+
+/* Fade from a to b over n frames */
+static void crossfade(int16_t *y, const int16_t *a, const int16_t *b,
+		      size_t n, uint8_t ch)
+{
+	size_t i;
+	uint8_t c;
+
+	for (i=0; i<n; i++) {
+		for (c=0; c<ch; c++) {
+			size_t k = i * ch + c;
+
+			y[k] = (int16_t)(((int32_t)a[k] * (int32_t)(n - i) +
+					  (int32_t)b[k] * (int32_t)i) /
+					 (int32_t)n);
+		}
+	}
+}
+
+
+static int sampv_grow(struct playout *po, size_t sampc)
+{
+	if (po->sampsz >= sampc)
+		return 0;
+
+	po->sampv  = mem_deref(po->sampv);
+	po->sampsz = 0;
+
+	po->sampv = mem_alloc(sampc * sizeof(*po->sampv), NULL);
+	if (!po->sampv)
+		return ENOMEM;
+
+	po->sampsz = sampc;
+
+	return 0;
+}
+
+
+/* Remove the second period, the first fades into it */
+static size_t accelerate(struct playout *po, struct auframe *af, size_t t)
+{
+	const int16_t *x = af->sampv;
+	const size_t ch = po->ch;
+	const size_t frames = af->sampc / ch;
+
+	if (sampv_grow(po, af->sampc))
+		return 0;
+
+	crossfade(po->sampv, x, &x[t * ch], t, po->ch);
+	memcpy(&po->sampv[t * ch], &x[2 * t * ch],
+	       (frames - 2 * t) * ch * sizeof(*x));
+
+	af->sampv = po->sampv;
+	af->sampc = (frames - t) * ch;
+
+	return t;
+}
+
+
+/* Repeat the first period, the second fades into it */
+static size_t expand(struct playout *po, struct auframe *af, size_t t)
+{
+	const int16_t *x = af->sampv;
+	const size_t ch = po->ch;
+	const size_t frames = af->sampc / ch;
+
+	if (sampv_grow(po, af->sampc + t * ch))
+		return 0;
+
+	memcpy(po->sampv, x, t * ch * sizeof(*x));
+	crossfade(&po->sampv[t * ch], &x[t * ch], x, t, po->ch);
+	memcpy(&po->sampv[2 * t * ch], &x[t * ch],
+	       (frames - t) * ch * sizeof(*x));
+
+	af->sampv = po->sampv;
+	af->sampc = (frames + t) * ch;
+
+	return t;
+}
+
+
+/**
+ * Time-stretch a decoded frame towards the target buffer level
+ *
+ * The frame is changed in place, the samples may point to a buffer of
+ * the playout controller that is valid until the next call.
+ *
+ * @param po       Playout controller
+ * @param af       Audio frame
+ * @param buffered Current buffer level in [us]
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int playout_process(struct playout *po, struct auframe *af,
+		    uint32_t buffered)
+{
+	size_t frames, t = 0;
+	uint32_t dur, hyst;
+	double corr = 0.0;
+	int dir = 0;
+
+	if (!po || !af)
+		return EINVAL;
+
+	if (af->fmt != AUFMT_S16LE || af->ch != po->ch ||
+	    af->srate != po->srate || !af->sampc)
+		return 0;
+
+	frames = af->sampc / po->ch;
+	dur    = frame_usec(po, frames);
+	hyst   = max(dur / 2, (uint32_t)HYSTERESIS);
+
+	if (po->level_set) {
+		po->level += ((int64_t)buffered - po->level) / LEVEL_SMOOTH;
+	}
+	else {
+		po->level = buffered;
+		po->level_set = true;
+	}
+
+	po->target = min(max(po->jitter + dur, po->min), po->max);
+
+	if (po->level > (int64_t)po->target + hyst)
+		dir = -1;
+	else if (po->level + hyst < (int64_t)po->target)
+		dir = 1;
+
+	if (!dir)
+		return 0;
+
+	/* any period will do for silence, take the longest */
+	if (is_silence(po, af->sampv, frames)) {
+		t = (size_t)po->srate * PERIOD_MAX / 1000000;
+		t = min(t, frames / 2);
+	}
+	else {
+		t = pitch_period(po, af->sampv, frames, &corr);
+		if (corr < CORR_MIN)
+			return 0;
+	}
+
+	if (!t)
+		return 0;
+
+	if (dir < 0) {
+		t = accelerate(po, af, t);
+		po->level -= frame_usec(po, t);
+		po->n_accel += t ? 1 : 0;
+	}
+	else {
+		t = expand(po, af, t);
+		po->level += frame_usec(po, t);
+		po->n_expand += t ? 1 : 0;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Get the target buffer level
+ *
+ * @param po Playout controller
+ *
+ * @return Target buffer level in [us]
+ */
+uint32_t playout_target(const struct playout *po)
+{
+	return po ? po->target : 0;
+}
+
+
+/**
+ * Print the playout controller state
+ *
+ * @param pf Print function
+ * @param po Playout controller
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int playout_debug(struct re_printf *pf, const struct playout *po)
+{
+	if (!po)
+		return 0;
+
+	return re_hprintf(pf, "jitter %u ms, target %u ms, level %lld ms,"
+			  " accelerate %llu, expand %llu",
+			  po->jitter / 1000, po->target / 1000,
+			  po->level / 1000, po->n_accel, po->n_expand);
+}
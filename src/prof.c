@@ -0,0 +1,430 @@
+/**
+ * @file prof.c  Main loop profiler
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The profiler measures the execution time of the handlers which run in
+ * the re main loop, and the lateness of their timers. Each call site is
+ * identified by its module and function name and has two histograms.
+ *
+ * Handlers inside libre (e.g. SIP transactions) cannot be instrumented
+ * from here, a probe timer measures the lateness of the main loop which
+ * also includes their execution time.
+ *
+ * Only calls from the main thread are recorded, so no locking is needed.
+ *
+ * A handler over the budget is logged at most once per interval and
+ * call site, together with the number of calls over the budget since
+ * the last warning. A handler which is always slow would otherwise
+ * flood the log, and add the cost of logging to the loop it measures.
+ */
+
+
+enum {
+	PROF_PROBE  =    10,   /* Probe timer interval in [ms]     */
+	PROF_BUDGET =  5000,   /* Default handler budget in [us]   */
+	PROF_HASH   =    64,   /* Hash table size for call sites   */
+	PROF_WARN   = 10000,   /* Warning interval per site [ms]   */
+};
+
+
+struct prof_site {
+	struct le he;
+	char *mod;
+	char *func;
+	struct aulat exec;     /**< Execution time in [us]         */
+	struct aulat late;     /**< Timer lateness in [us]         */
+	uint64_t total;        /**< Total execution time in [us]   */
+	uint32_t over;         /**< Calls exceeding the budget     */
+	uint32_t over_warn;    /**< Value of over at last warning  */
+	uint64_t t_warn;       /**< Time of last warning in [ms]   */
+};
+
+
+static struct {
+	bool enabled;
+	thrd_t tid;
+	uint32_t budget;
+	struct hash *sites;
+	struct tmr tmr;
+	struct aulat loop;
+	uint64_t expected;
+} prof = {
+	.budget = PROF_BUDGET,
+};
+
+
+static void site_destructor(void *arg)
+{
+	struct prof_site *site = arg;
+
+	hash_unlink(&site->he);
+	mem_deref(site->mod);
+	mem_deref(site->func);
+}
+
+
+struct site_key {
+	const char *mod;
+	const char *func;
+};
+
+
+static bool site_cmp_handler(struct le *le, void *arg)
+{
+	const struct prof_site *site = le->data;
+	const struct site_key *key = arg;
+
+	return 0 == str_cmp(site->func, key->func) &&
+		0 == str_cmp(site->mod, key->mod);
+}
+
+
+static struct prof_site *site_get(const char *mod, const char *func)
+{
+	struct site_key key = {mod, func};
+	struct prof_site *site;
+	uint32_t h = hash_joaat_str(func);
+
+	site = list_ledata(hash_lookup(prof.sites, h, site_cmp_handler,
+				       &key));
+	if (site)
+		return site;
+
+	site = mem_zalloc(sizeof(*site), site_destructor);
+	if (!site)
+		return NULL;
+
+	if (str_dup(&site->mod, mod) || str_dup(&site->func, func)) {
+		mem_deref(site);
+		return NULL;
+	}
+
+	hash_append(prof.sites, h, &site->he, site);
+
+	return site;
+}
+
+
+static void probe_handler(void *arg)
+{
+	uint64_t now = tmr_jiffies_usec();
+	(void)arg;
+
+	if (prof.expected)
+		aulat_add(&prof.loop, now > prof.expected ?
+			  (uint32_t)(now - prof.expected) : 0);
+
+	prof.expected = now + PROF_PROBE * 1000;
+	tmr_start(&prof.tmr, PROF_PROBE, probe_handler, NULL);
+}
+
+
+/**
+ * Enable or disable the main loop profiler
+ *
+ * Must be called from the main thread.
+ *
+ * @param enable True to enable, false to disable and free all data
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int prof_enable(bool enable)
+{
+	int err;
+
+	if (enable == prof.enabled)
+		return 0;
+
+	if (!enable) {
+		prof.enabled = false;
+		tmr_cancel(&prof.tmr);
+		hash_flush(prof.sites);
+		prof.sites = mem_deref(prof.sites);
+		return 0;
+	}
+
+	err = hash_alloc(&prof.sites, PROF_HASH);
+	if (err)
+		return err;
+
+	memset(&prof.loop, 0, sizeof(prof.loop));
+	prof.expected = 0;
+	prof.tid = thrd_current();
+
+	tmr_init(&prof.tmr);
+	tmr_start(&prof.tmr, PROF_PROBE, probe_handler, NULL);
+
+	prof.enabled = true;
+
+	return 0;
+}
+
+
+/**
+ * Check if the main loop profiler is enabled
+ *
+ * @return True if enabled, otherwise false
+ */
+bool prof_enabled(void)
+{
+	return prof.enabled;
+}
+
+
+/**
+ * Set the execution time budget, longer handlers are logged
+ *
+ * @param usec Budget in [us], 0 to disable
+ */
+void prof_set_budget(uint32_t usec)
+{
+	prof.budget = usec;
+}
+
+
+/**
+ * Reset all profiler histograms
+ */
+void prof_reset(void)
+{
+	if (!prof.enabled)
+		return;
+
+	hash_flush(prof.sites);
+	memset(&prof.loop, 0, sizeof(prof.loop));
+}
+
+
+/**
+ * Start profiling a handler
+ *
+ * @param ctx Profiler context on the stack of the handler
+ * @param tmr Timer which called the handler (optional)
+ */
+void prof_begin(struct prof_ctx *ctx, const struct tmr *tmr)
+{
+	if (!ctx)
+		return;
+
+	ctx->t0 = 0;
+
+	if (!prof.enabled || !thrd_equal(thrd_current(), prof.tid))
+		return;
+
+	ctx->t0   = tmr_jiffies_usec();
+	ctx->late = 0;
+	ctx->tmr  = tmr != NULL;
+
+	/* the timer expiry is kept after the timer has fired */
+	if (tmr && ctx->t0 > tmr->jfs * 1000)
+		ctx->late = (uint32_t)min(ctx->t0 - tmr->jfs * 1000,
+					  (uint64_t)UINT32_MAX);
+}
+
+
+/**
+ * Stop profiling a handler and record the execution time
+ *
+ * @param ctx  Profiler context from prof_begin()
+ * @param mod  Module name
+ * @param func Function name
+ */
+void prof_end(const struct prof_ctx *ctx, const char *mod, const char *func)
+{
+	struct prof_site *site;
+	uint32_t usec;
+
+	if (!ctx || !ctx->t0 || !prof.enabled)
+		return;
+
+	usec = (uint32_t)min(tmr_jiffies_usec() - ctx->t0,
+			     (uint64_t)UINT32_MAX);
+
+	site = site_get(mod, func);
+	if (!site)
+		return;
+
+	aulat_add(&site->exec, usec);
+	site->total += usec;
+
+	if (ctx->tmr)
+		aulat_add(&site->late, ctx->late);
+
+	if (prof.budget && usec > prof.budget) {
+		uint64_t now = tmr_jiffies();
+
+		++site->over;
+
+		if (site->t_warn && now < site->t_warn + PROF_WARN)
+			return;
+
+		warning("prof: %s/%s took %u us (budget %u us,"
+			" %u times over since last warning)\n",
+			mod, func, usec, prof.budget,
+			site->over - site->over_warn);
+
+		site->over_warn = site->over;
+		site->t_warn    = now;
+	}
+}
+
+
+static bool sort_handler(struct le *le1, struct le *le2, void *arg)
+{
+	const struct prof_site *s1 = le1->data;
+	const struct prof_site *s2 = le2->data;
+	(void)arg;
+
+	return s1->total >= s2->total;
+}
+
+
+static bool sort_apply(struct le *le, void *arg)
+{
+	struct prof_site *site = le->data;
+	struct list *sorted = arg;
+	struct le *lex = mem_zalloc(sizeof(*lex), NULL);
+
+	if (!lex)
+		return true;
+
+	list_append(sorted, lex, site);
+
+	return false;
+}
+
+
+/* all call sites sorted by total execution time, the caller frees it */
+static void sites_sorted(struct list *sorted)
+{
+	list_init(sorted);
+
+	hash_apply(prof.sites, sort_apply, sorted);
+	list_sort(sorted, sort_handler, NULL);
+}
+
+
+/**
+ * Print the profiler histograms
+ *
+ * @param pf     Print handler
+ * @param unused Unused parameter
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int prof_debug(struct re_printf *pf, void *unused)
+{
+	struct list sorted;
+	struct le *le;
+	int err;
+	(void)unused;
+
+	if (!prof.enabled)
+		return re_hprintf(pf, "main loop profiler is disabled\n");
+
+	err  = re_hprintf(pf, "--- Main loop profiler (budget %u us) ---\n",
+			  prof.budget);
+	err |= re_hprintf(pf, "loop lateness [us]:    p50     p99     max\n"
+			  "                    %H\n", aulat_debug, &prof.loop);
+	err |= re_hprintf(pf, "\n%-32s %10s %6s  %s\n",
+			  "handler", "total [ms]", "over",
+			  "exec [us]: p50 p99 max / timer late [us]");
+
+	sites_sorted(&sorted);
+
+	for (le = sorted.head; le; le = le->next) {
+		const struct prof_site *site = le->data;
+		char name[64];
+
+		re_snprintf(name, sizeof(name), "%s/%s",
+			    site->mod, site->func);
+
+		err |= re_hprintf(pf, "%-32s %10llu %6u  %H\n",
+				  name, site->total / 1000, site->over,
+				  aulat_debug, &site->exec);
+
+		if (re_atomic_rlx(&site->late.n))
+			err |= re_hprintf(pf, "%52s%H\n", "",
+					  aulat_debug, &site->late);
+	}
+
+	list_flush(&sorted);
+
+	return err;
+}
+
+
+/**
+ * Encode the profiler histograms in JSON
+ *
+ * @param od Dictionary to encode into
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int prof_json_api(struct odict *od)
+{
+	struct odict *sites = NULL;
+	struct list sorted;
+	struct le *le;
+	int err;
+
+	if (!od)
+		return EINVAL;
+
+	err  = odict_entry_add(od, "enabled", ODICT_BOOL, prof.enabled);
+	err |= odict_entry_add(od, "budget", ODICT_INT,
+			       (int64_t)prof.budget);
+	if (err || !prof.enabled)
+		return err;
+
+	err = aulat_json_api(od, "loop", &prof.loop);
+	if (err)
+		return err;
+
+	err = odict_alloc(&sites, 32);
+	if (err)
+		return err;
+
+	sites_sorted(&sorted);
+
+	for (le = sorted.head; le && !err; le = le->next) {
+		const struct prof_site *site = le->data;
+		struct odict *o = NULL;
+		char name[64];
+
+		re_snprintf(name, sizeof(name), "%s/%s",
+			    site->mod, site->func);
+
+		err = odict_alloc(&o, 8);
+		if (err)
+			break;
+
+		err |= odict_entry_add(o, "total", ODICT_INT,
+				       (int64_t)site->total);
+		err |= odict_entry_add(o, "over", ODICT_INT,
+				       (int64_t)site->over);
+		err |= aulat_json_api(o, "exec", &site->exec);
+		if (re_atomic_rlx(&site->late.n))
+			err |= aulat_json_api(o, "late", &site->late);
+
+		err |= odict_entry_add(sites, name, ODICT_OBJECT, o);
+		mem_deref(o);
+	}
+
+	list_flush(&sorted);
+
+	if (!err)
+		err = odict_entry_add(od, "handlers", ODICT_OBJECT, sites);
+
+	mem_deref(sites);
+
+	return err;
+}
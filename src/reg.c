@@ -13,6 +13,7 @@ struct reg {
 	struct le le;                /**< Linked list element                */
 	struct ua *ua;               /**< Pointer to parent UA object        */
 	struct sipreg *sipreg;       /**< SIP Register client                */
+	struct account *acc;         /**< Account used for authentication    */
 	int id;                      /**< Registration ID (for SIP outbound) */
 	int regint;                  /**< Registration interval              */
 
@@ -29,6 +30,7 @@ static void destructor(void *arg)
 
 	list_unlink(&reg->le);
 	mem_deref(reg->sipreg);
+	mem_deref(reg->acc);
 	mem_deref(reg->srv);
 }
 
@@ -113,6 +115,7 @@ static void register_handler(int err, const struct sip_msg *msg, void *arg)
 				account_aor(acc), prio, err);
 
 		reg->scode = 999;
+		stats_inc(STATS_REG_FAIL);
 
 		ua_event(reg->ua, evfail, NULL, "%m", err);
 		return;
@@ -141,6 +144,7 @@ static void register_handler(int err, const struct sip_msg *msg, void *arg)
 		}
 
 		reg->scode = msg->scode;
+		stats_inc(STATS_REG_OK);
 
 		hdr = sip_msg_hdr_apply(msg, true, SIP_HDR_CONTACT,
 					contact_handler, reg);
@@ -164,6 +168,7 @@ static void register_handler(int err, const struct sip_msg *msg, void *arg)
 				prio, msg->scode, &msg->reason, reg->srv);
 
 		reg->scode = msg->scode;
+		stats_inc(STATS_REG_FAIL);
 
 		ua_event(reg->ua, evfail, NULL, "%u %r",
 			 msg->scode, &msg->reason);
@@ -209,6 +214,11 @@ int reg_register(struct reg *reg, const char *reg_uri, const char *params,
 
 	failed = sipreg_failed(reg->sipreg);
 	reg->sipreg = mem_deref(reg->sipreg);
+
+	/* the UA may replace its account while this client registers */
+	mem_deref(reg->acc);
+	reg->acc = mem_ref(acc);
+
 	err = sipreg_alloc(&reg->sipreg, uag_sip(), reg_uri,
 			      account_aor(acc),
 			      acc ? acc->dispname : NULL, account_aor(acc),
@@ -216,7 +226,7 @@ int reg_register(struct reg *reg, const char *reg_uri, const char *params,
 			      routev[0] ? routev : NULL,
 			      routev[0] ? 1 : 0,
 			      reg->id,
-			      sip_auth_handler, acc, true,
+			      sip_auth_handler, reg->acc, true,
 			      register_handler, reg,
 			      params[0] ? &params[1] : NULL,
 			      "Allow: %H\r\n", ua_print_allowed, reg->ua);
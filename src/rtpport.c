@@ -0,0 +1,378 @@
+/**
+ * @file rtpport.c  RTP port allocator
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The RTP port range is split into even/odd pairs (RTP and RTCP), with
+ * one bit per pair. A rotating cursor hands out the next free pair, so
+ * recently released ports are not reused immediately and a reservation
+ * does not need to probe ports which are known to be in use.
+ */
+
+
+enum {
+	RTPPORT_AFC = 2,
+	RTPPORT_BIND_TRIES = 8,
+};
+
+
+/** Port allocator state for one address family */
+struct rtpport_af {
+	uint32_t *bitmap;     /**< One bit per even/odd port pair      */
+	struct range range;   /**< Configured port range               */
+	uint16_t base;        /**< First even port                     */
+	uint32_t npairs;      /**< Number of port pairs                */
+	uint32_t nwords;      /**< Number of words in the bitmap       */
+	uint32_t cursor;      /**< Next pair to check                  */
+	uint32_t used;        /**< Number of reserved pairs            */
+	uint32_t peak;        /**< Peak number of reserved pairs       */
+	uint32_t n_full;      /**< Reservations failed, range full     */
+	uint32_t n_bindfail;  /**< Reserved ports that failed to bind  */
+};
+
+
+/** RTP port allocator */
+struct rtpport {
+	mtx_t lock;
+	struct rtpport_af afv[RTPPORT_AFC];
+};
+
+
+static void destructor(void *arg)
+{
+	struct rtpport *rp = arg;
+	size_t i;
+
+	for (i=0; i<RTPPORT_AFC; i++)
+		mem_deref(rp->afv[i].bitmap);
+
+	mtx_destroy(&rp->lock);
+}
+
+
+static struct rtpport_af *af_state(struct rtpport *rp, int af)
+{
+	switch (af) {
+
+	case AF_INET:  return &rp->afv[0];
+	case AF_INET6: return &rp->afv[1];
+	default:       return NULL;
+	}
+}
+
+
+static const char *af_name(size_t i)
+{
+	return i == 0 ? "IPv4" : "IPv6";
+}
+
+
+static int af_init(struct rtpport_af *st, const struct range *ports)
+{
+	uint32_t *bitmap;
+	uint32_t base, npairs, nwords, tail;
+
+	base = (ports->min + 1) & ~1u;
+	if (ports->max > 0xffff || base + 1 > ports->max)
+		return EINVAL;
+
+	npairs = (ports->max - base + 1) / 2;
+	nwords = (npairs + 31) / 32;
+
+	bitmap = mem_zalloc(nwords * sizeof(*bitmap), NULL);
+	if (!bitmap)
+		return ENOMEM;
+
+	/* the bits after the last pair are never free */
+	tail = npairs % 32;
+	if (tail)
+		bitmap[nwords - 1] = ~0u << tail;
+
+	mem_deref(st->bitmap);
+
+	st->bitmap = bitmap;
+	st->range  = *ports;
+	st->base   = base;
+	st->npairs = npairs;
+	st->nwords = nwords;
+	st->cursor = rand_u32() % npairs;
+	st->used   = 0;
+
+	return 0;
+}
+
+
+static unsigned first_bit(uint32_t v)
+{
+	unsigned n = 0;
+
+	while (!(v & 1)) {
+		v >>= 1;
+		++n;
+	}
+
+	return n;
+}
+
+
+static bool find_free(const struct rtpport_af *st, uint32_t *ixp)
+{
+	uint32_t w = st->cursor / 32;
+	uint32_t i;
+
+	/* the word with the cursor is visited twice, first the bits
+	 * from the cursor and last the bits before it */
+	for (i=0; i<=st->nwords; i++) {
+
+		uint32_t avail = ~st->bitmap[w];
+
+		if (i == 0)
+			avail &= ~0u << (st->cursor % 32);
+
+		if (avail) {
+			*ixp = w * 32 + first_bit(avail);
+			return true;
+		}
+
+		if (++w == st->nwords)
+			w = 0;
+	}
+
+	return false;
+}
+
+
+/**
+ * Allocate an RTP port allocator
+ *
+ * @param rpp Pointer to allocated RTP port allocator
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtpport_alloc(struct rtpport **rpp)
+{
+	struct rtpport *rp;
+	int err;
+
+	if (!rpp)
+		return EINVAL;
+
+	rp = mem_zalloc(sizeof(*rp), destructor);
+	if (!rp)
+		return ENOMEM;
+
+	err = mtx_init(&rp->lock, mtx_plain) != thrd_success;
+	if (err) {
+		mem_deref(rp);
+		return ENOMEM;
+	}
+
+	*rpp = rp;
+
+	return 0;
+}
+
+
+/**
+ * Reserve a free RTP/RTCP port pair
+ *
+ * @param rp    RTP port allocator
+ * @param af    Address family
+ * @param ports Port range
+ * @param portp Pointer to reserved (even) RTP port, RTCP is port + 1
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtpport_reserve(struct rtpport *rp, int af, const struct range *ports,
+		    uint16_t *portp)
+{
+	struct rtpport_af *st;
+	uint32_t ix;
+	int err = 0;
+
+	if (!rp || !ports || !portp)
+		return EINVAL;
+
+	mtx_lock(&rp->lock);
+
+	st = af_state(rp, af);
+	if (!st) {
+		err = EAFNOSUPPORT;
+		goto out;
+	}
+
+	/* a changed range takes effect once all ports are released */
+	if (!st->bitmap || (!st->used &&
+			    (st->range.min != ports->min ||
+			     st->range.max != ports->max))) {
+
+		err = af_init(st, ports);
+		if (err)
+			goto out;
+	}
+
+	if (!find_free(st, &ix)) {
+		++st->n_full;
+		err = ENOSPC;
+		goto out;
+	}
+
+	st->bitmap[ix / 32] |= 1u << (ix % 32);
+	st->cursor = (ix + 1) % st->npairs;
+
+	if (++st->used > st->peak)
+		st->peak = st->used;
+
+	*portp = st->base + 2 * ix;
+
+ out:
+	mtx_unlock(&rp->lock);
+
+	return err;
+}
+
+
+/**
+ * Release a reserved RTP/RTCP port pair
+ *
+ * @param rp       RTP port allocator
+ * @param af       Address family
+ * @param port     Reserved RTP port
+ * @param bindfail True if the port pair could not be bound
+ */
+void rtpport_release(struct rtpport *rp, int af, uint16_t port,
+		     bool bindfail)
+{
+	struct rtpport_af *st;
+	uint32_t ix, bit;
+
+	if (!rp || !port)
+		return;
+
+	mtx_lock(&rp->lock);
+
+	st = af_state(rp, af);
+	if (!st || !st->bitmap || port < st->base)
+		goto out;
+
+	ix = (port - st->base) / 2;
+	if (ix >= st->npairs)
+		goto out;
+
+	bit = 1u << (ix % 32);
+	if (!(st->bitmap[ix / 32] & bit))
+		goto out;
+
+	st->bitmap[ix / 32] &= ~bit;
+	--st->used;
+
+	if (bindfail)
+		++st->n_bindfail;
+
+ out:
+	mtx_unlock(&rp->lock);
+}
+
+
+/**
+ * Listen on a port pair from the RTP port allocator. Ports which are in
+ * use by other applications fail to bind and are skipped.
+ *
+ * @param rp    RTP port allocator (optional)
+ * @param rtpp  Pointer to allocated RTP socket
+ * @param laddr Local address
+ * @param ports Port range
+ * @param portp Pointer to reserved RTP port, zero if not reserved
+ * @param rtph  RTP receive handler
+ * @param rtcph RTCP receive handler
+ * @param arg   Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtpport_listen(struct rtpport *rp, struct rtp_sock **rtpp,
+		   const struct sa *laddr, const struct range *ports,
+		   uint16_t *portp, rtp_recv_h *rtph, rtcp_recv_h *rtcph,
+		   void *arg)
+{
+	int af = sa_af(laddr);
+	uint16_t port;
+	unsigned i;
+	int err = 0;
+
+	if (!rtpp || !laddr || !ports || !portp)
+		return EINVAL;
+
+	*portp = 0;
+
+	if (!rp) {
+		return rtp_listen(rtpp, IPPROTO_UDP, laddr,
+				  ports->min, ports->max,
+				  true, rtph, rtcph, arg);
+	}
+
+	for (i=0; i<RTPPORT_BIND_TRIES; i++) {
+
+		err = rtpport_reserve(rp, af, ports, &port);
+		if (err)
+			return err;
+
+		err = rtp_listen(rtpp, IPPROTO_UDP, laddr, port, port + 1,
+				 true, rtph, rtcph, arg);
+		if (!err) {
+			*portp = port;
+			return 0;
+		}
+
+		rtpport_release(rp, af, port, true);
+	}
+
+	return err;
+}
+
+
+/**
+ * Print the RTP port allocator utilization
+ *
+ * @param pf Print function
+ * @param rp RTP port allocator
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtpport_debug(struct re_printf *pf, const struct rtpport *rp)
+{
+	struct rtpport *rpm = (struct rtpport *)rp;
+	size_t i;
+	int err;
+
+	if (!rp)
+		return 0;
+
+	err = re_hprintf(pf, "--- RTP ports ---\n");
+
+	mtx_lock(&rpm->lock);
+
+	for (i=0; i<RTPPORT_AFC; i++) {
+
+		const struct rtpport_af *st = &rp->afv[i];
+
+		if (!st->bitmap)
+			continue;
+
+		err |= re_hprintf(pf, " %s: %u-%u pairs=%u used=%u (%.1f%%)"
+				  " peak=%u full=%u bindfail=%u\n",
+				  af_name(i), st->range.min, st->range.max,
+				  st->npairs, st->used,
+				  100.0 * st->used / st->npairs,
+				  st->peak, st->n_full, st->n_bindfail);
+	}
+
+	mtx_unlock(&rpm->lock);
+
+	return err;
+}
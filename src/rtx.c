@@ -0,0 +1,516 @@
+/**
+ * @file rtx.c  RTP Retransmission (RFC 4585 Generic NACK and RFC 4588 RTX)
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+enum {
+	RTX_REORDER_PKTS = 3,    /**< Reordering tolerance in packets     */
+	RTX_REORDER_MS   = 10,   /**< Reordering tolerance in [ms]        */
+	RTX_RETRY_MS     = 40,   /**< Interval between NACKs in [ms]      */
+	RTX_MAX_TRIES    = 3,    /**< Max NACKs sent per missing packet   */
+	RTX_MAX_AGE      = 500,  /**< Give up on a missing packet [ms]    */
+	RTX_BUFSZ        = 1500, /**< Initial size of history buffers     */
+};
+
+
+/*
+ * Send history
+ *
+ * Ring buffer of the most recent outgoing RTP packets, indexed by the
+ * low bits of the RTP sequence number. The packet buffers are recycled,
+ * so after the ring has been filled once no more memory is allocated.
+ */
+
+struct rtx_hist {
+	struct rtx_pkt *pktv;  /**< Packet slots                         */
+	struct mbuf *spare;    /**< Staged payload, swapped into a slot  */
+	uint16_t mask;         /**< Number of slots minus one            */
+
+	struct {
+		uint32_t n_resent; /**< Packets retransmitted            */
+		uint32_t n_miss;   /**< Requested but no longer cached   */
+	} stats;
+};
+
+
+static void hist_destructor(void *arg)
+{
+	struct rtx_hist *rh = arg;
+	size_t i;
+
+	for (i=0; i<=rh->mask; i++)
+		mem_deref(rh->pktv[i].mb);
+
+	mem_deref(rh->pktv);
+	mem_deref(rh->spare);
+}
+
+
+/**
+ * Allocate an RTP send history
+ *
+ * @param rhp  Pointer to allocated send history
+ * @param size Number of packets to keep, must be a power of two
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtx_hist_alloc(struct rtx_hist **rhp, uint16_t size)
+{
+	struct rtx_hist *rh;
+	int err = 0;
+
+	if (!rhp || !size || (size & (size - 1)))
+		return EINVAL;
+
+	rh = mem_zalloc(sizeof(*rh), hist_destructor);
+	if (!rh)
+		return ENOMEM;
+
+	rh->mask = size - 1;
+
+	rh->pktv  = mem_zalloc(size * sizeof(*rh->pktv), NULL);
+	rh->spare = mbuf_alloc(RTX_BUFSZ);
+	if (!rh->pktv || !rh->spare) {
+		err = ENOMEM;
+		goto out;
+	}
+
+ out:
+	if (err)
+		mem_deref(rh);
+	else
+		*rhp = rh;
+
+	return err;
+}
+
+
+/**
+ * Stage an outgoing RTP payload before it is sent. The payload must be
+ * copied before sending, since media encryption works in-place.
+ *
+ * @param rh  Send history
+ * @param mb  RTP payload, including any header extension
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtx_hist_stage(struct rtx_hist *rh, const struct mbuf *mb)
+{
+	if (!rh || !mb)
+		return EINVAL;
+
+	if (!rh->spare) {
+		rh->spare = mbuf_alloc(RTX_BUFSZ);
+		if (!rh->spare)
+			return ENOMEM;
+	}
+
+	mbuf_rewind(rh->spare);
+
+	return mbuf_write_mem(rh->spare, mbuf_buf(mb), mbuf_get_left(mb));
+}
+
+
+/**
+ * Commit the staged payload to the send history, once the sequence
+ * number assigned by the RTP stack is known
+ *
+ * @param rh     Send history
+ * @param seq    RTP sequence number
+ * @param ext    Extension bit
+ * @param marker Marker bit
+ * @param ts     RTP timestamp
+ */
+void rtx_hist_commit(struct rtx_hist *rh, uint16_t seq, bool ext,
+		     bool marker, uint32_t ts)
+{
+	struct rtx_pkt *pkt;
+	struct mbuf *mb;
+
+	if (!rh || !rh->spare)
+		return;
+
+	pkt = &rh->pktv[seq & rh->mask];
+
+	/* swap buffers, the old packet buffer is the next spare */
+	mb = pkt->mb;
+	pkt->mb = rh->spare;
+	rh->spare = mb;
+
+	pkt->seq    = seq;
+	pkt->ts     = ts;
+	pkt->ext    = ext;
+	pkt->marker = marker;
+	pkt->valid  = true;
+}
+
+
+/**
+ * Look up a packet in the send history
+ *
+ * @param rh  Send history
+ * @param seq RTP sequence number
+ *
+ * @return Cached packet if found, otherwise NULL
+ */
+const struct rtx_pkt *rtx_hist_lookup(struct rtx_hist *rh, uint16_t seq)
+{
+	const struct rtx_pkt *pkt;
+
+	if (!rh)
+		return NULL;
+
+	pkt = &rh->pktv[seq & rh->mask];
+	if (!pkt->valid || pkt->seq != seq) {
+		++rh->stats.n_miss;
+		return NULL;
+	}
+
+	++rh->stats.n_resent;
+
+	return pkt;
+}
+
+
+int rtx_hist_debug(struct re_printf *pf, const struct rtx_hist *rh)
+{
+	if (!rh)
+		return 0;
+
+	return re_hprintf(pf, " rtx history: size=%u resent=%u miss=%u\n",
+			  rh->mask + 1, rh->stats.n_resent,
+			  rh->stats.n_miss);
+}
+
+
+/**
+ * Encode an RTX packet (RFC 4588) from a cached packet. The original
+ * sequence number is inserted in front of the original payload, after
+ * any header extension.
+ *
+ * @param mb   Buffer to encode into
+ * @param pkt  Cached packet
+ * @param pt   RTX payload type
+ * @param seq  RTX sequence number
+ * @param ssrc RTX synchronization source
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtx_encode(struct mbuf *mb, const struct rtx_pkt *pkt, uint8_t pt,
+	       uint16_t seq, uint32_t ssrc)
+{
+	struct rtp_header hdr;
+	const uint8_t *p;
+	size_t len, ext_len = 0;
+	int err;
+
+	if (!mb || !pkt || !pkt->mb)
+		return EINVAL;
+
+	p   = pkt->mb->buf;
+	len = pkt->mb->end;
+
+	if (pkt->ext) {
+		if (len < RTPEXT_HDR_SIZE)
+			return EBADMSG;
+
+		ext_len = RTPEXT_HDR_SIZE + 4 * (p[2] << 8 | p[3]);
+		if (ext_len > len)
+			return EBADMSG;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+
+	hdr.ver  = RTP_VERSION;
+	hdr.ext  = pkt->ext;
+	hdr.m    = pkt->marker;
+	hdr.pt   = pt;
+	hdr.seq  = seq;
+	hdr.ts   = pkt->ts;
+	hdr.ssrc = ssrc;
+
+	err  = rtp_hdr_encode(mb, &hdr);
+	err |= mbuf_write_mem(mb, p, ext_len);
+	err |= mbuf_write_u16(mb, htons(pkt->seq));
+	err |= mbuf_write_mem(mb, p + ext_len, len - ext_len);
+
+	return err;
+}
+
+
+/**
+ * Decode an incoming RTX packet (RFC 4588) into the original packet.
+ * The header extension, if any, is kept in front of the payload.
+ *
+ * @param hdr RTP header, rewritten to the original packet
+ * @param mb  RTP payload
+ * @param apt Associated (original) payload type
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtx_decode(struct rtp_header *hdr, struct mbuf *mb, uint8_t apt)
+{
+	size_t ext_len;
+
+	if (!hdr || !mb)
+		return EINVAL;
+
+	if (mbuf_get_left(mb) < 2)
+		return EBADMSG;
+
+	hdr->seq = ntohs(mbuf_read_u16(mb));
+	hdr->pt  = apt;
+
+	/* move the extension data next to the original payload */
+	ext_len = hdr->ext ? hdr->x.len * sizeof(uint32_t) : 0;
+	if (ext_len && mb->pos >= ext_len + 2) {
+
+		uint8_t *p = mb->buf + mb->pos - 2 - ext_len;
+
+		memmove(p + 2, p, ext_len);
+	}
+
+	return 0;
+}
+
+
+/*
+ * NACK generator
+ *
+ * Tracks missing sequence numbers of incoming RTP packets. A packet is
+ * only reported missing after the reordering tolerance has passed, and
+ * is given up after a number of retries, at which point the caller
+ * should fall back to requesting a picture update.
+ */
+
+struct rtx_nack {
+	struct rtx_miss {
+		uint64_t first;    /**< Time the gap was detected        */
+		uint64_t sent;     /**< Time of the last NACK            */
+		uint16_t seq;      /**< Missing sequence number          */
+		uint8_t tries;     /**< Number of NACKs sent             */
+	} missv[RTX_NACK_MAX];
+	size_t missc;              /**< Number of missing packets        */
+	uint16_t seq_max;          /**< Highest sequence number received */
+	bool started;              /**< First packet received            */
+
+	struct {
+		uint32_t n_nack;      /**< NACKed packets                */
+		uint32_t n_recovered; /**< Recovered after a NACK        */
+		uint32_t n_lost;      /**< Given up                      */
+	} stats;
+};
+
+
+/**
+ * Allocate a NACK generator
+ *
+ * @param rnp Pointer to allocated NACK generator
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int rtx_nack_alloc(struct rtx_nack **rnp)
+{
+	struct rtx_nack *rn;
+
+	if (!rnp)
+		return EINVAL;
+
+	rn = mem_zalloc(sizeof(*rn), NULL);
+	if (!rn)
+		return ENOMEM;
+
+	*rnp = rn;
+
+	return 0;
+}
+
+
+void rtx_nack_reset(struct rtx_nack *rn)
+{
+	if (!rn)
+		return;
+
+	rn->missc   = 0;
+	rn->started = false;
+}
+
+
+static void miss_remove(struct rtx_nack *rn, size_t i)
+{
+	--rn->missc;
+
+	memmove(&rn->missv[i], &rn->missv[i + 1],
+		(rn->missc - i) * sizeof(rn->missv[0]));
+}
+
+
+/**
+ * Register an incoming RTP packet
+ *
+ * @param rn  NACK generator
+ * @param seq RTP sequence number
+ * @param now Current time in [ms]
+ *
+ * @return Number of packets that cannot be recovered
+ */
+unsigned rtx_nack_recv(struct rtx_nack *rn, uint16_t seq, uint64_t now)
+{
+	int16_t delta;
+	size_t i;
+
+	if (!rn)
+		return 0;
+
+	if (!rn->started) {
+		rn->seq_max = seq;
+		rn->started = true;
+		return 0;
+	}
+
+	delta = (int16_t)(seq - rn->seq_max);
+
+	if (delta > 0) {
+
+		unsigned gap = delta - 1;
+		uint16_t s;
+
+		rn->seq_max = seq;
+
+		/* too many packets missing, better ask for a picture update */
+		if (gap > RTX_NACK_MAX - rn->missc) {
+
+			gap += (unsigned)rn->missc;
+
+			rn->missc = 0;
+			rn->stats.n_lost += gap;
+
+			return gap;
+		}
+
+		for (s = seq - gap; s != seq; s++) {
+
+			struct rtx_miss *m = &rn->missv[rn->missc++];
+
+			m->first = now;
+			m->sent  = 0;
+			m->seq   = s;
+			m->tries = 0;
+		}
+	}
+	else if (delta < 0) {
+
+		/* reordered or retransmitted packet */
+		for (i=0; i<rn->missc; i++) {
+
+			if (rn->missv[i].seq != seq)
+				continue;
+
+			if (rn->missv[i].tries)
+				++rn->stats.n_recovered;
+
+			miss_remove(rn, i);
+			break;
+		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Send NACKs for all missing packets that are due
+ *
+ * @param rn    NACK generator
+ * @param now   Current time in [ms]
+ * @param nackh Handler called for each Generic NACK FCI entry
+ * @param arg   Handler argument
+ *
+ * @return Number of packets that were given up
+ */
+unsigned rtx_nack_poll(struct rtx_nack *rn, uint64_t now,
+		       rtx_nack_h *nackh, void *arg)
+{
+	uint16_t pid = 0, blp = 0;
+	bool pending = false;
+	unsigned lost = 0;
+	size_t i = 0;
+
+	if (!rn || !nackh)
+		return 0;
+
+	while (i < rn->missc) {
+
+		struct rtx_miss *m = &rn->missv[i];
+		uint16_t dist;
+
+		if (now - m->first > RTX_MAX_AGE ||
+		    (m->tries >= RTX_MAX_TRIES &&
+		     now - m->sent >= RTX_RETRY_MS)) {
+
+			miss_remove(rn, i);
+			++lost;
+			continue;
+		}
+
+		++i;
+
+		/* reordering tolerance */
+		if ((uint16_t)(rn->seq_max - m->seq) < RTX_REORDER_PKTS &&
+		    now - m->first < RTX_REORDER_MS)
+			continue;
+
+		if (m->tries >= RTX_MAX_TRIES ||
+		    (m->tries && now - m->sent < RTX_RETRY_MS))
+			continue;
+
+		m->sent = now;
+		++m->tries;
+		++rn->stats.n_nack;
+
+		dist = m->seq - pid;
+
+		if (pending && dist >= 1 && dist <= 16) {
+			blp |= 1 << (dist - 1);
+			continue;
+		}
+
+		if (pending)
+			(void)nackh(pid, blp, arg);
+
+		pid = m->seq;
+		blp = 0;
+		pending = true;
+	}
+
+	if (pending)
+		(void)nackh(pid, blp, arg);
+
+	rn->stats.n_lost += lost;
+
+	return lost;
+}
+
+
+bool rtx_nack_pending(const struct rtx_nack *rn)
+{
+	return rn ? rn->missc > 0 : false;
+}
+
+
+int rtx_nack_debug(struct re_printf *pf, const struct rtx_nack *rn)
+{
+	if (!rn)
+		return 0;
+
+	return re_hprintf(pf, " rtx nack: missing=%zu nacked=%u"
+			  " recovered=%u lost=%u\n",
+			  rn->missc, rn->stats.n_nack,
+			  rn->stats.n_recovered, rn->stats.n_lost);
+}
@@ -0,0 +1,715 @@
+/**
+ * @file shard.c  User-Agents in worker threads
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * In sharded mode the User-Agents are partitioned across worker threads.
+ * Each shard runs its own re main loop with its own SIP stack, so a UA
+ * and its calls are handled by one thread and the signalling load is
+ * spread over several cores.
+ *
+ * Work is passed to a shard with shard_exec(). UA events from a shard are
+ * passed to the main thread, where the event handlers are called with the
+ * re context of the shard entered. The handlers may use the UA and call
+ * of the event, but note that timers started and re_cancel() called from
+ * a handler act on the main loop of the shard.
+ */
+
+
+enum {
+	MQ_EXEC = 1,
+	MQ_STOP,
+};
+
+
+struct shard {
+	unsigned idx;
+	thrd_t tid;
+	struct re *re;             /**< re context of the shard          */
+	struct mqueue *mq;         /**< Message queue to the shard       */
+	struct uag_stack st;       /**< SIP Stack of the shard           */
+	struct list ual;           /**< User-Agents of the shard         */
+	int err;
+	bool run;                  /**< Thread was started               */
+	bool ready;                /**< Thread is initialized            */
+	bool stopping;             /**< SIP Stack is closing             */
+	bool stopped;              /**< Thread has exited                */
+};
+
+struct shard_work {
+	shard_h *h;
+	void *arg;
+	bool wait;
+	bool done;
+};
+
+struct shard_event {
+	struct le le;
+	struct shard *sh;
+	struct ua *ua;
+	struct call *call;
+	enum ua_event ev;
+	char *buf;
+};
+
+
+static struct {
+	struct shard **shardv;     /**< Allocated shards                 */
+	unsigned size;             /**< Size of shardv                   */
+	unsigned n;                /**< Number of running shards         */
+	unsigned next;             /**< Next shard for a new UA          */
+	struct mqueue *mq;         /**< Message queue to the main thread */
+	struct list evl;           /**< Pending events (shard_event)     */
+	mtx_t *mtx;                /**< Protects evl and the shard state */
+	cnd_t cnd;
+	tss_t key;                 /**< Current shard of the thread      */
+	bool key_init;
+} shards;
+
+
+static void shard_set_current(struct shard *sh)
+{
+	(void)tss_set(shards.key, sh);
+}
+
+
+static void shard_enter(struct shard *sh)
+{
+	(void)re_thread_attach(sh->re);
+	re_thread_enter();
+	shard_set_current(sh);
+}
+
+
+static void shard_leave(void)
+{
+	shard_set_current(NULL);
+	re_thread_leave();
+	re_thread_detach();
+}
+
+
+static int shard_push(struct shard *sh, int id, void *data)
+{
+	int err;
+
+	mtx_lock(shards.mtx);
+	err = sh->mq ? mqueue_push(sh->mq, id, data) : ESHUTDOWN;
+	mtx_unlock(shards.mtx);
+
+	return err;
+}
+
+
+static void shard_stop(struct shard *sh, bool forced)
+{
+	struct le *le;
+
+	if (sh->stopping) {
+		if (forced) {
+			sipsess_close_all(sh->st.sock);
+			sip_close(sh->st.sip, true);
+		}
+		return;
+	}
+
+	sh->stopping = true;
+
+	le = sh->ual.head;
+	while (le) {
+		struct ua *ua = le->data;
+		le = le->next;
+
+		(void)ua_destroy(ua);
+	}
+
+	if (forced)
+		sipsess_close_all(sh->st.sock);
+
+	sip_close(sh->st.sip, forced);
+}
+
+
+static void mqueue_handler(int id, void *data, void *arg)
+{
+	struct shard *sh = arg;
+	struct shard_work *work = data;
+
+	switch (id) {
+
+	case MQ_EXEC:
+		work->h(work->arg);
+
+		if (!work->wait) {
+			mem_deref(work);
+			break;
+		}
+
+		/* the work is on the stack of the waiting thread */
+		mtx_lock(shards.mtx);
+		work->done = true;
+		cnd_broadcast(&shards.cnd);
+		mtx_unlock(shards.mtx);
+		break;
+
+	case MQ_STOP:
+		shard_stop(sh, data != NULL);
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+/* This function is called when all SIP transactions of the shard are done */
+static void exit_handler(void *arg)
+{
+	struct shard *sh = arg;
+
+	debug("shard %u: sip-stack exit\n", sh->idx);
+
+	re_cancel();
+}
+
+
+static int shard_thread(void *arg)
+{
+	struct shard *sh = arg;
+	struct mqueue *mq;
+	int err;
+
+	err = re_alloc(&sh->re);
+	if (err)
+		goto out;
+
+	err = re_thread_attach(sh->re);
+	if (err)
+		goto out;
+
+	shard_set_current(sh);
+
+	err = mqueue_alloc(&mq, mqueue_handler, sh);
+	if (err)
+		goto out;
+
+	mtx_lock(shards.mtx);
+	sh->mq = mq;
+	mtx_unlock(shards.mtx);
+
+	err = uag_stack_alloc(&sh->st, exit_handler, sh);
+
+ out:
+	mtx_lock(shards.mtx);
+	sh->err = err;
+	sh->ready = true;
+	cnd_broadcast(&shards.cnd);
+	mtx_unlock(shards.mtx);
+
+	if (!err)
+		err = re_main(NULL);
+
+	list_flush(&sh->ual);
+	uag_stack_close(&sh->st);
+
+	mtx_lock(shards.mtx);
+	mq = sh->mq;
+	sh->mq = NULL;
+	mtx_unlock(shards.mtx);
+
+	mem_deref(mq);
+
+	shard_set_current(NULL);
+	re_thread_detach();
+
+	/* wake up threads waiting for lost work */
+	mtx_lock(shards.mtx);
+	sh->stopped = true;
+	cnd_broadcast(&shards.cnd);
+	mtx_unlock(shards.mtx);
+
+	return err;
+}
+
+
+static void shard_destructor(void *arg)
+{
+	struct shard *sh = arg;
+
+	if (sh->run) {
+		(void)shard_push(sh, MQ_STOP, sh);
+		thrd_join(sh->tid, NULL);
+	}
+
+	mem_deref(sh->re);
+}
+
+
+static int shard_alloc(struct shard **shp, unsigned idx)
+{
+	struct shard *sh;
+	int err;
+
+	sh = mem_zalloc(sizeof(*sh), shard_destructor);
+	if (!sh)
+		return ENOMEM;
+
+	sh->idx = idx;
+	list_init(&sh->ual);
+
+	err = thread_create_name(&sh->tid, "shard", shard_thread, sh);
+	if (err)
+		goto out;
+
+	sh->run = true;
+
+	mtx_lock(shards.mtx);
+	while (!sh->ready)
+		cnd_wait(&shards.cnd, shards.mtx);
+	err = sh->err;
+	mtx_unlock(shards.mtx);
+
+ out:
+	if (err)
+		mem_deref(sh);
+	else
+		*shp = sh;
+
+	return err;
+}
+
+
+static void event_destructor(void *arg)
+{
+	struct shard_event *sev = arg;
+
+	mem_deref(sev->call);
+	mem_deref(sev->ua);
+	mem_deref(sev->buf);
+}
+
+
+static void events_dispatch(void)
+{
+	struct list evl = LIST_INIT;
+	struct le *le;
+
+	for (;;) {
+		mtx_lock(shards.mtx);
+		while ((le = list_head(&shards.evl))) {
+			list_unlink(le);
+			list_append(&evl, le, le->data);
+		}
+		mtx_unlock(shards.mtx);
+
+		if (list_isempty(&evl))
+			break;
+
+		while ((le = list_head(&evl))) {
+			struct shard_event *sev = le->data;
+
+			list_unlink(le);
+
+			shard_enter(sev->sh);
+			ua_event_emit(sev->ua, sev->ev, sev->call, sev->buf);
+			mem_deref(sev);
+			shard_leave();
+		}
+	}
+}
+
+
+static void main_mqueue_handler(int id, void *data, void *arg)
+{
+	(void)id;
+	(void)data;
+	(void)arg;
+
+	events_dispatch();
+}
+
+
+/**
+ * Start the shards, must be called from the main thread
+ *
+ * @param n Number of shards
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int shard_init(unsigned n)
+{
+	unsigned i;
+	int err;
+
+	if (!n)
+		return EINVAL;
+
+	if (shards.shardv)
+		return EALREADY;
+
+	err = mutex_alloc(&shards.mtx);
+	if (err)
+		return err;
+
+	if (cnd_init(&shards.cnd) != thrd_success) {
+		shards.mtx = mem_deref(shards.mtx);
+		return ENOMEM;
+	}
+
+	if (tss_create(&shards.key, NULL) != thrd_success) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	shards.key_init = true;
+
+	err = mqueue_alloc(&shards.mq, main_mqueue_handler, NULL);
+	if (err)
+		goto out;
+
+	shards.shardv = mem_zalloc(n * sizeof(*shards.shardv), NULL);
+	if (!shards.shardv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	shards.size = n;
+
+	for (i=0; i<n; i++) {
+		err = shard_alloc(&shards.shardv[i], i);
+		if (err) {
+			warning("shard: could not start shard %u (%m)\n",
+				i, err);
+			goto out;
+		}
+	}
+
+	shards.n = n;
+
+	info("shard: %u User-Agent shards started\n", n);
+
+ out:
+	if (err)
+		shard_close();
+
+	return err;
+}
+
+
+/**
+ * Stop the shards and free all resources
+ */
+void shard_close(void)
+{
+	unsigned i;
+
+	if (!shards.mtx)
+		return;
+
+	shards.n = 0;
+
+	for (i=0; i<shards.size; i++) {
+		struct shard *sh = shards.shardv[i];
+
+		if (!sh || !sh->run)
+			continue;
+
+		(void)shard_push(sh, MQ_STOP, sh);
+		thrd_join(sh->tid, NULL);
+		sh->run = false;
+	}
+
+	/* deliver the events from the shutdown of the shards */
+	if (shards.shardv)
+		events_dispatch();
+
+	for (i=0; i<shards.size; i++)
+		mem_deref(shards.shardv[i]);
+
+	shards.shardv = mem_deref(shards.shardv);
+	shards.size = 0;
+	shards.mq = mem_deref(shards.mq);
+
+	if (shards.key_init) {
+		tss_delete(shards.key);
+		shards.key_init = false;
+	}
+
+	cnd_destroy(&shards.cnd);
+	shards.mtx = mem_deref(shards.mtx);
+	shards.next = 0;
+}
+
+
+/**
+ * Stop all User-Agents of the shards and close their SIP stacks
+ *
+ * @param forced True to force, otherwise false
+ */
+void shard_stop_all(bool forced)
+{
+	unsigned i;
+
+	for (i=0; i<shards.n; i++)
+		(void)shard_push(shards.shardv[i], MQ_STOP,
+				 forced ? shards.shardv[i] : NULL);
+}
+
+
+struct ua_alloc_ctx {
+	struct ua **uap;
+	const char *aor;
+	int err;
+};
+
+
+static void ua_alloc_handler(void *arg)
+{
+	struct ua_alloc_ctx *ctx = arg;
+
+	ctx->err = ua_alloc(ctx->uap, ctx->aor);
+}
+
+
+/**
+ * Allocate a User-Agent in the next shard
+ *
+ * @param uap Pointer to allocated User-Agent object (optional)
+ * @param aor SIP Address-of-Record (AOR)
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int shard_ua_alloc(struct ua **uap, const char *aor)
+{
+	struct ua_alloc_ctx ctx = {uap, aor, 0};
+	struct shard *sh;
+	int err;
+
+	if (!shards.n)
+		return ENOENT;
+
+	sh = shards.shardv[shards.next++ % shards.n];
+
+	err = shard_exec(sh, ua_alloc_handler, &ctx, true);
+
+	return err ? err : ctx.err;
+}
+
+
+/**
+ * Pass a UA event from a shard to the main thread
+ *
+ * @param ua   User-Agent object (optional)
+ * @param ev   User-agent event
+ * @param call Call object (optional)
+ * @param buf  Event parameters
+ */
+void shard_event_post(struct ua *ua, enum ua_event ev, struct call *call,
+		      const char *buf)
+{
+	struct shard_event *sev;
+	bool wakeup;
+
+	sev = mem_zalloc(sizeof(*sev), event_destructor);
+	if (!sev)
+		return;
+
+	/* an object in its destructor can not be referenced */
+	sev->sh   = shard_current();
+	sev->ua   = ua && mem_nrefs(ua) ? mem_ref(ua) : NULL;
+	sev->call = call && mem_nrefs(call) ? mem_ref(call) : NULL;
+	sev->ev   = ev;
+
+	if (str_dup(&sev->buf, buf)) {
+		mem_deref(sev);
+		return;
+	}
+
+	mtx_lock(shards.mtx);
+	wakeup = list_isempty(&shards.evl);
+	list_append(&shards.evl, &sev->le, sev);
+	mtx_unlock(shards.mtx);
+
+	if (wakeup)
+		(void)mqueue_push(shards.mq, 0, NULL);
+}
+
+
+/**
+ * Get the number of shards
+ *
+ * @return Number of shards, 0 if sharded mode is off
+ */
+unsigned shard_count(void)
+{
+	return shards.n;
+}
+
+
+/**
+ * Get a shard by index
+ *
+ * @param idx Shard index
+ *
+ * @return Shard if found, otherwise NULL
+ */
+struct shard *shard_get(unsigned idx)
+{
+	return idx < shards.n ? shards.shardv[idx] : NULL;
+}
+
+
+/**
+ * Get the shard of the current thread
+ *
+ * In the main thread this is the shard of the event which is being
+ * handled, if any.
+ *
+ * @return Current shard, NULL for the main thread
+ */
+struct shard *shard_current(void)
+{
+	return shards.key_init ? tss_get(shards.key) : NULL;
+}
+
+
+/**
+ * Get the index of a shard
+ *
+ * @param sh Shard
+ *
+ * @return Shard index
+ */
+unsigned shard_index(const struct shard *sh)
+{
+	return sh ? sh->idx : 0;
+}
+
+
+/**
+ * Execute a handler in the thread of a shard
+ *
+ * If the current thread belongs to the shard the handler is called
+ * directly. A shard must not wait for another shard.
+ *
+ * @param sh   Shard, or NULL for the main thread
+ * @param h    Handler
+ * @param arg  Handler argument
+ * @param wait True to wait until the handler has returned
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int shard_exec(struct shard *sh, shard_h *h, void *arg, bool wait)
+{
+	struct shard_work sync, *work;
+	int err;
+
+	if (!h)
+		return EINVAL;
+
+	if (sh == shard_current()) {
+		h(arg);
+		return 0;
+	}
+
+	if (!sh)
+		return EINVAL;
+
+	if (wait) {
+		memset(&sync, 0, sizeof(sync));
+		work = &sync;
+	}
+	else {
+		work = mem_zalloc(sizeof(*work), NULL);
+		if (!work)
+			return ENOMEM;
+	}
+
+	work->h    = h;
+	work->arg  = arg;
+	work->wait = wait;
+
+	err = shard_push(sh, MQ_EXEC, work);
+	if (err) {
+		if (!wait)
+			mem_deref(work);
+		return err;
+	}
+
+	if (!wait)
+		return 0;
+
+	mtx_lock(shards.mtx);
+	while (!work->done && !sh->stopped)
+		cnd_wait(&shards.cnd, shards.mtx);
+	err = work->done ? 0 : ESHUTDOWN;
+	mtx_unlock(shards.mtx);
+
+	return err;
+}
+
+
+/**
+ * Execute a handler in the main thread and in the thread of each shard
+ *
+ * The handler is called once per thread, one call after the other, so it
+ * can collect results in its argument without locking. In each call
+ * uag_list() returns the User-Agents of that thread. Must be called from
+ * the main thread, outside of the event handler of a shard.
+ *
+ * @param h    Handler
+ * @param arg  Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int shard_exec_all(shard_h *h, void *arg)
+{
+	unsigned i;
+	int err = 0;
+
+	if (!h)
+		return EINVAL;
+
+	if (shard_current())
+		return EDEADLK;
+
+	h(arg);
+
+	for (i=0; i<shards.n && !err; i++)
+		err = shard_exec(shards.shardv[i], h, arg, true);
+
+	return err;
+}
+
+
+/**
+ * Get the User-Agents of a shard
+ *
+ * @param sh Shard
+ *
+ * @return List of User-Agents (struct ua)
+ */
+struct list *shard_ual(struct shard *sh)
+{
+	return sh ? &sh->ual : NULL;
+}
+
+
+/**
+ * Get the SIP Stack of a shard
+ *
+ * @param sh Shard
+ *
+ * @return SIP Stack of the shard
+ */
+struct uag_stack *shard_stack(struct shard *sh)
+{
+	return sh ? &sh->st : NULL;
+}
@@ -7,8 +7,12 @@
 SRCS	+= account.c
 SRCS	+= aucodec.c
 SRCS	+= audio.c
+SRCS	+= aulat.c
+SRCS	+= auring.c
 SRCS	+= aufilt.c
+SRCS	+= aug711.c
 SRCS	+= auplay.c
+SRCS	+= aupoly.c
 SRCS	+= ausrc.c
 SRCS	+= baresip.c
 SRCS	+= bundle.c
@@ -20,6 +24,7 @@ SRCS	+= contact.c
 SRCS	+= custom_hdrs.c
 SRCS	+= descr.c
 SRCS	+= dial_number.c
+SRCS	+= dtx.c
 SRCS	+= event.c
 SRCS	+= http.c
 SRCS	+= log.c
@@ -33,11 +38,18 @@ SRCS	+= module.c
 SRCS	+= net.c
 SRCS	+= peerconn.c
 SRCS	+= play.c
+SRCS	+= playout.c
+SRCS	+= prof.c
 SRCS	+= reg.c
+SRCS	+= rtpport.c
 SRCS	+= rtpstat.c
+SRCS	+= rtx.c
 SRCS	+= sdp.c
+SRCS	+= shard.c
 SRCS	+= sipreq.c
+SRCS	+= stats.c
 SRCS	+= stream.c
+SRCS	+= strmpool.c
 SRCS	+= stunuri.c
 SRCS	+= timestamp.c
 SRCS	+= ua.c
@@ -47,6 +59,7 @@ SRCS	+= vidcodec.c
 SRCS	+= video.c
 SRCS	+= vidfilt.c
 SRCS	+= vidisp.c
+SRCS	+= vidscale.c
 SRCS	+= vidsrc.c
 SRCS	+= vidutil.c
 
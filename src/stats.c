@@ -0,0 +1,288 @@
+/**
+ * @file stats.c  Global media and signalling counters
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <re.h>
+#include <re_atomic.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The counters are the sums over all streams and calls. They are updated
+ * with relaxed atomics in the thread of the caller, so reading them does
+ * not need to walk the calls or to lock anything.
+ */
+
+
+enum { MEDIA_N = 2 };
+
+
+struct stats_media {
+	RE_ATOMIC uint64_t rtpv[STATS_RTP_N];
+	struct aulat jitter;       /**< RTCP interarrival jitter [us]  */
+	struct aulat jbuf_delay;   /**< Jitter buffer delay [us]       */
+};
+
+
+static struct {
+	RE_ATOMIC uint64_t cntv[STATS_N];
+	struct stats_media mediav[MEDIA_N];
+} stats;
+
+
+static const char *media_namev[MEDIA_N] = {"audio", "video"};
+
+
+static struct stats_media *media_get(enum media_type type)
+{
+	return (unsigned)type < MEDIA_N ? &stats.mediav[type] : NULL;
+}
+
+
+/**
+ * Increment a global counter
+ *
+ * @param c Counter
+ */
+void stats_inc(enum stats_counter c)
+{
+	if ((unsigned)c < STATS_N)
+		re_atomic_rlx_add(&stats.cntv[c], 1);
+}
+
+
+/**
+ * Add to a global RTP counter
+ *
+ * @param type Media type
+ * @param c    RTP counter
+ * @param n    Value to add
+ */
+void stats_rtp_add(enum media_type type, enum stats_rtp c, uint64_t n)
+{
+	struct stats_media *m = media_get(type);
+
+	if (m && (unsigned)c < STATS_RTP_N)
+		re_atomic_rlx_add(&m->rtpv[c], n);
+}
+
+
+/**
+ * Add an interarrival jitter sample
+ *
+ * @param type Media type
+ * @param usec Jitter in [us]
+ */
+void stats_jitter(enum media_type type, uint32_t usec)
+{
+	struct stats_media *m = media_get(type);
+
+	if (m)
+		aulat_add(&m->jitter, usec);
+}
+
+
+/**
+ * Add a jitter buffer delay sample
+ *
+ * @param type Media type
+ * @param usec Delay in [us]
+ */
+void stats_jbuf_delay(enum media_type type, uint32_t usec)
+{
+	struct stats_media *m = media_get(type);
+
+	if (m)
+		aulat_add(&m->jbuf_delay, usec);
+}
+
+
+static uint64_t cnt(enum stats_counter c)
+{
+	return re_atomic_rlx(&stats.cntv[c]);
+}
+
+
+/**
+ * Get the number of active calls
+ *
+ * @return Number of calls which are allocated and not destroyed
+ */
+uint32_t stats_calls(void)
+{
+	uint64_t created   = cnt(STATS_CALLS_CREATED);
+	uint64_t destroyed = cnt(STATS_CALLS_DESTROYED);
+
+	return created > destroyed ? (uint32_t)(created - destroyed) : 0;
+}
+
+
+static int print_family(struct re_printf *pf, const char *name,
+			const char *type, const char *help)
+{
+	return re_hprintf(pf, "# HELP %s %s\n# TYPE %s %s\n",
+			  name, help, name, type);
+}
+
+
+static const struct {
+	const char *name;
+	const char *help;
+} rtpv[STATS_RTP_N] = {
+	{"baresip_rtp_tx_packets_total", "Transmitted RTP packets"},
+	{"baresip_rtp_tx_bytes_total",   "Transmitted RTP bytes"},
+	{"baresip_rtp_rx_packets_total", "Received RTP packets"},
+	{"baresip_rtp_rx_bytes_total",   "Received RTP bytes"},
+	{"baresip_rtp_rx_lost_total",    "Lost RTP packets"},
+	{"baresip_rtp_rx_errors_total",  "Dropped RTP packets"},
+};
+
+
+static int print_rtp(struct re_printf *pf)
+{
+	unsigned i, t;
+	int err = 0;
+
+	for (i=0; i<STATS_RTP_N; i++) {
+
+		err |= print_family(pf, rtpv[i].name, "counter",
+				    rtpv[i].help);
+
+		for (t=0; t<MEDIA_N; t++) {
+			const struct stats_media *m = &stats.mediav[t];
+
+			err |= re_hprintf(pf, "%s{media=\"%s\"} %llu\n",
+					  rtpv[i].name, media_namev[t],
+					  re_atomic_rlx(&m->rtpv[i]));
+		}
+	}
+
+	err |= print_family(pf, "baresip_rtp_jitter_seconds", "histogram",
+			    "RTCP interarrival jitter");
+
+	for (t=0; t<MEDIA_N; t++) {
+		char labels[32];
+
+		re_snprintf(labels, sizeof(labels), "media=\"%s\"",
+			    media_namev[t]);
+
+		err |= aulat_prometheus(pf, "baresip_rtp_jitter_seconds",
+					labels, &stats.mediav[t].jitter);
+	}
+
+	err |= print_family(pf, "baresip_jbuf_delay_seconds", "histogram",
+			    "Jitter buffer delay");
+
+	for (t=0; t<MEDIA_N; t++) {
+		char labels[32];
+
+		re_snprintf(labels, sizeof(labels), "media=\"%s\"",
+			    media_namev[t]);
+
+		err |= aulat_prometheus(pf, "baresip_jbuf_delay_seconds",
+					labels, &stats.mediav[t].jbuf_delay);
+	}
+
+	return err;
+}
+
+
+struct ua_count {
+	uint32_t n_ua;
+	uint32_t n_reg;
+	uint32_t n_fail;
+};
+
+
+static void ua_count_handler(void *arg)
+{
+	struct ua_count *uc = arg;
+	struct le *le;
+
+	for (le = list_head(uag_list()); le; le = le->next) {
+		const struct ua *ua = le->data;
+
+		++uc->n_ua;
+		if (ua_isregistered(ua))
+			++uc->n_reg;
+		else if (ua_regfailed(ua))
+			++uc->n_fail;
+	}
+}
+
+
+/**
+ * Print the global counters in the Prometheus text format
+ *
+ * The registration state is counted over the User-Agents, all other
+ * values are read from the global counters.
+ *
+ * @param pf     Print function
+ * @param unused Unused parameter
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stats_prometheus(struct re_printf *pf, void *unused)
+{
+	struct ua_count uc = {0, 0, 0};
+	int err = 0;
+	(void)unused;
+
+	/* the User-Agents of the shards are counted in their threads */
+	if (shard_current())
+		ua_count_handler(&uc);
+	else
+		(void)shard_exec_all(ua_count_handler, &uc);
+
+	err |= print_family(pf, "baresip_calls", "gauge", "Active calls");
+	err |= re_hprintf(pf, "baresip_calls %u\n", stats_calls());
+
+	err |= print_family(pf, "baresip_calls_total", "counter",
+			    "Calls by direction");
+	err |= re_hprintf(pf, "baresip_calls_total{direction=\"incoming\"}"
+			  " %llu\n", cnt(STATS_CALLS_INCOMING));
+	err |= re_hprintf(pf, "baresip_calls_total{direction=\"outgoing\"}"
+			  " %llu\n", cnt(STATS_CALLS_OUTGOING));
+
+	err |= print_family(pf, "baresip_calls_established_total", "counter",
+			    "Established calls");
+	err |= re_hprintf(pf, "baresip_calls_established_total %llu\n",
+			  cnt(STATS_CALLS_ESTABLISHED));
+
+	err |= print_family(pf, "baresip_user_agents", "gauge",
+			    "User-Agents by registration state");
+	err |= re_hprintf(pf, "baresip_user_agents{state=\"registered\"}"
+			  " %u\n", uc.n_reg);
+	err |= re_hprintf(pf, "baresip_user_agents{state=\"failed\"} %u\n",
+			  uc.n_fail);
+	err |= re_hprintf(pf, "baresip_user_agents{state=\"other\"} %u\n",
+			  uc.n_ua - uc.n_reg - uc.n_fail);
+
+	err |= print_family(pf, "baresip_registrations_total", "counter",
+			    "SIP registration responses");
+	err |= re_hprintf(pf, "baresip_registrations_total{result=\"ok\"}"
+			  " %llu\n", cnt(STATS_REG_OK));
+	err |= re_hprintf(pf, "baresip_registrations_total{result=\"fail\"}"
+			  " %llu\n", cnt(STATS_REG_FAIL));
+
+	err |= print_family(pf, "baresip_aubuf_underruns_total", "counter",
+			    "Audio buffer underruns");
+	err |= re_hprintf(pf, "baresip_aubuf_underruns_total %llu\n",
+			  cnt(STATS_AUBUF_UNDERRUN));
+
+	err |= print_family(pf, "baresip_aubuf_overruns_total", "counter",
+			    "Audio buffer overruns");
+	err |= re_hprintf(pf, "baresip_aubuf_overruns_total %llu\n",
+			  cnt(STATS_AUBUF_OVERRUN));
+
+	err |= print_family(pf, "baresip_dtx_frames_total", "counter",
+			    "Audio frames suppressed by DTX");
+	err |= re_hprintf(pf, "baresip_dtx_frames_total %llu\n",
+			  cnt(STATS_DTX_FRAMES));
+
+	err |= print_rtp(pf);
+
+	return err;
+}
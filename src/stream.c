@@ -6,6 +6,7 @@
 #include <string.h>
 #include <time.h>
 #include <re.h>
+#include <re_atomic.h>
 #include <baresip.h>
 #include "core.h"
 
@@ -18,6 +19,7 @@
 enum {
 	RTP_RECV_SIZE = 8192,
 	RTP_CHECK_INTERVAL = 1000,  /* how often to check for RTP [ms] */
+	NACK_INTERVAL = 10,         /* how often to check for NACK [ms] */
 	PORT_DISCARD = 9,
 };
 
@@ -28,6 +30,11 @@ struct sender {
 	struct sa raddr_rtp;   /**< Remote RTP address              */
 	struct sa raddr_rtcp;  /**< Remote RTCP address             */
 	int pt_enc;            /**< Payload type for encoding       */
+	struct rtx_hist *rtx;  /**< Send history for retransmission */
+	struct mbuf *mb_rtx;   /**< Buffer for outgoing RTX packets */
+	int pt_rtx;            /**< RTX payload type, or -1         */
+	uint32_t ssrc_rtx;     /**< RTX synchronization source      */
+	uint16_t seq_rtx;      /**< RTX sequence number             */
 };
 
 
@@ -44,6 +51,12 @@ struct receiver {
 	bool pseq_set;        /**< True if sequence number is set   */
 	bool rtp_estab;       /**< True if RTP stream established   */
 	bool enabled;         /**< True if enabled                  */
+	struct rtx_nack *nack; /**< NACK generator (optional)       */
+	struct tmr tmr_nack;  /**< Timer for sending NACKs          */
+	int pt_rtx;           /**< Last incoming RTX payload type   */
+	int apt_rtx;          /**< Associated payload type for RTX  */
+	RE_ATOMIC uint32_t srate;  /**< RTP clock rate for stats    */
+	RE_ATOMIC uint32_t ts_put; /**< Newest RTP timestamp in jbuf */
 };
 
 
@@ -57,6 +70,9 @@ struct stream {
 	struct sdp_media *sdp;   /**< SDP Media line                        */
 	enum sdp_dir ldir;       /**< SDP direction of the stream           */
 	struct rtp_sock *rtp;    /**< RTP Socket                            */
+	uint16_t rtp_port;       /**< Reserved RTP port, or zero            */
+	int rtp_af;              /**< Address family of reserved RTP port   */
+	struct strmpool_ent *pent;/**< Stream pool entry, owns the socket   */
 	struct rtcp_stats rtcp_stats;/**< RTCP statistics                   */
 	const struct mnat *mnat; /**< Media NAT traversal module            */
 	struct mnat_media *mns;  /**< Media NAT traversal state             */
@@ -80,6 +96,7 @@ struct stream {
 	stream_rtpestab_h *rtpestabh;/**< RTP established handler           */
 	stream_rtcp_h *sessrtcph;    /**< Stream RTCP handler               */
 	stream_error_h *errorh;  /**< Stream error handler                  */
+	stream_lost_h *losth;    /**< Unrecoverable packet loss handler     */
 	void *sess_arg;          /**< Session handlers argument             */
 
 	struct bundle *bundle;
@@ -137,14 +154,20 @@ static void stream_destructor(void *arg)
 	mem_deref(s->rx.metric);
 
 	tmr_cancel(&s->rx.tmr_rtp);
+	tmr_cancel(&s->rx.tmr_nack);
 	list_unlink(&s->le);
 	mem_deref(s->sdp);
 	mem_deref(s->mes);
 	mem_deref(s->mencs);
 	mem_deref(s->mns);
 	mem_deref(s->rx.jbuf);
+	mem_deref(s->rx.nack);
+	mem_deref(s->tx.rtx);
+	mem_deref(s->tx.mb_rtx);
 	mem_deref(s->bundle);  /* NOTE: deref before rtp */
 	mem_deref(s->rtp);
+	mem_deref(s->pent);
+	rtpport_release(baresip_rtpport(), s->rtp_af, s->rtp_port, false);
 	mem_deref(s->cname);
 	mem_deref(s->peer);
 	mem_deref(s->mid);
@@ -339,10 +362,102 @@ static int handle_rtp(struct stream *s, const struct rtp_header *hdr,
 }
 
 
-static void rtp_handler(const struct sa *src, const struct rtp_header *hdr,
-			struct mbuf *mb, void *arg)
+static int nack_send_handler(uint16_t pid, uint16_t blp, void *arg)
+{
+	struct stream *s = arg;
+
+	return rtcp_send_gnack(s->rtp, s->rx.ssrc, pid, blp);
+}
+
+
+static void nack_tmr_handler(void *arg)
+{
+	struct stream *s = arg;
+	unsigned lostc;
+
+	MAGIC_CHECK(s);
+
+	lostc = rtx_nack_poll(s->rx.nack, tmr_jiffies(),
+			      nack_send_handler, s);
+
+	if (rtx_nack_pending(s->rx.nack))
+		tmr_start(&s->rx.tmr_nack, NACK_INTERVAL,
+			  nack_tmr_handler, s);
+
+	if (lostc && s->losth)
+		s->losth(lostc, s->arg);
+}
+
+
+static void nack_recv(struct stream *s, uint16_t seq, bool flush)
+{
+	unsigned lostc;
+
+	if (flush)
+		rtx_nack_reset(s->rx.nack);
+
+	lostc = rtx_nack_recv(s->rx.nack, seq, tmr_jiffies());
+
+	if (rtx_nack_pending(s->rx.nack) && !tmr_isrunning(&s->rx.tmr_nack))
+		tmr_start(&s->rx.tmr_nack, NACK_INTERVAL,
+			  nack_tmr_handler, s);
+
+	if (lostc && s->losth)
+		s->losth(lostc, s->arg);
+}
+
+
+/* Get the associated payload type from a "rtx" format, or -1 */
+static int rtx_apt(const struct sdp_format *fmt)
+{
+	struct pl apt;
+
+	if (!fmt || str_casecmp(fmt->name, "rtx"))
+		return -1;
+
+	if (re_regex(fmt->params, str_len(fmt->params), "apt=[0-9]+", &apt))
+		return -1;
+
+	return (int)pl_u32(&apt);
+}
+
+
+/* Get the associated payload type of an incoming RTX packet, or -1 */
+static int rx_rtx_apt(struct stream *s, uint8_t pt)
+{
+	struct le *le;
+
+	if (s->rx.pt_rtx == pt)
+		return s->rx.apt_rtx;
+
+	le = list_head(sdp_media_format_lst(s->sdp, false));
+	for (; le; le = le->next) {
+
+		const struct sdp_format *fmt = le->data;
+		int apt;
+
+		if (fmt->pt != pt)
+			continue;
+
+		apt = rtx_apt(fmt);
+		if (apt < 0)
+			break;
+
+		s->rx.pt_rtx  = pt;
+		s->rx.apt_rtx = apt;
+
+		return apt;
+	}
+
+	return -1;
+}
+
+
+static void recv_rtp(const struct sa *src, const struct rtp_header *hdr,
+		     struct mbuf *mb, void *arg)
 {
 	struct stream *s = arg;
+	struct rtp_header hdr_rtx;
 	bool flush = false;
 	bool first = false;
 	int err;
@@ -364,6 +479,8 @@ static void rtp_handler(const struct sa *src, const struct rtp_header *hdr,
 		return;
 
 	metric_add_packet(s->rx.metric, mbuf_get_left(mb));
+	stats_rtp_add(s->type, STATS_RTP_RX_PACKETS, 1);
+	stats_rtp_add(s->type, STATS_RTP_RX_BYTES, mbuf_get_left(mb));
 
 	if (!s->rx.rtp_estab) {
 		info("stream: incoming rtp for '%s' established"
@@ -375,6 +492,23 @@ static void rtp_handler(const struct sa *src, const struct rtp_header *hdr,
 			s->rtpestabh(s, s->sess_arg);
 	}
 
+	/* RFC 4588 -- retransmissions are sent with a separate SSRC */
+	if (s->tx.rtx && s->rx.ssrc_set && hdr->ssrc != s->rx.ssrc) {
+
+		int apt = rx_rtx_apt(s, hdr->pt);
+
+		if (apt >= 0) {
+
+			hdr_rtx = *hdr;
+			hdr_rtx.ssrc = s->rx.ssrc;
+
+			if (rtx_decode(&hdr_rtx, mb, apt))
+				return;
+
+			hdr = &hdr_rtx;
+		}
+	}
+
 	if (!s->rx.pseq_set) {
 		s->rx.ssrc = hdr->ssrc;
 		s->rx.ssrc_set = true;
@@ -394,6 +528,9 @@ static void rtp_handler(const struct sa *src, const struct rtp_header *hdr,
 		flush = true;
 	}
 
+	if (s->rx.nack)
+		nack_recv(s, hdr->seq, flush);
+
 	/* payload-type changed? */
 	err = s->pth(hdr->pt, mb, s->arg);
 	if (err && err != ENODATA)
@@ -415,6 +552,10 @@ static void rtp_handler(const struct sa *src, const struct rtp_header *hdr,
 			     sdp_media_name(s->sdp), mb->end,
 			     src, hdr->seq, hdr->ts, err);
 			metric_inc_err(s->rx.metric);
+			stats_rtp_add(s->type, STATS_RTP_RX_ERRORS, 1);
+		}
+		else {
+			re_atomic_rlx_set(&s->rx.ts_put, hdr->ts);
 		}
 
 
@@ -441,6 +582,7 @@ int stream_decode(struct stream *s)
 {
 	struct rtp_header hdr;
 	void *mb;
+	uint32_t srate;
 	int lostc;
 	int err;
 	int err2;
@@ -456,6 +598,18 @@ int stream_decode(struct stream *s)
 		return ENOENT;
 
 	lostc = lostcalc(&s->rx, hdr.seq);
+	if (lostc > 0)
+		stats_rtp_add(s->type, STATS_RTP_RX_LOST, lostc);
+
+	srate = re_atomic_rlx(&s->rx.srate);
+	if (srate) {
+		uint32_t delta = re_atomic_rlx(&s->rx.ts_put) - hdr.ts;
+
+		/* ignore reordered packets and timestamp jumps */
+		if (delta < srate * 10)
+			stats_jbuf_delay(s->type, (uint32_t)
+					 ((uint64_t)delta * 1000000 / srate));
+	}
 
 	err2 = handle_rtp(s, &hdr, mb, lostc > 0 ? lostc : 0, err == EAGAIN);
 	mem_deref(mb);
@@ -467,19 +621,36 @@ int stream_decode(struct stream *s)
 }
 
 
+static void rtp_handler(const struct sa *src, const struct rtp_header *hdr,
+			struct mbuf *mb, void *arg)
+{
+	struct prof_ctx prof;
+
+	prof_begin(&prof, NULL);
+
+	recv_rtp(src, hdr, mb, arg);
+
+	prof_end(&prof, "stream", "rtp");
+}
+
+
 static void rtcp_handler(const struct sa *src, struct rtcp_msg *msg, void *arg)
 {
 	struct stream *s = arg;
+	struct prof_ctx prof;
 	(void)src;
 
 	MAGIC_CHECK(s);
 
+	prof_begin(&prof, NULL);
+
 	s->rx.ts_last = tmr_jiffies();
 
 	switch (msg->hdr.pt) {
 
 	case RTCP_SR:
-		(void)rtcp_stats(s->rtp, msg->r.sr.ssrc, &s->rtcp_stats);
+		if (0 == rtcp_stats(s->rtp, msg->r.sr.ssrc, &s->rtcp_stats))
+			stats_jitter(s->type, s->rtcp_stats.rx.jit);
 		break;
 	}
 
@@ -488,13 +659,15 @@ static void rtcp_handler(const struct sa *src, struct rtcp_msg *msg, void *arg)
 
 	if (s->sessrtcph)
 		s->sessrtcph(s, msg, s->sess_arg);
+
+	prof_end(&prof, "stream", "rtcp");
 }
 
 
 static int stream_sock_alloc(struct stream *s, int af)
 {
 	struct sa laddr;
-	int tos, err;
+	int tos, err = 0;
 
 	if (!s)
 		return EINVAL;
@@ -502,9 +675,21 @@ static int stream_sock_alloc(struct stream *s, int af)
 	/* we listen on all interfaces */
 	sa_init(&laddr, af);
 
-	err = rtp_listen(&s->rtp, IPPROTO_UDP, &laddr,
-			 s->cfg.rtp_ports.min, s->cfg.rtp_ports.max,
-			 true, rtp_handler, rtcp_handler, s);
+	/* the pool is not shared with the threads of the shards */
+	if (!shard_current() &&
+	    0 == strmpool_take(baresip_strmpool(), &s->cfg, af, &s->pent,
+			       rtp_handler, rtcp_handler, s)) {
+
+		s->rtp = mem_ref(strmpool_ent_rtp(s->pent));
+	}
+	else {
+		err = rtpport_listen(baresip_rtpport(), &s->rtp, &laddr,
+				     &s->cfg.rtp_ports, &s->rtp_port,
+				     rtp_handler, rtcp_handler, s);
+		if (!err)
+			s->rtp_af = af;
+	}
+
 	if (err) {
 		warning("stream: rtp_listen failed: af=%s ports=%u-%u"
 			" (%m)\n", net_af2name(af),
@@ -641,6 +826,7 @@ static int sender_init(struct sender *tx)
 	err = metric_init(tx->metric);
 
 	tx->pt_enc = -1;
+	tx->pt_rtx = -1;
 
 	return err;
 }
@@ -657,8 +843,10 @@ static int receiver_init(struct receiver *rx)
 	err = metric_init(rx->metric);
 
 	tmr_init(&rx->tmr_rtp);
+	tmr_init(&rx->tmr_nack);
 
 	rx->pseq = -1;
+	rx->pt_rtx = -1;
 
 	return err;
 }
@@ -725,11 +913,14 @@ int stream_alloc(struct stream **sp, struct list *streaml,
 	/* Jitter buffer */
 	if (prm->use_rtp && cfg->jbtype != JBUF_OFF && cfg->jbuf_del.max) {
 
-		err  = jbuf_alloc(&s->rx.jbuf, cfg->jbuf_del.min,
-				cfg->jbuf_del.max);
-		err |= jbuf_set_type(s->rx.jbuf, cfg->jbtype);
-		if (err)
-			goto out;
+		s->rx.jbuf = strmpool_ent_jbuf(s->pent, cfg);
+		if (!s->rx.jbuf) {
+			err  = jbuf_alloc(&s->rx.jbuf, cfg->jbuf_del.min,
+					  cfg->jbuf_del.max);
+			err |= jbuf_set_type(s->rx.jbuf, cfg->jbtype);
+			if (err)
+				goto out;
+		}
 	}
 
 	err = sdp_media_add(&s->sdp, sdp_sess, media_name(type),
@@ -895,21 +1086,164 @@ int stream_send(struct stream *s, bool ext, bool marker, int pt, uint32_t ts,
 	}
 
 	metric_add_packet(s->tx.metric, mbuf_get_left(mb));
+	stats_rtp_add(s->type, STATS_RTP_TX_PACKETS, 1);
+	stats_rtp_add(s->type, STATS_RTP_TX_BYTES, mbuf_get_left(mb));
 
 	if (pt < 0)
 		pt = s->tx.pt_enc;
 
 	if (pt >= 0) {
+		const size_t pos = mb->pos;
+
+		if (s->tx.rtx)
+			(void)rtx_hist_stage(s->tx.rtx, mb);
+
 		err = rtp_send(s->rtp, &s->tx.raddr_rtp, ext, marker, pt, ts,
 			       tmr_jiffies_rt_usec(), mb);
-		if (err)
+		if (err) {
 			metric_inc_err(s->tx.metric);
+		}
+		else if (s->tx.rtx) {
+			/* the RTP header is sent in clear, read back the
+			 * sequence number assigned by the RTP socket */
+			const uint8_t *p = mb->buf + pos - RTP_HEADER_SIZE;
+
+			rtx_hist_commit(s->tx.rtx, p[2] << 8 | p[3],
+					ext, marker, ts);
+		}
 	}
 
 	return err;
 }
 
 
+/**
+ * Retransmit a previously sent RTP packet as RTX (RFC 4588)
+ *
+ * @param s   Stream object
+ * @param seq Sequence number of the original packet
+ *
+ * @return 0 if success, ENOENT if the packet is not cached anymore,
+ * otherwise errorcode
+ */
+int stream_resend(struct stream *s, uint16_t seq)
+{
+	const struct rtx_pkt *pkt;
+	struct mbuf *mb;
+	int err;
+
+	if (!s)
+		return EINVAL;
+
+	if (!s->tx.rtx || s->tx.pt_rtx < 0)
+		return ENOTSUP;
+
+	if (!sa_isset(&s->tx.raddr_rtp, SA_ALL) || s->hold)
+		return 0;
+
+	pkt = rtx_hist_lookup(s->tx.rtx, seq);
+	if (!pkt)
+		return ENOENT;
+
+	mb = s->tx.mb_rtx;
+
+	/* leave room for a TURN header in front */
+	mbuf_rewind(mb);
+	mb->pos = mb->end = STREAM_PRESZ - RTP_HEADER_SIZE;
+
+	err = rtx_encode(mb, pkt, s->tx.pt_rtx, s->tx.seq_rtx++,
+			 s->tx.ssrc_rtx);
+	if (err)
+		return err;
+
+	mb->pos = STREAM_PRESZ - RTP_HEADER_SIZE;
+
+	metric_add_packet(s->tx.metric, mbuf_get_left(mb));
+	stats_rtp_add(s->type, STATS_RTP_TX_PACKETS, 1);
+	stats_rtp_add(s->type, STATS_RTP_TX_BYTES, mbuf_get_left(mb));
+
+	err = udp_send(rtp_sock(s->rtp), &s->tx.raddr_rtp, mb);
+	if (err)
+		metric_inc_err(s->tx.metric);
+
+	return err;
+}
+
+
+/* Find the remote RTX payload type for the current encoder */
+static void update_rtx_pt(struct stream *s)
+{
+	struct le *le;
+
+	s->tx.pt_rtx = -1;
+
+	if (!s->tx.rtx || s->tx.pt_enc < 0)
+		return;
+
+	le = list_head(sdp_media_format_lst(s->sdp, false));
+	for (; le; le = le->next) {
+
+		const struct sdp_format *fmt = le->data;
+
+		if (rtx_apt(fmt) == s->tx.pt_enc) {
+			s->tx.pt_rtx = fmt->pt;
+			break;
+		}
+	}
+}
+
+
+/**
+ * Enable RTP retransmission for a stream. The send history is used to
+ * answer Generic NACKs (RFC 4585) with RTX packets (RFC 4588).
+ *
+ * @param strm  Stream object
+ * @param nack  True to send Generic NACKs for incoming packet loss
+ * @param losth Handler called for packet loss that could not be recovered
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int stream_enable_rtx(struct stream *strm, bool nack, stream_lost_h *losth)
+{
+	int err;
+
+	if (!strm)
+		return EINVAL;
+
+	if (!strm->tx.rtx) {
+
+		err = rtx_hist_alloc(&strm->tx.rtx, RTX_HIST_SIZE);
+		if (err)
+			return err;
+
+		strm->tx.mb_rtx = mbuf_alloc(STREAM_PRESZ + 1500 +
+					     STREAM_TRAILSZ);
+		if (!strm->tx.mb_rtx)
+			return ENOMEM;
+
+		strm->tx.ssrc_rtx = rand_u32();
+		strm->tx.seq_rtx  = rand_u16();
+	}
+
+	if (nack && !strm->rx.nack) {
+
+		err = rtx_nack_alloc(&strm->rx.nack);
+		if (err)
+			return err;
+	}
+	else if (!nack) {
+		tmr_cancel(&strm->rx.tmr_nack);
+		strm->rx.nack = mem_deref(strm->rx.nack);
+	}
+
+	strm->losth = losth;
+
+	update_rtx_pt(strm);
+
+	return 0;
+}
+
+
 static void disable_mnat(struct stream *s)
 {
 	info("stream: disable MNAT (%s)\n", media_name(s->type));
@@ -1064,6 +1398,9 @@ void stream_update_encoder(struct stream *s, int pt_enc)
 
 	if (pt_enc >= 0)
 		s->tx.pt_enc = pt_enc;
+
+	if (s->tx.rtx)
+		update_rtx_pt(s);
 }
 
 
@@ -1126,8 +1463,10 @@ void stream_set_srate(struct stream *s, uint32_t srate_tx, uint32_t srate_rx)
 
 	if (srate_tx)
 		rtcp_set_srate_tx(s->rtp, srate_tx);
-	if (srate_rx)
+	if (srate_rx) {
 		rtcp_set_srate_rx(s->rtp, srate_rx);
+		re_atomic_rlx_set(&s->rx.srate, srate_rx);
+	}
 }
 
 
@@ -1139,6 +1478,8 @@ void stream_flush(struct stream *s)
 	if (s->rx.jbuf)
 		jbuf_flush(s->rx.jbuf);
 
+	rtx_nack_reset(s->rx.nack);
+
 	if (s->type == MEDIA_AUDIO)
 		rtp_clear(s->rtp);
 }
@@ -1489,7 +1830,7 @@ int stream_open_natpinhole(const struct stream *strm)
 		if (!sc)
 			return EINVAL;
 
-		mb = mbuf_alloc(RTP_HEADER_SIZE);
+		mb = mbuf_alloc(RTP_HEADER_SIZE + STREAM_TRAILSZ);
 		if (!mb)
 			return ENOMEM;
 
@@ -1678,6 +2019,13 @@ int stream_debug(struct re_printf *pf, const struct stream *s)
 	err |= rtp_debug(pf, s->rtp);
 	err |= jbuf_debug(pf, s->rx.jbuf);
 
+	if (s->tx.rtx) {
+		err |= re_hprintf(pf, " rtx: pt=%d ssrc=0x%08x\n",
+				  s->tx.pt_rtx, s->tx.ssrc_rtx);
+		err |= rtx_hist_debug(pf, s->tx.rtx);
+		err |= rtx_nack_debug(pf, s->rx.nack);
+	}
+
 	if (s->bundle)
 		err |= bundle_debug(pf, s->bundle);
 
@@ -0,0 +1,441 @@
+/**
+ * @file strmpool.c  Pool of pre-bound media streams
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * The stream pool keeps a number of RTP sockets per address family which
+ * are already bound and listening, together with a jitter buffer. A new
+ * media stream takes an entry from the pool instead of binding a socket
+ * during call setup. The pool is replenished from the main loop, one
+ * entry per timer tick.
+ *
+ * The RTP handlers of a socket cannot be changed after rtp_listen(), so
+ * the pooled socket is bound with handlers which forward to the handlers
+ * given by the owner of the entry.
+ */
+
+
+enum {
+	STRMPOOL_AFC = 2,
+	REFILL_INTERVAL = 5,      /* interval between refills [ms]     */
+	REFILL_BACKOFF = 1000,    /* wait after a failed refill [ms]   */
+};
+
+
+/** Stream pool */
+struct strmpool {
+	const struct config_avt *cfg; /**< Transport configuration       */
+	struct list entl[STRMPOOL_AFC]; /**< Idle entries per AF         */
+	struct tmr tmr;           /**< Refill timer                      */
+	uint32_t size;            /**< Target number of entries per AF   */
+	uint32_t n_hit;           /**< Streams served from the pool      */
+	uint32_t n_miss;          /**< Streams allocated without pool    */
+	uint32_t n_stale;         /**< Entries dropped, config changed   */
+	uint32_t n_fail;          /**< Failed refills                    */
+};
+
+
+/** Stream pool entry */
+struct strmpool_ent {
+	struct le le;             /**< Linked list element               */
+	struct rtp_sock *rtp;     /**< Bound RTP socket                  */
+	struct jbuf *jbuf;        /**< Jitter buffer (optional)          */
+	struct range ports;       /**< RTP port range when allocated     */
+	struct range jbuf_del;    /**< Jitter buffer delay               */
+	enum jbuf_type jbtype;    /**< Jitter buffer type                */
+	uint16_t port;            /**< Reserved RTP port, or zero        */
+	int af;                   /**< Address family                    */
+	rtp_recv_h *rtph;         /**< RTP handler of the owner          */
+	rtcp_recv_h *rtcph;       /**< RTCP handler of the owner         */
+	void *arg;                /**< Handler argument                  */
+};
+
+
+static const int afv[STRMPOOL_AFC] = {AF_INET, AF_INET6};
+
+
+static void destructor(void *arg)
+{
+	struct strmpool *sp = arg;
+	size_t i;
+
+	tmr_cancel(&sp->tmr);
+
+	for (i=0; i<STRMPOOL_AFC; i++)
+		list_flush(&sp->entl[i]);
+}
+
+
+static void ent_destructor(void *arg)
+{
+	struct strmpool_ent *ent = arg;
+
+	list_unlink(&ent->le);
+	mem_deref(ent->jbuf);
+	mem_deref(ent->rtp);
+	rtpport_release(baresip_rtpport(), ent->af, ent->port, false);
+}
+
+
+static void rtp_handler(const struct sa *src, const struct rtp_header *hdr,
+			struct mbuf *mb, void *arg)
+{
+	struct strmpool_ent *ent = arg;
+
+	/* packets to an idle socket are dropped */
+	if (ent->rtph)
+		ent->rtph(src, hdr, mb, ent->arg);
+}
+
+
+static void rtcp_handler(const struct sa *src, struct rtcp_msg *msg,
+			 void *arg)
+{
+	struct strmpool_ent *ent = arg;
+
+	if (ent->rtcph)
+		ent->rtcph(src, msg, ent->arg);
+}
+
+
+static struct list *af_list(struct strmpool *sp, int af)
+{
+	switch (af) {
+
+	case AF_INET:  return &sp->entl[0];
+	case AF_INET6: return &sp->entl[1];
+	default:       return NULL;
+	}
+}
+
+
+static bool ent_match(const struct strmpool_ent *ent,
+		      const struct config_avt *cfg)
+{
+	return ent->ports.min == cfg->rtp_ports.min &&
+		ent->ports.max == cfg->rtp_ports.max;
+}
+
+
+static int ent_alloc(struct strmpool *sp, int af)
+{
+	const struct config_avt *cfg = sp->cfg;
+	struct strmpool_ent *ent;
+	struct sa laddr;
+	int err;
+
+	ent = mem_zalloc(sizeof(*ent), ent_destructor);
+	if (!ent)
+		return ENOMEM;
+
+	ent->af       = af;
+	ent->ports    = cfg->rtp_ports;
+	ent->jbuf_del = cfg->jbuf_del;
+	ent->jbtype   = cfg->jbtype;
+
+	sa_init(&laddr, af);
+
+	err = rtpport_listen(baresip_rtpport(), &ent->rtp, &laddr,
+			     &cfg->rtp_ports, &ent->port,
+			     rtp_handler, rtcp_handler, ent);
+	if (err)
+		goto out;
+
+	if (cfg->jbtype != JBUF_OFF && cfg->jbuf_del.max) {
+
+		err  = jbuf_alloc(&ent->jbuf, cfg->jbuf_del.min,
+				  cfg->jbuf_del.max);
+		err |= jbuf_set_type(ent->jbuf, cfg->jbtype);
+		if (err)
+			goto out;
+	}
+
+	list_append(af_list(sp, af), &ent->le, ent);
+
+ out:
+	if (err)
+		mem_deref(ent);
+
+	return err;
+}
+
+
+static void refill_handler(void *arg)
+{
+	struct strmpool *sp = arg;
+	bool more = false;
+	size_t i;
+
+	for (i=0; i<STRMPOOL_AFC; i++) {
+
+		struct list *lst = &sp->entl[i];
+		int err;
+
+		if (!net_af_enabled(baresip_network(), afv[i]))
+			continue;
+
+		if (list_count(lst) >= sp->size)
+			continue;
+
+		err = ent_alloc(sp, afv[i]);
+		if (err) {
+			warning("strmpool: refill failed: af=%s (%m)\n",
+				net_af2name(afv[i]), err);
+			++sp->n_fail;
+			tmr_start(&sp->tmr, REFILL_BACKOFF,
+				  refill_handler, sp);
+			return;
+		}
+
+		if (list_count(lst) < sp->size)
+			more = true;
+	}
+
+	if (more)
+		tmr_start(&sp->tmr, REFILL_INTERVAL, refill_handler, sp);
+}
+
+
+static void refill(struct strmpool *sp)
+{
+	if (sp->size && !tmr_isrunning(&sp->tmr))
+		tmr_start(&sp->tmr, 0, refill_handler, sp);
+}
+
+
+/**
+ * Allocate a stream pool
+ *
+ * @param spp Pointer to allocated stream pool
+ * @param cfg Transport configuration, must outlive the pool
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int strmpool_alloc(struct strmpool **spp, const struct config_avt *cfg)
+{
+	struct strmpool *sp;
+
+	if (!spp || !cfg)
+		return EINVAL;
+
+	sp = mem_zalloc(sizeof(*sp), destructor);
+	if (!sp)
+		return ENOMEM;
+
+	sp->cfg  = cfg;
+	sp->size = cfg->stream_pool;
+
+	tmr_init(&sp->tmr);
+	refill(sp);
+
+	*spp = sp;
+
+	return 0;
+}
+
+
+/**
+ * Set the number of pre-bound streams per address family
+ *
+ * @param sp   Stream pool
+ * @param size Number of streams, zero to disable the pool
+ */
+void strmpool_set_size(struct strmpool *sp, uint32_t size)
+{
+	size_t i;
+
+	if (!sp)
+		return;
+
+	sp->size = size;
+
+	for (i=0; i<STRMPOOL_AFC; i++) {
+
+		while (list_count(&sp->entl[i]) > size)
+			mem_deref(list_ledata(list_tail(&sp->entl[i])));
+	}
+
+	if (!size)
+		tmr_cancel(&sp->tmr);
+
+	refill(sp);
+}
+
+
+/**
+ * Take a pre-bound stream from the pool
+ *
+ * @param sp    Stream pool
+ * @param cfg   Transport configuration of the stream
+ * @param af    Address family
+ * @param entp  Pointer to pool entry, owned by the caller
+ * @param rtph  RTP receive handler
+ * @param rtcph RTCP receive handler
+ * @param arg   Handler argument
+ *
+ * @return 0 if success, ENOENT if the pool is empty
+ */
+int strmpool_take(struct strmpool *sp, const struct config_avt *cfg, int af,
+		  struct strmpool_ent **entp,
+		  rtp_recv_h *rtph, rtcp_recv_h *rtcph, void *arg)
+{
+	struct strmpool_ent *ent = NULL;
+	struct list *lst;
+
+	if (!sp || !cfg || !entp)
+		return EINVAL;
+
+	if (!sp->size)
+		return ENOENT;
+
+	lst = af_list(sp, af);
+	if (!lst)
+		return EAFNOSUPPORT;
+
+	while (!list_isempty(lst)) {
+
+		ent = list_ledata(list_head(lst));
+		list_unlink(&ent->le);
+
+		if (ent_match(ent, cfg))
+			break;
+
+		++sp->n_stale;
+		ent = mem_deref(ent);
+	}
+
+	refill(sp);
+
+	if (!ent) {
+		++sp->n_miss;
+		return ENOENT;
+	}
+
+	++sp->n_hit;
+
+	ent->rtph  = rtph;
+	ent->rtcph = rtcph;
+	ent->arg   = arg;
+
+	*entp = ent;
+
+	return 0;
+}
+
+
+/**
+ * Get the RTP socket of a pool entry
+ *
+ * @param ent Pool entry
+ *
+ * @return RTP socket, owned by the entry
+ */
+struct rtp_sock *strmpool_ent_rtp(const struct strmpool_ent *ent)
+{
+	return ent ? ent->rtp : NULL;
+}
+
+
+/**
+ * Take the pre-allocated jitter buffer of a pool entry
+ *
+ * @param ent Pool entry
+ * @param cfg Transport configuration of the stream
+ *
+ * @return Jitter buffer, or NULL if the configuration does not match
+ */
+struct jbuf *strmpool_ent_jbuf(struct strmpool_ent *ent,
+			       const struct config_avt *cfg)
+{
+	struct jbuf *jb;
+
+	if (!ent || !cfg || !ent->jbuf)
+		return NULL;
+
+	if (ent->jbtype != cfg->jbtype ||
+	    ent->jbuf_del.min != cfg->jbuf_del.min ||
+	    ent->jbuf_del.max != cfg->jbuf_del.max)
+		return NULL;
+
+	jb = ent->jbuf;
+	ent->jbuf = NULL;
+
+	return jb;
+}
+
+
+/**
+ * Get the number of streams served from the pool
+ *
+ * @param sp Stream pool
+ *
+ * @return Number of streams
+ */
+uint32_t strmpool_hits(const struct strmpool *sp)
+{
+	return sp ? sp->n_hit : 0;
+}
+
+
+/**
+ * Get the number of idle entries of an address family
+ *
+ * @param sp Stream pool
+ * @param af Address family
+ *
+ * @return Number of idle entries
+ */
+uint32_t strmpool_idle(const struct strmpool *sp, int af)
+{
+	if (!sp)
+		return 0;
+
+	switch (af) {
+
+	case AF_INET:  return list_count(&sp->entl[0]);
+	case AF_INET6: return list_count(&sp->entl[1]);
+	default:       return 0;
+	}
+}
+
+
+/**
+ * Print the stream pool status
+ *
+ * @param pf Print function
+ * @param sp Stream pool
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int strmpool_debug(struct re_printf *pf, const struct strmpool *sp)
+{
+	size_t i;
+	int err;
+
+	if (!sp)
+		return 0;
+
+	err = re_hprintf(pf, "--- Stream pool ---\n"
+			 " size=%u hit=%u miss=%u stale=%u fail=%u\n",
+			 sp->size, sp->n_hit, sp->n_miss, sp->n_stale,
+			 sp->n_fail);
+
+	for (i=0; i<STRMPOOL_AFC; i++) {
+
+		if (list_isempty(&sp->entl[i]))
+			continue;
+
+		err |= re_hprintf(pf, " %s: idle=%u\n",
+				  net_af2name(afv[i]),
+				  list_count(&sp->entl[i]));
+	}
+
+	return err;
+}
@@ -31,6 +31,7 @@ struct ua {
 	struct list custom_hdrs;     /**< List of outgoing headers           */
 	char *ansval;                /**< SIP auto answer value              */
 	struct sa dst;               /**< Current destination address        */
+	struct shard *shard;         /**< Owning shard, NULL for main thread */
 };
 
 struct ua_xhdr_filter {
@@ -99,21 +100,34 @@ static void add_extension(struct ua *ua, const char *extension)
 }
 
 
+static void add_account_extensions(struct ua *ua)
+{
+	if (uag_cfg() && str_isset(uag_cfg()->uuid))
+		add_extension(ua, "gruu");
+
+	if (0 == str_casecmp(ua->acc->sipnat, "outbound")) {
+		add_extension(ua, "path");
+		add_extension(ua, "outbound");
+	}
+
+	add_extension(ua, "replaces");
+
+	if (ua->acc->rel100_mode)
+		add_extension(ua, "100rel");
+}
+
+
 static int create_register_clients(struct ua *ua)
 {
 	int err = 0;
 
-	/* Register clients */
-	if (uag_cfg() && str_isset(uag_cfg()->uuid))
-		add_extension(ua, "gruu");
+	add_account_extensions(ua);
 
+	/* Register clients */
 	if (0 == str_casecmp(ua->acc->sipnat, "outbound")) {
 
 		size_t i;
 
-		add_extension(ua, "path");
-		add_extension(ua, "outbound");
-
 		if (!str_isset(uag_cfg()->uuid)) {
 
 			warning("ua: outbound requires valid UUID!\n");
@@ -134,11 +148,6 @@ static int create_register_clients(struct ua *ua)
 		err = reg_add(&ua->regl, ua, 0);
 	}
 
-	add_extension(ua, "replaces");
-
-	if (ua->acc->rel100_mode)
-		add_extension(ua, "100rel");
-
  out:
 	return err;
 }
@@ -1072,12 +1081,18 @@ int ua_alloc(struct ua **uap, const char *aor)
 	if (!aor)
 		return EINVAL;
 
+	/* in sharded mode the UA is allocated in the thread of a shard */
+	if (shard_count() && !shard_current())
+		return shard_ua_alloc(uap, aor);
+
 	ua = mem_zalloc(sizeof(*ua), ua_destructor);
 	if (!ua)
 		return ENOMEM;
 
 	MAGIC_INIT(ua);
 
+	ua->shard = shard_current();
+
 	list_init(&ua->calls);
 
 	/* Decode SIP address */
@@ -1167,6 +1182,89 @@ int ua_update_account(struct ua *ua)
 }
 
 
+/**
+ * Replace the account of a User-Agent with new parameters
+ *
+ * The Address-of-Record must not change. Existing calls keep the old
+ * account, and the register clients are only re-created if one of the
+ * registration parameters has changed. The caller must then register
+ * the UA again.
+ *
+ * @param ua   User-Agent object
+ * @param aor  SIP Address-of-Record (AOR) with the new parameters
+ * @param regp Set to true if the UA must register again (optional)
+ *
+ * @return 0 if success, ENOTSUP if the UA must be re-created, otherwise
+ *         errorcode
+ */
+int ua_reload_account(struct ua *ua, const char *aor, bool *regp)
+{
+	struct account *acc = NULL;
+	char *buf = NULL;
+	bool reg;
+	int err;
+
+	if (!ua || !aor)
+		return EINVAL;
+
+	if (uag_eprm()) {
+		err = re_sdprintf(&buf, "%s;%s", aor, uag_eprm());
+		if (err)
+			return err;
+		aor = buf;
+	}
+
+	err = account_alloc(&acc, aor);
+	if (err)
+		goto out;
+
+	/* the SIP transport has the client certificate of the old AOR */
+	if (str_casecmp(acc->aor, ua->acc->aor) ||
+	    str_cmp(acc->cert, ua->acc->cert)) {
+		err = ENOTSUP;
+		goto out;
+	}
+
+	/* keep a password which was entered at the prompt */
+	if (!acc->auth_pass && ua->acc->auth_pass &&
+	    0 == str_cmp(acc->auth_user, ua->acc->auth_user)) {
+		err = account_set_auth_pass(acc, ua->acc->auth_pass);
+		if (err)
+			goto out;
+	}
+
+	reg = !account_reg_equal(acc, ua->acc);
+
+	if (reg)
+		list_flush(&ua->regl);
+
+	mem_deref(ua->acc);
+	ua->acc = acc;
+	acc = NULL;
+
+	ua->extensionc = 0;
+
+	if (ua->acc->mnat && 0 == str_casecmp(ua->acc->mnat->id, "ice"))
+		add_extension(ua, "ice");
+
+	if (reg)
+		err = create_register_clients(ua);
+	else
+		add_account_extensions(ua);
+
+	add_extension(ua, "norefersub");
+
+	if (regp)
+		*regp = reg;
+
+ out:
+	mem_deref(acc);
+	mem_deref(buf);
+
+	return err;
+}
+
+
 /**
  * Appends params to mbuf if params do not already exist in mbuf.
  *
@@ -1593,9 +1691,44 @@ int ua_debug(struct re_printf *pf, const struct ua *ua)
 }
 
 
+static int calls_json_api(struct odict *od, const struct ua *ua)
+{
+	struct le *le;
+	int err = 0;
+
+	LIST_FOREACH(&ua->calls, le) {
+		const struct call *call = le->data;
+		struct odict *odc = NULL, *lat = NULL;
+
+		err  = odict_alloc(&odc, 8);
+		err |= odict_alloc(&lat, 8);
+		if (err)
+			goto next;
+
+		err  = odict_entry_add(odc, "peeruri", ODICT_STRING,
+				       call_peeruri(call));
+		err |= audio_latency_json_api(lat, call_audio(call));
+		err |= odict_entry_add(odc, "audio_latency", ODICT_OBJECT,
+				       lat);
+		err |= odict_entry_add(od, call_id(call), ODICT_OBJECT, odc);
+
+	next:
+		mem_deref(lat);
+		mem_deref(odc);
+		if (err)
+			break;
+	}
+
+	return err;
+}
+
+
 /**
  * Print the user-agent information in JSON
  *
+ * Each call has the per-stage audio latency histograms, see
+ * audio_latency_json_api().
+ *
  * @param od  User-Agent dict
  * @param ua  User-Agent object
  *
@@ -1605,6 +1738,7 @@ int ua_state_json_api(struct odict *od, const struct ua *ua)
 {
 	struct odict *reg = NULL;
 	struct odict *cfg = NULL;
+	struct odict *calls = NULL;
 	struct le *le;
 	size_t i = 0;
 	int err = 0;
@@ -1614,6 +1748,7 @@ int ua_state_json_api(struct odict *od, const struct ua *ua)
 
 	err |= odict_alloc(&reg, 8);
 	err |= odict_alloc(&cfg, 8);
+	err |= odict_alloc(&calls, 8);
 
 	/* user-agent info */
 	err |= odict_entry_add(od, "cuser", ODICT_STRING, ua->cuser);
@@ -1639,12 +1774,19 @@ int ua_state_json_api(struct odict *od, const struct ua *ua)
 	if (err)
 		warning("ua: failed to encode json registration (%m)\n", err);
 
+	/* calls */
+	err |= calls_json_api(calls, ua);
+	if (err)
+		warning("ua: failed to encode json calls (%m)\n", err);
+
 	/* package */
 	err |= odict_entry_add(od, "settings", ODICT_OBJECT, cfg);
 	err |= odict_entry_add(od, "registration", ODICT_OBJECT, reg);
+	err |= odict_entry_add(od, "calls", ODICT_OBJECT, calls);
 	if (err)
 		warning("ua: failed to encode json package (%m)\n", err);
 
+	mem_deref(calls);
 	mem_deref(cfg);
 	mem_deref(reg);
 	return err;
@@ -1785,6 +1927,19 @@ struct account *ua_account(const struct ua *ua)
 }
 
 
+/**
+ * Get the shard which owns a User-Agent
+ *
+ * @param ua User-Agent
+ *
+ * @return Owning shard, NULL if the UA belongs to the main thread
+ */
+struct shard *ua_shard(const struct ua *ua)
+{
+	return ua ? ua->shard : NULL;
+}
+
+
 /**
  * Set Public GRUU of a User-Agent (UA)
  *
@@ -28,8 +28,9 @@ static struct uag uag = {
 	NULL,
 #ifdef USE_TLS
 	NULL,
-	NULL
+	NULL,
 #endif
+	NULL
 };
 
 
@@ -47,6 +48,71 @@ static void exit_handler(void *arg)
 }
 
 
+/*
+ * Call the handler for the User-Agents of all threads. In the thread of a
+ * shard only the User-Agents of that shard are visited, a shard must not
+ * wait for another shard.
+ */
+static void uag_exec(shard_h *h, void *arg)
+{
+	if (shard_current())
+		h(arg);
+	else
+		(void)shard_exec_all(h, arg);
+}
+
+
+struct call_hold {
+	struct call *call;
+	bool hold;
+	int err;
+};
+
+
+static void call_hold_handler(void *arg)
+{
+	struct call_hold *ch = arg;
+
+	ch->err = call_hold(ch->call, ch->hold);
+}
+
+
+/* Hold or resume a call in the thread of its User-Agent */
+static int hold_call(struct call *call, bool hold)
+{
+	struct call_hold ch = {call, hold, 0};
+	int err;
+
+	err = shard_exec(ua_shard(call_get_ua(call)), call_hold_handler,
+			 &ch, true);
+
+	return err ? err : ch.err;
+}
+
+
+struct hold_resume {
+	struct call *resume;
+	struct call *active;
+};
+
+
+static void hold_resume_handler(void *arg)
+{
+	struct hold_resume *hr = arg;
+	struct le *le;
+
+	for (le = list_head(uag_list()); le; le = le->next) {
+		struct ua *ua = le->data;
+
+		if (!hr->resume)
+			hr->resume = ua_find_call_onhold(ua);
+
+		if (!hr->active)
+			hr->active = ua_find_active_call(ua);
+	}
+}
+
+
 /**
  * Put the established call on hold and resume the given call
  *
@@ -56,139 +122,172 @@ static void exit_handler(void *arg)
  */
 int uag_hold_resume(struct call *call)
 {
+	struct hold_resume hr = {call, NULL};
 	int err = 0;
-	struct le *le = NULL;
-	struct ua *ua = NULL;
-	struct call *acall = NULL, *toresume = call;
 
-	for (le = list_head(&uag.ual); le && !toresume; le = le->next) {
-		ua = le->data;
-		toresume = ua_find_call_onhold(ua);
-	}
+	uag_exec(hold_resume_handler, &hr);
 
-	if (!toresume) {
+	if (!hr.resume) {
 		debug ("ua: no call to resume\n");
 		return 0;
 	}
 
-	for (le = list_head(&uag.ual); le && !acall; le = le->next) {
-		ua = le->data;
-		acall = ua_find_active_call(ua);
-	}
-
-	if (acall)
-		err =  call_hold(acall, true);
+	if (hr.active)
+		err =  hold_call(hr.active, true);
 
-	err |= call_hold(toresume, false);
+	err |= hold_call(hr.resume, false);
 
 	return err;
 }
 
 
-/**
- * Put all established calls on hold, except the given one
- *
- * @param call  Excluded call, or NULL
- *
- * @return 0 if success, otherwise errorcode
- */
-int uag_hold_others(struct call *call)
-{
-	int err = 0;
-	struct le *le = NULL;
-	struct call *acall = NULL;
+struct hold_others {
+	const struct call *call;
+	struct call *active;
+};
 
-	if (!conf_config()->call.hold_other_calls) {
-		return 0;
-	}
 
-	for (le = list_head(&uag.ual); le && !acall; le = le->next) {
+static void hold_others_handler(void *arg)
+{
+	struct hold_others *ho = arg;
+	struct le *le;
+
+	for (le = list_head(uag_list()); le && !ho->active; le = le->next) {
 		struct ua *ua = le->data;
 		struct le *lec = NULL;
 
 		for (lec = list_head(ua_calls(ua)); lec; lec = lec->next) {
 			struct call *ccall = lec->data;
-			if (ccall == call)
+			if (ccall == ho->call)
 				continue;
 
 			if (call_state(ccall) == CALL_STATE_ESTABLISHED &&
 					!call_is_onhold(ccall)) {
-				acall = ccall;
+				ho->active = ccall;
 				break;
 			}
 		}
 	}
+}
+
+
+/**
+ * Put all established calls on hold, except the given one
+ *
+ * @param call  Excluded call, or NULL
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int uag_hold_others(struct call *call)
+{
+	struct hold_others ho = {call, NULL};
+
+	if (!conf_config()->call.hold_other_calls) {
+		return 0;
+	}
+
+	uag_exec(hold_others_handler, &ho);
 
-	if (!acall || call_state(acall) == CALL_STATE_TRANSFER)
+	if (!ho.active)
 		return 0;
 
-	err = call_hold(acall, true);
-	return err;
+	return hold_call(ho.active, true);
+}
+
+
+struct call_find {
+	const char *id;
+	struct call *call;
+};
+
+
+static void call_find_handler(void *arg)
+{
+	struct call_find *cf = arg;
+	struct le *le;
+
+	for (le = list_head(uag_list()); le && !cf->call; le = le->next) {
+		struct ua *ua = le->data;
+
+		cf->call = call_find_id(ua_calls(ua), cf->id);
+	}
 }
 
 
 /**
  * Find call with given id
  *
+ * In sharded mode the main thread searches the calls of all shards. A call
+ * of a shard must be accessed with shard_exec(), see ua_shard().
+ *
  * @param id  Call-id string
  *
  * @return The call if found, otherwise NULL.
  */
 struct call *uag_call_find(const char *id)
 {
-	struct le *le = NULL;
-	struct ua *ua = NULL;
-	struct call *call = NULL;
+	struct call_find cf = {id, NULL};
 
 	if (!str_isset(id))
 		return NULL;
 
-	for (le = list_head(&uag.ual); le; le = le->next) {
-		ua = le->data;
+	uag_exec(call_find_handler, &cf);
 
-		call = call_find_id(ua_calls(ua), id);
-		if (call)
-			break;
-	}
+	return cf.call;
+}
 
-	return call;
+
+struct filter_calls {
+	call_list_h *listh;
+	call_match_h *matchh;
+	void *arg;
+};
+
+
+static void filter_calls_handler(void *arg)
+{
+	struct filter_calls *fc = arg;
+	struct le *leu;
+
+	for (leu = list_head(uag_list()); leu; leu = leu->next) {
+		struct ua *ua = leu->data;
+		struct le *lec;
+
+		for (lec = list_tail(ua_calls(ua)); lec; lec = lec->prev) {
+			struct call *call = lec->data;
+
+			if (!fc->matchh || fc->matchh(call, fc->arg))
+				fc->listh(call, fc->arg);
+		}
+	}
 }
 
 
 /**
  * Filters the calls of all User-Agents
  *
+ * In sharded mode the handlers are called in the thread of each shard,
+ * one shard after the other.
+ *
  * @param listh   Call list handler is called for each match
  * @param matchh  Optional filter match handler (if NULL all calls are listed)
  * @param arg     User argument passed to listh
  */
 void uag_filter_calls(call_list_h *listh, call_match_h *matchh, void *arg)
 {
-	struct le *leu;
+	struct filter_calls fc = {listh, matchh, arg};
 
 	if (!listh)
 		return;
 
-	for (leu = list_head(uag_list()); leu; leu = leu->next) {
-		struct ua *ua = leu->data;
-		struct le *lec;
-
-		for (lec = list_tail(ua_calls(ua)); lec; lec = lec->prev) {
-			struct call *call = lec->data;
-
-			if (!matchh || matchh(call, arg))
-				listh(call, arg);
-		}
-	}
+	uag_exec(filter_calls_handler, &fc);
 }
 
 
-static bool request_handler(const struct sip_msg *msg, void *arg)
+static bool handle_request(const struct sip_msg *msg)
 {
 	struct ua *ua;
 
-	(void)arg;
-
 	if (pl_strcmp(&msg->met, "OPTIONS") &&
 	    pl_strcmp(&msg->met, "REFER"))
 		return false;
@@ -211,6 +310,22 @@ static bool request_handler(const struct sip_msg *msg, void *arg)
 }
 
 
+static bool request_handler(const struct sip_msg *msg, void *arg)
+{
+	struct prof_ctx prof;
+	bool handled;
+	(void)arg;
+
+	prof_begin(&prof, NULL);
+
+	handled = handle_request(msg);
+
+	prof_end(&prof, "uag", "request");
+
+	return handled;
+}
+
+
 static bool uri_only_user(const struct uri *uri)
 {
 	bool ret;
@@ -278,7 +393,7 @@ static int add_transp_clientcert(void)
 	struct le *le;
 	int err = 0;
 
-	for (le = list_head(&uag.ual); le; le = le->next) {
+	for (le = list_head(uag_list()); le; le = le->next) {
 		struct account *acc = ua_account(le->data);
 		if (acc->cert) {
 			err = sip_transp_add_ccert(uag.sip,
@@ -503,6 +618,118 @@ static bool sub_handler(const struct sip_msg *msg, void *arg)
 }
 
 
+struct stack_transp {
+	struct sip *sip;
+	int err;
+};
+
+
+static bool stack_transp_laddr(const char *ifname, const struct sa *sa,
+			       void *arg)
+{
+	struct stack_transp *stp = arg;
+	struct sa local;
+	int err = 0;
+	(void)ifname;
+
+	/* a shard listens on ephemeral ports */
+	sa_cpy(&local, sa);
+	sa_set_port(&local, 0);
+
+	if (u32mask_enabled(uag.transports, SIP_TRANSP_UDP))
+		err |= sip_transp_add(stp->sip, SIP_TRANSP_UDP, &local);
+	if (u32mask_enabled(uag.transports, SIP_TRANSP_TCP))
+		err |= sip_transp_add(stp->sip, SIP_TRANSP_TCP, &local);
+	if (err) {
+		warning("ua: shard SIP transport failed: %m\n", err);
+		stp->err = err;
+		return true;
+	}
+
+	return false;
+}
+
+
+/**
+ * Allocate the SIP Stack of a shard
+ *
+ * Must be called from the thread of the shard. The stack has the UDP
+ * and TCP transports of the global stack, on ephemeral ports.
+ *
+ * @param st    SIP Stack of the shard
+ * @param exith SIP Stack exit handler
+ * @param arg   Handler argument
+ *
+ * @return 0 if success, otherwise errorcode
+ */
+int uag_stack_alloc(struct uag_stack *st, sip_exit_h *exith, void *arg)
+{
+	struct network *net = baresip_network();
+	struct stack_transp stp = {NULL, 0};
+	const uint32_t bsize = 16;
+	int err;
+
+	if (!st)
+		return EINVAL;
+
+	err = net_dnsc_alloc(&st->dnsc, net);
+	if (err)
+		goto out;
+
+	err = sip_alloc(&st->sip, st->dnsc, bsize, bsize, bsize,
+			uag.software, exith, arg);
+	if (err)
+		goto out;
+
+	stp.sip = st->sip;
+	net_laddr_apply(net, stack_transp_laddr, &stp);
+	err = stp.err;
+	if (err)
+		goto out;
+
+	sip_transp_set_default(st->sip, uag.cfg->transp);
+	sip_settos(st->sip, uag.cfg->tos);
+
+	err = sip_listen(&st->lsnr, st->sip, true, request_handler, NULL);
+	if (err)
+		goto out;
+
+	err = sipsess_listen(&st->sock, st->sip, bsize,
+			     sipsess_conn_handler, NULL);
+	if (err)
+		goto out;
+
+	err = sipevent_listen(&st->evsock, st->sip, bsize, bsize,
+			      sub_handler, NULL);
+
+ out:
+	if (err) {
+		warning("ua: shard SIP stack failed (%m)\n", err);
+		uag_stack_close(st);
+	}
+
+	return err;
+}
+
+
+/**
+ * Free the SIP Stack of a shard
+ *
+ * @param st SIP Stack of the shard
+ */
+void uag_stack_close(struct uag_stack *st)
+{
+	if (!st)
+		return;
+
+	st->evsock = mem_deref(st->evsock);
+	st->sock   = mem_deref(st->sock);
+	st->lsnr   = mem_deref(st->lsnr);
+	st->sip    = mem_deref(st->sip);
+	st->dnsc   = mem_deref(st->dnsc);
+}
+
+
 static void sip_trace_handler(bool tx, enum sip_transp tp,
 			      const struct sa *src, const struct sa *dst,
 			      const uint8_t *pkt, size_t len, void *arg)
@@ -559,6 +786,10 @@ int ua_init(const char *software, bool udp, bool tcp, bool tls)
 
 	list_init(&uag.ual);
 
+	err = str_dup(&uag.software, software);
+	if (err)
+		goto out;
+
 	err = sip_alloc(&uag.sip, net_dnsc(net), bsize, bsize, bsize,
 			software, exit_handler, NULL);
 	if (err) {
@@ -584,6 +815,15 @@ int ua_init(const char *software, bool udp, bool tcp, bool tls)
 	if (err)
 		goto out;
 
+	if (uag.cfg->shards) {
+		/* the pooled sockets belong to the main loop */
+		strmpool_set_size(baresip_strmpool(), 0);
+
+		err = shard_init(uag.cfg->shards);
+		if (err)
+			goto out;
+	}
+
  out:
 	if (err) {
 		warning("ua: init failed (%m)\n", err);
@@ -598,11 +838,14 @@ int ua_init(const char *software, bool udp, bool tcp, bool tls)
  */
 void ua_close(void)
 {
+	shard_close();
+
 	uag.evsock   = mem_deref(uag.evsock);
 	uag.sock     = mem_deref(uag.sock);
 	uag.lsnr     = mem_deref(uag.lsnr);
 	uag.sip      = mem_deref(uag.sip);
 	uag.eprm     = mem_deref(uag.eprm);
+	uag.software = mem_deref(uag.software);
 
 #ifdef USE_TLS
 	uag.tls = mem_deref(uag.tls);
@@ -625,6 +868,8 @@ void ua_stop_all(bool forced)
 
 	info("ua: stop all (forced=%d)\n", forced);
 
+	shard_stop_all(forced);
+
 	/* check if someone else has grabbed a ref to ua */
 	le = uag.ual.head;
 	while (le) {
@@ -697,7 +942,7 @@ int uag_reset_transp(bool reg, bool reinvite)
 		return err;
 
 	/* Re-REGISTER all User-Agents */
-	for (le = uag.ual.head; le; le = le->next) {
+	for (le = list_head(uag_list()); le; le = le->next) {
 		struct ua *ua = le->data;
 		struct account *acc = ua_account(ua);
 		struct le *lec;
@@ -761,35 +1006,44 @@ struct config_sip *uag_cfg(void)
 
 
 /**
- * Get the global SIP Stack
+ * Get the SIP Stack of the current thread
+ *
+ * In the thread of a shard this is the SIP Stack of the shard,
+ * otherwise the global SIP Stack.
  *
  * @return SIP Stack
  */
 struct sip *uag_sip(void)
 {
-	return uag.sip;
+	struct shard *sh = shard_current();
+
+	return sh ? shard_stack(sh)->sip : uag.sip;
 }
 
 
 /**
- * Get the global SIP Session socket
+ * Get the SIP Session socket of the current thread
  *
  * @return SIP Session socket
  */
 struct sipsess_sock *uag_sipsess_sock(void)
 {
-	return uag.sock;
+	struct shard *sh = shard_current();
+
+	return sh ? shard_stack(sh)->sock : uag.sock;
 }
 
 
 /**
- * Get the global SIP Event socket
+ * Get the SIP Event socket of the current thread
  *
  * @return SIP Event socket
  */
 struct sipevent_sock *uag_sipevent_sock(void)
 {
-	return uag.evsock;
+	struct shard *sh = shard_current();
+
+	return sh ? shard_stack(sh)->evsock : uag.evsock;
 }
 
 
@@ -855,48 +1109,67 @@ static bool uri_match_af(const struct uri *accu, const struct uri *peeru)
 }
 
 
+struct find_cuser {
+	const struct pl *cuser;
+	struct ua *ua;        /**< Contact username match    */
+	struct ua *ua_aor;    /**< AOR username match        */
+	struct ua *ua_any;    /**< Catch-all UA              */
+};
+
+
+static void find_cuser_handler(void *arg)
+{
+	struct find_cuser *fc = arg;
+	struct le *le;
+
+	for (le = list_head(uag_list()); le && !fc->ua; le = le->next) {
+		struct ua *ua = le->data;
+		struct account *acc = ua_account(ua);
+
+		if (0 == pl_strcasecmp(fc->cuser, ua_local_cuser(ua)))
+			fc->ua = ua;
+		else if (!fc->ua_aor &&
+			 0 == pl_casecmp(fc->cuser, &acc->luri.user))
+			fc->ua_aor = ua;
+		else if (!fc->ua_any && ua_catchall(ua))
+			fc->ua_any = ua;
+	}
+}
+
+
 /**
  * Find the correct UA from the contact user
  *
+ * In sharded mode the main thread searches the User-Agents of all shards.
+ *
  * @param cuser Contact username
  *
  * @return Matching UA if found, NULL if not found
  */
 struct ua *uag_find(const struct pl *cuser)
 {
-	struct le *le;
+	struct find_cuser fc = {cuser, NULL, NULL, NULL};
 
-	for (le = uag.ual.head; le; le = le->next) {
-		struct ua *ua = le->data;
+	uag_exec(find_cuser_handler, &fc);
 
-		if (0 == pl_strcasecmp(cuser, ua_local_cuser(ua)))
-			return ua;
-	}
+	if (fc.ua)
+		return fc.ua;
 
 	/* Try also matching by AOR, for better interop */
-	for (le = uag.ual.head; le; le = le->next) {
-		struct ua *ua = le->data;
-		struct account *acc = ua_account(ua);
-
-		if (0 == pl_casecmp(cuser, &acc->luri.user))
-			return ua;
-	}
+	if (fc.ua_aor)
+		return fc.ua_aor;
 
 	/* Last resort, try any catchall UAs */
-	for (le = uag.ual.head; le; le = le->next) {
-		struct ua *ua = le->data;
-
-		if (ua_catchall(ua))
-			return ua;
-	}
-
-	return NULL;
+	return fc.ua_any;
 }
 
 
 /**
  * Find the correct UA from SIP message
  *
+ * The User-Agents of the current thread are searched, which own the SIP
+ * Stack that received the message.
+ *
  * @param msg SIP message
  *
  * @return Matching UA if found, NULL if not found
@@ -911,7 +1184,7 @@ struct ua *uag_find_msg(const struct sip_msg *msg)
 		return NULL;
 
 	cuser = &msg->uri.user;
-	for (le = uag.ual.head; le; le = le->next) {
+	for (le = list_head(uag_list()); le; le = le->next) {
 		struct ua *ua = le->data;
 
 		if (0 == pl_strcasecmp(cuser, ua_local_cuser(ua))) {
@@ -922,7 +1195,7 @@ struct ua *uag_find_msg(const struct sip_msg *msg)
 
 	/* Try also matching by AOR, for better interop and for peer-to-peer
 	 * calls */
-	for (le = uag.ual.head; le; le = le->next) {
+	for (le = list_head(uag_list()); le; le = le->next) {
 		struct ua *ua = le->data;
 		struct account *acc = ua_account(ua);
 
@@ -947,7 +1220,7 @@ struct ua *uag_find_msg(const struct sip_msg *msg)
 	}
 
 	/* Last resort, try any catchall UAs */
-	for (le = uag.ual.head; le; le = le->next) {
+	for (le = list_head(uag_list()); le; le = le->next) {
 		struct ua *ua = le->data;
 
 		if (ua_catchall(ua)) {
@@ -963,18 +1236,11 @@ struct ua *uag_find_msg(const struct sip_msg *msg)
 }
 
 
-/**
- * Find a User-Agent (UA) from an Address-of-Record (AOR)
- *
- * @param aor Address-of-Record string
- *
- * @return User-Agent (UA) if found, otherwise NULL
- */
-struct ua *uag_find_aor(const char *aor)
+static struct ua *find_aor(const struct list *ual, const char *aor)
 {
 	struct le *le;
 
-	for (le = uag.ual.head; le; le = le->next) {
+	for (le = list_head(ual); le; le = le->next) {
 		struct ua *ua = le->data;
 		struct account *acc = ua_account(ua);
 
@@ -988,95 +1254,132 @@ struct ua *uag_find_aor(const char *aor)
 }
 
 
+struct find_aor {
+	const char *aor;
+	struct ua *ua;
+};
+
+
+static void find_aor_handler(void *arg)
+{
+	struct find_aor *fa = arg;
+
+	if (!fa->ua)
+		fa->ua = find_aor(uag_list(), fa->aor);
+}
+
+
 /**
- * Find a User-Agent (UA) which has certain address parameter and/or value
+ * Find a User-Agent (UA) from an Address-of-Record (AOR)
  *
- * @param name  SIP Address parameter name
- * @param value SIP Address parameter value (optional)
+ * In sharded mode the main thread searches the User-Agents of all shards.
+ * A User-Agent of a shard must be accessed with shard_exec(), see
+ * ua_shard().
+ *
+ * @param aor Address-of-Record string
  *
  * @return User-Agent (UA) if found, otherwise NULL
  */
-struct ua *uag_find_param(const char *name, const char *value)
+struct ua *uag_find_aor(const char *aor)
 {
+	struct find_aor fa = {aor, NULL};
+
+	uag_exec(find_aor_handler, &fa);
+
+	return fa.ua;
+}
+
+
+struct find_param {
+	const char *name;
+	const char *value;
+	struct ua *ua;
+};
+
+
+static void find_param_handler(void *arg)
+{
+	struct find_param *fp = arg;
 	struct le *le;
 
-	for (le = uag.ual.head; le; le = le->next) {
+	for (le = list_head(uag_list()); le && !fp->ua; le = le->next) {
 		struct ua *ua = le->data;
 		struct account *acc = ua_account(ua);
 		struct sip_addr *laddr = account_laddr(acc);
 		struct pl val;
 
-		if (value) {
+		if (fp->value) {
 
-			if (0 == msg_param_decode(&laddr->params, name, &val)
+			if (0 == msg_param_decode(&laddr->params, fp->name,
+						  &val)
 			    &&
-			    0 == pl_strcasecmp(&val, value)) {
-				return ua;
+			    0 == pl_strcasecmp(&val, fp->value)) {
+				fp->ua = ua;
 			}
 		}
 		else {
-			if (0 == msg_param_exists(&laddr->params, name, &val))
-				return ua;
+			if (0 == msg_param_exists(&laddr->params, fp->name,
+						  &val))
+				fp->ua = ua;
 		}
 	}
-
-	return NULL;
 }
 
 
 /**
- * Find a User-Agent (UA) best fitting for a SIP request
+ * Find a User-Agent (UA) which has certain address parameter and/or value
  *
- * @param requri The SIP uri for the request
+ * In sharded mode the main thread searches the User-Agents of all shards.
+ *
+ * @param name  SIP Address parameter name
+ * @param value SIP Address parameter value (optional)
  *
  * @return User-Agent (UA) if found, otherwise NULL
  */
-struct ua *uag_find_requri(const char *requri)
+struct ua *uag_find_param(const char *name, const char *value)
 {
-	struct pl pl;
+	struct find_param fp = {name, value, NULL};
 
-	pl_set_str(&pl, requri);
-	return uag_find_requri_pl(&pl);
+	uag_exec(find_param_handler, &fp);
+
+	return fp.ua;
 }
 
 
 /**
  * Find a User-Agent (UA) best fitting for a SIP request
  *
- * @param requri The SIP uri pointer-length string for the request
+ * @param requri The SIP uri for the request
  *
  * @return User-Agent (UA) if found, otherwise NULL
  */
-struct ua *uag_find_requri_pl(const struct pl *requri)
+struct ua *uag_find_requri(const char *requri)
 {
 	struct pl pl;
-	struct uri *uri;
-	struct le *le;
-	struct ua *ret = NULL;
-	struct sip_addr addr;
-	char *uric;
-	int err;
 
-	if (!pl_isset(requri))
-		return NULL;
+	pl_set_str(&pl, requri);
+	return uag_find_requri_pl(&pl);
+}
 
-	if (!uag.ual.head)
-		return NULL;
 
-	err = account_uri_complete_strdup(NULL, &uric, requri);
-	if (err)
-		goto out;
+struct find_requri {
+	const struct uri *uri;
+	struct ua *ua;        /**< Matching UA, registered preferred */
+	struct ua *ua_p2p;    /**< Local account for peer-to-peer    */
+	struct ua *ua_first;  /**< Fallback selection                */
+};
 
-	pl_set_str(&pl, uric);
-	err = sip_addr_decode(&addr, &pl);
-	if (err) {
-		warning("ua: address %r could not be parsed: %m\n",
-			&pl, err);
-		goto out;
-	}
 
-	uri = &addr.uri;
-	for (le = uag.ual.head; le; le = le->next) {
+static void find_requri_handler(void *arg)
+{
+	struct find_requri *fr = arg;
+	const struct uri *uri = fr->uri;
+	struct le *le;
+
+	if (!fr->ua_first)
+		fr->ua_first = list_ledata(list_head(uag_list()));
+
+	for (le = list_head(uag_list()); le && !fr->ua; le = le->next) {
 		struct ua *ua = le->data;
 		struct account *acc = ua_account(ua);
 
@@ -1086,7 +1389,7 @@ struct ua *uag_find_requri_pl(const struct pl *requri)
 
 		if (uri_only_user(uri)) {
 			if (acc->regint) {
-				ret = ua;
+				fr->ua = ua;
 				break;
 			}
 		}
@@ -1096,7 +1399,7 @@ struct ua *uag_find_requri_pl(const struct pl *requri)
 				continue;
 			}
 			else {
-				ret = ua;
+				fr->ua = ua;
 				break;
 			}
 		}
@@ -1113,21 +1416,63 @@ struct ua *uag_find_requri_pl(const struct pl *requri)
 
 			/* Remember local account.
 			 * But we prefer registered UA. */
-			if (!ret)
-				ret = ua;
+			if (!fr->ua_p2p)
+				fr->ua_p2p = ua;
 		}
 	}
+}
+
 
+/**
+ * Find a User-Agent (UA) best fitting for a SIP request
+ *
+ * In sharded mode the main thread searches the User-Agents of all shards.
+ *
+ * @param requri The SIP uri pointer-length string for the request
+ *
+ * @return User-Agent (UA) if found, otherwise NULL
+ */
+struct ua *uag_find_requri_pl(const struct pl *requri)
+{
+	struct find_requri fr = {NULL, NULL, NULL, NULL};
+	struct pl pl;
+	struct ua *ret = NULL;
+	struct sip_addr addr;
+	char *uric = NULL;
+	int err;
+
+	if (!pl_isset(requri))
+		return NULL;
+
+	err = account_uri_complete_strdup(NULL, &uric, requri);
+	if (err)
+		goto out;
+
+	pl_set_str(&pl, uric);
+	err = sip_addr_decode(&addr, &pl);
+	if (err) {
+		warning("ua: address %r could not be parsed: %m\n",
+			&pl, err);
+		goto out;
+	}
+
+	fr.uri = &addr.uri;
+	uag_exec(find_requri_handler, &fr);
+
+	if (!fr.ua_first)
+		goto out;
+
+	ret = fr.ua ? fr.ua : fr.ua_p2p;
 	if (ret) {
 		ua_printf(ret, "selected for request\n");
 	}
 	else {
 		/* Ok, seems that matching account is missing. */
-		if (uri_only_user(uri)) {
+		if (uri_only_user(fr.uri)) {
 			goto out;
 		}
 
-		ret = uag.ual.head->data;
+		ret = fr.ua_first;
 		ua_printf(ret, "fallback selection\n");
 	}
 
@@ -1138,33 +1483,32 @@ out:
 
 
 /**
- * Get the list of User-Agents
+ * Get the list of User-Agents of the current thread
+ *
+ * In sharded mode each shard has its own list, a User-Agent of another
+ * shard must be accessed with shard_exec(). Use shard_exec_all() to visit
+ * the User-Agents of all shards.
  *
  * @return List of User-Agents (struct ua)
  */
 struct list *uag_list(void)
 {
-	return &uag.ual;
+	struct shard *sh = shard_current();
+
+	return sh ? shard_ual(sh) : &uag.ual;
 }
 
 
 /**
  * Counts the calls from all user agents.
  *
+ * The calls are counted globally, also over the shards.
+ *
  * @return the number of calls over all user agents.
  */
 uint32_t uag_call_count(void)
 {
-	struct le *le;
-	uint32_t c = 0;
-
-	for (le = uag.ual.head; le; le = le->next) {
-		struct ua *ua = le->data;
-
-		c += list_count(ua_calls(ua));
-	}
-
-	return c;
+	return stats_calls();
 }
 
 
@@ -1174,7 +1518,7 @@ int uag_raise(struct ua *ua, struct le *le)
 		return EINVAL;
 
 	list_unlink(le);
-	list_prepend(&uag.ual, le, ua);
+	list_prepend(uag_list(), le, ua);
 	return 0;
 }
 
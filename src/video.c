@@ -159,6 +159,7 @@ struct video {
 	struct tmr tmr;         /**< Timer for frame-rate estimation      */
 	char *peer;             /**< Peer URI                             */
 	bool nack_pli;          /**< Send NACK/PLI to peer                */
+	bool nack;              /**< Peer supports Generic NACK           */
 	video_err_h *errh;      /**< Error handler                        */
 	void *arg;              /**< Error handler argument               */
 };
@@ -313,13 +314,18 @@ static void vidqueue_poll(struct vtx *vtx, uint64_t jfs, uint64_t prev_jfs)
 static void rtp_tmr_handler(void *arg)
 {
 	struct vtx *vtx = arg;
+	struct prof_ctx prof;
 	uint64_t pjfs;
 
+	prof_begin(&prof, &vtx->tmr_rtp);
+
 	pjfs = vtx->tmr_rtp.jfs;
 
 	tmr_start(&vtx->tmr_rtp, 1000/MEDIA_POLL_RATE, rtp_tmr_handler, vtx);
 
 	vidqueue_poll(vtx, vtx->tmr_rtp.jfs, pjfs);
+
+	prof_end(&prof, "video", "rtp_tmr");
 }
 
 
@@ -468,7 +474,7 @@ static void encode_rtp_send(struct vtx *vtx, struct vidframe *frame,
 				goto out;
 		}
 
-		vidconv(vtx->frame, frame, 0);
+		vidscale(vtx->frame, frame, 0);
 		frame = vtx->frame;
 	}
 
@@ -844,19 +850,60 @@ static void stream_recv_handler(const struct rtp_header *hdr,
 
 	MAGIC_CHECK(v);
 
-	/* in case of packet loss, we need to receive a new keyframe */
-	if (lostc)
+	/* in case of packet loss, we need to receive a new keyframe,
+	 * unless the missing packets are recovered with retransmission */
+	if (lostc && !(v->cfg.rtx && v->nack))
 		request_picture_update(&v->vrx);
 
 	(void)video_stream_decode(&v->vrx, hdr, mb);
 }
 
 
+/* Packet loss that could not be recovered with retransmission */
+static void stream_lost_handler(unsigned lostc, void *arg)
+{
+	struct video *v = arg;
+
+	MAGIC_CHECK(v);
+
+	debug("video: %u packets lost after NACK\n", lostc);
+
+	request_picture_update(&v->vrx);
+}
+
+
+/* RFC 4585 Generic NACK -- retransmit the requested packets */
+static bool handle_gnack(struct stream *strm, const struct rtcp_msg *msg)
+{
+	bool picup = false;
+	uint32_t i;
+
+	for (i=0; i<msg->r.fb.n; i++) {
+
+		const struct gnack *gn = &msg->r.fb.fci.gnackv[i];
+		unsigned j;
+
+		if (stream_resend(strm, gn->pid))
+			picup = true;
+
+		for (j=0; j<16; j++) {
+
+			if (!(gn->blp & (1 << j)))
+				continue;
+
+			if (stream_resend(strm, gn->pid + j + 1))
+				picup = true;
+		}
+	}
+
+	return picup;
+}
+
+
 static void rtcp_handler(struct stream *strm, struct rtcp_msg *msg, void *arg)
 {
 	struct video *v = arg;
 	struct vtx *vtx = &v->vtx;
-	(void)strm;
 
 	MAGIC_CHECK(v);
 
@@ -882,7 +929,8 @@ static void rtcp_handler(struct stream *strm, struct rtcp_msg *msg, void *arg)
 		break;
 
 	case RTCP_RTPFB:
-		if (msg->hdr.count == RTCP_RTPFB_GNACK) {
+		if (msg->hdr.count == RTCP_RTPFB_GNACK &&
+		    handle_gnack(strm, msg)) {
 			mtx_lock(&vtx->lock_enc);
 			vtx->picup = true;
 			mtx_unlock(&vtx->lock_enc);
@@ -951,6 +999,30 @@ static int vrx_print_pipeline(struct re_printf *pf, const struct vrx *vrx)
 }
 
 
+/* Add one RTX payload format for each video codec */
+static int add_rtx_formats(struct sdp_media *m)
+{
+	struct le *le;
+	int err = 0;
+
+	le = list_head(sdp_media_format_lst(m, true));
+	for (; le && !err; le = le->next) {
+
+		const struct sdp_format *fmt = le->data;
+
+		/* skip the RTX formats added here */
+		if (!fmt->data)
+			continue;
+
+		err = sdp_format_add(NULL, m, false, NULL, "rtx",
+				     VIDEO_SRATE, 1, NULL, NULL, NULL, false,
+				     "apt=%s", fmt->id);
+	}
+
+	return err;
+}
+
+
 /**
  * Allocate a video stream
  *
@@ -1026,6 +1098,11 @@ int video_alloc(struct video **vp, struct list *streaml,
 	err |= sdp_media_set_lattr(stream_sdpmedia(v->strm), true,
 				   "rtcp-fb", "* nack pli");
 
+	if (v->cfg.rtx) {
+		err |= sdp_media_set_lattr(stream_sdpmedia(v->strm), false,
+					   "rtcp-fb", "* nack");
+	}
+
 	/* RFC 4796 */
 	if (content) {
 		err |= sdp_media_set_lattr(stream_sdpmedia(v->strm), true,
@@ -1052,6 +1129,10 @@ int video_alloc(struct video **vp, struct list *streaml,
 				      "%s", vc->fmtp);
 	}
 
+	/* RFC 4588 */
+	if (v->cfg.rtx)
+		err |= add_rtx_formats(stream_sdpmedia(v->strm));
+
 	/* Video filters */
 	for (le = list_head(vidfiltl); le; le = le->next) {
 		struct vidfilt *vf = le->data;
@@ -1148,6 +1229,27 @@ static void tmr_handler(void *arg)
 }
 
 
+/* Get the first supported remote codec, skipping e.g. RTX formats */
+static const struct sdp_format *video_rcodec(const struct sdp_media *m)
+{
+	struct le *le;
+
+	if (!sdp_media_rport(m))
+		return NULL;
+
+	le = list_head(sdp_media_format_lst(m, false));
+	for (; le; le = le->next) {
+
+		const struct sdp_format *fmt = le->data;
+
+		if (fmt->sup && fmt->data)
+			return fmt;
+	}
+
+	return NULL;
+}
+
+
 /**
  * Update video object and start/stop according to media direction
  *
@@ -1172,7 +1274,7 @@ int video_update(struct video *v, const char *peer)
 
 	if (!sdp_media_disabled(m)) {
 		dir = sdp_media_dir(m);
-		sc = sdp_media_rformat(m, NULL);
+		sc = video_rcodec(m);
 	}
 
 	if (!sc) {
@@ -1555,6 +1657,21 @@ static bool nack_handler(const char *name, const char *value, void *arg)
 }
 
 
+/* Generic NACK, i.e. "nack" without parameters */
+static bool gnack_handler(const char *name, const char *value, void *arg)
+{
+	struct pl fb, param;
+	(void)name;
+	(void)arg;
+
+	if (re_regex(value, str_len(value), "[^ ]+ [^ ]+[ ]*[^ ]*",
+		     NULL, &fb, NULL, &param))
+		return false;
+
+	return 0 == pl_strcasecmp(&fb, "nack") && !pl_isset(&param);
+}
+
+
 void video_sdp_attr_decode(struct video *v)
 {
 	if (!v)
@@ -1564,6 +1681,17 @@ void video_sdp_attr_decode(struct video *v)
 	if (sdp_media_rattr_apply(stream_sdpmedia(v->strm), "rtcp-fb",
 				  nack_handler, 0))
 		v->nack_pli = true;
+
+	v->nack = NULL != sdp_media_rattr_apply(stream_sdpmedia(v->strm),
+						"rtcp-fb", gnack_handler, 0);
+
+	/* RFC 4588 */
+	if (v->cfg.rtx) {
+		int err = stream_enable_rtx(v->strm, v->nack,
+					    stream_lost_handler);
+		if (err)
+			warning("video: could not enable rtx: %m\n", err);
+	}
 }
 
 
@@ -0,0 +1,625 @@
+/**
+ * @file vidscale.c  Fast video scaling and pixel format conversion
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <string.h>
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined (__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined (__ARM_NEON)
+#include <arm_neon.h>
+#endif
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "core.h"
+
+
+/*
+ * vidconv() converts and scales one pixel at a time with nearest
+ * neighbour sampling. This file has row kernels for the common cases,
+ * which all produce YUV420P:
+ *
+ *   YUV420P   -> YUV420P   copy, 2:1 box, area downscale or bilinear
+ *   NV12      -> YUV420P   same size
+ *   YUYV422   -> YUV420P   same size
+ *   RGB32     -> YUV420P   same size
+ *
+ * The kernels use SSE2, AVX2 or NEON when the compiler targets them and
+ * fall back to portable C. Everything else is passed on to vidconv().
+ *
+ * The temporary rows are on the stack, so the width is limited.
+ */
+
+
+enum {
+	MAX_WIDTH = 4096,   /* Maximum source and destination width   */
+	FRAC_BITS = 7,      /* Bilinear weights in [0, 128]           */
+	FRAC_ONE  = 1 << FRAC_BITS,
+};
+
+
+struct plane {
+	uint8_t *p;
+	unsigned stride;
+	unsigned w;
+	unsigned h;
+};
+
+
+/* dst[i] = (a[i] * (128 - f) + b[i] * f + 64) >> 7 */
+static void row_blend(uint8_t *dst, const uint8_t *a, const uint8_t *b,
+		      unsigned n, unsigned f)
+{
+	unsigned i = 0;
+
+	if (f == 0) {
+		memcpy(dst, a, n);
+		return;
+	}
+
+#if defined (__AVX2__)
+	{
+		const __m256i fa = _mm256_set1_epi16((short)(FRAC_ONE - f));
+		const __m256i fb = _mm256_set1_epi16((short)f);
+		const __m256i rnd = _mm256_set1_epi16(FRAC_ONE / 2);
+
+		for (; i + 16 <= n; i += 16) {
+			__m256i va = _mm256_cvtepu8_epi16(
+				_mm_loadu_si128((const __m128i *)(a + i)));
+			__m256i vb = _mm256_cvtepu8_epi16(
+				_mm_loadu_si128((const __m128i *)(b + i)));
+			__m256i v;
+
+			v = _mm256_add_epi16(_mm256_mullo_epi16(va, fa),
+					     _mm256_mullo_epi16(vb, fb));
+			v = _mm256_srli_epi16(_mm256_add_epi16(v, rnd),
+					      FRAC_BITS);
+			v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v),
+						     0xd8);
+
+			_mm_storeu_si128((__m128i *)(dst + i),
+					 _mm256_castsi256_si128(v));
+		}
+	}
+#elif defined (__SSE2__)
+	{
+		const __m128i fa = _mm_set1_epi16((short)(FRAC_ONE - f));
+		const __m128i fb = _mm_set1_epi16((short)f);
+		const __m128i rnd = _mm_set1_epi16(FRAC_ONE / 2);
+		const __m128i zero = _mm_setzero_si128();
+
+		for (; i + 16 <= n; i += 16) {
+			__m128i va = _mm_loadu_si128((const __m128i *)(a + i));
+			__m128i vb = _mm_loadu_si128((const __m128i *)(b + i));
+			__m128i lo, hi;
+
+			lo = _mm_add_epi16(
+			     _mm_mullo_epi16(_mm_unpacklo_epi8(va, zero), fa),
+			     _mm_mullo_epi16(_mm_unpacklo_epi8(vb, zero), fb));
+			hi = _mm_add_epi16(
+			     _mm_mullo_epi16(_mm_unpackhi_epi8(va, zero), fa),
+			     _mm_mullo_epi16(_mm_unpackhi_epi8(vb, zero), fb));
+
+			lo = _mm_srli_epi16(_mm_add_epi16(lo, rnd), FRAC_BITS);
+			hi = _mm_srli_epi16(_mm_add_epi16(hi, rnd), FRAC_BITS);
+
+			_mm_storeu_si128((__m128i *)(dst + i),
+					 _mm_packus_epi16(lo, hi));
+		}
+	}
+#elif defined (__ARM_NEON)
+	{
+		const uint8x8_t fa = vdup_n_u8((uint8_t)(FRAC_ONE - f));
+		const uint8x8_t fb = vdup_n_u8((uint8_t)f);
+
+		for (; i + 8 <= n; i += 8) {
+			uint16x8_t v;
+
+			v = vmull_u8(vld1_u8(a + i), fa);
+			v = vmlal_u8(v, vld1_u8(b + i), fb);
+
+			vst1_u8(dst + i, vrshrn_n_u16(v, FRAC_BITS));
+		}
+	}
+#endif
+
+	for (; i < n; i++)
+		dst[i] = (a[i] * (FRAC_ONE - f) + b[i] * f + FRAC_ONE/2)
+			>> FRAC_BITS;
+}
+
+
+/* dst[i] = average of the 2x2 block at a[2i], b[2i] */
+static void row_box2(uint8_t *dst, const uint8_t *a, const uint8_t *b,
+		     unsigned n)
+{
+	unsigned i = 0;
+
+#if defined (__SSE2__)
+	{
+		const __m128i mask = _mm_set1_epi16(0x00ff);
+		const __m128i two  = _mm_set1_epi16(2);
+
+		for (; i + 16 <= n; i += 16) {
+			__m128i s[2];
+			unsigned k;
+
+			for (k=0; k<2; k++) {
+				const __m128i *pa, *pb;
+				__m128i va, vb, v;
+
+				pa = (const __m128i *)(a + 2*i + 16*k);
+				pb = (const __m128i *)(b + 2*i + 16*k);
+				va = _mm_loadu_si128(pa);
+				vb = _mm_loadu_si128(pb);
+
+				v = _mm_add_epi16(_mm_and_si128(va, mask),
+						  _mm_srli_epi16(va, 8));
+				v = _mm_add_epi16(v, _mm_and_si128(vb, mask));
+				v = _mm_add_epi16(v, _mm_srli_epi16(vb, 8));
+				v = _mm_add_epi16(v, two);
+
+				s[k] = _mm_srli_epi16(v, 2);
+			}
+
+			_mm_storeu_si128((__m128i *)(dst + i),
+					 _mm_packus_epi16(s[0], s[1]));
+		}
+	}
+#elif defined (__ARM_NEON)
+	for (; i + 8 <= n; i += 8) {
+		uint16x8_t v;
+
+		v = vpaddlq_u8(vld1q_u8(a + 2*i));
+		v = vpadalq_u8(v, vld1q_u8(b + 2*i));
+
+		vst1_u8(dst + i, vrshrn_n_u16(v, 2));
+	}
+#endif
+
+	for (; i < n; i++)
+		dst[i] = (a[2*i] + a[2*i+1] + b[2*i] + b[2*i+1] + 2) >> 2;
+}
+
+
+/* Split interleaved UV into two planes */
+static void row_uv_split(uint8_t *u, uint8_t *v, const uint8_t *uv,
+			 unsigned n)
+{
+	unsigned i = 0;
+
+#if defined (__SSE2__)
+	{
+		const __m128i mask = _mm_set1_epi16(0x00ff);
+
+		for (; i + 16 <= n; i += 16) {
+			__m128i lo = _mm_loadu_si128((const __m128i *)
+						     (uv + 2*i));
+			__m128i hi = _mm_loadu_si128((const __m128i *)
+						     (uv + 2*i + 16));
+
+			_mm_storeu_si128((__m128i *)(u + i),
+				_mm_packus_epi16(_mm_and_si128(lo, mask),
+						 _mm_and_si128(hi, mask)));
+			_mm_storeu_si128((__m128i *)(v + i),
+				_mm_packus_epi16(_mm_srli_epi16(lo, 8),
+						 _mm_srli_epi16(hi, 8)));
+		}
+	}
+#elif defined (__ARM_NEON)
+	for (; i + 16 <= n; i += 16) {
+		uint8x16x2_t x = vld2q_u8(uv + 2*i);
+
+		vst1q_u8(u + i, x.val[0]);
+		vst1q_u8(v + i, x.val[1]);
+	}
+#endif
+
+	for (; i < n; i++) {
+		u[i] = uv[2*i];
+		v[i] = uv[2*i + 1];
+	}
+}
+
+
+/* Two rows of YUYV422 to two rows of Y and one row of U and V */
+static void row_yuyv(uint8_t *y0, uint8_t *y1, uint8_t *u, uint8_t *v,
+		     const uint8_t *a, const uint8_t *b, unsigned n)
+{
+	unsigned i = 0;
+
+#if defined (__SSE2__)
+	{
+		const __m128i mask = _mm_set1_epi16(0x00ff);
+		const __m128i zero = _mm_setzero_si128();
+
+		/* 16 pixels per row, 8 chroma samples */
+		for (; i + 16 <= n; i += 16) {
+			const __m128i *pa = (const __m128i *)(a + 2*i);
+			const __m128i *pb = (const __m128i *)(b + 2*i);
+			__m128i a0 = _mm_loadu_si128(pa);
+			__m128i a1 = _mm_loadu_si128(pa + 1);
+			__m128i b0 = _mm_loadu_si128(pb);
+			__m128i b1 = _mm_loadu_si128(pb + 1);
+			__m128i c;
+
+			_mm_storeu_si128((__m128i *)(y0 + i),
+				_mm_packus_epi16(_mm_and_si128(a0, mask),
+						 _mm_and_si128(a1, mask)));
+			_mm_storeu_si128((__m128i *)(y1 + i),
+				_mm_packus_epi16(_mm_and_si128(b0, mask),
+						 _mm_and_si128(b1, mask)));
+
+			/* U0 V0 U1 V1 .. averaged over the two rows */
+			c = _mm_avg_epu8(
+				_mm_packus_epi16(_mm_srli_epi16(a0, 8),
+						 _mm_srli_epi16(a1, 8)),
+				_mm_packus_epi16(_mm_srli_epi16(b0, 8),
+						 _mm_srli_epi16(b1, 8)));
+
+			_mm_storel_epi64((__m128i *)(u + i/2),
+				_mm_packus_epi16(_mm_and_si128(c, mask),
+						 zero));
+			_mm_storel_epi64((__m128i *)(v + i/2),
+				_mm_packus_epi16(_mm_srli_epi16(c, 8), zero));
+		}
+	}
+#elif defined (__ARM_NEON)
+	for (; i + 16 <= n; i += 16) {
+		uint8x8x4_t xa = vld4_u8(a + 2*i);
+		uint8x8x4_t xb = vld4_u8(b + 2*i);
+		uint8x8x2_t ya = {{xa.val[0], xa.val[2]}};
+		uint8x8x2_t yb = {{xb.val[0], xb.val[2]}};
+
+		vst2_u8(y0 + i, ya);
+		vst2_u8(y1 + i, yb);
+		vst1_u8(u + i/2, vrhadd_u8(xa.val[1], xb.val[1]));
+		vst1_u8(v + i/2, vrhadd_u8(xa.val[3], xb.val[3]));
+	}
+#endif
+
+	for (; i + 2 <= n; i += 2) {
+		y0[i]     = a[2*i];
+		y0[i+1]   = a[2*i + 2];
+		y1[i]     = b[2*i];
+		y1[i+1]   = b[2*i + 2];
+		u[i/2]    = (a[2*i + 1] + b[2*i + 1] + 1) >> 1;
+		v[i/2]    = (a[2*i + 3] + b[2*i + 3] + 1) >> 1;
+	}
+}
+
+
+static void plane_copy(const struct plane *d, const struct plane *s)
+{
+	unsigned y;
+
+	for (y=0; y<d->h; y++)
+		memcpy(d->p + y*d->stride, s->p + y*s->stride, d->w);
+}
+
+
+static void plane_box2(const struct plane *d, const struct plane *s)
+{
+	unsigned y;
+
+	for (y=0; y<d->h; y++) {
+		const uint8_t *a = s->p + 2*y*s->stride;
+
+		row_box2(d->p + y*d->stride, a, a + s->stride, d->w);
+	}
+}
+
+
+/* Each destination pixel is the average of its source area */
+static void plane_area(const struct plane *d, const struct plane *s)
+{
+	uint32_t acc[MAX_WIDTH];
+	uint16_t xv[MAX_WIDTH + 1];
+	unsigned x, y, i;
+
+	for (x=0; x<=d->w; x++)
+		xv[x] = (uint16_t)(x * s->w / d->w);
+
+	for (y=0; y<d->h; y++) {
+		unsigned y0 = y * s->h / d->h;
+		unsigned y1 = max((y + 1) * s->h / d->h, y0 + 1);
+		uint8_t *dst = d->p + y*d->stride;
+
+		memset(acc, 0, s->w * sizeof(acc[0]));
+
+		for (i=y0; i<y1; i++) {
+			const uint8_t *src = s->p + i*s->stride;
+
+			for (x=0; x<s->w; x++)
+				acc[x] += src[x];
+		}
+
+		for (x=0; x<d->w; x++) {
+			unsigned x0 = xv[x];
+			unsigned x1 = max((unsigned)xv[x+1], x0 + 1);
+			unsigned n = (x1 - x0) * (y1 - y0);
+			uint32_t sum = 0;
+
+			for (i=x0; i<x1; i++)
+				sum += acc[i];
+
+			dst[x] = (uint8_t)((sum + n/2) / n);
+		}
+	}
+}
+
+
+/* Map the centre of destination pixel i to the source, 16.16 fixed */
+static void bilinear_pos(unsigned *pos, unsigned *frac, unsigned i,
+			 unsigned dn, unsigned sn)
+{
+	int64_t p = ((2 * (int64_t)i + 1) * sn * 65536) / (2 * dn) - 32768;
+
+	if (p < 0)
+		p = 0;
+
+	*pos  = (unsigned)(p >> 16);
+	*frac = (unsigned)(p & 0xffff) >> (16 - FRAC_BITS);
+
+	if (*pos >= sn - 1) {
+		*pos  = sn - 1;
+		*frac = 0;
+	}
+}
+
+
+static void plane_bilinear(const struct plane *d, const struct plane *s)
+{
+	uint8_t row[MAX_WIDTH];
+	uint16_t xv[MAX_WIDTH];
+	uint8_t fv[MAX_WIDTH];
+	unsigned x, y;
+
+	for (x=0; x<d->w; x++) {
+		unsigned pos, frac;
+
+		bilinear_pos(&pos, &frac, x, d->w, s->w);
+
+		xv[x] = (uint16_t)pos;
+		fv[x] = (uint8_t)frac;
+	}
+
+	for (y=0; y<d->h; y++) {
+		uint8_t *dst = d->p + y*d->stride;
+		const uint8_t *a, *b;
+		unsigned pos, frac;
+
+		bilinear_pos(&pos, &frac, y, d->h, s->h);
+
+		a = s->p + pos*s->stride;
+		b = frac ? a + s->stride : a;
+
+		row_blend(row, a, b, s->w, frac);
+
+		for (x=0; x<d->w; x++) {
+			const unsigned i = xv[x];
+			const unsigned f = fv[x];
+
+			dst[x] = f ? (row[i] * (FRAC_ONE - f) + row[i+1] * f
+				      + FRAC_ONE/2) >> FRAC_BITS : row[i];
+		}
+	}
+}
+
+
+static void plane_scale(const struct plane *d, const struct plane *s)
+{
+	if (d->w == s->w && d->h == s->h)
+		plane_copy(d, s);
+	else if (2 * d->w == s->w && 2 * d->h == s->h)
+		plane_box2(d, s);
+	else if (2 * d->w <= s->w && 2 * d->h <= s->h)
+		plane_area(d, s);
+	else
+		plane_bilinear(d, s);
+}
+
+
+static void i420_scale(struct vidframe *dst, const struct vidframe *src,
+		       const struct vidrect *r)
+{
+	unsigned i;
+
+	for (i=0; i<3; i++) {
+		const unsigned sh = i ? 1 : 0;
+		struct plane d, s;
+
+		d.stride = dst->linesize[i];
+		d.p = dst->data[i] + (r->y >> sh) * d.stride + (r->x >> sh);
+		d.w = r->w >> sh;
+		d.h = r->h >> sh;
+
+		s.stride = src->linesize[i];
+		s.p = src->data[i];
+		s.w = src->size.w >> sh;
+		s.h = src->size.h >> sh;
+
+		plane_scale(&d, &s);
+	}
+}
+
+
+static void nv12_to_i420(struct vidframe *dst, const struct vidframe *src,
+			 const struct vidrect *r)
+{
+	uint8_t *dy = dst->data[0] + r->y * dst->linesize[0] + r->x;
+	uint8_t *du = dst->data[1] + r->y/2 * dst->linesize[1] + r->x/2;
+	uint8_t *dv = dst->data[2] + r->y/2 * dst->linesize[2] + r->x/2;
+	unsigned y;
+
+	for (y=0; y<r->h; y++)
+		memcpy(dy + y*dst->linesize[0],
+		       src->data[0] + y*src->linesize[0], r->w);
+
+	for (y=0; y<r->h/2; y++)
+		row_uv_split(du + y*dst->linesize[1], dv + y*dst->linesize[2],
+			     src->data[1] + y*src->linesize[1], r->w/2);
+}
+
+
+static void yuyv_to_i420(struct vidframe *dst, const struct vidframe *src,
+			 const struct vidrect *r)
+{
+	uint8_t *dy = dst->data[0] + r->y * dst->linesize[0] + r->x;
+	uint8_t *du = dst->data[1] + r->y/2 * dst->linesize[1] + r->x/2;
+	uint8_t *dv = dst->data[2] + r->y/2 * dst->linesize[2] + r->x/2;
+	unsigned y;
+
+	for (y=0; y<r->h; y+=2) {
+		const uint8_t *a = src->data[0] + y*src->linesize[0];
+
+		row_yuyv(dy + y*dst->linesize[0], dy + (y+1)*dst->linesize[0],
+			 du + y/2*dst->linesize[1], dv + y/2*dst->linesize[2],
+			 a, a + src->linesize[0], r->w);
+	}
+}
+
+
+static void rgb32_to_i420(struct vidframe *dst, const struct vidframe *src,
+			  const struct vidrect *r)
+{
+	uint8_t *dy = dst->data[0] + r->y * dst->linesize[0] + r->x;
+	uint8_t *du = dst->data[1] + r->y/2 * dst->linesize[1] + r->x/2;
+	uint8_t *dv = dst->data[2] + r->y/2 * dst->linesize[2] + r->x/2;
+	unsigned x, y;
+
+	for (y=0; y<r->h; y+=2) {
+
+		const uint32_t *a = (const uint32_t *)
+			(void *)(src->data[0] + y*src->linesize[0]);
+		const uint32_t *b = (const uint32_t *)
+			(void *)(src->data[0] + (y+1)*src->linesize[0]);
+		uint8_t *y0 = dy + y*dst->linesize[0];
+		uint8_t *y1 = y0 + dst->linesize[0];
+
+		for (x=0; x<r->w; x+=2) {
+			const uint32_t px[4] = {a[x], a[x+1], b[x], b[x+1]};
+			unsigned k, rs = 0, gs = 0, bs = 0;
+
+			for (k=0; k<4; k++) {
+				rs += px[k] >> 16 & 0xff;
+				gs += px[k] >>  8 & 0xff;
+				bs += px[k]       & 0xff;
+			}
+
+			y0[x]   = rgb2y(a[x]   >> 16, a[x]   >> 8, a[x]);
+			y0[x+1] = rgb2y(a[x+1] >> 16, a[x+1] >> 8, a[x+1]);
+			y1[x]   = rgb2y(b[x]   >> 16, b[x]   >> 8, b[x]);
+			y1[x+1] = rgb2y(b[x+1] >> 16, b[x+1] >> 8, b[x+1]);
+
+			du[y/2*dst->linesize[1] + x/2] =
+				rgb2u(rs/4, gs/4, bs/4);
+			dv[y/2*dst->linesize[2] + x/2] =
+				rgb2v(rs/4, gs/4, bs/4);
+		}
+	}
+}
+
+
+static bool is_even(unsigned v)
+{
+	return (v & 1) == 0;
+}
+
+
+static bool fast_path(const struct vidframe *dst, const struct vidframe *src,
+		      const struct vidrect *r)
+{
+	if (dst->fmt != VID_FMT_YUV420P)
+		return false;
+
+	if (!is_even(r->x) || !is_even(r->y) ||
+	    !is_even(r->w) || !is_even(r->h) ||
+	    !is_even(src->size.w) || !is_even(src->size.h))
+		return false;
+
+	if (!r->w || !r->h || !src->size.w || !src->size.h)
+		return false;
+
+	if (r->x + r->w > dst->size.w || r->y + r->h > dst->size.h)
+		return false;
+
+	if (r->w > MAX_WIDTH || src->size.w > MAX_WIDTH)
+		return false;
+
+	switch (src->fmt) {
+
+	case VID_FMT_YUV420P:
+		return true;
+
+	case VID_FMT_NV12:
+	case VID_FMT_YUYV422:
+	case VID_FMT_RGB32:
+		return r->w == src->size.w && r->h == src->size.h;
+
+	default:
+		return false;
+	}
+}
+
+
+/**
+ * Convert and scale a video frame
+ *
+ * Same as vidconv(), but uses optimized kernels for the common pixel
+ * formats and bilinear or area scaling instead of nearest neighbour.
+ *
+ * @param dst Destination frame
+ * @param src Source frame
+ * @param r   Destination rectangle, NULL for the whole frame
+ */
+void vidscale(struct vidframe *dst, const struct vidframe *src,
+	      struct vidrect *r)
+{
+	struct vidrect rect;
+
+	if (!vidframe_isvalid(dst) || !vidframe_isvalid(src))
+		return;
+
+	if (r) {
+		rect = *r;
+	}
+	else {
+		rect.x = 0;
+		rect.y = 0;
+		rect.w = dst->size.w;
+		rect.h = dst->size.h;
+	}
+
+	if (!fast_path(dst, src, &rect)) {
+		vidconv(dst, src, r);
+		return;
+	}
+
+	switch (src->fmt) {
+
+	case VID_FMT_YUV420P:
+		i420_scale(dst, src, &rect);
+		break;
+
+	case VID_FMT_NV12:
+		nv12_to_i420(dst, src, &rect);
+		break;
+
+	case VID_FMT_YUYV422:
+		yuyv_to_i420(dst, src, &rect);
+		break;
+
+	case VID_FMT_RGB32:
+		rgb32_to_i420(dst, src, &rect);
+		break;
+
+	default:
+		break;
+	}
+}
@@ -4,6 +4,12 @@
  * Copyright (C) 2017 Alfred E. Heggestad
  */
 
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef WIN32
+#include <windows.h>
+#endif
 #include <re.h>
 #include <rem.h>
 #include <baresip.h>
@@ -69,3 +75,55 @@ uint64_t video_calc_timebase_timestamp(uint64_t rtp_ts)
 {
 	return rtp_ts * VIDEO_TIMEBASE / VIDEO_SRATE;
 }
+
+
+static unsigned cpu_count(void)
+{
+#if defined (WIN32)
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+
+	return si.dwNumberOfProcessors ? si.dwNumberOfProcessors : 1;
+#elif defined (HAVE_UNISTD_H) && defined (_SC_NPROCESSORS_ONLN)
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (unsigned)n : 1;
+#else
+	return 1;
+#endif
+}
+
+
+/**
+ * Get the default number of video encoder threads for a picture size
+ *
+ * Small pictures are encoded in one thread, since the slices would be
+ * too small to split. Larger pictures use more threads, but at most
+ * half of the CPU cores so that other calls are not starved.
+ *
+ * @param size Picture size
+ *
+ * @return Number of encoder threads
+ */
+unsigned video_enc_threads(const struct vidsz *size)
+{
+	unsigned ncpu = cpu_count();
+	unsigned pixels, n;
+
+	if (!size)
+		return 1;
+
+	pixels = size->w * size->h;
+
+	if (pixels >= 1920 * 1080)
+		n = 8;
+	else if (pixels >= 1280 * 720)
+		n = 4;
+	else if (pixels >= 640 * 360)
+		n = 2;
+	else
+		n = 1;
+
+	return max(min(n, ncpu / 2), 1u);
+}
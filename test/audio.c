@@ -0,0 +1,504 @@
+/**
+ * @file test/audio.c  Baresip selftest -- audio
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <re.h>
+#include <re_atomic.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+#include "../src/core.h"
+
+
+enum {
+	SRATE  = 8000,
+	SAMPC  = 160,         /* 20ms at 8000 Hz mono */
+	FRAMES = 1000,
+};
+
+
+struct producer {
+	struct auring *ring;
+	RE_ATOMIC bool done;
+	RE_ATOMIC bool stop;
+};
+
+
+static void frame_fill(int16_t *sampv, size_t sampc, unsigned n)
+{
+	size_t i;
+
+	for (i=0; i<sampc; i++)
+		sampv[i] = (int16_t)(n * sampc + i);
+}
+
+
+static int producer_thread(void *arg)
+{
+	struct producer *prod = arg;
+	int16_t sampv[SAMPC];
+	struct auframe af;
+	unsigned n = 0;
+
+	while (n < FRAMES && !re_atomic_acq(&prod->stop)) {
+
+		frame_fill(sampv, SAMPC, n);
+
+		auframe_init(&af, AUFMT_S16LE, sampv, SAMPC, SRATE, 1);
+		af.timestamp = (uint64_t)n * SAMPC * AUDIO_TIMEBASE / SRATE;
+
+		if (auring_write_auframe(prod->ring, &af) == ENOSPC) {
+			sys_usleep(100);
+			continue;
+		}
+
+		++n;
+	}
+
+	re_atomic_rls_set(&prod->done, true);
+
+	return 0;
+}
+
+
+static int test_auring_basic(void)
+{
+	struct auring *ring = NULL;
+	int16_t sampv[SAMPC], outv[SAMPC];
+	struct auframe af;
+	unsigned i;
+	int err;
+
+	err = auring_alloc(&ring, 3 * SAMPC * 2);
+	TEST_ERR(err);
+
+	/* rounded up to a power of 2 */
+	ASSERT_EQ(1024, auring_size(ring));
+	ASSERT_EQ(0, auring_cur_size(ring));
+
+	/* empty ring gives silence */
+	memset(outv, 0xff, sizeof(outv));
+	auframe_init(&af, AUFMT_S16LE, outv, SAMPC, SRATE, 1);
+	ASSERT_EQ(ENODATA, auring_read_auframe(ring, &af));
+	for (i=0; i<SAMPC; i++)
+		ASSERT_EQ(0, outv[i]);
+
+	/* write and read across the end of the buffer */
+	for (i=0; i<10; i++) {
+
+		frame_fill(sampv, SAMPC, i);
+
+		auframe_init(&af, AUFMT_S16LE, sampv, SAMPC, SRATE, 1);
+		af.timestamp = 1000000 + i * 20000;
+
+		err = auring_write_auframe(ring, &af);
+		TEST_ERR(err);
+		ASSERT_EQ(SAMPC * 2, auring_cur_size(ring));
+
+		/* read in two halves */
+		auframe_init(&af, AUFMT_S16LE, outv, SAMPC/2, SRATE, 1);
+		err = auring_read_auframe(ring, &af);
+		TEST_ERR(err);
+		ASSERT_TRUE(af.timestamp == 1000000 + i * 20000);
+
+		auframe_init(&af, AUFMT_S16LE, outv + SAMPC/2, SAMPC/2,
+			     SRATE, 1);
+		err = auring_read_auframe(ring, &af);
+		TEST_ERR(err);
+		ASSERT_TRUE(af.timestamp == 1000000 + i * 20000 + 10000);
+
+		TEST_MEMCMP(sampv, sizeof(sampv), outv, sizeof(outv));
+	}
+
+	/* a full ring drops the new frame */
+	auframe_init(&af, AUFMT_S16LE, sampv, SAMPC, SRATE, 1);
+	for (i=0; i<3; i++) {
+		err = auring_write_auframe(ring, &af);
+		TEST_ERR(err);
+	}
+	ASSERT_EQ(ENOSPC, auring_write_auframe(ring, &af));
+	ASSERT_EQ(3 * SAMPC * 2, auring_cur_size(ring));
+
+	/* flush is done on the next read */
+	auring_flush(ring);
+	auframe_init(&af, AUFMT_S16LE, outv, SAMPC, SRATE, 1);
+	ASSERT_EQ(ENODATA, auring_read_auframe(ring, &af));
+	ASSERT_EQ(0, auring_cur_size(ring));
+
+ out:
+	mem_deref(ring);
+
+	return err;
+}
+
+
+static int test_auring_threads(void)
+{
+	struct producer prod;
+	int16_t sampv[SAMPC], outv[SAMPC];
+	struct auframe af;
+	thrd_t thr;
+	uint64_t ts;
+	unsigned n = 0;
+	int err;
+
+	memset(&prod, 0, sizeof(prod));
+
+	err = auring_alloc(&prod.ring, 4 * SAMPC * 2);
+	TEST_ERR(err);
+
+	err = thread_create_name(&thr, "auring test", producer_thread, &prod);
+	TEST_ERR(err);
+
+	while (n < FRAMES) {
+
+		auframe_init(&af, AUFMT_S16LE, outv, SAMPC, SRATE, 1);
+
+		if (auring_read_auframe(prod.ring, &af) == ENODATA) {
+			sys_usleep(100);
+			continue;
+		}
+
+		frame_fill(sampv, SAMPC, n);
+		ts = (uint64_t)n * SAMPC * AUDIO_TIMEBASE / SRATE;
+
+		if (memcmp(sampv, outv, sizeof(sampv)) || af.timestamp != ts) {
+			warning("auring: frame %u is corrupt\n", n);
+			err = EBADMSG;
+			break;
+		}
+
+		++n;
+	}
+
+	re_atomic_rls_set(&prod.stop, true);
+	thrd_join(thr, NULL);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(re_atomic_acq(&prod.done));
+	ASSERT_EQ(0, auring_cur_size(prod.ring));
+
+ out:
+	mem_deref(prod.ring);
+
+	return err;
+}
+
+
+int test_auring(void)
+{
+	int err;
+
+	err = test_auring_basic();
+	TEST_ERR(err);
+
+	err = test_auring_threads();
+	TEST_ERR(err);
+
+ out:
+	return err;
+}
+
+
+int test_aulat(void)
+{
+	struct aulat lat;
+	struct aulat_rel rel;
+	uint32_t i;
+	int err = 0;
+
+	memset(&lat, 0, sizeof(lat));
+	memset(&rel, 0, sizeof(rel));
+
+	ASSERT_EQ(0, aulat_percentile(&lat, 50));
+
+	/* 1..1000 us, the percentile is rounded up to the bin limit */
+	for (i=1; i<=1000; i++)
+		aulat_add(&lat, i);
+
+	ASSERT_EQ(1000, re_atomic_rlx(&lat.n));
+	ASSERT_EQ(1000, re_atomic_rlx(&lat.max));
+	ASSERT_TRUE(aulat_percentile(&lat, 50) >= 500);
+	ASSERT_TRUE(aulat_percentile(&lat, 50) <  500 * 5 / 4);
+	ASSERT_TRUE(aulat_percentile(&lat, 99) >= 990);
+	ASSERT_EQ(1000, aulat_percentile(&lat, 100));
+
+	/* relative delay to the fastest frame */
+	ASSERT_EQ(0, aulat_rel_delay(&rel, 10000, 5000));
+	ASSERT_EQ(2999, aulat_rel_delay(&rel, 33000, 25000));
+	ASSERT_EQ(0, aulat_rel_delay(&rel, 44000, 40000));
+	ASSERT_EQ(0, aulat_rel_delay(&rel, 44000, 40000));
+
+ out:
+	return err;
+}
+
+
+static const double PI = 3.14159265358979323846;
+
+
+/*
+ * Resample one second of a 1 kHz sine in 10 ms blocks and check the
+ * number of output samples, the level and the channel conversion.
+ */
+static int test_aupoly_sine(uint32_t irate, uint8_t ich,
+			    uint32_t orate, uint8_t och)
+{
+	const size_t blk = irate / 100;
+	struct aupoly *rs = NULL;
+	int16_t *inv = NULL, *outv = NULL;
+	size_t total = 0, i;
+	int16_t peak = 0;
+	uint8_t c;
+	int err;
+
+	err = aupoly_alloc(&rs, irate, ich, orate, och, AUPOLY_MEDIUM);
+	TEST_ERR(err);
+
+	inv  = mem_alloc(blk * ich * sizeof(*inv), NULL);
+	outv = mem_zalloc((orate + 1) * och * sizeof(*outv), NULL);
+	if (!inv || !outv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for (i=0; i<irate; i+=blk) {
+
+		size_t j, outc = aupoly_maxout(rs, blk * ich);
+
+		for (j=0; j<blk; j++) {
+			double t = (double)(i + j) / irate;
+			int16_t v = (int16_t)(16000 * sin(2 * PI * 1000 * t));
+
+			for (c=0; c<ich; c++)
+				inv[j*ich + c] = v;
+		}
+
+		ASSERT_TRUE(total + outc <= (orate + 1) * och);
+
+		err = aupoly_process(rs, &outv[total], &outc, inv, blk * ich);
+		TEST_ERR(err);
+
+		total += outc;
+	}
+
+	ASSERT_EQ(orate * och, total);
+
+	/* skip the filter delay */
+	for (i=orate/10; i<orate; i++) {
+
+		for (c=1; c<och; c++)
+			ASSERT_EQ(outv[i*och], outv[i*och + c]);
+
+		peak = max(peak, outv[i*och]);
+	}
+
+	ASSERT_TRUE(peak > 15500 && peak < 16500);
+
+ out:
+	mem_deref(outv);
+	mem_deref(inv);
+	mem_deref(rs);
+
+	return err;
+}
+
+
+int test_aupoly(void)
+{
+	static const struct {
+		uint32_t irate;
+		uint8_t ich;
+		uint32_t orate;
+		uint8_t och;
+	} testv[] = {
+		{44100, 1, 48000, 1},
+		{48000, 1, 44100, 1},
+		{ 8000, 1, 48000, 2},
+		{48000, 2,  8000, 1},
+		{16000, 2, 32000, 2},
+	};
+	struct aupoly *rs = NULL;
+	size_t i;
+	int err;
+
+	err = aupoly_alloc(&rs, 44100, 2, 48000, 3, AUPOLY_LOW);
+	ASSERT_EQ(ENOTSUP, err);
+
+	for (i=0; i<ARRAY_SIZE(testv); i++) {
+
+		err = test_aupoly_sine(testv[i].irate, testv[i].ich,
+				       testv[i].orate, testv[i].och);
+		TEST_ERR(err);
+	}
+
+ out:
+	mem_deref(rs);
+
+	return err;
+}
+
+
+static int test_playout_stretch(uint32_t buffered, bool noise,
+				size_t *sampc)
+{
+	const struct range buffer = {20, 160};
+	struct playout *po = NULL;
+	int16_t sampv[160];
+	struct auframe af;
+	size_t i;
+	int err;
+
+	err = playout_alloc(&po, 8000, 1, &buffer);
+	TEST_ERR(err);
+
+	/* 200 Hz, a pitch period of 40 samples */
+	for (i=0; i<ARRAY_SIZE(sampv); i++) {
+		if (noise)
+			sampv[i] = (int16_t)(rand_u16() % 20000) - 10000;
+		else
+			sampv[i] = (int16_t)(10000 * sin(2 * PI * i / 40));
+	}
+
+	auframe_init(&af, AUFMT_S16LE, sampv, ARRAY_SIZE(sampv), 8000, 1);
+
+	err = playout_process(po, &af, buffered);
+	TEST_ERR(err);
+
+	*sampc = af.sampc;
+
+	/* the cross-fade keeps the waveform continuous */
+	for (i=1; i<af.sampc; i++) {
+		const int16_t *p = af.sampv;
+
+		ASSERT_TRUE(abs(p[i] - p[i-1]) < 1700 || noise);
+	}
+
+ out:
+	mem_deref(po);
+
+	return err;
+}
+
+
+int test_playout(void)
+{
+	const struct range buffer = {20, 160};
+	struct playout *po = NULL;
+	int16_t sampv[160] = {0};
+	struct auframe af;
+	size_t sampc, i;
+	int err;
+
+	/* too much buffered, one or two periods are removed */
+	err = test_playout_stretch(150000, false, &sampc);
+	TEST_ERR(err);
+	ASSERT_TRUE(sampc == 120 || sampc == 80);
+
+	/* buffer is empty, periods are repeated */
+	err = test_playout_stretch(0, false, &sampc);
+	TEST_ERR(err);
+	ASSERT_TRUE(sampc == 200 || sampc == 240);
+
+	/* noise is not periodic and not stretched */
+	err = test_playout_stretch(150000, true, &sampc);
+	TEST_ERR(err);
+	ASSERT_EQ(160, sampc);
+
+	/* the target follows the jitter */
+	err = playout_alloc(&po, 8000, 1, &buffer);
+	TEST_ERR(err);
+
+	playout_arrival(po, 0);
+	auframe_init(&af, AUFMT_S16LE, sampv, ARRAY_SIZE(sampv), 8000, 1);
+	err = playout_process(po, &af, 20000);
+	TEST_ERR(err);
+	ASSERT_EQ(20000, playout_target(po));
+
+	playout_arrival(po, 80000);
+	auframe_init(&af, AUFMT_S16LE, sampv, ARRAY_SIZE(sampv), 8000, 1);
+	err = playout_process(po, &af, 20000);
+	TEST_ERR(err);
+	ASSERT_EQ(100000, playout_target(po));
+
+	/* and decays slowly when the network calms down */
+	for (i=0; i<1000; i++)
+		playout_arrival(po, 0);
+
+	auframe_init(&af, AUFMT_S16LE, sampv, ARRAY_SIZE(sampv), 8000, 1);
+	err = playout_process(po, &af, 20000);
+	TEST_ERR(err);
+	ASSERT_TRUE(playout_target(po) < 40000);
+
+ out:
+	mem_deref(po);
+
+	return err;
+}
+
+
+int test_dtx(void)
+{
+	struct dtx_vad vad = {0};
+	struct mbuf *mb = NULL;
+	int16_t sampv[8000];
+	uint32_t seed = 0;
+	double level;
+	unsigned i;
+	int err = 0;
+
+	/* background noise is silence */
+	for (i=0; i<50; i++)
+		ASSERT_TRUE(!dtx_vad(&vad, -50.0, 20));
+
+	/* speech, and a hangover of 200 ms after it */
+	ASSERT_TRUE(dtx_vad(&vad, -20.0, 20));
+
+	for (i=0; i<10; i++)
+		ASSERT_TRUE(dtx_vad(&vad, -50.0, 20));
+
+	ASSERT_TRUE(!dtx_vad(&vad, -50.0, 20));
+
+	/* quiet speech above the noise floor */
+	ASSERT_TRUE(dtx_vad(&vad, -40.0, 20));
+
+	/* comfort noise payload */
+	mb = mbuf_alloc(8);
+	if (!mb) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err  = dtx_cn_encode(mb, -45.3);
+	err |= dtx_cn_encode(mb, -200.0);
+	err |= dtx_cn_encode(mb, 3.0);
+	TEST_ERR(err);
+
+	ASSERT_EQ(3, mb->end);
+	ASSERT_EQ(45, mb->buf[0]);
+	ASSERT_EQ(127, mb->buf[1]);
+	ASSERT_EQ(0, mb->buf[2]);
+
+	mb->pos = 0;
+	err = dtx_cn_decode(&level, mb);
+	TEST_ERR(err);
+	ASSERT_TRUE(level == -45.0);
+
+	mb->pos = mb->end;
+	ASSERT_EQ(EBADMSG, dtx_cn_decode(&level, mb));
+
+	/* generated noise has the requested level */
+	dtx_cn_generate(&seed, sampv, ARRAY_SIZE(sampv), -30.0);
+
+	level = aulevel_calc_dbov(AUFMT_S16LE, sampv, ARRAY_SIZE(sampv));
+	ASSERT_TRUE(fabs(level + 30.0) < 1.0);
+
+ out:
+	mem_deref(mb);
+
+	return err;
+}
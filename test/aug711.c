@@ -0,0 +1,79 @@
+/**
+ * @file test/aug711.c  Baresip selftest -- G.711 batch encode and decode
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+
+
+/* All sample values and codes must match the scalar functions */
+int test_aug711(void)
+{
+	int16_t *pcm = NULL, *out = NULL;
+	uint8_t *law = NULL;
+	uint8_t codes[256];
+	int16_t dec[256];
+	size_t i, n;
+	int err = 0;
+
+	pcm = mem_alloc(65536 * sizeof(*pcm), NULL);
+	out = mem_alloc(65536 * sizeof(*out), NULL);
+	law = mem_alloc(65536, NULL);
+	if (!pcm || !out || !law) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	for (i=0; i<65536; i++)
+		pcm[i] = (int16_t)i;
+
+	aug711_pcm2ulaw(law, pcm, 65536);
+	for (i=0; i<65536; i++)
+		ASSERT_EQ(g711_pcm2ulaw(pcm[i]), law[i]);
+
+	aug711_pcm2alaw(law, pcm, 65536);
+	for (i=0; i<65536; i++)
+		ASSERT_EQ(g711_pcm2alaw(pcm[i]), law[i]);
+
+	for (i=0; i<256; i++)
+		codes[i] = (uint8_t)i;
+
+	/* every length, to cover the vector loop and the tail */
+	for (n=0; n<=ARRAY_SIZE(codes); n++) {
+
+		aug711_ulaw2pcm(dec, codes, n);
+		for (i=0; i<n; i++)
+			ASSERT_EQ(g711_ulaw2pcm(codes[i]), dec[i]);
+
+		aug711_alaw2pcm(dec, codes, n);
+		for (i=0; i<n; i++)
+			ASSERT_EQ(g711_alaw2pcm(codes[i]), dec[i]);
+	}
+
+	/* unaligned buffers */
+	aug711_ulaw2pcm(&out[1], &codes[3], 200);
+	for (i=0; i<200; i++)
+		ASSERT_EQ(g711_ulaw2pcm(codes[i + 3]), out[i + 1]);
+
+	aug711_alaw2pcm(&out[1], &codes[3], 200);
+	for (i=0; i<200; i++)
+		ASSERT_EQ(g711_alaw2pcm(codes[i + 3]), out[i + 1]);
+
+	aug711_pcm2ulaw(&law[1], &pcm[3], 200);
+	for (i=0; i<200; i++)
+		ASSERT_EQ(g711_pcm2ulaw(pcm[i + 3]), law[i + 1]);
+
+	aug711_pcm2alaw(&law[1], &pcm[3], 200);
+	for (i=0; i<200; i++)
+		ASSERT_EQ(g711_pcm2alaw(pcm[i + 3]), law[i + 1]);
+
+ out:
+	mem_deref(law);
+	mem_deref(out);
+	mem_deref(pcm);
+
+	return err;
+}
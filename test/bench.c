@@ -0,0 +1,986 @@
+/**
+ * @file bench.c  Call-capacity benchmark for Baresip core
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#ifdef HAVE_GETOPT
+#include <getopt.h>
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+#include "sip/sipsrv.h"
+
+
+/*
+ * The benchmark registers the called UA at the mock SIP server, then
+ * sets up N concurrent loopback calls from UA "A" to UA "B" with the
+ * given setup rate. Audio is sent in both directions with a real codec,
+ * using the timer based mock audio source and player. After the media
+ * phase all calls are hung up and one JSON object is written with the
+ * results.
+ *
+ * Note that both call legs run in this process, the CPU and RSS numbers
+ * per call include both the caller and the callee side.
+ *
+ * With -t the User-Agents run in sharded mode. One caller/callee pair is
+ * allocated per shard and the calls are spread over the pairs. The UAs
+ * are only used in the thread of their shard, via shard_exec().
+ *
+ * With -p the media streams are taken from a pool of pre-bound streams,
+ * compare the setup times with and without it.
+ *
+ * With -m one of the micro benchmarks below is run instead of the calls,
+ * they also write JSON objects.
+ */
+
+
+enum {
+	PROBE_INTERVAL = 10,       /* Event-loop probe interval [ms]  */
+	LAT_BUCKET     = 100,      /* Latency histogram bucket [us]    */
+	LAT_BUCKETS    = 1000,     /* Histogram covers 0 .. 100 ms     */
+	SETUP_TIMEOUT  = 30000,    /* Timeout after the last INVITE    */
+	MAX_THREADS    = 64,       /* Maximum number of shards         */
+};
+
+
+struct bpair {
+	unsigned idx;
+	struct ua *ua_a;
+	struct ua *ua_b;
+	char buri[256];
+	bool registered;
+};
+
+
+struct bcall {
+	struct le le;
+	struct bpair *pair;
+	struct call *call;
+	uint64_t t0;
+	uint32_t setup_usec;
+	bool estab;
+};
+
+
+struct bench {
+	struct bpair pairv[MAX_THREADS];
+	unsigned npair;
+	unsigned n_registered;
+	unsigned threads;
+	uint32_t pool;
+	struct mqueue *mq;
+	struct list calll;
+	struct tmr tmr_conn;
+	struct tmr tmr_probe;
+	unsigned n;
+	unsigned rate;
+	unsigned n_started;
+	unsigned n_estab;
+	unsigned n_failed;
+	unsigned n_closed;
+	bool closing;
+	uint64_t t_first;
+	uint64_t t_last;
+	uint64_t rx_frames;
+
+	struct {
+		uint64_t expected;
+		uint64_t n;
+		uint64_t sum;
+		uint32_t max;
+		uint32_t hist[LAT_BUCKETS + 1];
+	} lat;
+
+	int err;
+};
+
+
+static void bcall_destructor(void *arg)
+{
+	struct bcall *bc = arg;
+
+	list_unlink(&bc->le);
+}
+
+
+static struct bcall *bcall_find(const struct bench *b,
+				const struct call *call)
+{
+	struct le *le;
+
+	for (le = b->calll.head; le; le = le->next) {
+		struct bcall *bc = le->data;
+
+		if (bc->call == call)
+			return bc;
+	}
+
+	return NULL;
+}
+
+
+static struct bpair *pair_find(struct bench *b, const struct ua *ua,
+			       bool *callee)
+{
+	unsigned i;
+
+	for (i=0; i<b->npair; i++) {
+		struct bpair *pair = &b->pairv[i];
+
+		if (ua == pair->ua_a || ua == pair->ua_b) {
+			*callee = ua == pair->ua_b;
+			return pair;
+		}
+	}
+
+	return NULL;
+}
+
+
+static void mqueue_handler(int id, void *data, void *arg)
+{
+	(void)id;
+	(void)data;
+	(void)arg;
+
+	re_cancel();
+}
+
+
+/*
+ * Stop the main loop of the benchmark. The event handlers of sharded UAs
+ * are called with the re context of the shard entered, so the main loop
+ * is woken up via the message queue.
+ */
+static void bench_cancel(struct bench *b)
+{
+	if (shard_current())
+		(void)mqueue_push(b->mq, 0, NULL);
+	else
+		re_cancel();
+}
+
+
+static void bench_abort(struct bench *b, int err)
+{
+	b->err = err;
+	bench_cancel(b);
+}
+
+
+static void check_setup_done(struct bench *b)
+{
+	if (b->closing)
+		return;
+
+	if (b->n_estab + b->n_failed >= b->n)
+		bench_cancel(b);
+}
+
+
+static void event_handler(struct ua *ua, enum ua_event ev,
+			  struct call *call, const char *prm, void *arg)
+{
+	struct bench *b = arg;
+	struct bpair *pair;
+	struct bcall *bc;
+	bool callee = false;
+	int err;
+	(void)prm;
+
+	pair = pair_find(b, ua, &callee);
+	if (!pair)
+		return;
+
+	switch (ev) {
+
+	case UA_EVENT_REGISTER_OK:
+		if (callee && !pair->registered) {
+			pair->registered = true;
+			if (++b->n_registered >= b->npair)
+				bench_cancel(b);
+		}
+		break;
+
+	case UA_EVENT_REGISTER_FAIL:
+		if (callee)
+			bench_abort(b, EPROTO);
+		break;
+
+	case UA_EVENT_CALL_INCOMING:
+		if (!callee)
+			break;
+
+		err = ua_answer(ua, call, VIDMODE_OFF);
+		if (err) {
+			warning("bench: ua_answer failed (%m)\n", err);
+			bench_abort(b, err);
+		}
+		break;
+
+	case UA_EVENT_CALL_ESTABLISHED:
+		if (callee)
+			break;
+
+		bc = bcall_find(b, call);
+		if (!bc || bc->estab)
+			break;
+
+		bc->estab = true;
+		bc->setup_usec = (uint32_t)(tmr_jiffies_usec() - bc->t0);
+		b->t_last = tmr_jiffies_usec();
+		++b->n_estab;
+
+		check_setup_done(b);
+		break;
+
+	case UA_EVENT_CALL_CLOSED:
+		if (callee && b->closing) {
+			if (++b->n_closed >= b->n_estab)
+				bench_cancel(b);
+			break;
+		}
+		else if (callee) {
+			break;
+		}
+
+		bc = bcall_find(b, call);
+		if (!bc)
+			break;
+
+		if (!bc->estab && !b->closing) {
+			warning("bench: call failed (%s)\n", prm);
+			++b->n_failed;
+		}
+
+		mem_deref(bc);
+		check_setup_done(b);
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+static void sample_handler(const void *sampv, size_t sampc, void *arg)
+{
+	struct bench *b = arg;
+	(void)sampv;
+
+	if (sampc)
+		++b->rx_frames;
+}
+
+
+struct connect_ctx {
+	struct bcall *bc;
+	int err;
+};
+
+
+static void connect_handler(void *arg)
+{
+	struct connect_ctx *ctx = arg;
+	struct bcall *bc = ctx->bc;
+
+	ctx->err = ua_connect(bc->pair->ua_a, &bc->call, NULL,
+			      bc->pair->buri, VIDMODE_OFF);
+}
+
+
+static void conn_handler(void *arg)
+{
+	struct bench *b = arg;
+	struct connect_ctx ctx;
+	struct bcall *bc;
+	int err;
+
+	if (b->n_started >= b->n)
+		return;
+
+	tmr_start(&b->tmr_conn, 1000 / b->rate, conn_handler, b);
+
+	bc = mem_zalloc(sizeof(*bc), bcall_destructor);
+	if (!bc) {
+		bench_abort(b, ENOMEM);
+		return;
+	}
+
+	bc->pair = &b->pairv[b->n_started % b->npair];
+	bc->t0 = tmr_jiffies_usec();
+	if (!b->t_first)
+		b->t_first = bc->t0;
+
+	ctx.bc  = bc;
+	ctx.err = 0;
+
+	err = shard_exec(ua_shard(bc->pair->ua_a), connect_handler, &ctx,
+			 true);
+	if (!err)
+		err = ctx.err;
+	if (err) {
+		warning("bench: ua_connect failed (%m)\n", err);
+		mem_deref(bc);
+		++b->n_failed;
+	}
+	else {
+		list_append(&b->calll, &bc->le, bc);
+	}
+
+	++b->n_started;
+
+	check_setup_done(b);
+}
+
+
+static void probe_handler(void *arg)
+{
+	struct bench *b = arg;
+	uint64_t now = tmr_jiffies_usec();
+	uint32_t late;
+
+	if (b->lat.expected) {
+		late = now > b->lat.expected ?
+			(uint32_t)(now - b->lat.expected) : 0;
+
+		++b->lat.n;
+		b->lat.sum += late;
+		b->lat.max = max(b->lat.max, late);
+		++b->lat.hist[min(late / LAT_BUCKET, (uint32_t)LAT_BUCKETS)];
+	}
+
+	b->lat.expected = now + PROBE_INTERVAL * 1000;
+	tmr_start(&b->tmr_probe, PROBE_INTERVAL, probe_handler, b);
+}
+
+
+static uint32_t lat_percentile(const struct bench *b, unsigned pct)
+{
+	uint64_t cnt = 0, lim = b->lat.n * pct / 100;
+	unsigned i;
+
+	for (i=0; i<=LAT_BUCKETS; i++) {
+
+		cnt += b->lat.hist[i];
+		if (cnt > lim)
+			return (i + 1) * LAT_BUCKET;
+	}
+
+	return b->lat.max;
+}
+
+
+static int u32_cmp(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t *)a;
+	const uint32_t y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+
+static uint64_t cpu_usec(void)
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		return 0;
+
+	return (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000
+		+ ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+
+/* current resident set size in [kB], falls back to the peak RSS */
+static uint64_t rss_kb(void)
+{
+	struct rusage ru;
+	unsigned long size, resident;
+	uint64_t pgsz = sysconf(_SC_PAGESIZE);
+	FILE *f;
+
+	f = fopen("/proc/self/statm", "r");
+	if (f) {
+		int n = fscanf(f, "%lu %lu", &size, &resident);
+		fclose(f);
+
+		if (n == 2)
+			return resident * pgsz / 1024;
+	}
+
+	if (getrusage(RUSAGE_SELF, &ru))
+		return 0;
+
+#ifdef DARWIN
+	return ru.ru_maxrss / 1024;
+#else
+	return ru.ru_maxrss;
+#endif
+}
+
+
+static void raise_fd_limit(void)
+{
+	struct rlimit rl;
+
+	if (getrlimit(RLIMIT_NOFILE, &rl))
+		return;
+
+	rl.rlim_cur = rl.rlim_max;
+	(void)setrlimit(RLIMIT_NOFILE, &rl);
+	(void)fd_setsize(-1);
+}
+
+
+struct jitter {
+	uint64_t rx_sum;
+	uint64_t tx_sum;
+	uint32_t rx_max;
+	uint32_t tx_max;
+	uint64_t rx_packets;
+	unsigned n;
+};
+
+
+struct jitter_ctx {
+	const struct bcall *bc;
+	struct jitter *jit;
+};
+
+
+static void jitter_handler(void *arg)
+{
+	struct jitter_ctx *ctx = arg;
+	struct jitter *jit = ctx->jit;
+	const struct stream *strm;
+	const struct rtcp_stats *rtcp;
+
+	strm = audio_strm(call_audio(ctx->bc->call));
+	rtcp = stream_rtcp_stats(strm);
+
+	jit->rx_packets += stream_metric_get_rx_n_packets(strm);
+
+	if (!rtcp)
+		return;
+
+	jit->rx_sum += rtcp->rx.jit;
+	jit->tx_sum += rtcp->tx.jit;
+	jit->rx_max  = max(jit->rx_max, rtcp->rx.jit);
+	jit->tx_max  = max(jit->tx_max, rtcp->tx.jit);
+	++jit->n;
+}
+
+
+static void jitter_collect(const struct bench *b, struct jitter *jit)
+{
+	struct le *le;
+
+	memset(jit, 0, sizeof(*jit));
+
+	for (le = b->calll.head; le; le = le->next) {
+		const struct bcall *bc = le->data;
+		struct jitter_ctx ctx = {bc, jit};
+
+		if (!bc->estab)
+			continue;
+
+		(void)shard_exec(ua_shard(bc->pair->ua_a), jitter_handler,
+				 &ctx, true);
+	}
+}
+
+
+static int print_results(FILE *f, const struct bench *b, const char *codec,
+			 uint32_t duration, uint64_t cpu, uint64_t media_usec,
+			 uint64_t rss0, uint64_t rss1,
+			 const struct jitter *jit)
+{
+	uint32_t *setupv;
+	uint64_t setup_sum = 0;
+	uint32_t p50 = 0, p95 = 0, pmax = 0;
+	double cps = 0.0, cpu_pct = 0.0;
+	struct le *le;
+	unsigned n = 0;
+	int err = 0;
+
+	setupv = mem_zalloc(max(b->n_estab, 1u) * sizeof(*setupv), NULL);
+	if (!setupv)
+		return ENOMEM;
+
+	for (le = b->calll.head; le && n < b->n_estab; le = le->next) {
+		const struct bcall *bc = le->data;
+
+		if (!bc->estab)
+			continue;
+
+		setupv[n++] = bc->setup_usec;
+		setup_sum  += bc->setup_usec;
+	}
+
+	if (n) {
+		qsort(setupv, n, sizeof(*setupv), u32_cmp);
+		p50  = setupv[n * 50 / 100];
+		p95  = setupv[n * 95 / 100];
+		pmax = setupv[n - 1];
+	}
+
+	if (b->t_last > b->t_first)
+		cps = b->n_estab * 1e6 / (double)(b->t_last - b->t_first);
+
+	if (n && media_usec)
+		cpu_pct = 100.0 * cpu / (double)media_usec / n;
+
+	err = re_fprintf(f,
+		 "{\"version\":\"%s\",\"codec\":\"%s\",\"threads\":%u,"
+		 "\"stream_pool\":%u,"
+		 "\"calls\":%u,\"established\":%u,\"failed\":%u,"
+		 "\"rate\":%u,\"duration\":%u,"
+		 "\"setup\":{\"cps\":%.1f,\"avg_us\":%llu,"
+		 "\"p50_us\":%u,\"p95_us\":%u,\"max_us\":%u},"
+		 "\"cpu_per_call_pct\":%.3f,"
+		 "\"rss_kb\":%llu,\"rss_per_call_kb\":%llu,"
+		 "\"loop_latency\":{\"samples\":%llu,\"avg_us\":%llu,"
+		 "\"p99_us\":%u,\"max_us\":%u},"
+		 "\"jitter\":{\"calls\":%u,\"rx_avg_us\":%llu,"
+		 "\"rx_max_us\":%u,\"tx_avg_us\":%llu,\"tx_max_us\":%u},"
+		 "\"rx_packets\":%llu,\"rx_frames\":%llu}\n",
+		 BARESIP_VERSION, codec, b->threads, b->pool,
+		 b->n, b->n_estab, b->n_failed,
+		 b->rate, duration,
+		 cps, n ? setup_sum / n : 0,
+		 p50, p95, pmax,
+		 cpu_pct,
+		 rss1, n && rss1 > rss0 ? (rss1 - rss0) / n : 0,
+		 b->lat.n, b->lat.n ? b->lat.sum / b->lat.n : 0,
+		 lat_percentile(b, 99), b->lat.max,
+		 jit->n, jit->n ? jit->rx_sum / jit->n : 0,
+		 jit->rx_max, jit->n ? jit->tx_sum / jit->n : 0, jit->tx_max,
+		 jit->rx_packets, b->rx_frames);
+
+	mem_deref(setupv);
+
+	return err < 0 ? EIO : 0;
+}
+
+
+static const struct micro {
+	const char *name;
+	int (*benchh)(FILE *f);
+} microv[] = {
+	{"aug711",   bench_aug711},
+	{"vidscale", bench_vidscale},
+};
+
+
+static const struct micro *micro_find(const char *name)
+{
+	size_t i;
+
+	for (i=0; i<ARRAY_SIZE(microv); i++) {
+
+		if (0 == str_casecmp(name, microv[i].name))
+			return &microv[i];
+	}
+
+	return NULL;
+}
+
+
+static void usage(void)
+{
+	(void)re_fprintf(stderr,
+			 "Usage: benchmark [options]\n"
+			 "options:\n"
+			 "\t-n <calls>       Number of concurrent calls"
+			 " (default 100)\n"
+			 "\t-r <rate>        Call setup rate per second"
+			 " (default 50)\n"
+			 "\t-d <seconds>     Duration of the media phase"
+			 " (default 10)\n"
+			 "\t-c <module>      Audio codec module"
+			 " (default g711)\n"
+			 "\t-o <file>        Write the JSON result to file\n"
+			 "\t-t <threads>     Number of UA shards"
+			 " (default 0, off)\n"
+			 "\t-p <streams>     Pre-bound streams per address"
+			 " family (default 0, off)\n"
+			 "\t-m <name>        Run a micro benchmark"
+			 " (aug711, vidscale)\n"
+			 "\t-v               Verbose output (INFO level)\n"
+			 );
+}
+
+
+static const char *modconfig =
+	"ausrc_format    s16\n"
+	"auplay_format   s16\n";
+
+
+struct pair_ctx {
+	struct bpair *pair;
+	int err;
+};
+
+
+static void register_handler(void *arg)
+{
+	struct pair_ctx *ctx = arg;
+
+	ctx->err = ua_register(ctx->pair->ua_b);
+}
+
+
+/* the mock SIP server does not proxy, call the contact directly */
+static void buri_handler(void *arg)
+{
+	struct pair_ctx *ctx = arg;
+	struct sa laddr, dst;
+
+	ctx->err  = sa_set_str(&dst, "127.0.0.1", 5060);
+	ctx->err |= sip_transp_laddr(uag_sip(), &laddr, SIP_TRANSP_UDP, &dst);
+	if (ctx->err)
+		return;
+
+	re_snprintf(ctx->pair->buri, sizeof(ctx->pair->buri), "sip:b%u@%J",
+		    ctx->pair->idx, &laddr);
+}
+
+
+static void hangup_handler(void *arg)
+{
+	struct ua *ua = arg;
+
+	while (ua_call(ua))
+		ua_hangup(ua, NULL, 0, NULL);
+}
+
+
+static void deref_handler(void *arg)
+{
+	mem_deref(arg);
+}
+
+
+static int pair_exec(struct bench *b, shard_h *h)
+{
+	unsigned i;
+	int err = 0;
+
+	for (i=0; i<b->npair && !err; i++) {
+		struct pair_ctx ctx = {&b->pairv[i], 0};
+
+		err = shard_exec(ua_shard(b->pairv[i].ua_b), h, &ctx, true);
+		if (!err)
+			err = ctx.err;
+	}
+
+	return err;
+}
+
+
+static int run_bench(struct bench *b, const char *codec, uint32_t duration,
+		     FILE *f)
+{
+	struct sip_server *srv = NULL;
+	struct ausrc *ausrc = NULL;
+	struct auplay *auplay = NULL;
+	struct jitter jit;
+	struct sa laddr;
+	char aor[256];
+	uint64_t rss0, rss1, cpu0, cpu1, t0, t1;
+	unsigned i;
+	int err;
+
+	err = mqueue_alloc(&b->mq, mqueue_handler, b);
+	TEST_ERR(err);
+
+	err = ua_init("benchmark", true, true, false);
+	TEST_ERR(err);
+
+	err = module_load(".", codec);
+	TEST_ERR_TXT(err, codec);
+
+	err  = mock_ausrc_register(&ausrc, baresip_ausrcl());
+	err |= mock_auplay_register(&auplay, baresip_auplayl(),
+				    sample_handler, b);
+	TEST_ERR(err);
+
+	err = uag_event_register(event_handler, b);
+	TEST_ERR(err);
+
+	err = sip_server_alloc(&srv, NULL, NULL);
+	TEST_ERR(err);
+
+	err = sip_transp_laddr(srv->sip, &laddr, SIP_TRANSP_UDP, NULL);
+	TEST_ERR(err);
+
+	/* the callees are registered at the mock SIP server */
+	for (i=0; i<b->npair; i++) {
+		struct bpair *pair = &b->pairv[i];
+
+		pair->idx = i;
+
+		re_snprintf(aor, sizeof(aor), "B <sip:b%u@%J>;regint=600",
+			    i, &laddr);
+		err = ua_alloc(&pair->ua_b, aor);
+		TEST_ERR(err);
+
+		re_snprintf(aor, sizeof(aor), "A <sip:a%u@127.0.0.1>;regint=0",
+			    i);
+		err = ua_alloc(&pair->ua_a, aor);
+		TEST_ERR(err);
+	}
+
+	err = pair_exec(b, register_handler);
+	TEST_ERR(err);
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	TEST_ERR(b->err);
+
+	err = pair_exec(b, buri_handler);
+	TEST_ERR(err);
+
+	rss0 = rss_kb();
+
+	/* setup phase */
+	tmr_start(&b->tmr_probe, PROBE_INTERVAL, probe_handler, b);
+	tmr_start(&b->tmr_conn, 0, conn_handler, b);
+
+	err = re_main_timeout(b->n * 1000 / b->rate + SETUP_TIMEOUT);
+	TEST_ERR(err);
+	TEST_ERR(b->err);
+
+	info("bench: %u calls established, %u failed\n",
+	     b->n_estab, b->n_failed);
+
+	/* media phase */
+	rss1 = rss_kb();
+	memset(&b->lat, 0, sizeof(b->lat));
+	b->rx_frames = 0;
+
+	cpu0 = cpu_usec();
+	t0   = tmr_jiffies_usec();
+
+	(void)re_main_timeout(duration * 1000);
+
+	cpu1 = cpu_usec();
+	t1   = tmr_jiffies_usec();
+
+	tmr_cancel(&b->tmr_probe);
+
+	jitter_collect(b, &jit);
+
+	err = print_results(f, b, codec, duration, cpu1 - cpu0, t1 - t0,
+			    rss0, rss1, &jit);
+	TEST_ERR(err);
+
+	/* teardown phase, wait for the BYE to reach the callee */
+	b->closing = true;
+
+	for (i=0; i<b->npair; i++)
+		(void)shard_exec(ua_shard(b->pairv[i].ua_a), hangup_handler,
+				 b->pairv[i].ua_a, true);
+
+	if (b->n_estab)
+		(void)re_main_timeout(5000);
+
+	if (b->n_failed)
+		err = EPROTO;
+
+ out:
+	tmr_cancel(&b->tmr_conn);
+	tmr_cancel(&b->tmr_probe);
+	list_flush(&b->calll);
+
+	uag_event_unregister(event_handler);
+
+	for (i=0; i<b->npair; i++) {
+		struct bpair *pair = &b->pairv[i];
+
+		(void)shard_exec(ua_shard(pair->ua_a), deref_handler,
+				 pair->ua_a, true);
+		(void)shard_exec(ua_shard(pair->ua_b), deref_handler,
+				 pair->ua_b, true);
+		pair->ua_a = NULL;
+		pair->ua_b = NULL;
+	}
+
+	ua_stop_all(true);
+	ua_close();
+
+	mem_deref(srv);
+	b->mq = mem_deref(b->mq);
+	mem_deref(auplay);
+	mem_deref(ausrc);
+	module_unload(codec);
+
+	return err;
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct bench bench;
+	struct config *config;
+	const struct micro *micro = NULL;
+	const char *codec = "g711";
+	const char *outfile = NULL;
+	uint32_t duration = 10;
+	FILE *f = stdout;
+	struct sa sa;
+	int err;
+
+	memset(&bench, 0, sizeof(bench));
+	bench.n    = 100;
+	bench.rate = 50;
+
+	err = libre_init();
+	if (err)
+		return err;
+
+	log_enable_info(false);
+
+#ifdef HAVE_GETOPT
+	for (;;) {
+		const int c = getopt(argc, argv, "c:d:hm:n:o:p:r:t:v");
+		if (0 > c)
+			break;
+
+		switch (c) {
+
+		case 'c':
+			codec = optarg;
+			break;
+
+		case 'd':
+			duration = atoi(optarg);
+			break;
+
+		case 'm':
+			micro = micro_find(optarg);
+			if (!micro) {
+				usage();
+				return -2;
+			}
+			break;
+
+		case 'n':
+			bench.n = atoi(optarg);
+			break;
+
+		case 'o':
+			outfile = optarg;
+			break;
+
+		case 'p':
+			bench.pool = atoi(optarg);
+			break;
+
+		case 'r':
+			bench.rate = atoi(optarg);
+			break;
+
+		case 't':
+			bench.threads = atoi(optarg);
+			break;
+
+		case 'v':
+			log_enable_info(true);
+			break;
+
+		case '?':
+		case 'h':
+		default:
+			usage();
+			return -2;
+		}
+	}
+#else
+	(void)argc;
+	(void)argv;
+#endif
+
+	if (!bench.n || !bench.rate || bench.rate > 1000 ||
+	    bench.threads > MAX_THREADS) {
+		usage();
+		return -2;
+	}
+
+	raise_fd_limit();
+
+	err = conf_configure_buf((uint8_t *)modconfig, str_len(modconfig));
+	if (err) {
+		warning("bench: configure failed: %m\n", err);
+		goto out;
+	}
+
+	config = conf_config();
+	if (!config) {
+		err = ENOENT;
+		goto out;
+	}
+
+	/* the stream pool is filled by baresip_init() */
+	config->avt.stream_pool = bench.pool;
+
+	err = baresip_init(config);
+	if (err)
+		goto out;
+
+	/* note: run SIP-traffic on localhost */
+	err  = sa_set_str(&sa, "127.0.0.1", 0);
+	err |= net_add_address(baresip_network(), &sa);
+	if (err)
+		goto out;
+
+	str_ncpy(config->sip.local, "0.0.0.0:0", sizeof(config->sip.local));
+	str_ncpy(config->audio.src_mod, "mock-ausrc",
+		 sizeof(config->audio.src_mod));
+	str_ncpy(config->audio.play_mod, "mock-auplay",
+		 sizeof(config->audio.play_mod));
+	config->sip.verify_server = false;
+	config->call.max_calls = 0;
+	config->sip.shards = bench.threads;
+	bench.npair = max(bench.threads, 1u);
+
+	if (outfile) {
+		f = fopen(outfile, "w");
+		if (!f) {
+			err = errno;
+			warning("bench: could not open %s (%m)\n",
+				outfile, err);
+			goto out;
+		}
+	}
+
+	if (micro)
+		err = micro->benchh(f);
+	else
+		err = run_bench(&bench, codec, duration, f);
+
+	if (f != stdout)
+		fclose(f);
+
+ out:
+	if (err)
+		warning("bench: failed (%m)\n", err);
+
+	conf_close();
+
+	baresip_close();
+
+	re_thread_async_close();
+
+	libre_close();
+
+	return err;
+}
@@ -0,0 +1,111 @@
+/**
+ * @file bench_aug711.c  Benchmark of the G.711 batch encode and decode
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <stdio.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+
+
+enum {
+	FRAMES = 20000,  /* Number of frames      */
+	SAMPC  = 160,    /* 20 ms at 8000 Hz      */
+};
+
+
+/*
+ * The scalar loops call the inline functions of librem directly, a
+ * function pointer would make the baseline slower than it is.
+ */
+static int bench_law(FILE *f, bool alaw, const int16_t *pcm)
+{
+	int16_t dec[SAMPC];
+	uint8_t enc[SAMPC];
+	uint64_t t0, t_enc, t_dec, t_benc, t_bdec;
+	unsigned i, j;
+	int err = 0;
+
+	t0 = tmr_jiffies_usec();
+	for (i=0; i<FRAMES; i++) {
+		if (alaw) {
+			for (j=0; j<SAMPC; j++)
+				enc[j] = g711_pcm2alaw(pcm[j]);
+		}
+		else {
+			for (j=0; j<SAMPC; j++)
+				enc[j] = g711_pcm2ulaw(pcm[j]);
+		}
+	}
+	t_enc = tmr_jiffies_usec() - t0;
+
+	t0 = tmr_jiffies_usec();
+	for (i=0; i<FRAMES; i++) {
+		if (alaw) {
+			for (j=0; j<SAMPC; j++)
+				dec[j] = g711_alaw2pcm(enc[j]);
+		}
+		else {
+			for (j=0; j<SAMPC; j++)
+				dec[j] = g711_ulaw2pcm(enc[j]);
+		}
+	}
+	t_dec = tmr_jiffies_usec() - t0;
+
+	t0 = tmr_jiffies_usec();
+	for (i=0; i<FRAMES; i++) {
+		if (alaw)
+			aug711_pcm2alaw(enc, pcm, SAMPC);
+		else
+			aug711_pcm2ulaw(enc, pcm, SAMPC);
+	}
+	t_benc = tmr_jiffies_usec() - t0;
+
+	t0 = tmr_jiffies_usec();
+	for (i=0; i<FRAMES; i++) {
+		if (alaw)
+			aug711_alaw2pcm(dec, enc, SAMPC);
+		else
+			aug711_ulaw2pcm(dec, enc, SAMPC);
+	}
+	t_bdec = tmr_jiffies_usec() - t0;
+
+	for (j=0; j<SAMPC; j++) {
+		ASSERT_EQ(alaw ? g711_alaw2pcm(enc[j]) : g711_ulaw2pcm(enc[j]),
+			  dec[j]);
+	}
+
+	if (re_fprintf(f, "{\"bench\":\"aug711\",\"law\":\"%s\","
+		       "\"frames\":%u,\"samples\":%u,"
+		       "\"encode\":{\"scalar_us\":%llu,\"batch_us\":%llu},"
+		       "\"decode\":{\"scalar_us\":%llu,\"batch_us\":%llu}}\n",
+		       alaw ? "alaw" : "ulaw", FRAMES, SAMPC,
+		       t_enc, t_benc, t_dec, t_bdec) < 0)
+		err = EIO;
+
+ out:
+	return err;
+}
+
+
+/*
+ * Compare the batch functions with the per-sample functions of librem,
+ * one JSON object is written per law.
+ */
+int bench_aug711(FILE *f)
+{
+	int16_t pcm[SAMPC];
+	unsigned i;
+	int err;
+
+	/* speech-like noise, the sign changes often */
+	for (i=0; i<SAMPC; i++)
+		pcm[i] = (int16_t)(rand_u16() & 0x3fff) - 0x2000;
+
+	err  = bench_law(f, false, pcm);
+	err |= bench_law(f, true, pcm);
+
+	return err;
+}
@@ -0,0 +1,94 @@
+/**
+ * @file bench_vidscale.c  Benchmark of the video scaling
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <stdio.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+
+
+enum { FRAMES = 20 };
+
+
+static void fill_random(struct vidframe *f)
+{
+	size_t n = vidframe_size(f->fmt, &f->size);
+	size_t i;
+
+	for (i=0; i<n; i++)
+		f->data[0][i] = rand_u32() & 0xff;
+}
+
+
+static uint64_t run(bool fast, struct vidframe *dst,
+		    const struct vidframe *src)
+{
+	uint64_t t0 = tmr_jiffies_usec();
+	unsigned i;
+
+	for (i=0; i<FRAMES; i++) {
+		if (fast)
+			vidscale(dst, src, NULL);
+		else
+			vidconv(dst, src, NULL);
+	}
+
+	return (tmr_jiffies_usec() - t0) / FRAMES;
+}
+
+
+/*
+ * Compare vidscale() with vidconv() at 720p, one JSON object is written
+ * per case with the time per frame.
+ */
+int bench_vidscale(FILE *f)
+{
+	static const struct {
+		enum vidfmt fmt;
+		struct vidsz src;
+		struct vidsz dst;
+	} casev[] = {
+		{VID_FMT_NV12,    {1280, 720}, {1280, 720}},
+		{VID_FMT_YUYV422, {1280, 720}, {1280, 720}},
+		{VID_FMT_RGB32,   {1280, 720}, {1280, 720}},
+		{VID_FMT_YUV420P, {1280, 720}, { 640, 360}},
+		{VID_FMT_YUV420P, {1280, 720}, { 320, 180}},
+		{VID_FMT_YUV420P, { 640, 360}, {1280, 720}},
+	};
+	unsigned i;
+	int err = 0;
+
+	for (i=0; i<ARRAY_SIZE(casev) && !err; i++) {
+		struct vidframe *src = NULL, *dst = NULL;
+		uint64_t t_conv, t_scale;
+
+		err  = vidframe_alloc(&src, casev[i].fmt, &casev[i].src);
+		err |= vidframe_alloc(&dst, VID_FMT_YUV420P, &casev[i].dst);
+		if (err)
+			goto next;
+
+		fill_random(src);
+
+		t_conv  = run(false, dst, src);
+		t_scale = run(true, dst, src);
+
+		if (re_fprintf(f, "{\"bench\":\"vidscale\",\"fmt\":\"%s\","
+			       "\"src\":\"%ux%u\",\"dst\":\"%ux%u\","
+			       "\"frames\":%u,\"vidconv_us\":%llu,"
+			       "\"vidscale_us\":%llu}\n",
+			       vidfmt_name(casev[i].fmt),
+			       casev[i].src.w, casev[i].src.h,
+			       casev[i].dst.w, casev[i].dst.h,
+			       FRAMES, t_conv, t_scale) < 0)
+			err = EIO;
+
+	next:
+		mem_deref(dst);
+		mem_deref(src);
+	}
+
+	return err;
+}
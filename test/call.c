@@ -463,6 +463,8 @@ static void event_handler(struct ua *ua, enum ua_event ev,
 int test_call_answer(void)
 {
 	struct fixture fix, *f = &fix;
+	struct odict *od = NULL;
+	const struct odict *o;
 	int err = 0;
 
 	fixture_init(f);
@@ -487,7 +489,22 @@ int test_call_answer(void)
 	ASSERT_EQ(1, fix.b.n_established);
 	ASSERT_EQ(0, fix.b.n_closed);
 
+	/* the JSON state has the audio latency of each call */
+	err = odict_alloc(&od, 8);
+	TEST_ERR(err);
+
+	err = ua_state_json_api(od, f->a.ua);
+	TEST_ERR(err);
+
+	o = odict_get_object(od, "calls");
+	o = o ? odict_get_object(o, call_id(ua_call(f->a.ua))) : NULL;
+	o = o ? odict_get_object(o, "audio_latency") : NULL;
+	ASSERT_TRUE(o != NULL);
+	ASSERT_TRUE(NULL != odict_get_object(o, "tx"));
+	ASSERT_TRUE(NULL != odict_get_object(o, "rx"));
+
  out:
+	mem_deref(od);
 	fixture_close(f);
 
 	return err;
@@ -748,6 +765,77 @@ int test_call_multiple(void)
 }
 
 
+static void wait_handler(void *arg)
+{
+	(void)arg;
+	re_cancel();
+}
+
+
+/* run the main loop until the stream pool has n idle IPv4 entries */
+static int pool_wait(struct tmr *tmr, uint32_t n)
+{
+	unsigned i;
+
+	for (i=0; i<100; i++) {
+
+		if (strmpool_idle(baresip_strmpool(), AF_INET) == n)
+			return 0;
+
+		tmr_start(tmr, 10, wait_handler, NULL);
+		re_main(NULL);
+	}
+
+	return ETIMEDOUT;
+}
+
+
+int test_call_stream_pool(void)
+{
+	struct fixture fix, *f = &fix;
+	struct tmr tmr;
+	uint32_t hits;
+	int err = 0;
+
+	tmr_init(&tmr);
+
+	fixture_init(f);
+
+	f->behaviour = BEHAVIOUR_ANSWER;
+
+	strmpool_set_size(baresip_strmpool(), 2);
+
+	err = pool_wait(&tmr, 2);
+	TEST_ERR(err);
+
+	hits = strmpool_hits(baresip_strmpool());
+
+	err = ua_connect(f->a.ua, 0, NULL, f->buri, VIDMODE_OFF);
+	TEST_ERR(err);
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	ASSERT_EQ(1, fix.a.n_established);
+	ASSERT_EQ(1, fix.b.n_established);
+
+	/* the audio streams of A and B are taken from the pool */
+	ASSERT_EQ(hits + 2, strmpool_hits(baresip_strmpool()));
+
+	/* and the pool is filled up again */
+	err = pool_wait(&tmr, 2);
+	TEST_ERR(err);
+
+ out:
+	tmr_cancel(&tmr);
+	strmpool_set_size(baresip_strmpool(), 0);
+	fixture_close(f);
+
+	return err;
+}
+
+
 int test_call_max(void)
 {
 	struct fixture fix, *f = &fix;
@@ -1682,6 +1770,397 @@ int test_call_aufilt(void)
 }
 
 
+enum {
+	RELAY_HIST  =    32,  /* Number of payloads sent by A to remember */
+	RELAY_PKTS  =    10,  /* Number of packets from B per phase       */
+	RELAY_TS    =   160,  /* RTP timestamp step, 20 ms at 8000 Hz     */
+	RELAY_LAYER = -1000,  /* UDP helper layer, below the media stack  */
+};
+
+enum relay_phase {
+	RELAY_DECODE,      /* B encodes its own audio                  */
+	RELAY_ACTIVE,      /* B relays the payload of A back to A      */
+	RELAY_FALLBACK,    /* B encodes again, with another codec      */
+};
+
+struct relay_tap {
+	struct fixture *f;
+	struct udp_helper *uh;
+	enum relay_phase phase;
+	bool filter;
+	uint8_t txv[RELAY_HIST][256];
+	size_t txlv[RELAY_HIST];
+	unsigned txc;
+	struct rtp_header last;
+	bool last_set;
+	unsigned n_rx;
+	unsigned n_relayed;
+};
+
+
+static bool relay_tap_match(const struct relay_tap *rt,
+			    const uint8_t *p, size_t len)
+{
+	unsigned i;
+
+	for (i=0; i<min(rt->txc, (unsigned)RELAY_HIST); i++) {
+
+		if (rt->txlv[i] == len && 0 == memcmp(rt->txv[i], p, len))
+			return true;
+	}
+
+	return false;
+}
+
+
+/* Remember the payloads sent by A */
+static bool relay_tap_send(int *err, struct sa *dst, struct mbuf *mb,
+			   void *arg)
+{
+	struct relay_tap *rt = arg;
+	struct rtp_header hdr;
+	size_t pos = mb->pos;
+	(void)err;
+	(void)dst;
+
+	if (!rtp_hdr_decode(&hdr, mb) &&
+	    mbuf_get_left(mb) <= sizeof(rt->txv[0])) {
+
+		unsigned i = rt->txc++ % RELAY_HIST;
+
+		rt->txlv[i] = mbuf_get_left(mb);
+		memcpy(rt->txv[i], mbuf_buf(mb), rt->txlv[i]);
+	}
+
+	mb->pos = pos;
+
+	return false;
+}
+
+
+static int relay_tap_phase(struct relay_tap *rt,
+			   const struct rtp_header *hdr, bool relayed)
+{
+	struct audio *au_b = call_audio(ua_call(rt->f->b.ua));
+	const struct aucodec *ac;
+	int err = 0;
+
+	switch (rt->phase) {
+
+	case RELAY_DECODE:
+		ASSERT_TRUE(!relayed);
+
+		if (++rt->n_rx < RELAY_PKTS)
+			break;
+
+		/* B sends the payload it receives from A back to A */
+		err = audio_set_relay(au_b, au_b);
+		TEST_ERR(err);
+
+		rt->phase = RELAY_ACTIVE;
+		rt->n_rx  = 0;
+		break;
+
+	case RELAY_ACTIVE:
+		++rt->n_rx;
+
+		/* a filter which changes the audio prevents the relay */
+		if (rt->filter) {
+			ASSERT_TRUE(!relayed);
+
+			if (rt->n_rx >= 2 * RELAY_PKTS)
+				re_cancel();
+			break;
+		}
+
+		/* the packets which B encoded before */
+		if (!relayed) {
+			ASSERT_EQ(0, rt->n_relayed);
+			break;
+		}
+
+		ASSERT_EQ(0, hdr->pt);
+		ASSERT_EQ(rt->n_relayed == 0, hdr->m);
+
+		if (++rt->n_relayed < RELAY_PKTS)
+			break;
+
+		/* the codecs of the legs differ, the encoder takes over */
+		ac = aucodec_find(baresip_aucodecl(), "PCMA", 8000, 1);
+		ASSERT_TRUE(ac != NULL);
+
+		err = audio_encoder_set(au_b, ac, 8, NULL);
+		TEST_ERR(err);
+
+		rt->phase = RELAY_FALLBACK;
+		rt->n_rx  = 0;
+		break;
+
+	case RELAY_FALLBACK:
+		/* relayed before the codec was changed */
+		if (relayed && !rt->n_rx)
+			break;
+
+		ASSERT_TRUE(!relayed);
+		ASSERT_EQ(8, hdr->pt);
+		ASSERT_EQ(rt->n_rx == 0, hdr->m);
+
+		if (++rt->n_rx >= RELAY_PKTS)
+			re_cancel();
+		break;
+	}
+
+ out:
+	return err;
+}
+
+
+/* Check the packets which A receives from B */
+static bool relay_tap_recv(struct sa *src, struct mbuf *mb, void *arg)
+{
+	struct relay_tap *rt = arg;
+	struct rtp_header hdr;
+	size_t pos = mb->pos;
+	bool relayed;
+	int err;
+	(void)src;
+
+	err = rtp_hdr_decode(&hdr, mb);
+	if (err) {
+		err = 0;
+		goto out;
+	}
+
+	relayed = relay_tap_match(rt, mbuf_buf(mb), mbuf_get_left(mb));
+
+	/* the peer leg has one SSRC, no gaps in sequence and timestamp */
+	if (rt->last_set) {
+		ASSERT_EQ(rt->last.ssrc, hdr.ssrc);
+		ASSERT_EQ((uint16_t)(rt->last.seq + 1), hdr.seq);
+		ASSERT_EQ((uint32_t)(rt->last.ts + RELAY_TS), hdr.ts);
+	}
+
+	rt->last     = hdr;
+	rt->last_set = true;
+
+	err = relay_tap_phase(rt, &hdr, relayed);
+
+ out:
+	mb->pos = pos;
+
+	if (err)
+		fixture_abort(rt->f, err);
+
+	return false;
+}
+
+
+static int test_call_relay_base(bool filter)
+{
+	struct fixture fix, *f = &fix;
+	struct ausrc *ausrc = NULL;
+	struct auplay *auplay = NULL;
+	struct relay_tap *rt;
+	struct stream *strm;
+	int err = 0;
+
+	rt = mem_zalloc(sizeof(*rt), NULL);
+	if (!rt)
+		return ENOMEM;
+
+	fixture_init(f);
+
+	rt->f      = f;
+	rt->filter = filter;
+
+	err  = mock_ausrc_register(&ausrc, baresip_ausrcl());
+	err |= mock_auplay_register(&auplay, baresip_auplayl(), NULL, NULL);
+	TEST_ERR(err);
+
+	if (filter)
+		mock_aufilt_register(baresip_aufiltl());
+
+	f->behaviour = BEHAVIOUR_ANSWER;
+	f->estab_action = ACTION_NOTHING;
+	f->stop_on_rtp = true;
+
+	/* Make a call from A to B */
+	err = ua_connect(f->a.ua, 0, NULL, f->buri, VIDMODE_OFF);
+	TEST_ERR(err);
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	f->stop_on_rtp = false;
+
+	/* tap the RTP socket of A */
+	strm = audio_strm(call_audio(ua_call(f->a.ua)));
+
+	err = udp_register_helper(&rt->uh, rtp_sock(stream_rtp_sock(strm)),
+				  RELAY_LAYER, relay_tap_send, relay_tap_recv,
+				  rt);
+	TEST_ERR(err);
+
+	err = re_main_timeout(10000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	ASSERT_EQ(filter ? RELAY_ACTIVE : RELAY_FALLBACK, rt->phase);
+	ASSERT_EQ(filter ? 0 : RELAY_PKTS, rt->n_relayed);
+
+ out:
+	mem_deref(rt->uh);
+	fixture_close(f);
+	mem_deref(auplay);
+	mem_deref(ausrc);
+	if (filter)
+		mock_aufilt_unregister();
+	mem_deref(rt);
+
+	return err;
+}
+
+
+/*
+ * Relay the received payload of B back to A. The payload must arrive
+ * unchanged, and the stream from B must continue without gaps when the
+ * relay starts and when B encodes again.
+ */
+int test_call_relay(void)
+{
+	return test_call_relay_base(false);
+}
+
+
+/* A filter which processes the audio of B prevents the relay */
+int test_call_relay_filter(void)
+{
+	return test_call_relay_base(true);
+}
+
+
+/* Count the payloads which A sent to B and receives back from C */
+static bool bridge_tap_recv(struct sa *src, struct mbuf *mb, void *arg)
+{
+	struct relay_tap *rt = arg;
+	struct rtp_header hdr;
+	size_t pos = mb->pos;
+	(void)src;
+
+	if (!rtp_hdr_decode(&hdr, mb) &&
+	    relay_tap_match(rt, mbuf_buf(mb), mbuf_get_left(mb))) {
+
+		if (++rt->n_relayed >= RELAY_PKTS)
+			re_cancel();
+	}
+
+	mb->pos = pos;
+
+	return false;
+}
+
+
+static bool relay_active(const struct call *call)
+{
+	char buf[2048];
+
+	if (re_snprintf(buf, sizeof(buf), "%H",
+			audio_debug, call_audio(call)) < 0)
+		return false;
+
+	return NULL != strstr(buf, "relay: active");
+}
+
+
+/*
+ * A calls B and C. The calls of B and C use crossed aubridge devices,
+ * so the two audio streams are relayed: the payload which A sends to B
+ * comes back unchanged from C.
+ */
+int test_call_relay_bridge(void)
+{
+	struct fixture fix, *f = &fix;
+	struct ausrc *ausrc = NULL;
+	struct auplay *auplay = NULL;
+	struct udp_helper *uh_c = NULL;
+	struct call *call_b = NULL, *call_c = NULL;
+	struct relay_tap *rt;
+	struct udp_sock *us;
+	char curi[256];
+	int err = 0;
+
+	rt = mem_zalloc(sizeof(*rt), NULL);
+	if (!rt)
+		return ENOMEM;
+
+	fixture_init(f);
+
+	rt->f = f;
+
+	/* A uses the mock devices, which are registered first */
+	err  = mock_ausrc_register(&ausrc, baresip_ausrcl());
+	err |= mock_auplay_register(&auplay, baresip_auplayl(), NULL, NULL);
+	TEST_ERR(err);
+
+	err = module_load(".", "aubridge");
+	TEST_ERR(err);
+
+	mem_deref(f->b.ua);
+	err = ua_alloc(&f->b.ua, "B <sip:b@127.0.0.1>;regint=0"
+		       ";audio_source=aubridge,bc;audio_player=aubridge,cb");
+	TEST_ERR(err);
+
+	err = ua_alloc(&f->c.ua, "C <sip:c@127.0.0.1>;regint=0"
+		       ";audio_source=aubridge,cb;audio_player=aubridge,bc");
+	TEST_ERR(err);
+
+	f->c.peer = &f->a;
+
+	f->behaviour = BEHAVIOUR_ANSWER;
+	f->estab_action = ACTION_NOTHING;
+
+	re_snprintf(curi, sizeof(curi), "sip:c@%J", &f->laddr_udp);
+
+	err  = ua_connect(f->a.ua, &call_b, NULL, f->buri, VIDMODE_OFF);
+	err |= ua_connect(f->a.ua, &call_c, NULL, curi, VIDMODE_OFF);
+	TEST_ERR(err);
+
+	/* tap the RTP sockets of A */
+	us  = rtp_sock(stream_rtp_sock(audio_strm(call_audio(call_b))));
+	err = udp_register_helper(&rt->uh, us, RELAY_LAYER,
+				  relay_tap_send, NULL, rt);
+	TEST_ERR(err);
+
+	us  = rtp_sock(stream_rtp_sock(audio_strm(call_audio(call_c))));
+	err = udp_register_helper(&uh_c, us, RELAY_LAYER,
+				  NULL, bridge_tap_recv, rt);
+	TEST_ERR(err);
+
+	err = re_main_timeout(10000);
+	TEST_ERR(err);
+	TEST_ERR(fix.err);
+
+	ASSERT_EQ(RELAY_PKTS, rt->n_relayed);
+
+	ASSERT_EQ(1, list_count(ua_calls(f->b.ua)));
+	ASSERT_EQ(1, list_count(ua_calls(f->c.ua)));
+	ASSERT_TRUE(relay_active(ua_call(f->b.ua)));
+	ASSERT_TRUE(relay_active(ua_call(f->c.ua)));
+
+ out:
+	mem_deref(uh_c);
+	mem_deref(rt->uh);
+	fixture_close(f);
+	module_unload("aubridge");
+	mem_deref(auplay);
+	mem_deref(ausrc);
+	mem_deref(rt);
+
+	return err;
+}
+
+
 /*
  * Simulate a complete WebRTC testcase
  */
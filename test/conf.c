@@ -0,0 +1,113 @@
+/**
+ * @file test/conf.c  Baresip selftest -- config cache
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <stdio.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+#include "../src/core.h"
+
+
+static int write_file(const char *file, const uint8_t *buf, size_t len)
+{
+	FILE *f;
+	int err = 0;
+
+	f = fopen(file, "wb");
+	if (!f)
+		return errno;
+
+	if (len && 1 != fwrite(buf, len, 1, f))
+		err = EIO;
+
+	(void)fclose(f);
+
+	return err;
+}
+
+
+int test_conf_cache(void)
+{
+	static const char *file = "selftest_config.cache";
+	struct conf_cache_hdr key, key2;
+	struct config *cfg = NULL, *cfg2 = NULL;
+	struct mbuf *src = NULL, *mb = NULL;
+	int err;
+
+	cfg  = mem_zalloc(sizeof(*cfg), NULL);
+	cfg2 = mem_zalloc(sizeof(*cfg2), NULL);
+	src  = mbuf_alloc(64);
+	if (!cfg || !cfg2 || !src) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = mbuf_write_str(src, "sip_listen\t\t127.0.0.1:5070\n");
+	TEST_ERR(err);
+
+	conf_cache_key(&key, src, conf_config());
+
+	*cfg = *conf_config();
+	str_ncpy(cfg->sip.local, "127.0.0.1:5070", sizeof(cfg->sip.local));
+	cfg->call.max_calls = 42;
+
+	/* round trip */
+	err = conf_cache_save(file, &key, cfg);
+	TEST_ERR(err);
+
+	err = conf_cache_load(file, &key, cfg2);
+	TEST_ERR(err);
+	TEST_MEMCMP(cfg, sizeof(*cfg), cfg2, sizeof(*cfg2));
+
+	/* a changed config file is a cache miss */
+	err = mbuf_write_str(src, "call_max_calls\t\t4\n");
+	TEST_ERR(err);
+
+	conf_cache_key(&key2, src, conf_config());
+
+	memset(cfg2, 0, sizeof(*cfg2));
+	err = conf_cache_load(file, &key2, cfg2);
+	ASSERT_EQ(ENOENT, err);
+	ASSERT_EQ(0, cfg2->call.max_calls);
+
+	/* a corrupt core config is rejected */
+	err = conf_loadfile(&mb, file);
+	TEST_ERR(err);
+
+	mb->buf[sizeof(key) + 1] ^= 0xff;
+
+	err = write_file(file, mb->buf, mb->end);
+	TEST_ERR(err);
+
+	err = conf_cache_load(file, &key, cfg2);
+	ASSERT_EQ(ENOENT, err);
+
+	/* a truncated cache is rejected */
+	mb->buf[sizeof(key) + 1] ^= 0xff;
+
+	err = write_file(file, mb->buf, mb->end - 1);
+	TEST_ERR(err);
+
+	err = conf_cache_load(file, &key, cfg2);
+	ASSERT_EQ(ENOENT, err);
+
+	err = write_file(file, mb->buf, mb->end);
+	TEST_ERR(err);
+
+	err = conf_cache_load(file, &key, cfg2);
+	TEST_ERR(err);
+	TEST_MEMCMP(cfg, sizeof(*cfg), cfg2, sizeof(*cfg2));
+
+ out:
+	(void)remove(file);
+
+	mem_deref(mb);
+	mem_deref(src);
+	mem_deref(cfg2);
+	mem_deref(cfg);
+
+	return err;
+}
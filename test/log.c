@@ -0,0 +1,154 @@
+/**
+ * @file test/log.c  Baresip selftest -- logging
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+enum { N_MSG = 10000 };
+
+
+struct logtest {
+	struct log log;
+	unsigned n;
+	unsigned last;
+	bool order_err;
+};
+
+
+static struct logtest lt;
+
+
+static void log_handler(uint32_t level, const char *msg)
+{
+	struct pl pl;
+	unsigned v;
+	(void)level;
+
+	if (re_regex(msg, strlen(msg), "logtest: [0-9]+", &pl))
+		return;
+
+	v = pl_u32(&pl);
+
+	if (lt.n && v <= lt.last)
+		lt.order_err = true;
+
+	lt.last = v;
+	++lt.n;
+}
+
+
+static int test_log_async(void)
+{
+	uint64_t dropped;
+	unsigned i;
+	int err;
+
+	dropped = log_dropped();
+
+	err = log_enable_async(true);
+	TEST_ERR(err);
+
+	for (i=0; i<N_MSG; i++)
+		loglv(LEVEL_DEBUG, "logtest: %u\n", i);
+
+	/* write all pending messages */
+	err = log_enable_async(false);
+	TEST_ERR(err);
+
+	dropped = log_dropped() - dropped;
+
+	ASSERT_TRUE(!lt.order_err);
+	ASSERT_TRUE(lt.n > 0);
+	ASSERT_TRUE(lt.n + dropped == N_MSG);
+
+ out:
+	return err;
+}
+
+
+static int test_log_ratelimit(void)
+{
+	uint64_t suppressed;
+	unsigned i;
+	int err = 0;
+
+	suppressed = log_suppressed();
+
+	log_set_ratelimit(5);
+
+	for (i=0; i<20; i++)
+		loglv(LEVEL_DEBUG, "logtest: %u\n", i);
+
+	log_set_ratelimit(0);
+
+	suppressed = log_suppressed() - suppressed;
+
+	/* the burst may span two rate limit intervals */
+	ASSERT_TRUE(lt.n >= 5 && lt.n <= 10);
+	ASSERT_TRUE(lt.n + suppressed == 20);
+
+	/* two call sites with the same format are limited separately */
+	lt.n = 0;
+	log_set_ratelimit(5);
+
+	for (i=0; i<20; i++) {
+		loglv(LEVEL_DEBUG, "logtest: %u\n", i);
+		loglv(LEVEL_DEBUG, "logtest: %u\n", i);
+	}
+
+	log_set_ratelimit(0);
+
+	ASSERT_TRUE(lt.n >= 10 && lt.n <= 20);
+
+	/* warnings are never suppressed */
+	lt.n = 0;
+	suppressed = log_suppressed();
+	log_set_ratelimit(5);
+
+	for (i=0; i<20; i++)
+		warning("logtest: %u\n", i);
+
+	log_set_ratelimit(0);
+
+	ASSERT_EQ(20, lt.n);
+	ASSERT_EQ(suppressed, log_suppressed());
+
+ out:
+	return err;
+}
+
+
+int test_log(void)
+{
+	enum log_level level = log_level_get();
+	int err;
+
+	memset(&lt, 0, sizeof(lt));
+	lt.log.h = log_handler;
+
+	log_register_handler(&lt.log);
+	log_enable_stdout(false);
+	log_level_set(LEVEL_DEBUG);
+
+	err = test_log_async();
+	TEST_ERR(err);
+
+	lt.n = 0;
+	lt.last = 0;
+	lt.order_err = false;
+
+	err = test_log_ratelimit();
+	TEST_ERR(err);
+
+ out:
+	log_level_set(level);
+	log_enable_stdout(true);
+	log_unregister_handler(&lt.log);
+
+	return err;
+}
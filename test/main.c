@@ -23,6 +23,10 @@ struct test {
 static const struct test tests[] = {
 	TEST(test_account),
 	TEST(test_account_uri_complete),
+	TEST(test_aug711),
+	TEST(test_aulat),
+	TEST(test_aupoly),
+	TEST(test_auring),
 	TEST(test_call_answer),
 	TEST(test_call_answer_hangup_a),
 	TEST(test_call_answer_hangup_b),
@@ -37,8 +41,12 @@ static const struct test tests[] = {
 	TEST(test_call_multiple),
 	TEST(test_call_progress),
 	TEST(test_call_reject),
+	TEST(test_call_relay),
+	TEST(test_call_relay_bridge),
+	TEST(test_call_relay_filter),
 	TEST(test_call_rtcp),
 	TEST(test_call_rtp_timeout),
+	TEST(test_call_stream_pool),
 	TEST(test_call_tcp),
 	TEST(test_call_deny_udp),
 	TEST(test_call_transfer),
@@ -51,11 +59,21 @@ static const struct test tests[] = {
 	TEST(test_call_ipv6ll),
 	TEST(test_cmd),
 	TEST(test_cmd_long),
+	TEST(test_conf_cache),
 	TEST(test_contact),
+	TEST(test_dtx),
 	TEST(test_event),
+	TEST(test_log),
 	TEST(test_message),
 	TEST(test_network),
+	TEST(test_rtpport),
 	TEST(test_play),
+	TEST(test_playout),
+	TEST(test_prof),
+	TEST(test_shard_event),
+	TEST(test_shard_exec),
+	TEST(test_shard_uag_find),
+	TEST(test_stats),
 	TEST(test_stunuri),
 	TEST(test_ua_alloc),
 	TEST(test_ua_options),
@@ -64,8 +82,12 @@ static const struct test tests[] = {
 	TEST(test_ua_register_auth),
 	TEST(test_ua_register_auth_dns),
 	TEST(test_ua_register_dns),
+	TEST(test_ua_reload_account),
+	TEST(test_ua_reload_account_auth),
 	TEST(test_uag_find_param),
 	TEST(test_video),
+	TEST(test_video_rtx),
+	TEST(test_vidscale),
 	TEST(test_clean_number),
 	TEST(test_clean_number_only_numeric),
 };
@@ -0,0 +1,114 @@
+/**
+ * @file mock/mock_ausrc.c Mock audio source
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "../test.h"
+
+
+/*
+ * The mock audio source is driven by a timer in the main thread, so that
+ * many instances can run without one thread per source.
+ */
+
+
+struct ausrc_st {
+	struct tmr tmr;
+	struct ausrc_prm prm;
+	int16_t *sampv;
+	size_t sampc;
+	uint64_t ts;
+	ausrc_read_h *rh;
+	void *arg;
+};
+
+
+static void ausrc_destructor(void *arg)
+{
+	struct ausrc_st *st = arg;
+
+	tmr_cancel(&st->tmr);
+	mem_deref(st->sampv);
+}
+
+
+static void tmr_handler(void *arg)
+{
+	struct ausrc_st *st = arg;
+	struct auframe af;
+
+	tmr_start(&st->tmr, st->prm.ptime, tmr_handler, st);
+
+	auframe_init(&af, AUFMT_S16LE, st->sampv, st->sampc, st->prm.srate,
+		     st->prm.ch);
+
+	af.timestamp = st->ts;
+
+	st->ts += st->prm.ptime * AUDIO_TIMEBASE / 1000;
+
+	if (st->rh)
+		st->rh(&af, st->arg);
+}
+
+
+static int mock_ausrc_alloc(struct ausrc_st **stp, const struct ausrc *as,
+			    struct ausrc_prm *prm, const char *device,
+			    ausrc_read_h *rh, ausrc_error_h *errh, void *arg)
+{
+	static unsigned n_inst;
+	struct ausrc_st *st;
+	int16_t ampl;
+	size_t i;
+	int err = 0;
+	(void)device;
+	(void)errh;
+
+	if (!stp || !as || !prm)
+		return EINVAL;
+
+	if (prm->fmt != AUFMT_S16LE)
+		return ENOTSUP;
+
+	st = mem_zalloc(sizeof(*st), ausrc_destructor);
+	if (!st)
+		return ENOMEM;
+
+	st->prm  = *prm;
+	st->rh   = rh;
+	st->arg  = arg;
+
+	st->sampc = prm->srate * prm->ch * prm->ptime / 1000;
+
+	st->sampv = mem_zalloc(st->sampc * sizeof(int16_t), NULL);
+	if (!st->sampv) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	/* square wave, so that the encoders have something to do.
+	 * The amplitude differs per instance, to tell the sources apart.
+	 */
+	ampl = 8000 + 1000 * (n_inst++ % 4);
+
+	for (i=0; i<st->sampc; i++)
+		st->sampv[i] = (i / 10) & 1 ? ampl : -ampl;
+
+	tmr_start(&st->tmr, 0, tmr_handler, st);
+
+ out:
+	if (err)
+		mem_deref(st);
+	else
+		*stp = st;
+
+	return err;
+}
+
+
+int mock_ausrc_register(struct ausrc **ausrcp, struct list *ausrcl)
+{
+	return ausrc_register(ausrcp, ausrcl, "mock-ausrc", mock_ausrc_alloc);
+}
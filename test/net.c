@@ -6,6 +6,7 @@
 #include <string.h>
 #include <re.h>
 #include <baresip.h>
+#include "../src/core.h"
 #include "test.h"
 
 
@@ -30,3 +31,46 @@ int test_network(void)
 	mem_deref(net);
 	return err;
 }
+
+
+int test_rtpport(void)
+{
+	struct range ports = {10001, 10008};
+	struct rtpport *rp = NULL;
+	uint16_t port, portv[4];
+	unsigned i;
+	int err;
+
+	err = rtpport_alloc(&rp);
+	TEST_ERR(err);
+
+	/* 10002, 10004, 10006 -- the RTCP port must be within range */
+	for (i=0; i<3; i++) {
+		err = rtpport_reserve(rp, AF_INET, &ports, &portv[i]);
+		TEST_ERR(err);
+
+		ASSERT_EQ(0, portv[i] & 1);
+		ASSERT_TRUE(portv[i] >= 10002 && portv[i] <= 10006);
+	}
+
+	ASSERT_TRUE(portv[0] != portv[1] && portv[1] != portv[2] &&
+		    portv[0] != portv[2]);
+
+	err = rtpport_reserve(rp, AF_INET, &ports, &portv[3]);
+	ASSERT_EQ(ENOSPC, err);
+
+	/* the address families are independent */
+	err = rtpport_reserve(rp, AF_INET6, &ports, &port);
+	TEST_ERR(err);
+
+	rtpport_release(rp, AF_INET, portv[1], false);
+
+	err = rtpport_reserve(rp, AF_INET, &ports, &port);
+	TEST_ERR(err);
+	ASSERT_EQ(portv[1], port);
+
+ out:
+	mem_deref(rp);
+
+	return err;
+}
@@ -0,0 +1,124 @@
+/**
+ * @file test/prof.c  Baresip selftest -- main loop profiler
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+enum { N_TMR = 5 };
+
+
+struct proftest {
+	struct tmr tmr;
+	unsigned n;
+};
+
+
+static void tmr_handler(void *arg)
+{
+	struct proftest *pt = arg;
+	struct prof_ctx prof;
+
+	prof_begin(&prof, &pt->tmr);
+
+	if (++pt->n < N_TMR)
+		tmr_start(&pt->tmr, 1, tmr_handler, pt);
+	else
+		re_cancel();
+
+	prof_end(&prof, "test", "tmr");
+}
+
+
+/* number of samples in a histogram of a call site, -1 if not found */
+static int site_count(const struct odict *od, const char *name,
+		      const char *hist)
+{
+	const struct odict *o;
+	uint64_t n;
+
+	o = odict_get_object(od, "handlers");
+	o = o ? odict_get_object(o, name) : NULL;
+	o = o ? odict_get_object(o, hist) : NULL;
+
+	if (!o || !odict_get_number(o, &n, "n"))
+		return -1;
+
+	return (int)n;
+}
+
+
+int test_prof(void)
+{
+	struct proftest pt;
+	struct odict *od = NULL;
+	struct prof_ctx prof;
+	bool enabled = false;
+	unsigned i;
+	int err;
+
+	memset(&pt, 0, sizeof(pt));
+	tmr_init(&pt.tmr);
+
+	ASSERT_TRUE(!prof_enabled());
+
+	/* not recorded while disabled */
+	prof_begin(&prof, NULL);
+	prof_end(&prof, "test", "site");
+
+	err = prof_enable(true);
+	TEST_ERR(err);
+
+	prof_set_budget(0);
+
+	for (i=0; i<10; i++) {
+		prof_begin(&prof, NULL);
+		prof_end(&prof, "test", "site");
+	}
+
+	tmr_start(&pt.tmr, 1, tmr_handler, &pt);
+
+	err = re_main_timeout(1000);
+	TEST_ERR(err);
+
+	ASSERT_EQ(N_TMR, pt.n);
+
+	err = odict_alloc(&od, 8);
+	TEST_ERR(err);
+
+	err = prof_json_api(od);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(odict_get_boolean(od, &enabled, "enabled"));
+	ASSERT_TRUE(enabled);
+	ASSERT_TRUE(NULL != odict_get_object(od, "loop"));
+
+	ASSERT_EQ(10, site_count(od, "test/site", "exec"));
+	ASSERT_EQ(-1, site_count(od, "test/site", "late"));
+	ASSERT_EQ(N_TMR, site_count(od, "test/tmr", "exec"));
+	ASSERT_EQ(N_TMR, site_count(od, "test/tmr", "late"));
+
+	od = mem_deref(od);
+
+	prof_reset();
+
+	err = odict_alloc(&od, 8);
+	TEST_ERR(err);
+
+	err = prof_json_api(od);
+	TEST_ERR(err);
+
+	ASSERT_EQ(-1, site_count(od, "test/site", "exec"));
+
+ out:
+	tmr_cancel(&pt.tmr);
+	mem_deref(od);
+	prof_set_budget(5000);
+	prof_enable(false);
+
+	return err;
+}
@@ -0,0 +1,268 @@
+/**
+ * @file test/shard.c  Baresip selftest -- User-Agents in worker threads
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <baresip.h>
+#include "test.h"
+
+
+enum { N_SHARDS = 2 };
+
+
+struct shard_test {
+	struct mqueue *mq;
+	struct shard *shv[N_SHARDS + 1];  /* current shard of the handler */
+	unsigned n_exec;
+	struct ua *ua;
+	struct shard *ev_shard;
+	thrd_t tid;
+	bool ev_main;
+	unsigned n_ev;
+};
+
+
+static int shards_start(void)
+{
+	int err;
+
+	conf_config()->sip.shards = N_SHARDS;
+	err = ua_init("test", true, false, false);
+	conf_config()->sip.shards = 0;
+
+	return err;
+}
+
+
+static void shards_stop(void)
+{
+	ua_stop_all(true);
+	ua_close();
+}
+
+
+static void exec_handler(void *arg)
+{
+	struct shard_test *st = arg;
+
+	if (st->n_exec < ARRAY_SIZE(st->shv))
+		st->shv[st->n_exec] = shard_current();
+
+	++st->n_exec;
+}
+
+
+static void deref_handler(void *arg)
+{
+	mem_deref(arg);
+}
+
+
+static void ua_deref(struct ua *ua)
+{
+	(void)shard_exec(ua_shard(ua), deref_handler, ua, true);
+}
+
+
+int test_shard_exec(void)
+{
+	struct shard_test st;
+	unsigned i;
+	int err;
+
+	memset(&st, 0, sizeof(st));
+
+	err = shards_start();
+	TEST_ERR(err);
+
+	ASSERT_EQ(N_SHARDS, shard_count());
+	ASSERT_TRUE(shard_current() == NULL);
+
+	for (i=0; i<N_SHARDS; i++) {
+		struct shard *sh = shard_get(i);
+
+		ASSERT_TRUE(sh != NULL);
+		ASSERT_EQ(i, shard_index(sh));
+
+		err = shard_exec(sh, exec_handler, &st, true);
+		TEST_ERR(err);
+
+		ASSERT_EQ(i + 1, st.n_exec);
+		ASSERT_TRUE(st.shv[i] == sh);
+	}
+
+	ASSERT_TRUE(shard_get(N_SHARDS) == NULL);
+
+	/* the main thread and then every shard, one after the other */
+	memset(&st, 0, sizeof(st));
+
+	err = shard_exec_all(exec_handler, &st);
+	TEST_ERR(err);
+
+	ASSERT_EQ(N_SHARDS + 1, st.n_exec);
+	ASSERT_TRUE(st.shv[0] == NULL);
+	for (i=0; i<N_SHARDS; i++)
+		ASSERT_TRUE(st.shv[i + 1] == shard_get(i));
+
+	/* the work of a shard is done in order */
+	memset(&st, 0, sizeof(st));
+
+	err  = shard_exec(shard_get(1), exec_handler, &st, false);
+	err |= shard_exec(shard_get(1), exec_handler, &st, true);
+	TEST_ERR(err);
+
+	ASSERT_EQ(2, st.n_exec);
+	ASSERT_TRUE(st.shv[0] == shard_get(1));
+	ASSERT_TRUE(st.shv[1] == shard_get(1));
+
+	ASSERT_EQ(EINVAL, shard_exec(shard_get(0), NULL, &st, true));
+
+ out:
+	shards_stop();
+
+	return err;
+}
+
+
+static void mqueue_handler(int id, void *data, void *arg)
+{
+	(void)id;
+	(void)data;
+	(void)arg;
+
+	re_cancel();
+}
+
+
+static void event_handler(struct ua *ua, enum ua_event ev,
+			  struct call *call, const char *prm, void *arg)
+{
+	struct shard_test *st = arg;
+	(void)call;
+	(void)prm;
+
+	if (ev != UA_EVENT_MODULE || ua != st->ua)
+		return;
+
+	++st->n_ev;
+	st->ev_shard = shard_current();
+	st->ev_main  = thrd_equal(thrd_current(), st->tid);
+
+	/* the re context of the shard is entered, wake up the main loop */
+	(void)mqueue_push(st->mq, 0, NULL);
+}
+
+
+static void module_event_handler(void *arg)
+{
+	struct shard_test *st = arg;
+
+	module_event("test", "shard", st->ua, NULL, "%u",
+		     shard_index(shard_current()));
+}
+
+
+int test_shard_event(void)
+{
+	struct shard_test st;
+	int err;
+
+	memset(&st, 0, sizeof(st));
+	st.tid = thrd_current();
+
+	err = mqueue_alloc(&st.mq, mqueue_handler, NULL);
+	TEST_ERR(err);
+
+	err = shards_start();
+	TEST_ERR(err);
+
+	err = ua_alloc(&st.ua, "<sip:a@test.invalid>;regint=0");
+	TEST_ERR(err);
+
+	ASSERT_TRUE(ua_shard(st.ua) != NULL);
+	ASSERT_TRUE(list_isempty(uag_list()));
+
+	err = uag_event_register(event_handler, &st);
+	TEST_ERR(err);
+
+	err = shard_exec(ua_shard(st.ua), module_event_handler, &st, false);
+	TEST_ERR(err);
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+
+	/* the handler runs in the main thread, as the shard of the UA */
+	ASSERT_EQ(1, st.n_ev);
+	ASSERT_TRUE(st.ev_main);
+	ASSERT_TRUE(st.ev_shard == ua_shard(st.ua));
+	ASSERT_TRUE(shard_current() == NULL);
+
+ out:
+	uag_event_unregister(event_handler);
+	if (st.ua)
+		ua_deref(st.ua);
+	shards_stop();
+	mem_deref(st.mq);
+
+	return err;
+}
+
+
+static void find_handler(void *arg)
+{
+	struct ua **uap = arg;
+
+	*uap = uag_find_aor("sip:b@test.invalid");
+}
+
+
+int test_shard_uag_find(void)
+{
+	struct ua *ua_a = NULL, *ua_b = NULL, *ua;
+	int err;
+
+	err = shards_start();
+	TEST_ERR(err);
+
+	err  = ua_alloc(&ua_a, "<sip:a@test.invalid>;regint=0;xtest=a");
+	err |= ua_alloc(&ua_b, "<sip:b@test.invalid>;regint=0;xtest=b");
+	TEST_ERR(err);
+
+	/* the UAs are spread over the shards */
+	ASSERT_TRUE(ua_shard(ua_a) != NULL);
+	ASSERT_TRUE(ua_shard(ua_b) != NULL);
+	ASSERT_TRUE(ua_shard(ua_a) != ua_shard(ua_b));
+
+	/* the main thread searches all shards */
+	ASSERT_TRUE(list_isempty(uag_list()));
+	ASSERT_TRUE(ua_a == uag_find_aor("sip:a@test.invalid"));
+	ASSERT_TRUE(ua_b == uag_find_aor("sip:b@test.invalid"));
+	ASSERT_TRUE(NULL == uag_find_aor("sip:c@test.invalid"));
+	ASSERT_TRUE(ua_a == uag_find_param("xtest", "a"));
+	ASSERT_TRUE(ua_b == uag_find_param("xtest", "b"));
+	ASSERT_TRUE(NULL == uag_find_param("xtest", "c"));
+	ASSERT_TRUE(NULL == uag_call_find("no-such-call"));
+	ASSERT_EQ(0, uag_call_count());
+
+	/* a shard only searches its own User-Agents */
+	ua = NULL;
+	err = shard_exec(ua_shard(ua_b), find_handler, &ua, true);
+	TEST_ERR(err);
+	ASSERT_TRUE(ua == ua_b);
+
+	ua = ua_a;
+	err = shard_exec(ua_shard(ua_a), find_handler, &ua, true);
+	TEST_ERR(err);
+	ASSERT_TRUE(ua == NULL);
+
+ out:
+	if (ua_a)
+		ua_deref(ua_a);
+	if (ua_b)
+		ua_deref(ua_b);
+	shards_stop();
+
+	return err;
+}
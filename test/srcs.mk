@@ -9,16 +9,24 @@
 # Test-cases:
 #
 TEST_SRCS	+= account.c
+TEST_SRCS	+= audio.c
+TEST_SRCS	+= aug711.c
 TEST_SRCS	+= call.c
 TEST_SRCS	+= cmd.c
+TEST_SRCS	+= conf.c
 TEST_SRCS	+= contact.c
 TEST_SRCS	+= event.c
+TEST_SRCS	+= log.c
 TEST_SRCS	+= message.c
 TEST_SRCS	+= net.c
 TEST_SRCS	+= play.c
+TEST_SRCS	+= prof.c
+TEST_SRCS	+= shard.c
+TEST_SRCS	+= stats.c
 TEST_SRCS	+= stunuri.c
 TEST_SRCS	+= ua.c
 TEST_SRCS	+= video.c
+TEST_SRCS	+= vidscale.c
 TEST_SRCS	+= menu.c
 
 
@@ -40,6 +48,7 @@ endif
 
 TEST_SRCS	+= mock/mock_aufilt.c
 TEST_SRCS	+= mock/mock_auplay.c
+TEST_SRCS	+= mock/mock_ausrc.c
 TEST_SRCS	+= mock/mock_mnat.c
 TEST_SRCS	+= mock/mock_vidcodec.c
 TEST_SRCS	+= mock/mock_vidisp.c
@@ -47,3 +56,27 @@ TEST_SRCS	+= mock/mock_vidisp.c
 TEST_SRCS	+= test.c
 
 TEST_SRCS	+= main.c
+
+
+#
+# Call-capacity benchmark:
+#
+BENCH_SRCS	+= bench.c
+BENCH_SRCS	+= bench_aug711.c
+BENCH_SRCS	+= bench_vidscale.c
+
+BENCH_SRCS	+= sip/aor.c
+BENCH_SRCS	+= sip/auth.c
+BENCH_SRCS	+= sip/domain.c
+BENCH_SRCS	+= sip/location.c
+BENCH_SRCS	+= sip/sipsrv.c
+BENCH_SRCS	+= sip/user.c
+
+ifneq ($(USE_TLS),)
+BENCH_SRCS	+= mock/cert.c
+endif
+
+BENCH_SRCS	+= mock/mock_auplay.c
+BENCH_SRCS	+= mock/mock_ausrc.c
+
+BENCH_SRCS	+= test.c
@@ -0,0 +1,64 @@
+/**
+ * @file test/stats.c  Baresip selftest -- global counters
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <re.h>
+#include <re_atomic.h>
+#include <baresip.h>
+#include "test.h"
+#include "../src/core.h"
+
+
+static bool contains(const char *str, const char *sub)
+{
+	return str && strstr(str, sub) != NULL;
+}
+
+
+static int print_lat(struct re_printf *pf, const struct aulat *lat)
+{
+	return aulat_prometheus(pf, "t", "m=\"a\"", lat);
+}
+
+
+int test_stats(void)
+{
+	struct aulat lat;
+	char *buf = NULL;
+	int err;
+
+	memset(&lat, 0, sizeof(lat));
+
+	aulat_add(&lat, 100);
+	aulat_add(&lat, 3000);
+
+	err = re_sdprintf(&buf, "%H", print_lat, &lat);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(contains(buf, "t_bucket{m=\"a\",le=\"+Inf\"} 2\n"));
+	ASSERT_TRUE(contains(buf, "t_sum{m=\"a\"} 0.003100\n"));
+	ASSERT_TRUE(contains(buf, "t_count{m=\"a\"} 2\n"));
+
+	buf = mem_deref(buf);
+
+	stats_inc(STATS_REG_OK);
+	stats_rtp_add(MEDIA_VIDEO, STATS_RTP_RX_PACKETS, 1);
+
+	err = re_sdprintf(&buf, "%H", stats_prometheus, NULL);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(contains(buf, "# TYPE baresip_calls gauge\n"));
+	ASSERT_TRUE(contains(buf, "baresip_registrations_total"
+			     "{result=\"ok\"} "));
+	ASSERT_TRUE(contains(buf, "baresip_rtp_rx_packets_total"
+			     "{media=\"video\"} "));
+	ASSERT_TRUE(contains(buf, "baresip_jbuf_delay_seconds_count"
+			     "{media=\"audio\"} "));
+
+ out:
+	mem_deref(buf);
+
+	return err;
+}
@@ -157,6 +157,15 @@ int mock_auplay_register(struct auplay **auplayp, struct list *auplayl,
 			 mock_sample_h *sampleh, void *arg);
 
 
+/*
+ * Mock Audio-source
+ */
+
+struct ausrc;
+
+int mock_ausrc_register(struct ausrc **ausrcp, struct list *ausrcl);
+
+
 /*
  * Mock Audio-filter
  */
@@ -196,11 +205,23 @@ int mock_vidisp_register(struct vidisp **vidispp,
 			 mock_vidisp_h *disph, void *arg);
 
 
+/*
+ * Micro benchmarks, see "benchmark -m <name>"
+ */
+
+int bench_aug711(FILE *f);
+int bench_vidscale(FILE *f);
+
+
 /* test cases */
 
 int test_account(void);
 int test_account_uri_complete(void);
+int test_aug711(void);
 int test_aulevel(void);
+int test_aulat(void);
+int test_aupoly(void);
+int test_auring(void);
 int test_call_answer(void);
 int test_call_answer_hangup_a(void);
 int test_call_answer_hangup_b(void);
@@ -215,8 +236,12 @@ int test_call_medianat(void);
 int test_call_multiple(void);
 int test_call_progress(void);
 int test_call_reject(void);
+int test_call_relay(void);
+int test_call_relay_bridge(void);
+int test_call_relay_filter(void);
 int test_call_rtcp(void);
 int test_call_rtp_timeout(void);
+int test_call_stream_pool(void);
 int test_call_tcp(void);
 int test_call_deny_udp(void);
 int test_call_transfer(void);
@@ -229,11 +254,21 @@ int test_call_bundle(void);
 int test_call_ipv6ll(void);
 int test_cmd(void);
 int test_cmd_long(void);
+int test_conf_cache(void);
 int test_contact(void);
+int test_dtx(void);
 int test_event(void);
+int test_log(void);
 int test_message(void);
 int test_network(void);
+int test_rtpport(void);
 int test_play(void);
+int test_playout(void);
+int test_prof(void);
+int test_shard_event(void);
+int test_shard_exec(void);
+int test_shard_uag_find(void);
+int test_stats(void);
 int test_stunuri(void);
 int test_ua_alloc(void);
 int test_ua_options(void);
@@ -242,7 +277,11 @@ int test_ua_register(void);
 int test_ua_register_auth(void);
 int test_ua_register_auth_dns(void);
 int test_ua_register_dns(void);
+int test_ua_reload_account(void);
+int test_ua_reload_account_auth(void);
 int test_uag_find_param(void);
 int test_video(void);
+int test_video_rtx(void);
+int test_vidscale(void);
 int test_clean_number(void);
 int test_clean_number_only_numeric(void);
@@ -221,6 +221,48 @@ int test_ua_alloc(void)
 }
 
 
+int test_ua_reload_account(void)
+{
+	struct ua *ua = NULL;
+	bool reg = true;
+	int err = 0;
+
+	err = ua_alloc(&ua, "Foo <sip:user@test.invalid>;regint=0"
+		       ";answermode=manual");
+	TEST_ERR(err);
+
+	ASSERT_EQ(ANSWERMODE_MANUAL, account_answermode(ua_account(ua)));
+
+	/* a new media parameter does not restart the registration */
+	err = ua_reload_account(ua, "Foo <sip:user@test.invalid>;regint=0"
+				";answermode=auto", &reg);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(!reg);
+	ASSERT_EQ(ANSWERMODE_AUTO, account_answermode(ua_account(ua)));
+	ASSERT_TRUE(ua == uag_find_aor("sip:user@test.invalid"));
+
+	err = ua_reload_account(ua, "Foo <sip:user@test.invalid>;regint=600"
+				";answermode=auto", &reg);
+	TEST_ERR(err);
+
+	ASSERT_TRUE(reg);
+	ASSERT_EQ(600, account_regint(ua_account(ua)));
+
+	/* the AOR of a UA can not be changed */
+	err = ua_reload_account(ua, "<sip:other@test.invalid>;regint=0",
+				&reg);
+	ASSERT_EQ(ENOTSUP, err);
+	err = 0;
+
+	ASSERT_STREQ("sip:user@test.invalid", account_aor(ua_account(ua)));
+
+ out:
+	mem_deref(ua);
+	return err;
+}
+
+
 int test_uag_find_param(void)
 {
 	struct ua *ua1 = NULL, *ua2 = NULL;
@@ -492,6 +534,115 @@ static int reg_auth(enum sip_transp tp)
 }
 
 
+static void reload_event_handler(struct ua *ua, enum ua_event ev,
+				 struct call *call, const char *prm,
+				 void *arg)
+{
+	struct test *t = arg;
+	bool reg = true;
+	int err = 0;
+	(void)call;
+	(void)prm;
+
+	if (ua != t->ua)
+		return;
+
+	if (ev == UA_EVENT_REGISTER_FAIL) {
+		test_abort(t, EAUTH);
+		return;
+	}
+
+	if (ev != UA_EVENT_REGISTER_OK)
+		return;
+
+	if (++t->got_register_ok > 1) {
+		re_cancel();
+		return;
+	}
+
+	/* the account is replaced, but the register client is kept */
+	err = ua_reload_account(ua, t->uri, &reg);
+	TEST_ERR(err);
+	ASSERT_TRUE(!reg);
+
+	/* a new client is challenged and authenticates with the account */
+	err = ua_register(ua);
+	TEST_ERR(err);
+
+ out:
+	if (err)
+		test_abort(t, err);
+}
+
+
+/*
+ * Reload an unchanged account of a registered UA, then register again
+ * and answer a new digest challenge
+ */
+int test_ua_reload_account_auth(void)
+{
+	struct sa laddr;
+	struct test t;
+	int err;
+
+	memset(&t, 0, sizeof(t));
+
+	err = ua_init("test", true, true, true);
+	TEST_ERR(err);
+
+	err = sip_server_alloc(&t.srvv[0], sip_server_exit_handler, NULL);
+	TEST_ERR(err);
+
+	t.srvc = 1;
+
+	err = domain_add(t.srvv[0], DOMAIN);
+	TEST_ERR(err);
+
+	err = user_add(domain_lookup(t.srvv[0], DOMAIN)->ht_usr,
+		       USER, PASS, DOMAIN);
+	TEST_ERR(err);
+
+	t.srvv[0]->auth_enabled = true;
+
+	err = sip_transp_laddr(t.srvv[0]->sip, &laddr, SIP_TRANSP_UDP, NULL);
+	TEST_ERR(err);
+
+	if (re_snprintf(t.uri, sizeof(t.uri),
+			"<sip:%s@%s>;auth_pass=%s"
+			";outbound=\"sip:%J;transport=udp\"",
+			USER, DOMAIN, PASS, &laddr) < 0) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = ua_alloc(&t.ua, t.uri);
+	TEST_ERR(err);
+
+	err = uag_event_register(reload_event_handler, &t);
+	TEST_ERR(err);
+
+	err = ua_register(t.ua);
+	TEST_ERR(err);
+
+	err = re_main_timeout(5000);
+	TEST_ERR(err);
+	TEST_ERR(t.err);
+
+	ASSERT_EQ(2, t.got_register_ok);
+
+	/* both clients were challenged once */
+	ASSERT_EQ(4, t.srvv[0]->n_register_req);
+
+ out:
+	uag_event_unregister(reload_event_handler);
+	test_reset(&t);
+	ua_stop_all(true);
+	ua_close();
+
+	return err;
+}
+
+
 int test_ua_register_auth(void)
 {
 	int err;
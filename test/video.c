@@ -6,6 +6,7 @@
 
 #include <re.h>
 #include <baresip.h>
+#include "../src/core.h"
 #include "test.h"
 
 
@@ -31,3 +32,124 @@ int test_video(void)
  out:
 	return err;
 }
+
+
+struct nack_test {
+	uint16_t pid;
+	uint16_t blp;
+	unsigned n;
+};
+
+
+static int nack_handler(uint16_t pid, uint16_t blp, void *arg)
+{
+	struct nack_test *nt = arg;
+
+	nt->pid = pid;
+	nt->blp = blp;
+	++nt->n;
+
+	return 0;
+}
+
+
+int test_video_rtx(void)
+{
+	static const uint8_t pld[] = {0xde, 0xad, 0xbe, 0xef};
+	struct rtx_hist *rh = NULL;
+	struct rtx_nack *rn = NULL;
+	struct mbuf *mb = NULL, *mbe = NULL;
+	const struct rtx_pkt *pkt;
+	struct rtp_header hdr;
+	struct nack_test nt;
+	uint16_t seq;
+	int err;
+
+	err = rtx_hist_alloc(&rh, 4);
+	TEST_ERR(err);
+
+	mb = mbuf_alloc(16);
+	mbe = mbuf_alloc(64);
+	if (!mb || !mbe) {
+		err = ENOMEM;
+		goto out;
+	}
+
+	err = mbuf_write_mem(mb, pld, sizeof(pld));
+	TEST_ERR(err);
+	mb->pos = 0;
+
+	/* history keeps the last 4 packets, also across wrap-around */
+	for (seq = 65533; seq != 3; seq++) {
+		err = rtx_hist_stage(rh, mb);
+		TEST_ERR(err);
+		rtx_hist_commit(rh, seq, false, seq == 2, 1000 + seq);
+	}
+
+	ASSERT_TRUE(NULL == rtx_hist_lookup(rh, 65534));
+	ASSERT_TRUE(NULL == rtx_hist_lookup(rh, 3));
+
+	pkt = rtx_hist_lookup(rh, 2);
+	ASSERT_TRUE(pkt != NULL);
+	ASSERT_EQ(2, pkt->seq);
+	ASSERT_TRUE(pkt->marker);
+	ASSERT_EQ(1002, pkt->ts);
+
+	/* RTX encode and decode */
+	err = rtx_encode(mbe, pkt, 97, 4711, 0x12345678);
+	TEST_ERR(err);
+	ASSERT_EQ(RTP_HEADER_SIZE + 2 + sizeof(pld), mbe->end);
+
+	mbe->pos = 0;
+	err = rtp_hdr_decode(&hdr, mbe);
+	TEST_ERR(err);
+	ASSERT_EQ(97, hdr.pt);
+	ASSERT_EQ(4711, hdr.seq);
+	ASSERT_EQ(0x12345678, hdr.ssrc);
+
+	err = rtx_decode(&hdr, mbe, 96);
+	TEST_ERR(err);
+	ASSERT_EQ(96, hdr.pt);
+	ASSERT_EQ(2, hdr.seq);
+	ASSERT_EQ(sizeof(pld), mbuf_get_left(mbe));
+	ASSERT_TRUE(0 == memcmp(pld, mbuf_buf(mbe), sizeof(pld)));
+
+	/* NACK generator with reordering tolerance */
+	err = rtx_nack_alloc(&rn);
+	TEST_ERR(err);
+
+	memset(&nt, 0, sizeof(nt));
+
+	ASSERT_EQ(0, rtx_nack_recv(rn, 100, 0));
+	ASSERT_EQ(0, rtx_nack_recv(rn, 102, 0));
+	ASSERT_TRUE(rtx_nack_pending(rn));
+
+	/* reordered packet arrives in time */
+	ASSERT_EQ(0, rtx_nack_recv(rn, 101, 1));
+	ASSERT_TRUE(!rtx_nack_pending(rn));
+
+	/* not reported before the reordering tolerance has passed */
+	ASSERT_EQ(0, rtx_nack_recv(rn, 104, 2));
+	ASSERT_EQ(0, rtx_nack_poll(rn, 3, nack_handler, &nt));
+	ASSERT_EQ(0, nt.n);
+
+	ASSERT_EQ(0, rtx_nack_recv(rn, 106, 4));
+
+	ASSERT_EQ(0, rtx_nack_poll(rn, 20, nack_handler, &nt));
+	ASSERT_EQ(1, nt.n);
+	ASSERT_EQ(103, nt.pid);
+	ASSERT_EQ(0x0002, nt.blp);
+
+	/* retransmission recovers one, the other one is given up */
+	ASSERT_EQ(0, rtx_nack_recv(rn, 103, 30));
+	ASSERT_EQ(1, rtx_nack_poll(rn, 1000, nack_handler, &nt));
+	ASSERT_TRUE(!rtx_nack_pending(rn));
+
+ out:
+	mem_deref(rn);
+	mem_deref(rh);
+	mem_deref(mbe);
+	mem_deref(mb);
+
+	return err;
+}
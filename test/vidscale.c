@@ -0,0 +1,216 @@
+/**
+ * @file test/vidscale.c  Baresip selftest -- video scaling
+ *
+ * Copyright (C) 2023 Alfred E. Heggestad
+ */
+#include <string.h>
+#include <stdlib.h>
+#include <re.h>
+#include <rem.h>
+#include <baresip.h>
+#include "test.h"
+
+
+static void fill_random(struct vidframe *f)
+{
+	size_t n = vidframe_size(f->fmt, &f->size);
+	size_t i;
+
+	for (i=0; i<n; i++)
+		f->data[0][i] = rand_u32() & 0xff;
+}
+
+
+/*
+ * vidconv() takes the chroma of a packed source from one pixel, vidscale()
+ * averages the 2x2 block. Make the blocks uniform so that both agree.
+ */
+static void fill_blocks(struct vidframe *f)
+{
+	uint8_t *p = f->data[0];
+	unsigned ls = f->linesize[0];
+	unsigned x, y;
+
+	fill_random(f);
+
+	for (y=0; y<f->size.h; y+=2) {
+
+		if (f->fmt == VID_FMT_RGB32) {
+			for (x=0; x<f->size.w; x+=2)
+				memcpy(&p[y*ls + 4*x + 4], &p[y*ls + 4*x], 4);
+		}
+
+		memcpy(&p[(y+1)*ls], &p[y*ls], ls);
+	}
+}
+
+
+static unsigned absdiff(uint8_t a, uint8_t b)
+{
+	return a > b ? a - b : b - a;
+}
+
+
+/* Compare the three planes of two YUV420P frames */
+static unsigned max_diff(const struct vidframe *a, const struct vidframe *b)
+{
+	unsigned d = 0;
+	unsigned i, x, y;
+
+	for (i=0; i<3; i++) {
+		const unsigned sh = i ? 1 : 0;
+
+		for (y=0; y < a->size.h >> sh; y++) {
+			for (x=0; x < a->size.w >> sh; x++) {
+				uint8_t va = a->data[i][y*a->linesize[i] + x];
+				uint8_t vb = b->data[i][y*b->linesize[i] + x];
+
+				d = max(d, absdiff(va, vb));
+			}
+		}
+	}
+
+	return d;
+}
+
+
+static int test_convert(enum vidfmt fmt)
+{
+	const struct vidsz sz = {320, 240};
+	struct vidframe *src = NULL, *ref = NULL, *dst = NULL;
+	unsigned d;
+	int err;
+
+	err  = vidframe_alloc(&src, fmt, &sz);
+	err |= vidframe_alloc(&ref, VID_FMT_YUV420P, &sz);
+	err |= vidframe_alloc(&dst, VID_FMT_YUV420P, &sz);
+	TEST_ERR(err);
+
+	if (fmt == VID_FMT_NV12)
+		fill_random(src);
+	else
+		fill_blocks(src);
+
+	vidconv(ref, src, NULL);
+	vidscale(dst, src, NULL);
+
+	d = max_diff(ref, dst);
+	if (d) {
+		warning("vidscale: %s: difference %u\n", vidfmt_name(fmt), d);
+		err = EINVAL;
+	}
+
+ out:
+	mem_deref(dst);
+	mem_deref(ref);
+	mem_deref(src);
+
+	return err;
+}
+
+
+/* A horizontal gradient keeps its shape at all sizes */
+static int test_gradient(const struct vidsz *dsz)
+{
+	const struct vidsz sz = {640, 360};
+	struct vidframe *src = NULL, *dst = NULL;
+	unsigned x, y;
+	int err;
+
+	err  = vidframe_alloc(&src, VID_FMT_YUV420P, &sz);
+	err |= vidframe_alloc(&dst, VID_FMT_YUV420P, dsz);
+	TEST_ERR(err);
+
+	vidframe_fill_color(src, 0, 0, 0);
+
+	for (y=0; y<sz.h; y++) {
+		for (x=0; x<sz.w; x++)
+			src->data[0][y*src->linesize[0] + x] = x * 255 / sz.w;
+	}
+
+	vidscale(dst, src, NULL);
+
+	for (y=0; y<dsz->h; y++) {
+		for (x=0; x<dsz->w; x++) {
+			uint8_t v = dst->data[0][y*dst->linesize[0] + x];
+			uint8_t e = (2*x + 1) * 255 / (2 * dsz->w);
+
+			ASSERT_TRUE(absdiff(v, e) <= 8);
+		}
+	}
+
+ out:
+	mem_deref(dst);
+	mem_deref(src);
+
+	return err;
+}
+
+
+int test_vidscale(void)
+{
+	static const struct vidsz sizev[] = {
+		{320, 180}, {426, 240}, {160, 90}, {1280, 720}
+	};
+	const struct vidsz sz = {64, 32}, half = {32, 16};
+	struct vidframe *src = NULL, *dst = NULL;
+	struct vidrect rect = {16, 8, 32, 16};
+	unsigned i;
+	int err;
+
+	err = test_convert(VID_FMT_NV12);
+	TEST_ERR(err);
+
+	err = test_convert(VID_FMT_YUYV422);
+	TEST_ERR(err);
+
+	err = test_convert(VID_FMT_RGB32);
+	TEST_ERR(err);
+
+	for (i=0; i<ARRAY_SIZE(sizev); i++) {
+		err = test_gradient(&sizev[i]);
+		TEST_ERR(err);
+	}
+
+	/* 2:1 downscale is the exact average of each 2x2 block */
+	err  = vidframe_alloc(&src, VID_FMT_YUV420P, &sz);
+	err |= vidframe_alloc(&dst, VID_FMT_YUV420P, &half);
+	TEST_ERR(err);
+
+	fill_random(src);
+	vidscale(dst, src, NULL);
+
+	for (i=0; i<half.w*half.h; i++) {
+		const uint8_t *p = src->data[0];
+		unsigned x = i % half.w, y = i / half.w;
+		unsigned s = src->linesize[0];
+		unsigned e;
+
+		e = (p[2*y*s + 2*x] + p[2*y*s + 2*x + 1] +
+		     p[(2*y+1)*s + 2*x] + p[(2*y+1)*s + 2*x + 1] + 2) / 4;
+
+		ASSERT_EQ(e, dst->data[0][y*dst->linesize[0] + x]);
+	}
+
+	/* Pixels outside of the rectangle are not touched */
+	vidframe_fill_color(src, 255, 255, 255);
+	dst = mem_deref(dst);
+
+	err = vidframe_alloc(&dst, VID_FMT_YUV420P, &sz);
+	TEST_ERR(err);
+
+	vidframe_fill_color(dst, 0, 0, 0);
+	vidscale(dst, src, &rect);
+
+	ASSERT_EQ(0, dst->data[0][0]);
+	ASSERT_EQ(235, dst->data[0][rect.y*dst->linesize[0] + rect.x]);
+	ASSERT_EQ(0, dst->data[0][(rect.y + rect.h)*dst->linesize[0]
+				  + rect.x + rect.w]);
+
+ out:
+	mem_deref(dst);
+	mem_deref(src);
+
+	return err;
+}
+